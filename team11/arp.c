@@ -192,22 +192,19 @@ forward_to (struct Interface *dst,
             const void *frame,
             size_t frame_size)
 {
-  char iob[frame_size + sizeof (struct GLAB_MessageHeader)];
-  struct GLAB_MessageHeader hdr;
+  struct iovec iov = {
+    .iov_base = (void *) frame,
+    .iov_len = frame_size
+  };
 
   if (frame_size > dst->mtu)
     abort ();
-  hdr.size = htons (sizeof (iob));
-  hdr.type = htons (dst->ifc_num);
-  memcpy (iob,
-          &hdr,
-          sizeof (hdr));
-  memcpy (&iob[sizeof (hdr)],
-          frame,
-          frame_size);
-  write_all (STDOUT_FILENO,
-             iob,
-             sizeof (iob));
+  GLAB_PROBE2 (frame_tx, dst->ifc_num, frame_size);
+  metrics_tx (dst->ifc_num, frame_size);
+  /* replies are built on the stack, copy them */
+  send_frame_copy (dst->ifc_num,
+                   &iov,
+                   1);
 }
 
 
@@ -228,6 +225,7 @@ parse_frame (struct Interface *ifc,
   void *ptr = (uint8_t*) frame;
 
   if (frame_size < sizeof (eh)) {
+    metrics_drop (ifc->ifc_num, GLAB_DROP_MALFORMED);
     fprintf (stderr, "Malformed frame\n");
     return;
   }
@@ -303,11 +301,17 @@ parse_frame (struct Interface *ifc,
 	memcpy (&table[i].name, ifc->name, sizeof(ifc->name));
 	table[i].ifc_num = ifc->ifc_num;
 	table[i].mtu = ifc->mtu;
+	GLAB_PROBE2 (arp_learn, ah.sender_pa.s_addr, ifc->ifc_num);
 	break;
     }
   }
   //if not -> insert into table
     if (!containedMacAndIp){
+       if (0 != table[tableIndex].ip.s_addr)
+         GLAB_PROBE2 (arp_expire,
+                      table[tableIndex].ip.s_addr,
+                      table[tableIndex].ifc_num);
+       GLAB_PROBE2 (arp_learn, ah.sender_pa.s_addr, ifc->ifc_num);
        table[tableIndex].mac = ah.sender_ha;
        table[tableIndex].ip = ah.sender_pa;
        table[tableIndex].netmask = ifc->netmask;
@@ -634,6 +638,8 @@ handle_control (char *cmd,
   const char *tok;
 
   cmd[cmd_len - 1] = '\0';
+  if (metrics_command (cmd))
+    return;
   tok = strtok (cmd,
                 " ");
   if (0 == strcasecmp (tok,
@@ -697,6 +703,14 @@ main (int argc,
   for (int i = 0; i < 6; i++) {
       nullMac.mac[i] = 0x00;
   }
+  {
+    const char *names[num_ifc + 1];
+
+    for (unsigned int i = 0; i < num_ifc; i++)
+      names[i] = ifc[i].name;
+    metrics_init_interfaces (num_ifc,
+                             names);
+  }
 
   loop (&handle_frame,
         &handle_control,
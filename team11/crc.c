@@ -127,7 +127,13 @@ GNUNET_CRYPTO_crc16_step (uint32_t sum, const void *buf, size_t len)
   for (; len >= 2; len -= 2)
     sum += *(hdr++);
   if (len == 1)
-    sum += (*hdr) & ntohs (0xFF00);
+  {
+    /* only read the last byte, it may end the buffer */
+    uint16_t last = 0;
+
+    memcpy (&last, hdr, 1);
+    sum += last;
+  }
   return sum;
 }
 
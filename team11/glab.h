@@ -39,6 +39,8 @@
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
 #include <fcntl.h>
 #include <time.h>
 #include <byteswap.h>
@@ -96,6 +98,255 @@ struct MacAddress
 _Pragma("pack(pop)")
 
 
+/**
+ * Static tracepoints.  If <sys/sdt.h> (systemtap-sdt-dev) is available,
+ * GLAB_PROBEn(name, ...) places a USDT probe "glab:name" that costs a
+ * single nop until a tracer attaches to it, e.g.:
+ *
+ *   bpftrace -e 'usdt:./router:glab:drop { @[arg1] = count(); }'
+ *
+ * Without <sys/sdt.h>, the probes compile to nothing.  The probes are:
+ *
+ * frame_rx(ifc, size)     loop() dispatches a frame received on @a ifc
+ *                         (all programs)
+ * frame_tx(ifc, size)     a frame is written to the parent for @a ifc
+ *                         (hub, switch, arp: forward_to(); router:
+ *                         when leaving the egress queue)
+ * route_lookup(dst, idx)  router FIB lookup for @a dst (network byte
+ *                         order) found route @a idx, -1 for none
+ * arp_learn(ip, ifc)      arp, router: ARP cache entry for @a ip
+ *                         (network byte order) added or updated
+ * arp_expire(ip, ifc)     arp, router: ARP cache entry for @a ip evicted
+ *                         to make room for another one
+ * mac_learn(mac, ifc)     switch: new MAC table entry; @a mac points to
+ *                         the 6-byte address
+ * mac_move(mac, old, new) switch: @a mac moved from port @a old to @a new
+ * drop(ifc, reason)       a frame from (or to) @a ifc was dropped, see
+ *                         `enum GLAB_DropReason` (fired by metrics_drop())
+ */
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define GLAB_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef GLAB_HAVE_SDT
+#define GLAB_PROBE1(name, a) DTRACE_PROBE1 (glab, name, a)
+#define GLAB_PROBE2(name, a, b) DTRACE_PROBE2 (glab, name, a, b)
+#define GLAB_PROBE3(name, a, b, c) DTRACE_PROBE3 (glab, name, a, b, c)
+#else
+#define GLAB_PROBE1(name, a) do { (void) (a); } while (0)
+#define GLAB_PROBE2(name, a, b) do { (void) (a); (void) (b); } while (0)
+#define GLAB_PROBE3(name, a, b, c) \
+  do { (void) (a); (void) (b); (void) (c); } while (0)
+#endif
+
+
+/**
+ * Reason codes of the "drop" probe.
+ */
+enum GLAB_DropReason
+{
+  /**
+   * Frame too short or headers inconsistent.
+   */
+  GLAB_DROP_MALFORMED = 1,
+
+  /**
+   * Switch: source and destination MAC are the same.
+   */
+  GLAB_DROP_LOOP = 2,
+
+  /**
+   * No route to the destination.
+   */
+  GLAB_DROP_NO_ROUTE = 3,
+
+  /**
+   * Blackhole, unreachable or prohibit route.
+   */
+  GLAB_DROP_ROUTE_TYPE = 4,
+
+  /**
+   * TTL expired.
+   */
+  GLAB_DROP_TTL = 5,
+
+  /**
+   * Denied by an ACL.
+   */
+  GLAB_DROP_ACL = 6,
+
+  /**
+   * Exceeded the ingress policer.
+   */
+  GLAB_DROP_POLICER = 7,
+
+  /**
+   * Shed because the router fell behind.
+   */
+  GLAB_DROP_OVERLOAD = 8,
+
+  /**
+   * Egress queue full.
+   */
+  GLAB_DROP_QUEUE = 9,
+
+  /**
+   * Dropped by active queue management (CoDel).
+   */
+  GLAB_DROP_AQM = 10,
+
+  /**
+   * Larger than the MTU and may not be fragmented.
+   */
+  GLAB_DROP_TOO_BIG = 11
+};
+
+
+/**
+ * Register a counter.  Metrics are kept per thread (in cache-line
+ * aligned blocks, so threads never share a line) and summed when read.
+ * Aborts if too many metrics are registered.
+ *
+ * @param name name of the counter
+ * @return handle to pass to metrics_add()
+ */
+unsigned int
+metrics_counter (const char *name);
+
+
+/**
+ * Register a gauge.  Each thread sets its share; reads return the sum.
+ *
+ * @param name name of the gauge
+ * @return handle to pass to metrics_set()
+ */
+unsigned int
+metrics_gauge (const char *name);
+
+
+/**
+ * Add @a delta to counter @a id.
+ *
+ * @param id counter to update
+ * @param delta amount to add
+ */
+void
+metrics_add (unsigned int id,
+             uint64_t delta);
+
+
+/**
+ * Set the current thread's share of gauge @a id.
+ *
+ * @param id gauge to update
+ * @param value new value
+ */
+void
+metrics_set (unsigned int id,
+             uint64_t value);
+
+
+/**
+ * Get the value of metric @a id, summed over all threads.
+ *
+ * @param id metric to read
+ * @return its value
+ */
+uint64_t
+metrics_get (unsigned int id);
+
+
+/**
+ * Get the number of registered metrics.  Handles are 0 to this value
+ * (exclusive).
+ *
+ * @return number of metrics
+ */
+unsigned int
+metrics_num (void);
+
+
+/**
+ * Get the name of metric @a id.
+ *
+ * @param id metric to get the name of
+ * @return its name
+ */
+const char *
+metrics_name (unsigned int id);
+
+
+/**
+ * Register the per-interface metrics ("NAME.rx_packets", "NAME.rx_bytes",
+ * "NAME.tx_packets", "NAME.tx_bytes" and "NAME.drop.REASON") and the
+ * totals per drop reason ("drop.REASON").  Until this is called,
+ * metrics_rx(), metrics_tx() and metrics_drop() count nothing.
+ *
+ * @param num_ifc number of interfaces
+ * @param names names of the interfaces, NULL for "ifc1", "ifc2", ...
+ */
+void
+metrics_init_interfaces (unsigned int num_ifc,
+                         const char *const *names);
+
+
+/**
+ * Count a frame received on interface @a ifc.  Called by loop().
+ *
+ * @param ifc interface number (counting from 1)
+ * @param size size of the frame
+ */
+void
+metrics_rx (uint16_t ifc,
+            size_t size);
+
+
+/**
+ * Count a frame sent on interface @a ifc.
+ *
+ * @param ifc interface number (counting from 1)
+ * @param size size of the frame
+ */
+void
+metrics_tx (uint16_t ifc,
+            size_t size);
+
+
+/**
+ * Count a dropped frame and fire the "drop" probe.
+ *
+ * @param ifc interface the frame came from or was meant for, 0 if unknown
+ * @param reason why the frame was dropped
+ */
+void
+metrics_drop (uint16_t ifc,
+              enum GLAB_DropReason reason);
+
+
+/**
+ * Print the metrics to the user, one "name value" line each.
+ *
+ * @param prefix only print metrics starting with this (including those
+ *        that are zero), NULL to print all metrics that are not zero
+ */
+void
+metrics_print (const char *prefix);
+
+
+/**
+ * Handle the "stats [PREFIX]" command all programs understand: print
+ * the metrics, see metrics_print().
+ *
+ * @param cmd 0-terminated command the user entered, modified
+ * @return 1 if @a cmd was a "stats" command, 0 if not
+ */
+int
+metrics_command (char *cmd);
+
+
 /**
  * Process frame received from @a interface.
  *
@@ -129,6 +380,15 @@ typedef void
               const struct MacAddress *mac);
 
 
+/**
+ * Function called by loop() after all complete messages returned by
+ * one read() have been processed.  Used to flush work that was
+ * deferred while processing the batch.
+ */
+typedef void
+(*BatchHandler)(void);
+
+
 /**
  * Sample main loop.  Reads packets from STDIN_FILENO and calls fh(),
  * ch() or mh() on each depending on the type.
@@ -139,6 +399,210 @@ loop (FrameHandler fh,
       MacHandler mh);
 
 
+/**
+ * Set the function loop() calls at the end of each batch.
+ *
+ * @param bh batch handler, NULL for none
+ */
+void
+loop_set_batch_handler (BatchHandler bh);
+
+
+/**
+ * Get the time at which loop() received the current batch of
+ * messages.  Cheap: the clock is only read once per batch.
+ *
+ * @return monotonic time in microseconds
+ */
+uint64_t
+loop_now (void);
+
+
+/**
+ * Get the number of input bytes that were still waiting in the pipe
+ * when loop() read the current batch.  Grows when we fall behind the
+ * sender.
+ *
+ * @return backlog in bytes
+ */
+size_t
+loop_backlog (void);
+
+
+/**
+ * Get for how long loop() has been behind: the time since the last
+ * read that emptied the input pipe.
+ *
+ * @return lag in microseconds, 0 if the current batch emptied the pipe
+ */
+uint64_t
+loop_lag (void);
+
+
+/**
+ * Ask loop() to call the batch handler at time @a when even if no
+ * input arrives until then.  The request is one-shot; the batch
+ * handler must ask again if it still has deferred work.  If several
+ * times are requested, the earliest one wins.  A batch of input that
+ * arrives first satisfies a request that is already due.
+ *
+ * @param when monotonic time in microseconds (see loop_now())
+ */
+void
+loop_wakeup_at (uint64_t when);
+
+
+/**
+ * Function called when a timer expires.
+ *
+ * @param cls closure
+ */
+typedef void
+(*TimerCallback)(void *cls);
+
+
+/**
+ * A timer of loop()'s timer wheel.  Owned by the caller (typically
+ * embedded in the object the timer is for), so arming a timer never
+ * allocates.  Initialize with loop_timer_init(); the fields are
+ * private to loop.c.
+ */
+struct LoopTimer
+{
+  /**
+   * Next timer in the same wheel slot.
+   */
+  struct LoopTimer *next;
+
+  /**
+   * Pointer to the pointer to us, NULL if not armed.
+   */
+  struct LoopTimer **pprev;
+
+  /**
+   * Tick at which the timer expires.
+   */
+  uint64_t expires;
+
+  /**
+   * Function to call on expiration.
+   */
+  TimerCallback cb;
+
+  /**
+   * Closure for @e cb.
+   */
+  void *cls;
+};
+
+
+/**
+ * Initialize timer @a t.
+ *
+ * @param t timer to initialize
+ * @param cb function to call when @a t expires
+ * @param cls closure for @a cb
+ */
+void
+loop_timer_init (struct LoopTimer *t,
+                 TimerCallback cb,
+                 void *cls);
+
+
+/**
+ * Arm (or re-arm) timer @a t.  loop() calls its callback at the first
+ * millisecond tick at or after @a when.  Arming, cancelling and
+ * expiring a timer take constant time regardless of how many timers
+ * are armed.
+ *
+ * @param t timer to arm
+ * @param when monotonic time in microseconds (see loop_now())
+ */
+void
+loop_timer_arm (struct LoopTimer *t,
+                uint64_t when);
+
+
+/**
+ * Cancel timer @a t.  Does nothing if @a t is not armed.
+ *
+ * @param t timer to cancel
+ */
+void
+loop_timer_cancel (struct LoopTimer *t);
+
+
+/**
+ * Check whether timer @a t is armed.
+ *
+ * @param t timer to check
+ * @return non-zero if @a t is armed
+ */
+int
+loop_timer_armed (const struct LoopTimer *t);
+
+
+/**
+ * Function called when a file descriptor registered with loop_add_fd()
+ * is ready.
+ *
+ * @param fd the file descriptor
+ * @param events epoll events that occurred (EPOLLIN, EPOLLOUT, ...)
+ * @param cls closure
+ */
+typedef void
+(*FdCallback)(int fd,
+              uint32_t events,
+              void *cls);
+
+
+/**
+ * Have loop() watch @a fd in addition to STDIN_FILENO.
+ *
+ * @param fd file descriptor to watch
+ * @param events epoll events to watch for (EPOLLIN, EPOLLOUT, ...)
+ * @param cb function to call when @a fd is ready
+ * @param cls closure for @a cb
+ * @return 0 on success, -1 on error (see errno)
+ */
+int
+loop_add_fd (int fd,
+             uint32_t events,
+             FdCallback cb,
+             void *cls);
+
+
+/**
+ * Stop watching @a fd.  Safe to call from any callback.
+ *
+ * @param fd file descriptor given to loop_add_fd()
+ */
+void
+loop_remove_fd (int fd);
+
+
+/**
+ * Function called to do deferred work.
+ *
+ * @param cls closure
+ */
+typedef void
+(*DeferredCallback)(void *cls);
+
+
+/**
+ * Have loop() call @a cb once the messages of the current batch have
+ * been handled (before the batch handler), or on its next iteration
+ * if called outside of a batch.
+ *
+ * @param cb function to call
+ * @param cls closure for @a cb
+ */
+void
+loop_defer (DeferredCallback cb,
+            void *cls);
+
+
 /**
  * Helper function to deal with partial writes.
  * Fails hard (calls exit() on failures)!
@@ -154,7 +618,49 @@ write_all (int fd,
 
 
 /**
- * Print message to the user by sending to parent.
+ * Queue @a frame for sending on interface @a ifc_num, without copying
+ * it.  @a frame must remain valid until send_flush(); frames loop()
+ * passed to the FrameHandler do.  The queue is flushed by loop() after
+ * each batch, or earlier if it grows too large.
+ *
+ * @param ifc_num interface to send the frame on
+ * @param frame the frame
+ * @param frame_size number of bytes in @a frame
+ */
+void
+send_frame (uint16_t ifc_num,
+            const void *frame,
+            size_t frame_size);
+
+
+/**
+ * Queue a copy of the frame made of the @a iovcnt pieces at @a iov
+ * for sending on interface @a ifc_num.  The pieces may be reused as
+ * soon as this returns.
+ *
+ * @param ifc_num interface to send the frame on
+ * @param iov pieces of the frame
+ * @param iovcnt number of entries in @a iov
+ */
+void
+send_frame_copy (uint16_t ifc_num,
+                 const struct iovec *iov,
+                 int iovcnt);
+
+
+/**
+ * Write everything queued by print(), send_frame() and
+ * send_frame_copy() to the parent, with as few writev() calls as
+ * possible.  Fails hard (calls exit() on failures)!
+ */
+void
+send_flush (void);
+
+
+/**
+ * Print message to the user by sending to parent.  The message is
+ * queued like frames (see send_flush()); write_all() to STDOUT_FILENO
+ * flushes the queue first to keep the order.
  *
  * @param fmt format string
  * @param ... arguments for @a fmt
@@ -163,6 +669,28 @@ void
 print (const char *fmt,
        ...)  __attribute__ ((format (gnu_printf, 1, 2)));
 
+/**
+ * Perform an incremental step in a CRC16 (for TCP/IP) calculation.
+ *
+ * @param sum current sum, initially 0
+ * @param buf buffer to calculate CRC over (must be 16-bit aligned)
+ * @param len number of bytes in hdr, must be multiple of 2
+ * @return updated crc sum (must be subjected to #GNUNET_CRYPTO_crc16_finish() to get actual crc16)
+ */
+uint32_t
+GNUNET_CRYPTO_crc16_step (uint32_t sum, const void *buf, size_t len);
+
+
+/**
+ * Convert results from #GNUNET_CRYPTO_crc16_step() to final crc16.
+ *
+ * @param sum cummulative sum
+ * @return crc16 value
+ */
+uint16_t
+GNUNET_CRYPTO_crc16_finish (uint32_t sum);
+
+
 /**
  * Calculate the checksum of a buffer in one step.
  *
@@ -51,6 +51,16 @@ static char child_buf[65536];
  */
 static size_t child_buf_pos;
 
+/**
+ * Messages queued by tqueue() for the next tflush().
+ */
+static char batch_buf[4 * 65536];
+
+/**
+ * Number of bytes in #batch_buf.
+ */
+static size_t batch_pos;
+
 /**
  * List of our MAMakefileC addresses
  */
@@ -369,6 +379,58 @@ tsend (uint16_t type,
 }
 
 
+/**
+ * Queue a message for the next tflush(), so that several messages
+ * reach the child with a single write().
+ *
+ * @param type message type to use (0 = control, other: interface)
+ * @param msg payload to send
+ * @param msg_len number of bytes in @a msg
+ */
+void
+tqueue (uint16_t type,
+        const void *msg,
+        size_t msg_len)
+{
+  struct GLAB_MessageHeader hdr;
+
+  if ( (msg_len > UINT16_MAX - sizeof (hdr)) ||
+       (batch_pos + sizeof (hdr) + msg_len > sizeof (batch_buf)) )
+    abort ();
+  hdr.type = htons (type);
+  hdr.size = htons (sizeof (hdr) + msg_len);
+  memcpy (&batch_buf[batch_pos],
+          &hdr,
+          sizeof (hdr));
+  memcpy (&batch_buf[batch_pos + sizeof (hdr)],
+          msg,
+          msg_len);
+  batch_pos += sizeof (hdr) + msg_len;
+}
+
+
+/**
+ * Write the first @a len bytes queued by tqueue() with a single
+ * write(); the rest stays queued.  A @a len that ends in the middle
+ * of a message lets tests split a message across reads of the child.
+ *
+ * @param len number of bytes to write, SIZE_MAX for all
+ */
+void
+tflush (size_t len)
+{
+  if (len > batch_pos)
+    len = batch_pos;
+  write_all (child_stdin,
+             batch_buf,
+             len);
+  memmove (batch_buf,
+           &batch_buf[len],
+           batch_pos - len);
+  batch_pos -= len;
+}
+
+
 /**
  * Receive message.
  *
@@ -631,6 +693,12 @@ meta (struct Command *cmd,
       perror ("pipe");
       return 1;
     }
+    /* a full batch must fit, so that tflush() writes it at once and
+       the child finds more input waiting after its first read */
+    if (-1 == fcntl (cin[1],
+                     F_SETPIPE_SZ,
+                     (int) (4 * sizeof (batch_buf))))
+      perror ("fcntl");
     chld = fork ();
     if (-1 == chld)
     {
@@ -708,6 +776,9 @@ cleanup:
         SIGKILL);
   close (child_stdin);
   close (child_stdout);
+  batch_pos = 0;
+  /* drop what the child sent that the test did not read */
+  child_buf_pos = 0;
   return ret;
 }
 
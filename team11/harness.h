@@ -215,6 +215,30 @@ tsend (uint16_t type,
        size_t msg_len);
 
 
+/**
+ * Queue a message for the next tflush(), so that several messages
+ * reach the child with a single write().
+ *
+ * @param type message type to use (0 = control, other: interface)
+ * @param msg payload to send
+ * @param msg_len number of bytes in @a msg
+ */
+void
+tqueue (uint16_t type,
+        const void *msg,
+        size_t msg_len);
+
+
+/**
+ * Write the first @a len bytes queued by tqueue() with a single
+ * write(); the rest stays queued.
+ *
+ * @param len number of bytes to write, SIZE_MAX for all
+ */
+void
+tflush (size_t len);
+
+
 /**
  * Function called with a message we received.
  *
@@ -82,20 +82,12 @@ forward_to (struct Interface *dst,
             const void *frame,
             size_t frame_size)
 {
-  char iob[frame_size + sizeof (struct GLAB_MessageHeader)];
-  struct GLAB_MessageHeader hdr;
-
-  hdr.size = htons (sizeof (iob));
-  hdr.type = htons (dst->ifc_num);
-  memcpy (iob,
-          &hdr,
-          sizeof (hdr));
-  memcpy (&iob[sizeof (hdr)],
-          frame,
-          frame_size);
-  write_all (STDOUT_FILENO,
-             iob,
-             sizeof (iob));
+  GLAB_PROBE2 (frame_tx, dst->ifc_num, frame_size);
+  metrics_tx (dst->ifc_num, frame_size);
+  /* we only forward frames loop() gave us, no need to copy */
+  send_frame (dst->ifc_num,
+              frame,
+              frame_size);
 }
 
 
@@ -145,6 +137,8 @@ handle_control (char *cmd,
                 size_t cmd_len)
 {
   cmd[cmd_len - 1] = '\0';
+  if (metrics_command (cmd))
+    return;
   print ("Received command `%s' (ignored)\n",
          cmd);
 }
@@ -179,6 +173,8 @@ main (int argc,
   gifc = ifc;
   for (unsigned int i = 1; i<argc; i++)
     ifc[i - 1].ifc_num = i;
+  metrics_init_interfaces (num_ifc,
+                           NULL);
 
   loop (&handle_frame,
         &handle_control,
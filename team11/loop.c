@@ -24,79 +24,923 @@
 #include "glab.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
+#include <sys/epoll.h>
+
+/**
+ * Function to call at the end of each batch, or NULL.
+ */
+static BatchHandler batch_handler;
+
+/**
+ * Time the current batch was received, in microseconds.
+ */
+static uint64_t batch_time;
+
+/**
+ * Bytes left in the input pipe after the read of the current batch.
+ */
+static size_t backlog;
+
+/**
+ * Time of the last batch after which the input pipe was empty.
+ */
+static uint64_t caught_up_time;
+
+
+/**
+ * Read the monotonic clock.
+ *
+ * @return current time in microseconds
+ */
+static uint64_t
+read_clock (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC,
+                 &ts);
+  return (uint64_t) ts.tv_sec * 1000000LLU + ts.tv_nsec / 1000;
+}
+
+
+/**
+ * Set the function loop() calls at the end of each batch.
+ *
+ * @param bh batch handler, NULL for none
+ */
+void
+loop_set_batch_handler (BatchHandler bh)
+{
+  batch_handler = bh;
+}
+
+
+/**
+ * Get the time at which loop() received the current batch of
+ * messages.
+ *
+ * @return monotonic time in microseconds
+ */
+uint64_t
+loop_now (void)
+{
+  if (0 == batch_time)
+    batch_time = read_clock ();
+  return batch_time;
+}
+
+
+size_t
+loop_backlog (void)
+{
+  return backlog;
+}
+
+
+uint64_t
+loop_lag (void)
+{
+  return batch_time - caught_up_time;
+}
+
+
+/**
+ * Length of a timer wheel tick in microseconds.  Timers fire at the
+ * first tick at or after their expiration time.
+ */
+#define TIMER_TICK 1000
+
+/**
+ * log2 of the number of slots per level of the timer wheel.
+ */
+#define TIMER_BITS 6
+
+/**
+ * Number of slots per level of the timer wheel.
+ */
+#define TIMER_SLOTS (1 << TIMER_BITS)
+
+/**
+ * Number of levels of the timer wheel.  Level l holds timers expiring
+ * within 64^(l+1) ticks; together they cover more than two years.
+ */
+#define TIMER_LEVELS 6
+
+/**
+ * Maximum number of events handled per epoll_wait().
+ */
+#define LOOP_MAX_EVENTS 32
+
+
+/**
+ * A file descriptor registered with loop_add_fd().
+ */
+struct FdRegistration
+{
+  /**
+   * Next registration in the list.
+   */
+  struct FdRegistration *next;
+
+  /**
+   * Function to call when @e fd is ready, NULL once removed.
+   */
+  FdCallback cb;
+
+  /**
+   * Closure for @e cb.
+   */
+  void *cls;
+
+  /**
+   * The file descriptor.
+   */
+  int fd;
+};
+
+
+/**
+ * Work queued with loop_defer().
+ */
+struct DeferredWork
+{
+  /**
+   * Function to call.
+   */
+  DeferredCallback cb;
+
+  /**
+   * Closure for @e cb.
+   */
+  void *cls;
+};
+
+
+/**
+ * Timer wheel: lists of timers, by level and slot.  Level 0 slot s
+ * holds the timers expiring at the tick t with t % 64 == s within the
+ * next 64 ticks; higher levels hold timers further out, which are
+ * moved ("cascaded") down when their slot comes up.
+ */
+static struct LoopTimer *wheel[TIMER_LEVELS][TIMER_SLOTS];
+
+/**
+ * Bit s of wheel_used[l] is set if wheel[l][s] is not empty.
+ */
+static uint64_t wheel_used[TIMER_LEVELS];
+
+/**
+ * Last tick the wheel processed.
+ */
+static uint64_t wheel_tick;
+
+/**
+ * Is @e wheel_tick initialized?
+ */
+static int wheel_started;
+
+/**
+ * Number of armed timers.
+ */
+static unsigned long long wheel_armed;
+
+/**
+ * Timer calling the batch handler at the time requested via
+ * loop_wakeup_at().
+ */
+static struct LoopTimer wakeup_timer;
+
+/**
+ * Is the time requested via loop_wakeup_at() due?
+ */
+static int wakeup_due;
+
+/**
+ * epoll instance, -1 until needed.
+ */
+static int epoll_fd = -1;
+
+/**
+ * Can STDIN_FILENO be waited for with epoll?  Not if it is a regular
+ * file, which is always readable.
+ */
+static int stdin_pollable;
+
+/**
+ * Registered file descriptors.
+ */
+static struct FdRegistration *fd_head;
+
+/**
+ * Registrations removed while their events may still be pending.
+ */
+static struct FdRegistration *fd_removed;
+
+/**
+ * Work queued with loop_defer().
+ */
+static struct DeferredWork *deferred;
+
+/**
+ * Number of entries used in #deferred.
+ */
+static unsigned int deferred_len;
+
+/**
+ * Number of entries allocated in #deferred.
+ */
+static unsigned int deferred_size;
+
+
+/**
+ * Initialize the timer wheel to the current time if needed.
+ */
+static void
+wheel_start (void)
+{
+  if (wheel_started)
+    return;
+  wheel_tick = read_clock () / TIMER_TICK;
+  wheel_started = 1;
+}
+
+
+/**
+ * Put @a t into the wheel.
+ *
+ * @param t timer to insert
+ * @param earliest first tick @a t may fire at
+ */
+static void
+wheel_insert (struct LoopTimer *t,
+              uint64_t earliest)
+{
+  uint64_t e = (t->expires < earliest) ? earliest : t->expires;
+  unsigned int level;
+  unsigned int slot;
+
+  for (level = 0; level < TIMER_LEVELS; level++)
+    if ( (e >> (TIMER_BITS * level))
+         - (wheel_tick >> (TIMER_BITS * level)) < TIMER_SLOTS)
+      break;
+  if (TIMER_LEVELS == level)
+  {
+    /* too far out: park in the last slot of the top level, we will
+       look at it again when that slot cascades */
+    level = TIMER_LEVELS - 1;
+    slot = ((wheel_tick >> (TIMER_BITS * level)) + TIMER_SLOTS - 1)
+           % TIMER_SLOTS;
+  }
+  else
+  {
+    slot = (e >> (TIMER_BITS * level)) % TIMER_SLOTS;
+  }
+  t->next = wheel[level][slot];
+  if (NULL != t->next)
+    t->next->pprev = &t->next;
+  t->pprev = &wheel[level][slot];
+  wheel[level][slot] = t;
+  wheel_used[level] |= 1LLU << slot;
+}
+
+
+/**
+ * Take all timers out of slot @a slot of level @a level.
+ *
+ * @param level level of the slot
+ * @param slot the slot
+ * @param[out] head set to the list of timers, which point to it
+ */
+static void
+wheel_take (unsigned int level,
+            unsigned int slot,
+            struct LoopTimer **head)
+{
+  *head = wheel[level][slot];
+  wheel[level][slot] = NULL;
+  wheel_used[level] &= ~(1LLU << slot);
+  if (NULL != *head)
+    (*head)->pprev = head;
+}
+
+
+/**
+ * Get the first tick after #wheel_tick at which the wheel has work:
+ * a level 0 slot to run or a higher slot to cascade.  O(TIMER_LEVELS).
+ *
+ * @return the tick, UINT64_MAX if no timer is armed
+ */
+static uint64_t
+wheel_next_tick (void)
+{
+  uint64_t next = UINT64_MAX;
+
+  for (unsigned int level = 0; level < TIMER_LEVELS; level++)
+  {
+    unsigned int shift = TIMER_BITS * level;
+    uint64_t used = wheel_used[level];
+    unsigned int from;
+    uint64_t rotated;
+    uint64_t tick;
+
+    if (0 == used)
+      continue;
+    /* distance from the current slot to the next used one, 1..64 */
+    from = ((wheel_tick >> shift) + 1) % TIMER_SLOTS;
+    rotated = (0 == from)
+              ? used
+              : (used >> from) | (used << (TIMER_SLOTS - from));
+    tick = ((wheel_tick >> shift) + 1 + __builtin_ctzll (rotated)) << shift;
+    if (tick < next)
+      next = tick;
+  }
+  return next;
+}
+
+
+/**
+ * Run the timers that expire at or before tick @a target.
+ *
+ * @param target tick to advance the wheel to
+ */
+static void
+wheel_advance (uint64_t target)
+{
+  while (wheel_tick < target)
+  {
+    struct LoopTimer *head;
+    uint64_t next = wheel_next_tick ();
+
+    if (next > target)
+    {
+      /* nothing happens until then, skip the empty ticks */
+      wheel_tick = target;
+      return;
+    }
+    wheel_tick = next;
+    for (unsigned int level = TIMER_LEVELS - 1; level > 0; level--)
+    {
+      unsigned int shift = TIMER_BITS * level;
+
+      if (0 != (wheel_tick & ((1LLU << shift) - 1)))
+        continue;
+      wheel_take (level,
+                  (wheel_tick >> shift) % TIMER_SLOTS,
+                  &head);
+      while (NULL != head)
+      {
+        struct LoopTimer *t = head;
+
+        head = t->next;
+        if (NULL != head)
+          head->pprev = &head;
+        wheel_insert (t,
+                      wheel_tick);
+      }
+    }
+    wheel_take (0,
+                wheel_tick % TIMER_SLOTS,
+                &head);
+    while (NULL != head)
+    {
+      struct LoopTimer *t = head;
+
+      /* unlink first: the callback may re-arm @a t or cancel others */
+      head = t->next;
+      if (NULL != head)
+        head->pprev = &head;
+      t->pprev = NULL;
+      wheel_armed--;
+      t->cb (t->cls);
+    }
+  }
+}
+
+
+void
+loop_timer_init (struct LoopTimer *t,
+                 TimerCallback cb,
+                 void *cls)
+{
+  memset (t,
+          0,
+          sizeof (*t));
+  t->cb = cb;
+  t->cls = cls;
+}
+
+
+void
+loop_timer_arm (struct LoopTimer *t,
+                uint64_t when)
+{
+  loop_timer_cancel (t);
+  wheel_start ();
+  t->expires = (when + TIMER_TICK - 1) / TIMER_TICK;
+  wheel_insert (t,
+                wheel_tick + 1);
+  wheel_armed++;
+}
+
+
+void
+loop_timer_cancel (struct LoopTimer *t)
+{
+  struct LoopTimer **pprev = t->pprev;
+  struct LoopTimer **first = &wheel[0][0];
+
+  if (NULL == pprev)
+    return;
+  *pprev = t->next;
+  if (NULL != t->next)
+    t->next->pprev = pprev;
+  if ( (pprev >= first) &&
+       (pprev < first + TIMER_LEVELS * TIMER_SLOTS) &&
+       (NULL == *pprev) )
+  {
+    size_t idx = pprev - first;
+
+    wheel_used[idx / TIMER_SLOTS] &= ~(1LLU << (idx % TIMER_SLOTS));
+  }
+  t->pprev = NULL;
+  wheel_armed--;
+}
+
+
+int
+loop_timer_armed (const struct LoopTimer *t)
+{
+  return NULL != t->pprev;
+}
+
+
+/**
+ * The time requested via loop_wakeup_at() has come.
+ *
+ * @param cls NULL
+ */
+static void
+wakeup_run (void *cls)
+{
+  (void) cls;
+  wakeup_due = 1;
+}
+
+
+void
+loop_wakeup_at (uint64_t when)
+{
+  if (when <= loop_now ())
+  {
+    wakeup_due = 1;
+    return;
+  }
+  if (! loop_timer_armed (&wakeup_timer))
+    loop_timer_init (&wakeup_timer,
+                     &wakeup_run,
+                     NULL);
+  else if (wakeup_timer.expires <= (when + TIMER_TICK - 1) / TIMER_TICK)
+    return; /* an earlier wakeup is already armed */
+  loop_timer_arm (&wakeup_timer,
+                  when);
+}
+
+
+/**
+ * Get the epoll instance, creating it (with STDIN_FILENO) if needed.
+ * Fails hard (calls exit() on failures)!
+ *
+ * @return the epoll file descriptor
+ */
+static int
+loop_epoll (void)
+{
+  struct epoll_event ev = {
+    .events = EPOLLIN,
+    .data.ptr = NULL /* marks STDIN_FILENO */
+  };
+
+  if (-1 != epoll_fd)
+    return epoll_fd;
+  epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+  if (-1 == epoll_fd)
+  {
+    fprintf (stderr,
+             "epoll_create1 failed: %s\n",
+             strerror (errno));
+    exit (1);
+  }
+  stdin_pollable = (0 == epoll_ctl (epoll_fd,
+                                    EPOLL_CTL_ADD,
+                                    STDIN_FILENO,
+                                    &ev));
+  return epoll_fd;
+}
+
+
+int
+loop_add_fd (int fd,
+             uint32_t events,
+             FdCallback cb,
+             void *cls)
+{
+  struct FdRegistration *reg;
+  struct epoll_event ev = {
+    .events = events
+  };
+
+  reg = malloc (sizeof (*reg));
+  if (NULL == reg)
+    return -1;
+  reg->fd = fd;
+  reg->cb = cb;
+  reg->cls = cls;
+  ev.data.ptr = reg;
+  if (0 != epoll_ctl (loop_epoll (),
+                      EPOLL_CTL_ADD,
+                      fd,
+                      &ev))
+  {
+    free (reg);
+    return -1;
+  }
+  reg->next = fd_head;
+  fd_head = reg;
+  return 0;
+}
+
+
+void
+loop_remove_fd (int fd)
+{
+  for (struct FdRegistration **pos = &fd_head;
+       NULL != *pos;
+       pos = &(*pos)->next)
+  {
+    struct FdRegistration *reg = *pos;
+
+    if (fd != reg->fd)
+      continue;
+    (void) epoll_ctl (epoll_fd,
+                      EPOLL_CTL_DEL,
+                      fd,
+                      NULL);
+    *pos = reg->next;
+    /* events for it may still be pending, free it later */
+    reg->cb = NULL;
+    reg->next = fd_removed;
+    fd_removed = reg;
+    return;
+  }
+}
+
+
+void
+loop_defer (DeferredCallback cb,
+            void *cls)
+{
+  if (deferred_len == deferred_size)
+  {
+    unsigned int size = (0 == deferred_size) ? 16 : 2 * deferred_size;
+    struct DeferredWork *d;
+
+    d = realloc (deferred,
+                 size * sizeof (*d));
+    if (NULL == d)
+      abort ();
+    deferred = d;
+    deferred_size = size;
+  }
+  deferred[deferred_len].cb = cb;
+  deferred[deferred_len].cls = cls;
+  deferred_len++;
+}
+
+
+/**
+ * Run the work queued with loop_defer().  Work queued while doing so
+ * runs next time.
+ */
+static void
+run_deferred (void)
+{
+  unsigned int n = deferred_len;
+
+  if (0 == n)
+    return;
+  for (unsigned int i = 0; i < n; i++)
+  {
+    struct DeferredWork d = deferred[i];
+
+    d.cb (d.cls);
+  }
+  memmove (deferred,
+           &deferred[n],
+           (deferred_len - n) * sizeof (*deferred));
+  deferred_len -= n;
+}
+
+
+/**
+ * Wait until STDIN_FILENO is readable.  Meanwhile, handle registered
+ * file descriptors, run expired timers and deferred work, and call the
+ * batch handler when the wakeup time requested via loop_wakeup_at()
+ * has come.  If there is none of these, return at once and let read()
+ * block.
+ */
+static void
+wait_for_input (void)
+{
+  for (;;)
+  {
+    struct epoll_event events[LOOP_MAX_EVENTS];
+    int stdin_ready;
+    uint64_t next = UINT64_MAX;
+    uint64_t now;
+    int timeout;
+    int epfd;
+    int n;
+
+    if ( (! wakeup_due) &&
+         (0 == wheel_armed) &&
+         (NULL == fd_head) &&
+         (0 == deferred_len) )
+      return;
+    epfd = loop_epoll ();
+    stdin_ready = ! stdin_pollable;
+    now = read_clock ();
+    if (0 != wheel_armed)
+    {
+      uint64_t tick = wheel_next_tick ();
+
+      if (tick * TIMER_TICK < next)
+        next = tick * TIMER_TICK;
+    }
+    /* input that is already waiting goes first, so deferred work
+       yields to packets even if it is due */
+    if ( (0 != deferred_len) ||
+         wakeup_due ||
+         (next <= now) ||
+         stdin_ready )
+      timeout = 0;
+    else if (UINT64_MAX == next)
+      timeout = -1;
+    else if ( (next - now + 999) / 1000 > INT_MAX)
+      timeout = INT_MAX;
+    else
+      timeout = (int) ( (next - now + 999) / 1000);
+    n = epoll_wait (epfd,
+                    events,
+                    LOOP_MAX_EVENTS,
+                    timeout);
+    if (-1 == n)
+    {
+      if (EINTR == errno)
+        continue;
+      fprintf (stderr,
+               "epoll_wait failed: %s\n",
+               strerror (errno));
+      exit (1);
+    }
+    now = read_clock ();
+    batch_time = now;
+    for (int i = 0; i < n; i++)
+    {
+      struct FdRegistration *reg = events[i].data.ptr;
+
+      if (NULL == reg)
+        stdin_ready = 1;
+      else if (NULL != reg->cb)
+        reg->cb (reg->fd,
+                 events[i].events,
+                 reg->cls);
+    }
+    while (NULL != fd_removed)
+    {
+      struct FdRegistration *reg = fd_removed;
+
+      fd_removed = reg->next;
+      free (reg);
+    }
+    if (0 != wheel_armed)
+      wheel_advance (now / TIMER_TICK);
+    else if (wheel_started)
+      wheel_tick = now / TIMER_TICK;
+    run_deferred ();
+    if (stdin_ready)
+    {
+      send_flush ();
+      return; /* input (or error, which read() will report) */
+    }
+    if (wakeup_due)
+    {
+      wakeup_due = 0;
+      backlog = 0; /* no input arrived */
+      caught_up_time = now;
+      if (NULL != batch_handler)
+        batch_handler ();
+    }
+    send_flush ();
+  }
+}
+
+
+/**
+ * Check whether the message @a msg must be handled before the data
+ * frames of its batch: control messages and ARP frames.
+ *
+ * @param msg message, starting with its header
+ * @param size number of bytes in @a msg
+ * @return 1 if @a msg is urgent
+ */
+static int
+is_urgent (const char *msg,
+           size_t size)
+{
+  struct GLAB_MessageHeader hdr;
+  uint16_t tag;
+
+  memcpy (&hdr,
+          msg,
+          sizeof (hdr));
+  if (0 == ntohs (hdr.type))
+    return 1;
+  /* Ethernet: two MACs, then the tag */
+  if (size < sizeof (hdr) + 2 * sizeof (struct MacAddress) + sizeof (tag))
+    return 0;
+  memcpy (&tag,
+          &msg[sizeof (hdr) + 2 * sizeof (struct MacAddress)],
+          sizeof (tag));
+  return 0x0806 == ntohs (tag);
+}
+
+
+/**
+ * Dispatch message @a msg to fh(), ch() or mh().
+ *
+ * @param fh frame handler
+ * @param ch control handler
+ * @param mh MAC handler
+ * @param[in,out] have_mac set once the MAC list was handled
+ * @param msg message, starting with its header
+ * @param size number of bytes in @a msg
+ */
+static void
+dispatch (FrameHandler fh,
+          ControlHandler ch,
+          MacHandler mh,
+          int *have_mac,
+          char *msg,
+          uint16_t size)
+{
+  struct GLAB_MessageHeader hdr;
+
+  memcpy (&hdr,
+          msg,
+          sizeof (hdr));
+  switch (ntohs (hdr.type))
+  {
+  case 0: /* control */
+    if (0 == *have_mac)
+    {
+      for (unsigned int i = 0; i<(size - sizeof (hdr)) / sizeof (struct
+                                                                 MacAddress);
+           i++)
+      {
+        struct MacAddress mac;
+
+        memcpy (&mac,
+                &msg[sizeof (hdr) + i * sizeof (struct MacAddress)],
+                sizeof (struct MacAddress));
+        mh (i + 1,
+            &mac);
+      }
+      *have_mac = 1;
+    }
+    else
+    {
+      ch (&msg[sizeof (hdr)],
+          size - sizeof (hdr));
+    }
+    break;
+  default:
+    GLAB_PROBE2 (frame_rx,
+                 ntohs (hdr.type),
+                 size - sizeof (hdr));
+    metrics_rx (ntohs (hdr.type),
+                size - sizeof (hdr));
+    fh (ntohs (hdr.type),
+        (const void *) &msg[sizeof (hdr)],
+        size - sizeof (hdr));
+    break;
+  }
+}
+
 
 /**
  * Sample main loop.  Reads packets from STDIN_FILENO
  * and calls handle_mac(), handle_control() or handle_frame()
- * on each depending on the type.
+ * on each depending on the type.  Of the messages returned by
+ * one read(), control messages and ARP frames are handled first,
+ * then the other frames in the order they arrived.
+ *
+ * Messages are handled in place.  The buffer holds two maximum-size
+ * messages; a message cut off by the end of a read() stays where it is
+ * and the next read() appends to it.  Only when less than a maximum-size
+ * message fits behind the data do we move the (partial) message to the
+ * front, which happens at most every other read().
  */
 void
 loop (FrameHandler fh,
       ControlHandler ch,
       MacHandler mh)
 {
-  char buf[UINT16_MAX];
+  char buf[2 * UINT16_MAX];
+  size_t start;
   size_t off;
   ssize_t ret;
   int have_mac;
 
+  start = 0;
   off = 0;
   have_mac = 0;
+  caught_up_time = read_clock ();
+  send_flush ();
+  wait_for_input ();
   while (-1 != (ret = read (STDIN_FILENO,
                             &buf[off],
                             sizeof (buf) - off)))
   {
-    struct GLAB_MessageHeader hdr;
-    uint16_t size;
+    size_t done = start;
 
     if (0 >= ret)
       break;
+    batch_time = read_clock ();
     off += ret;
-    while (off > sizeof (struct GLAB_MessageHeader))
     {
-      memcpy (&hdr,
-              buf,
-              sizeof (hdr));
-      size = ntohs (hdr.size);
-      if (off < size)
-        break;
-      if (size < sizeof (struct GLAB_MessageHeader))
-        abort ();
-      switch (ntohs (hdr.type))
+      int pending;
+
+      if ( (0 != ioctl (STDIN_FILENO,
+                        FIONREAD,
+                        &pending)) ||
+           (pending < 0) )
+        pending = 0;
+      backlog = pending;
+      if (0 == backlog)
+        caught_up_time = batch_time;
+    }
+    for (int urgent = 1; urgent >= 0; urgent--)
+    {
+      size_t pos = start;
+
+      while (off - pos > sizeof (struct GLAB_MessageHeader))
       {
-      case 0: /* control */
-        if (0 == have_mac)
-        {
-          for (unsigned int i = 0; i<(size - sizeof (hdr)) / sizeof (struct
-                                                                     MacAddress);
-               i++)
-          {
-            struct MacAddress mac;
-
-            memcpy (&mac,
-                    &buf[sizeof (hdr) + i * sizeof (struct MacAddress)],
-                    sizeof (struct MacAddress));
-            mh (i + 1,
-                &mac);
-          }
-          have_mac = 1;
-        }
-        else
-        {
-          ch (&buf[sizeof (hdr)],
-              size - sizeof (hdr));
-        }
-        break;
-      default:
-        fh (ntohs (hdr.type),
-            (const void *) &buf[sizeof (hdr)],
-            size - sizeof (hdr));
-        break;
+        struct GLAB_MessageHeader hdr;
+        uint16_t size;
+
+        memcpy (&hdr,
+                &buf[pos],
+                sizeof (hdr));
+        size = ntohs (hdr.size);
+        if (off - pos < size)
+          break;
+        if (size < sizeof (struct GLAB_MessageHeader))
+          abort ();
+        if (urgent == is_urgent (&buf[pos],
+                                 size))
+          dispatch (fh,
+                    ch,
+                    mh,
+                    &have_mac,
+                    &buf[pos],
+                    size);
+        pos += size;
       }
+      done = pos;
+    }
+    start = done;
+    run_deferred ();
+    /* this batch is the wakeup the batch handler asked for */
+    wakeup_due = 0;
+    if (NULL != batch_handler)
+      batch_handler ();
+    /* flush before we overwrite frames queued with send_frame() */
+    send_flush ();
+    if (start == off)
+    {
+      start = 0;
+      off = 0;
+    }
+    else if (sizeof (buf) - off < UINT16_MAX)
+    {
       memmove (buf,
-               &buf[size],
-               off - size);
-      off -= size;
+               &buf[start],
+               off - start);
+      off -= start;
+      start = 0;
     }
+    wait_for_input ();
   }
+  send_flush ();
 }
@@ -0,0 +1,498 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file metrics.c
+ * @brief Named counters and gauges shared by all programs
+ * @author Christian Grothoff
+ */
+#include "glab.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+/**
+ * Maximum number of metrics a program can register.
+ */
+#define METRICS_MAX 1024
+
+/**
+ * Size of a cache line.
+ */
+#define METRICS_CACHE_LINE 64
+
+/**
+ * Counters kept per interface, in this order, followed by one drop
+ * counter per `enum GLAB_DropReason`.
+ */
+#define METRICS_RX_PACKETS 0
+#define METRICS_RX_BYTES 1
+#define METRICS_TX_PACKETS 2
+#define METRICS_TX_BYTES 3
+#define METRICS_DROPS 4
+
+/**
+ * Number of drop reasons, see `enum GLAB_DropReason`.
+ */
+#define METRICS_NUM_REASONS 11
+
+/**
+ * Number of metrics per interface.
+ */
+#define METRICS_PER_IFC (METRICS_DROPS + METRICS_NUM_REASONS)
+
+
+/**
+ * Values of all metrics as seen by one thread.  Each thread only writes
+ * its own block; blocks are cache-line aligned and sized, so threads
+ * never write to the same cache line.
+ */
+struct MetricsBlock
+{
+  /**
+   * Next block in #metrics_blocks.
+   */
+  struct MetricsBlock *next;
+
+  /**
+   * Values, indexed by metric.
+   */
+  uint64_t values[METRICS_MAX];
+};
+
+
+/**
+ * Names of the metrics.
+ */
+static char *metrics_names[METRICS_MAX];
+
+/**
+ * Is the metric a gauge (rather than a counter)?
+ */
+static bool metrics_is_gauge[METRICS_MAX];
+
+/**
+ * Number of registered metrics.
+ */
+static unsigned int metrics_count;
+
+/**
+ * Blocks of all threads that ever updated a metric.
+ */
+static struct MetricsBlock *metrics_blocks;
+
+/**
+ * Block of the current thread, NULL until its first update.
+ */
+static __thread struct MetricsBlock *metrics_local;
+
+/**
+ * Number of interfaces with per-interface metrics.
+ */
+static unsigned int metrics_num_ifc;
+
+/**
+ * Metric of the first per-interface counter of the first interface.
+ */
+static unsigned int metrics_ifc_base;
+
+/**
+ * Metric of the first total drop counter.
+ */
+static unsigned int metrics_drop_base;
+
+/**
+ * Names of the drop reasons, indexed by `enum GLAB_DropReason` - 1.
+ */
+static const char *metrics_reason_names[METRICS_NUM_REASONS] = {
+  "malformed",
+  "loop",
+  "no_route",
+  "route_type",
+  "ttl",
+  "acl",
+  "policer",
+  "overload",
+  "queue",
+  "aqm",
+  "too_big"
+};
+
+
+/**
+ * Get the block of the current thread, allocating it on first use.
+ *
+ * @return block of the current thread
+ */
+static struct MetricsBlock *
+metrics_block (void)
+{
+  struct MetricsBlock *b = metrics_local;
+
+  if (NULL != b)
+    return b;
+  b = aligned_alloc (METRICS_CACHE_LINE,
+                     (sizeof (*b) + METRICS_CACHE_LINE - 1)
+                     & ~(METRICS_CACHE_LINE - 1));
+  if (NULL == b)
+    abort ();
+  memset (b,
+          0,
+          sizeof (*b));
+  b->next = __atomic_load_n (&metrics_blocks,
+                             __ATOMIC_ACQUIRE);
+  while (! __atomic_compare_exchange_n (&metrics_blocks,
+                                        &b->next,
+                                        b,
+                                        false,
+                                        __ATOMIC_RELEASE,
+                                        __ATOMIC_ACQUIRE))
+    ;
+  metrics_local = b;
+  return b;
+}
+
+
+/**
+ * Register a metric.
+ *
+ * @param name name of the metric
+ * @param gauge true for a gauge
+ * @return handle of the metric
+ */
+static unsigned int
+metrics_register (const char *name,
+                  bool gauge)
+{
+  if (METRICS_MAX == metrics_count)
+  {
+    fprintf (stderr,
+             "Too many metrics, cannot register `%s'\n",
+             name);
+    abort ();
+  }
+  metrics_names[metrics_count] = strdup (name);
+  if (NULL == metrics_names[metrics_count])
+    abort ();
+  metrics_is_gauge[metrics_count] = gauge;
+  return metrics_count++;
+}
+
+
+/**
+ * Register a counter.
+ *
+ * @param name name of the counter
+ * @return handle to pass to metrics_add()
+ */
+unsigned int
+metrics_counter (const char *name)
+{
+  return metrics_register (name,
+                           false);
+}
+
+
+/**
+ * Register a gauge.
+ *
+ * @param name name of the gauge
+ * @return handle to pass to metrics_set()
+ */
+unsigned int
+metrics_gauge (const char *name)
+{
+  return metrics_register (name,
+                           true);
+}
+
+
+/**
+ * Add @a delta to counter @a id of the current thread.
+ *
+ * @param id counter to update
+ * @param delta amount to add
+ */
+void
+metrics_add (unsigned int id,
+             uint64_t delta)
+{
+  struct MetricsBlock *b = metrics_block ();
+
+  __atomic_store_n (&b->values[id],
+                    b->values[id] + delta,
+                    __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Set the current thread's share of gauge @a id.
+ *
+ * @param id gauge to update
+ * @param value new value
+ */
+void
+metrics_set (unsigned int id,
+             uint64_t value)
+{
+  __atomic_store_n (&metrics_block ()->values[id],
+                    value,
+                    __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Get the value of metric @a id, summed over all threads.
+ *
+ * @param id metric to read
+ * @return its value
+ */
+uint64_t
+metrics_get (unsigned int id)
+{
+  uint64_t sum = 0;
+
+  for (const struct MetricsBlock *b = __atomic_load_n (&metrics_blocks,
+                                                       __ATOMIC_ACQUIRE);
+       NULL != b;
+       b = b->next)
+    sum += __atomic_load_n (&b->values[id],
+                            __ATOMIC_RELAXED);
+  return sum;
+}
+
+
+/**
+ * Get the number of registered metrics.  Handles are 0 to this value
+ * (exclusive).
+ *
+ * @return number of metrics
+ */
+unsigned int
+metrics_num (void)
+{
+  return metrics_count;
+}
+
+
+/**
+ * Get the name of metric @a id.
+ *
+ * @param id metric to get the name of
+ * @return its name
+ */
+const char *
+metrics_name (unsigned int id)
+{
+  return metrics_names[id];
+}
+
+
+/**
+ * Register the per-interface metrics: received, sent and dropped
+ * (by reason) frames and bytes.  The metrics are named after @a names,
+ * or "ifcN" if @a names is NULL.
+ *
+ * @param num_ifc number of interfaces
+ * @param names names of the interfaces, may be NULL
+ */
+void
+metrics_init_interfaces (unsigned int num_ifc,
+                         const char *const *names)
+{
+  static const char *kinds[METRICS_DROPS] = {
+    "rx_packets",
+    "rx_bytes",
+    "tx_packets",
+    "tx_bytes"
+  };
+  char name[128];
+
+  metrics_ifc_base = metrics_count;
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    char ifc[32];
+
+    if (NULL != names)
+      snprintf (ifc,
+                sizeof (ifc),
+                "%s",
+                names[i]);
+    else
+      snprintf (ifc,
+                sizeof (ifc),
+                "ifc%u",
+                i + 1);
+    for (unsigned int k = 0; k < METRICS_DROPS; k++)
+    {
+      snprintf (name,
+                sizeof (name),
+                "%s.%s",
+                ifc,
+                kinds[k]);
+      metrics_counter (name);
+    }
+    for (unsigned int r = 0; r < METRICS_NUM_REASONS; r++)
+    {
+      snprintf (name,
+                sizeof (name),
+                "%s.drop.%s",
+                ifc,
+                metrics_reason_names[r]);
+      metrics_counter (name);
+    }
+  }
+  metrics_drop_base = metrics_count;
+  for (unsigned int r = 0; r < METRICS_NUM_REASONS; r++)
+  {
+    snprintf (name,
+              sizeof (name),
+              "drop.%s",
+              metrics_reason_names[r]);
+    metrics_counter (name);
+  }
+  metrics_num_ifc = num_ifc;
+}
+
+
+/**
+ * Count a frame received on interface @a ifc.
+ *
+ * @param ifc interface number (counting from 1)
+ * @param size size of the frame
+ */
+void
+metrics_rx (uint16_t ifc,
+            size_t size)
+{
+  unsigned int base;
+
+  if ( (0 == ifc) ||
+       (ifc > metrics_num_ifc) )
+    return;
+  base = metrics_ifc_base + (ifc - 1) * METRICS_PER_IFC;
+  metrics_add (base + METRICS_RX_PACKETS,
+               1);
+  metrics_add (base + METRICS_RX_BYTES,
+               size);
+}
+
+
+/**
+ * Count a frame sent on interface @a ifc.
+ *
+ * @param ifc interface number (counting from 1)
+ * @param size size of the frame
+ */
+void
+metrics_tx (uint16_t ifc,
+            size_t size)
+{
+  unsigned int base;
+
+  if ( (0 == ifc) ||
+       (ifc > metrics_num_ifc) )
+    return;
+  base = metrics_ifc_base + (ifc - 1) * METRICS_PER_IFC;
+  metrics_add (base + METRICS_TX_PACKETS,
+               1);
+  metrics_add (base + METRICS_TX_BYTES,
+               size);
+}
+
+
+/**
+ * Count a dropped frame and fire the "drop" probe.
+ *
+ * @param ifc interface the frame came from or was meant for, 0 if unknown
+ * @param reason why the frame was dropped
+ */
+void
+metrics_drop (uint16_t ifc,
+              enum GLAB_DropReason reason)
+{
+  GLAB_PROBE2 (drop,
+               ifc,
+               reason);
+  if ( (reason < 1) ||
+       (reason > METRICS_NUM_REASONS) ||
+       (0 == metrics_num_ifc) )
+    return;
+  metrics_add (metrics_drop_base + reason - 1,
+               1);
+  if ( (0 == ifc) ||
+       (ifc > metrics_num_ifc) )
+    return;
+  metrics_add (metrics_ifc_base + (ifc - 1) * METRICS_PER_IFC
+               + METRICS_DROPS + reason - 1,
+               1);
+}
+
+
+/**
+ * Print all metrics that are not zero, or whose name starts with
+ * @a prefix.
+ *
+ * @param prefix only print metrics starting with this, NULL for all
+ */
+void
+metrics_print (const char *prefix)
+{
+  for (unsigned int i = 0; i < metrics_count; i++)
+  {
+    uint64_t v;
+
+    if ( (NULL != prefix) &&
+         (0 != strncmp (metrics_names[i],
+                        prefix,
+                        strlen (prefix))) )
+      continue;
+    v = metrics_get (i);
+    if ( (0 == v) &&
+         (NULL == prefix) )
+      continue;
+    print ("%s%s %llu\n",
+           metrics_names[i],
+           metrics_is_gauge[i] ? " (gauge)" : "",
+           (unsigned long long) v);
+  }
+}
+
+
+/**
+ * Handle the "stats [PREFIX]" command all programs understand: print
+ * the metrics, see metrics_print().
+ *
+ * @param cmd 0-terminated command the user entered, modified
+ * @return 1 if @a cmd was a "stats" command, 0 if not
+ */
+int
+metrics_command (char *cmd)
+{
+  const size_t len = strlen ("stats");
+
+  if ( (0 != strncasecmp (cmd,
+                          "stats",
+                          len)) ||
+       ( ('\0' != cmd[len]) &&
+         (' ' != cmd[len]) ) )
+    return 0;
+  metrics_print (strtok (&cmd[len],
+                         " "));
+  return 1;
+}
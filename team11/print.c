@@ -24,19 +24,90 @@
 #include "glab.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 /**
- * Helper function to deal with partial writes.
+ * Size of the buffer for output to the user.  Large enough for the
+ * largest message.
+ */
+#define PRINT_BUFFER_SIZE (UINT16_MAX + 1)
+
+/**
+ * Number of queued bytes at which send_frame() and send_frame_copy()
+ * flush the output queue (the default capacity of a pipe).
+ */
+#define SEND_THRESHOLD 65536
+
+/**
+ * Size of the buffer holding GLAB headers and copied frames: a full
+ * queue plus the largest message.
+ */
+#define SEND_ARENA_SIZE (SEND_THRESHOLD + UINT16_MAX + 1)
+
+
+/**
+ * Messages for the user that print() formatted but did not yet write.
+ */
+static char print_buf[PRINT_BUFFER_SIZE];
+
+/**
+ * Number of bytes used in #print_buf.
+ */
+static size_t print_off;
+
+/**
+ * Bytes of #print_buf before this offset are already in #send_iov.
+ */
+static size_t print_queued;
+
+/**
+ * Did we register send_flush() with atexit()?
+ */
+static int send_atexit;
+
+/**
+ * Output queue, written with a single writev() by send_flush().
+ */
+static struct iovec send_iov[IOV_MAX];
+
+/**
+ * Number of entries used in #send_iov.
+ */
+static int send_cnt;
+
+/**
+ * Number of bytes in #send_iov.
+ */
+static size_t send_bytes;
+
+/**
+ * Storage for GLAB headers and frames given to send_frame_copy().
+ */
+static char send_arena[SEND_ARENA_SIZE];
+
+/**
+ * Number of bytes used in #send_arena.
+ */
+static size_t send_arena_off;
+
+
+/**
+ * Write @a buf to @a fd, dealing with partial writes.
  * Fails hard (calls exit() on failures)!
  *
  * @param fd where to write to
  * @param buf what to write
  * @param buf_size number of bytes in @a buf
  */
-void
-write_all (int fd,
-           const void *buf,
-           size_t buf_size)
+static void
+write_fully (int fd,
+             const void *buf,
+             size_t buf_size)
 {
   const char *cbuf = buf;
   size_t off;
@@ -64,7 +135,241 @@ write_all (int fd,
 
 
 /**
- * Print message to the user by sending to parent.
+ * Make sure what is queued is not lost when the program ends.
+ */
+static void
+send_init (void)
+{
+  if (send_atexit)
+    return;
+  atexit (&send_flush);
+  send_atexit = 1;
+}
+
+
+/**
+ * Append @a len bytes at @a data to the output queue, extending the
+ * last entry if @a data directly follows it.
+ *
+ * @param data what to write
+ * @param len number of bytes at @a data
+ */
+static void
+send_queue (const void *data,
+            size_t len)
+{
+  send_init ();
+  if ( (0 < send_cnt) &&
+       ((const char *) send_iov[send_cnt - 1].iov_base
+        + send_iov[send_cnt - 1].iov_len == (const char *) data) )
+  {
+    send_iov[send_cnt - 1].iov_len += len;
+  }
+  else
+  {
+    send_iov[send_cnt].iov_base = (void *) data;
+    send_iov[send_cnt].iov_len = len;
+    send_cnt++;
+  }
+  send_bytes += len;
+}
+
+
+/**
+ * Move the messages print() added since the last call into the output
+ * queue, so that they are written before what is queued next.
+ */
+static void
+send_queue_print (void)
+{
+  if (print_off == print_queued)
+    return;
+  send_queue (&print_buf[print_queued],
+              print_off - print_queued);
+  print_queued = print_off;
+}
+
+
+/**
+ * Make sure the output queue can take @a iovcnt more entries and
+ * @a len more bytes, flushing it if not.
+ *
+ * @param iovcnt number of entries needed
+ * @param len number of bytes needed
+ */
+static void
+send_reserve (int iovcnt,
+              size_t len)
+{
+  if ( (send_cnt + iovcnt > IOV_MAX) ||
+       (send_bytes + len > SEND_THRESHOLD) )
+    send_flush ();
+}
+
+
+/**
+ * Write everything queued by print(), send_frame() and
+ * send_frame_copy() to the parent, using as few writev() calls as
+ * possible.  Fails hard (calls exit() on failures)!
+ */
+void
+send_flush (void)
+{
+  struct iovec *iov = send_iov;
+  int cnt;
+
+  send_queue_print ();
+  cnt = send_cnt;
+  /* reset first: if the write fails, exit() calls us again */
+  send_cnt = 0;
+  send_bytes = 0;
+  while (0 < cnt)
+  {
+    ssize_t ret;
+
+    ret = writev (STDOUT_FILENO,
+                  iov,
+                  cnt);
+    if (ret <= 0)
+    {
+      if ( (-1 == ret) &&
+           (EINTR == errno) )
+        continue;
+      fprintf (stderr,
+               "Writing to %d failed: %s\n",
+               STDOUT_FILENO,
+               strerror (errno));
+      exit (1);
+    }
+    /* skip what was written, a partial write may end mid-entry */
+    while ( (0 < cnt) &&
+            ((size_t) ret >= iov->iov_len) )
+    {
+      ret -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (0 < cnt)
+    {
+      iov->iov_base = (char *) iov->iov_base + ret;
+      iov->iov_len -= ret;
+    }
+  }
+  send_arena_off = 0;
+  print_off = 0;
+  print_queued = 0;
+}
+
+
+/**
+ * Helper function to deal with partial writes.
+ * Fails hard (calls exit() on failures)!
+ * Output queued for the parent is written first, so writes to
+ * STDOUT_FILENO stay in order with it.
+ *
+ * @param fd where to write to
+ * @param buf what to write
+ * @param buf_size number of bytes in @a buf
+ */
+void
+write_all (int fd,
+           const void *buf,
+           size_t buf_size)
+{
+  if (STDOUT_FILENO == fd)
+    send_flush ();
+  write_fully (fd,
+               buf,
+               buf_size);
+}
+
+
+/**
+ * Queue @a frame for sending on interface @a ifc_num, without copying
+ * it.  @a frame must remain valid until send_flush(); frames loop()
+ * passed to the FrameHandler do.
+ *
+ * @param ifc_num interface to send the frame on
+ * @param frame the frame
+ * @param frame_size number of bytes in @a frame
+ */
+void
+send_frame (uint16_t ifc_num,
+            const void *frame,
+            size_t frame_size)
+{
+  struct GLAB_MessageHeader hdr = {
+    .size = htons (frame_size + sizeof (hdr)),
+    .type = htons (ifc_num)
+  };
+
+  if (frame_size > UINT16_MAX - sizeof (hdr))
+    abort ();
+  send_reserve (3,
+                sizeof (hdr) + frame_size);
+  send_queue_print ();
+  memcpy (&send_arena[send_arena_off],
+          &hdr,
+          sizeof (hdr));
+  send_queue (&send_arena[send_arena_off],
+              sizeof (hdr));
+  send_arena_off += sizeof (hdr);
+  send_queue (frame,
+              frame_size);
+}
+
+
+/**
+ * Queue a copy of the frame made of the @a iovcnt pieces at @a iov
+ * for sending on interface @a ifc_num.  The pieces may be reused as
+ * soon as this returns.
+ *
+ * @param ifc_num interface to send the frame on
+ * @param iov pieces of the frame
+ * @param iovcnt number of entries in @a iov
+ */
+void
+send_frame_copy (uint16_t ifc_num,
+                 const struct iovec *iov,
+                 int iovcnt)
+{
+  struct GLAB_MessageHeader hdr;
+  size_t frame_size = 0;
+  char *pos;
+
+  for (int i = 0; i < iovcnt; i++)
+    frame_size += iov[i].iov_len;
+  if (frame_size > UINT16_MAX - sizeof (hdr))
+    abort ();
+  send_reserve (2,
+                sizeof (hdr) + frame_size);
+  send_queue_print ();
+  hdr.size = htons (frame_size + sizeof (hdr));
+  hdr.type = htons (ifc_num);
+  pos = &send_arena[send_arena_off];
+  memcpy (pos,
+          &hdr,
+          sizeof (hdr));
+  pos += sizeof (hdr);
+  for (int i = 0; i < iovcnt; i++)
+  {
+    memcpy (pos,
+            iov[i].iov_base,
+            iov[i].iov_len);
+    pos += iov[i].iov_len;
+  }
+  send_queue (&send_arena[send_arena_off],
+              sizeof (hdr) + frame_size);
+  send_arena_off += sizeof (hdr) + frame_size;
+}
+
+
+/**
+ * Print message to the user by sending to parent.  The message is
+ * formatted directly into a buffer that is written by send_flush(),
+ * which loop() calls after each batch.  Each call still yields exactly
+ * one message to the parent.  Text longer than a message can hold is
+ * truncated.
  *
  * @param fmt format string
  * @param ... arguments for @a fmt
@@ -73,32 +378,40 @@ void
 print (const char *fmt,
        ...)
 {
-  char *str;
+  const size_t max = UINT16_MAX - sizeof (struct GLAB_MessageHeader);
+  struct GLAB_MessageHeader hdr;
   va_list ap;
+  size_t avail;
+  int len;
 
-  va_start (ap,
-            fmt);
-  vasprintf (&str,
-             fmt,
-             ap);
-  va_end (ap);
+  send_init ();
+  for (;;)
   {
-    size_t slen = strlen (str);
-    struct GLAB_MessageHeader hdr = {
-      .size = htons (slen + sizeof (struct GLAB_MessageHeader)),
-      .type = htons (0)
-    };
-    char buf[sizeof (hdr) + slen];
-
-    memcpy (buf,
-            &hdr,
-            sizeof (hdr));
-    memcpy (&buf[sizeof(hdr)],
-            str,
-            slen);
-    write_all (STDOUT_FILENO,
-               buf,
-               sizeof (buf));
+    /* leave room for the 0-terminator vsnprintf() writes */
+    avail = sizeof (print_buf) - print_off - sizeof (hdr) - 1;
+    if (avail > max)
+      avail = max;
+    va_start (ap,
+              fmt);
+    len = vsnprintf (&print_buf[print_off + sizeof (hdr)],
+                     avail + 1,
+                     fmt,
+                     ap);
+    va_end (ap);
+    if (len < 0)
+      return;
+    if ( ((size_t) len <= avail) ||
+         (0 == print_off) )
+      break;
+    /* does not fit behind what is buffered, make room and retry */
+    send_flush ();
   }
-  free (str);
+  if ((size_t) len > avail)
+    len = avail;
+  hdr.size = htons (len + sizeof (hdr));
+  hdr.type = htons (0);
+  memcpy (&print_buf[print_off],
+          &hdr,
+          sizeof (hdr));
+  print_off += sizeof (hdr) + len;
 }
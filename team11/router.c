@@ -24,7 +24,11 @@
 #include "glab.h"
 #include <stdbool.h>
 #include <string.h>
+#include <limits.h>
+#include <ctype.h>
 #include <math.h>
+#include <sys/un.h>
+#include <sys/mman.h>
 
 
 /* see http://www.iana.org/assignments/ethernet-numbers */
@@ -42,6 +46,20 @@
 #define ETH_P_ARP 0x0806
 #endif
 
+#ifndef ETH_P_IPV6
+/**
+ * Number for IPv6
+ */
+#define ETH_P_IPV6 0x86DD
+#endif
+
+#ifndef ETH_P_MPLS_UC
+/**
+ * Number for MPLS unicast
+ */
+#define ETH_P_MPLS_UC 0x8847
+#endif
+
 //
 #define MAX_ENTRIES 16
 
@@ -218,6 +236,7 @@ struct IPv4Header
 #define ICMPCODE_NETWORK_UNREACHABLE 0
 #define ICMPCODE_HOST_UNREACHABLE 1
 #define ICMPCODE_FRAGMENTATION_REQUIRED 4
+#define ICMPCODE_ADMINISTRATIVELY_PROHIBITED 13
 
 /**
  * ICMP header.
@@ -250,6 +269,188 @@ struct IcmpHeader
      (at least for the two ICMP message types we care about here) */
 
 };
+
+
+/**
+ * IPv6 header.
+ */
+struct IPv6Header
+{
+  /**
+   * Version (4 bits), traffic class (8 bits) and flow label (20 bits),
+   * in network byte order.
+   */
+  uint32_t ver_tc_flow;
+
+  /**
+   * Length of the payload (after this header).
+   */
+  uint16_t payload_length;
+
+  /**
+   * Type of the next header, for example, IPPROTO_ICMPV6.
+   */
+  uint8_t next_header;
+
+  /**
+   * How many more hops can this packet be forwarded?
+   */
+  uint8_t hop_limit;
+
+  /**
+   * Origin of the packet.
+   */
+  struct in6_addr source_address;
+
+  /**
+   * Destination of the packet.
+   */
+  struct in6_addr destination_address;
+};
+
+
+#define ICMP6TYPE_DESTINATION_UNREACHABLE 1
+#define ICMP6TYPE_PACKET_TOO_BIG 2
+#define ICMP6TYPE_TIME_EXCEEDED 3
+#define ICMP6TYPE_ECHO_REQUEST 128
+#define ICMP6TYPE_ECHO_REPLY 129
+#define ICMP6TYPE_NEIGHBOR_SOLICITATION 135
+#define ICMP6TYPE_NEIGHBOR_ADVERTISEMENT 136
+
+#define ICMP6CODE_NO_ROUTE 0
+#define ICMP6CODE_ADDRESS_UNREACHABLE 3
+
+/**
+ * ICMPv6 header.
+ */
+struct Icmp6Header
+{
+  uint8_t type;
+  uint8_t code;
+  uint16_t crc;
+
+  /**
+   * Type-specific: MTU for #ICMP6TYPE_PACKET_TOO_BIG, ID and sequence
+   * number for echo, flags for neighbor advertisements, otherwise unused.
+   */
+  uint32_t data;
+};
+
+
+/**
+ * Neighbor Discovery option types (RFC 4861).
+ */
+#define ND_OPT_SOURCE_LINKADDR 1
+#define ND_OPT_TARGET_LINKADDR 2
+
+/**
+ * Neighbor advertisement flags (first byte of Icmp6Header.data).
+ */
+#define ND_NA_FLAG_ROUTER 0x80
+#define ND_NA_FLAG_SOLICITED 0x40
+#define ND_NA_FLAG_OVERRIDE 0x20
+
+/**
+ * Neighbor solicitation or advertisement, with a link-layer address
+ * option.
+ */
+struct NdMessage
+{
+  struct Icmp6Header hdr;
+
+  /**
+   * Address being solicited or advertised.
+   */
+  struct in6_addr target;
+
+  /**
+   * #ND_OPT_SOURCE_LINKADDR or #ND_OPT_TARGET_LINKADDR.
+   */
+  uint8_t opt_type;
+
+  /**
+   * Option length in units of 8 bytes, 1 for Ethernet.
+   */
+  uint8_t opt_len;
+
+  struct MacAddress opt_mac;
+};
+
+
+#define TCP_FLAG_FIN 0x01
+#define TCP_FLAG_PSH 0x08
+#define TCP_FLAG_CWR 0x80
+
+/**
+ * TCP header.
+ */
+struct TcpHeader
+{
+  uint16_t source_port;
+  uint16_t destination_port;
+
+  /**
+   * Sequence number of the first payload byte.
+   */
+  uint32_t sequence_number;
+
+  /**
+   * Acknowledgement number.
+   */
+  uint32_t ack_number;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+  unsigned int reserved : 4;
+  unsigned int data_offset : 4;
+#elif __BYTE_ORDER == __BIG_ENDIAN
+  unsigned int data_offset : 4;
+  unsigned int reserved : 4;
+#else
+  #error byteorder undefined
+#endif
+
+  /**
+   * See TCP_FLAG-values.
+   */
+  uint8_t flags;
+  uint16_t window_size;
+  uint16_t crc;
+  uint16_t urgent_pointer;
+};
+
+
+/**
+ * Pseudo header used for the TCP checksum.
+ */
+struct TcpPseudoHeader
+{
+  struct in_addr source_address;
+  struct in_addr destination_address;
+  uint8_t zero;
+  uint8_t protocol;
+  uint16_t tcp_length;
+};
+
+
+#define GRE_FLAG_CHECKSUM 0x8000
+#define GRE_FLAG_KEY 0x2000
+#define GRE_FLAG_SEQUENCE 0x1000
+#define GRE_VERSION_MASK 0x0007
+
+/**
+ * GRE header (RFC 2784/2890) without the optional fields.
+ */
+struct GreHeader
+{
+  /**
+   * See GRE_FLAG-values and #GRE_VERSION_MASK.
+   */
+  uint16_t flags_version;
+
+  /**
+   * Ethernet tag of the payload.
+   */
+  uint16_t protocol;
+};
 _Pragma("pack(pop)")
 
 
@@ -287,6 +488,22 @@ struct Interface
    * MTU to enforce for this interface.
    */
   uint16_t mtu;
+
+  /**
+   * Global IPv6 address of the interface, if @e ip6_len is non-zero.
+   */
+  struct in6_addr ip6;
+
+  /**
+   * Prefix length of @e ip6, 0 if the interface has no global IPv6
+   * address.
+   */
+  uint8_t ip6_len;
+
+  /**
+   * Link-local IPv6 address (EUI-64 from @e mac).
+   */
+  struct in6_addr ll6;
 };
 
 
@@ -308,17 +525,81 @@ struct MacAddress nullMac;
 
 struct in_addr nullInAddr;
 
+/**
+ * What the router does with packets matching a route.
+ */
+enum RouteType
+{
+  /**
+   * Forward to the next hop.
+   */
+  ROUTE_UNICAST = 0,
+
+  /**
+   * Drop silently.
+   */
+  ROUTE_BLACKHOLE,
+
+  /**
+   * Drop and answer with ICMP host unreachable.
+   */
+  ROUTE_UNREACHABLE,
+
+  /**
+   * Drop and answer with ICMP administratively prohibited.
+   */
+  ROUTE_PROHIBIT,
+
+  /**
+   * Addressed to the router itself.
+   */
+  ROUTE_LOCAL
+};
+
+
+/**
+ * Names of the route types, indexed by `enum RouteType`.
+ */
+static const char *const route_type_names[] = {
+  "unicast",
+  "blackhole",
+  "unreachable",
+  "prohibit",
+  "local"
+};
+
 //--routing-table
 struct TableEntry{
     struct in_addr target_network;
     struct in_addr netmask;
     struct in_addr nextHop;
     struct Interface interface;
+    // MPLS label to impose (if has_label)
+    uint32_t label;
+    bool has_label;
+    // a `enum RouteType`
+    uint8_t type;
 };
 
 struct TableEntry routingTable[MAX_ENTRIES];
 int routingTableIndex = 0;
 
+/**
+ * Traffic counters of one route.  Kept apart from #routingTable, one
+ * cache line each, so that counting does not dirty the cache lines the
+ * lookup reads.  The router is single-threaded, so one set suffices.
+ */
+struct RouteCounters
+{
+  uint64_t packets;
+  uint64_t bytes;
+} __attribute__ ((aligned (64)));
+
+/**
+ * Counters of the routes, same index as #routingTable.
+ */
+static struct RouteCounters routeCounters[MAX_ENTRIES];
+
 //static struct Interface*
 //find_interface (const char *name);
 
@@ -401,867 +682,12052 @@ static uint16_t shift_bytes(uint16_t n) {
 //--
 
 /**
- * Forward @a frame to interface @a dst.
- *
- * @param dst target interface to send the frame out on
- * @param frame the frame to forward
- * @param frame_size number of bytes in @a frame
+ * Direction an ACL applies to.
  */
-static void forward_to (struct Interface *dst, const void *frame, size_t frame_size) {
-  char iob[frame_size + sizeof (struct GLAB_MessageHeader)];
-  struct GLAB_MessageHeader hdr;
-
-  if (frame_size > dst->mtu)
-    abort ();
-  hdr.size = htons (sizeof (iob));
-  hdr.type = htons (dst->ifc_num);
-  memcpy (iob,
-          &hdr,
-          sizeof (hdr));
-  memcpy (&iob[sizeof (hdr)],
-          frame,
-          frame_size);
-  write_all (STDOUT_FILENO,
-             iob,
-             sizeof (iob));
-}
+enum AclDirection
+{
+  ACL_IN = 0,
+  ACL_OUT = 1
+};
 
 
 /**
- * Create Ethernet frame and forward it via @a ifc to @a target_ha.
- * Create Ethernet frame and forward it via @a ifc to @a target_ha.
- *
- * @param ifc interface to send frame out on
- * @param target destination MAC
- * @param tag Ethernet tag to use
- * @param frame_payload payload to use in frame
- * @param frame_payload_size number of bytes in @a frame_payload
+ * One ACL rule.  Rules are evaluated by ascending @e seq, the first
+ * matching rule wins.  If an ACL has rules but none matches, the
+ * packet is denied.
  */
-static void
-forward_frame_payload_to (struct Interface *ifc,
-                          const struct MacAddress *target_ha,
-                          uint16_t tag,
-                          const void *frame_payload,
-                          size_t frame_payload_size)
+struct AclRule
 {
-  char frame[sizeof (struct EthernetHeader) + frame_payload_size];
-  struct EthernetHeader eh;
+  /**
+   * Sequence number (priority) of the rule, lower wins.
+   */
+  unsigned int seq;
 
-  if (frame_payload_size + sizeof (struct EthernetHeader) > ifc->mtu)
-    abort ();
-  eh.dst = *target_ha;
-  eh.src = ifc->mac;
-  eh.tag = ntohs (tag);
-  memcpy (frame,
-          &eh,
-          sizeof (eh));
-  memcpy (&frame[sizeof (eh)],
-          frame_payload,
-          frame_payload_size);
-  forward_to (ifc,
-              frame,
-              sizeof (frame));
-}
+  /**
+   * true to permit, false to deny.
+   */
+  bool permit;
 
+  /**
+   * Source network (masked) and its prefix length.
+   */
+  struct in_addr src;
+  uint8_t src_len;
 
-/**
- * Route the @a ip packet with its @a payload.
- *
- * @param origin interface we received the packet from
- * @param ip IP header
- * @param payload IP packet payload
- * @param payload_size number of bytes in @a payload
- */
-static void route (struct Interface *origin, const struct IPv4Header *ip, const void *payload, size_t payload_size, struct EthernetHeader eh){
-  struct MacAddress target_mac;
-  bool routeKnown = false;
-  struct Interface arpTableInterface;
-  for (int i = 0; i < tableIndex; i++){
-       if (ipCmp (&table[i].ip, &ip->destination_address) == 0){
-  			routeKnown = true;
-  			arpTableInterface = table[i];
-       }
-  }
+  /**
+   * Destination network (masked) and its prefix length.
+   */
+  struct in_addr dst;
+  uint8_t dst_len;
 
-  struct TableEntry routingEntry;
-  int bestNetmaskMatch = 0;
-  int bestNetmaskMatchIndex = 0;
-  bool foundTableEntry = false;
+  /**
+   * L4 protocol to match, -1 for any.
+   */
+  int protocol;
 
-  for(int i = 0; i < routingTableIndex; i++){
-    struct TableEntry temp;
-    //vergleiche zieladresse mit Routing tabelle um zu prüfen ob target in in table gespeichert
-    int maskDestination = ip->destination_address.s_addr & routingTable[i].netmask.s_addr;
-    int maskNetwork = routingTable[i].target_network.s_addr & routingTable[i].netmask.s_addr;
+  /**
+   * Port ranges (inclusive, host byte order).  A rule whose ranges are
+   * not 0-65535 only matches TCP/UDP packets with known ports.
+   */
+  uint16_t sport_lo;
+  uint16_t sport_hi;
+  uint16_t dport_lo;
+  uint16_t dport_hi;
 
-    if (maskDestination == maskNetwork && &routingTable[i].interface != 0){
-	    if (routingTable[i].netmask.s_addr >= bestNetmaskMatch){
-		    bestNetmaskMatch = routingTable[i].netmask.s_addr;
-		    bestNetmaskMatchIndex = i;
-			foundTableEntry = true;
-	    }
-	}
-  }
-  //es wurde ein Eintrag gefunden
-  routingEntry = routingTable[bestNetmaskMatchIndex];
-  /* TODO: Eintrag not found*/
+  /**
+   * Number of packets that matched this rule.
+   */
+  uint64_t hits;
+};
 
- if (!foundTableEntry){
-	    struct IcmpHeader header;
-            header.type = ICMPTYPE_DESTINATION_UNREACHABLE;
-            header.code = ICMPCODE_NETWORK_UNREACHABLE;
-            header.quench.time_exceeded_unused = 0;
-            header.crc = GNUNET_CRYPTO_crc16_n(&header, sizeof(struct IcmpHeader));
-
-            struct IPv4Header ipv4Header;
-            memcpy (&ipv4Header, ip, sizeof(struct IPv4Header));
-            ipv4Header.destination_address = ip->source_address;
-            ipv4Header.source_address = origin->ip;
-            ipv4Header.identification = 0;
-            ipv4Header.diff_serv = 0;
-            ipv4Header.ttl = 32;
-            ipv4Header.protocol = IPPROTO_ICMP;
-            ipv4Header.fragmentation_info = 0;
-            ipv4Header.checksum = 0;
-            ipv4Header.checksum = GNUNET_CRYPTO_crc16_n (&ipv4Header, sizeof(struct IPv4Header));
-
-            char send [sizeof(struct IPv4Header) + sizeof(struct IPv4Header) + sizeof(struct IcmpHeader) + 8];
-
-            memcpy (&send, &ipv4Header, sizeof(struct IPv4Header));
-            memcpy (&send[sizeof(struct IPv4Header)], &header, sizeof(struct IcmpHeader));
-            memcpy (&send[sizeof(struct IPv4Header) + sizeof(struct IcmpHeader)], ip, sizeof(struct IPv4Header));
-            memcpy (&send[sizeof(struct IPv4Header) + sizeof(struct IcmpHeader) + sizeof(struct IPv4Header)], payload, 8);
-
-            forward_frame_payload_to (origin, &eh.src, 0x0800, &send, 8 + sizeof(struct IPv4Header) + sizeof(struct IPv4Header) + sizeof(struct IcmpHeader));
-            return;
-	    }
-	   // FOUND ROUTER ENTRY
-	   struct IPv4Header newHeader;
 
-	   memcpy (&newHeader, ip, sizeof (struct IPv4Header));
-	   newHeader.ttl = newHeader.ttl - 1;
+/**
+ * Slot in the hash table of an #AclTuple.  The key is the masked
+ * packet fields a rule of the tuple matches on.
+ */
+struct AclSlot
+{
+  /**
+   * Masked source and destination address.
+   */
+  uint32_t src;
+  uint32_t dst;
 
-	   // check ttl
-	   if (newHeader.ttl < 1){
-		 return;
-	   }
-	   bool RemainingTTLhopNeeded = true;
-           for (int i = 0; i < routingTableIndex; i++){
-		   if (newHeader.destination_address.s_addr == 0){
-			   RemainingTTLhopNeeded = false;
-		   }
-	   }
-//____________________________________________________
-  target_mac = arpTableInterface.mac;
-//_________________________
-	   if (RemainingTTLhopNeeded){
-		for (int i = 0; i < tableIndex; i++){
-			if (ipCmp (&table[i].ip, &routingEntry.nextHop) == 0){
-				target_mac = table[i].mac;
-			}
-		}
-	   } else {
-	   }
-//____________________________
-  //If target-mac Null do arp
-  if ( &target_mac == NULL){
-	print("a\n");
+  /**
+   * Masked source port (upper 16 bits) and destination port (lower
+   * 16 bits), in host byte order.
+   */
+  uint32_t ports;
 
-    //Struktur Arp-Header
-	struct EthernetHeader arpEh;
+  /**
+   * Protocol, 0 if the tuple matches any protocol.
+   */
+  uint8_t protocol;
 
-	arpEh.dst = broadcastMac;
-	arpEh.src = routingEntry.interface.mac;
-	arpEh.tag = htons(2054);
+  /**
+   * true if the slot is in use.
+   */
+  bool used;
 
-	struct ArpHeaderEthernetIPv4 arpHeader;
-	arpHeader.htype = htons(1);
-	arpHeader.ptype = htons(0x800);
-	arpHeader.hlen = 6;
-	arpHeader.plen = 4;
-	arpHeader.oper = htons(1);
-	arpHeader.sender_ha = routingEntry.interface.mac;
-	arpHeader.sender_pa = routingEntry.interface.ip;
-	arpHeader.target_ha = nullMac;
-	arpHeader.target_pa = routingEntry.nextHop;
+  /**
+   * Offset of the rule with the lowest @e seq with this key (in the
+   * classifier's rule array).  Rules with the same key match the same
+   * packets, so the others can never win.
+   */
+  uint32_t rule;
+};
 
-	void* ptr = malloc (sizeof (arpEh) + sizeof (arpHeader));
-	memcpy (ptr, &arpEh, sizeof(arpEh));
-	memcpy (ptr + sizeof(arpEh), &arpHeader, sizeof(arpHeader));
-	forward_to (&routingEntry.interface, ptr, sizeof(ptr));
-	free(ptr);
-	return;
-	}
 
-//_________________________________________________________________________
-// MTU Fragmentation Handling
+/**
+ * All rules with the same prefix lengths for the addresses and ports
+ * and the same kind of protocol match (exact or any).  Port ranges are
+ * split into prefixes, so a rule may be in several tuples.  Rules in
+ * one tuple are found by a single exact-match hash probe on the masked
+ * packet fields.
+ */
+struct AclTuple
+{
+  /**
+   * Netmasks of this tuple (network byte order).
+   */
+  uint32_t src_mask;
+  uint32_t dst_mask;
 
-  uint sizeHeadIPv4 =  sizeof(struct IPv4Header);
-  uint sizeHeadIcmp = sizeof(struct IcmpHeader);
-  uint sizeHeadEh = sizeof(struct EthernetHeader);
+  /**
+   * Port masks, laid out like @e ports of #AclSlot; 0 if the tuple
+   * does not look at ports.
+   */
+  uint32_t port_mask;
 
-  // ok ___________________________________________________________________
-  if(routingEntry.interface.mtu >= sizeHeadIPv4 + payload_size)
+  /**
+   * 0xFF to match the protocol, 0 to match any protocol.
+   */
+  uint8_t protocol_mask;
+
+  /**
+   * Smallest rule sequence number in this tuple.
+   */
+  unsigned int min_seq;
+
+  /**
+   * Open addressing hash table, size is a power of two.
+   */
+  struct AclSlot *slots;
+
+  /**
+   * Length of @e slots minus one.
+   */
+  uint32_t slot_mask;
+};
+
+
+/**
+ * Compiled classifier for one interface and direction (tuple space
+ * search).  Per-packet cost depends on the number of distinct tuples,
+ * not on the number of rules.
+ */
+struct AclClassifier
+{
+  /**
+   * Rules sorted by @e seq.
+   */
+  struct AclRule *rules;
+
+  /**
+   * Tuples sorted by their @e min_seq.
+   */
+  struct AclTuple *tuples;
+
+  /**
+   * Length of @e rules.
+   */
+  unsigned int num_rules;
+
+  /**
+   * Length of @e tuples.
+   */
+  unsigned int num_tuples;
+};
+
+
+/**
+ * ACL of one interface and direction.
+ */
+struct Acl
+{
+  /**
+   * Rules as configured, sorted by @e seq, not yet active.
+   */
+  struct AclRule *staged;
+
+  /**
+   * Number of entries in @e staged.
+   */
+  unsigned int num_staged;
+
+  /**
+   * Allocated length of @e staged.
+   */
+  unsigned int staged_size;
+
+  /**
+   * Classifier used on the forwarding path, built by "acl commit".
+   */
+  struct AclClassifier active;
+};
+
+
+/**
+ * Packet fields the ACL classifier looks at.
+ */
+struct AclPacket
+{
+  uint32_t src;
+  uint32_t dst;
+  uint8_t protocol;
+  bool have_ports;
+  uint16_t sport;
+  uint16_t dport;
+};
+
+
+/**
+ * ACLs, two (#ACL_IN, #ACL_OUT) per interface, indexed by
+ * (ifc_num - 1) * 2 + direction.
+ */
+static struct Acl *acls;
+
+
+/**
+ * Hash function for the tuple hash tables.
+ *
+ * @param src masked source address
+ * @param dst masked destination address
+ * @return hash value
+ */
+static uint32_t
+acl_hash (uint32_t src,
+          uint32_t dst)
+{
+  uint32_t h = src * 0x9E3779B1U;
+
+  h ^= dst + 0x7F4A7C15U + (h << 6) + (h >> 2);
+  h *= 0x85EBCA6BU;
+  return h ^ (h >> 16);
+}
+
+
+/**
+ * Hash the key of an ACL tuple slot.
+ *
+ * @param src masked source address
+ * @param dst masked destination address
+ * @param ports masked ports, see #AclSlot
+ * @param protocol masked protocol
+ * @return hash value
+ */
+static uint32_t
+acl_key_hash (uint32_t src,
+              uint32_t dst,
+              uint32_t ports,
+              uint8_t protocol)
+{
+  uint32_t h = acl_hash (src,
+                         dst);
+
+  h ^= ports * 0xCC9E2D51U;
+  h ^= protocol;
+  h *= 0x1B873593U;
+  return h ^ (h >> 15);
+}
+
+
+/**
+ * Find the first matching rule for @a pkt in @a c.
+ *
+ * @param c classifier to search
+ * @param pkt packet to classify
+ * @return NULL if no rule matches
+ */
+static struct AclRule *
+acl_classify (const struct AclClassifier *c,
+              const struct AclPacket *pkt)
+{
+  struct AclRule *best = NULL;
+  uint32_t ports = (uint32_t) pkt->sport << 16 | pkt->dport;
+
+  for (unsigned int i = 0; i < c->num_tuples; i++)
   {
+    const struct AclTuple *t = &c->tuples[i];
+    uint32_t src = pkt->src & t->src_mask;
+    uint32_t dst = pkt->dst & t->dst_mask;
+    uint32_t mports = ports & t->port_mask;
+    uint8_t protocol = pkt->protocol & t->protocol_mask;
+    uint32_t pos;
+
+    /* tuples are sorted by min_seq, nothing later can beat @a best */
+    if ( (NULL != best) &&
+         (t->min_seq >= best->seq) )
+      break;
+    /* rules restricting ports only match packets with known ports */
+    if ( (0 != t->port_mask) &&
+         (! pkt->have_ports) )
+      continue;
+    pos = acl_key_hash (src, dst, mports, protocol) & t->slot_mask;
+    while (t->slots[pos].used)
+    {
+      const struct AclSlot *s = &t->slots[pos];
 
-    char send[sizeHeadIPv4 + payload_size];
-    newHeader.checksum = 0;
-    newHeader.checksum = GNUNET_CRYPTO_crc16_n(&newHeader, sizeHeadIPv4);
-    memcpy (send, &newHeader, sizeHeadIPv4);
-    memcpy (send + sizeHeadIPv4, payload, payload_size);
-    	
-    forward_frame_payload_to (
-        &routingEntry.interface, 
-        &target_mac, 
-        0x0800, 
-        send, 
-        sizeHeadIPv4 + payload_size
-    );
-    return;
+      if ( (s->src == src) &&
+           (s->dst == dst) &&
+           (s->ports == mports) &&
+           (s->protocol == protocol) )
+      {
+        struct AclRule *r = &c->rules[s->rule];
+
+        if ( (NULL == best) ||
+             (r->seq < best->seq) )
+          best = r;
+        break;
+      }
+      pos = (pos + 1) & t->slot_mask;
+    }
   }
-  // not ok -> fragmentaion needed __________________________________________
-  else{
+  return best;
+}
 
-    // check flags
-    // fragment _____________________________________________________________
-    if (ntohs (ip->fragmentation_info) >> 13 != 2){
-      
-      // beginn fragment
-      bool hasNext  = (newHeader.fragmentation_info >> 13 == 1) 
-                          ? true 
-                          : false;
-      bool islast = false;
-      int sizeFragment, offset = 0;      
-      uint16_t mtuIfc = routingEntry.interface.mtu - sizeHeadEh - sizeHeadIPv4;
 
-      // check payload
-      while (offset < payload_size)
-      {
-        islast  = (payload_size - offset) < mtuIfc 
-              ? true 
-              : false;
+/**
+ * Check if the ACL of @a ifc_num in direction @a dir permits
+ * the IPv4 packet @a ip with @a payload.
+ *
+ * @param ifc_num interface the packet is received/sent on
+ * @param dir direction to check
+ * @param ip IP header
+ * @param payload IP packet payload
+ * @param payload_size number of bytes in @a payload
+ * @return true if the packet may pass
+ */
+static bool
+acl_permits (uint16_t ifc_num,
+             enum AclDirection dir,
+             const struct IPv4Header *ip,
+             const void *payload,
+             size_t payload_size)
+{
+  struct Acl *acl = &acls[(ifc_num - 1) * 2 + dir];
+  struct AclRule *r;
+  struct AclPacket pkt;
+
+  if (0 == acl->active.num_rules)
+    return true;
+  pkt.src = ip->source_address.s_addr;
+  pkt.dst = ip->destination_address.s_addr;
+  pkt.protocol = ip->protocol;
+  /* ports are only known in the first fragment */
+  pkt.have_ports = ( (IPPROTO_TCP == ip->protocol) ||
+                     (IPPROTO_UDP == ip->protocol) ) &&
+                   (payload_size >= 2 * sizeof (uint16_t)) &&
+                   (0 == (ntohs (ip->fragmentation_info) & 0x1FFF));
+  if (pkt.have_ports)
+  {
+    uint16_t ports[2];
 
-        sizeFragment  = (payload_size - offset) < mtuIfc 
-                      ?  (payload_size - offset)
-                      :  (mtuIfc - (mtuIfc % 8));
+    memcpy (ports,
+            payload,
+            sizeof (ports));
+    pkt.sport = ntohs (ports[0]);
+    pkt.dport = ntohs (ports[1]);
+  }
+  else
+  {
+    pkt.sport = 0;
+    pkt.dport = 0;
+  }
+  r = acl_classify (&acl->active,
+                    &pkt);
+  if (NULL == r)
+  {
+    metrics_drop (ifc_num, GLAB_DROP_ACL);
+    return false;
+  }
+  r->hits++;
+  if (! r->permit)
+    metrics_drop (ifc_num, GLAB_DROP_ACL);
+  return r->permit;
+}
 
-        struct IPv4Header fragmentHead;
-        memcpy (&fragmentHead, &newHeader, sizeHeadIPv4);
-        fragmentHead.checksum = 0;
-        fragmentHead.total_length = htons(sizeFragment);
-        fragmentHead.fragmentation_info = (islast && !hasNext)
-                        ? htons(ntohs(newHeader.fragmentation_info) 
-                        + (offset >> 3)) 
-                        : htons((1 << 13) 
-                        + ntohs(newHeader.fragmentation_info) 
-                        + (offset >> 3));
-        fragmentHead.checksum = GNUNET_CRYPTO_crc16_n (&fragmentHead, sizeHeadIPv4);
-        
-        char fragment[sizeFragment + sizeHeadIPv4];
-        memcpy (&fragment, &fragmentHead, sizeHeadIPv4);
-        memcpy (&fragment[sizeHeadIPv4], payload + offset, sizeFragment);
-        
-        offset += sizeFragment;
 
-        forward_frame_payload_to (
-            &routingEntry.interface, 
-            &target_mac, 
-            0x0800, 
-            fragment, 
-            sizeFragment
-        );
-      }
-      return;
-    } 
-    // do not fragment ______________________________________________________
-    else {
+/**
+ * Maximum number of NAT flows (preallocated on first "nat add").
+ */
+#define NAT_MAX_FLOWS (1 << 21)
 
-       struct IPv4Header ipv4Head;
-      memcpy(&ipv4Head, ip, sizeHeadIPv4);
-      ipv4Head.destination_address = ip->source_address;
-      ipv4Head.source_address = origin->ip;
-      ipv4Head.identification = 0;
-      ipv4Head.diff_serv = 0;
-      ipv4Head.ttl = 32;
-      ipv4Head.protocol = IPPROTO_ICMP;
-      ipv4Head.fragmentation_info = 0;
-      ipv4Head.checksum = 0;
-      ipv4Head.checksum = GNUNET_CRYPTO_crc16_n(&ipv4Head, sizeHeadIPv4);
+/**
+ * Number of slots in the NAT flow index.  Every flow is indexed under
+ * two keys, so this keeps the load factor at or below 0.5.
+ */
+#define NAT_INDEX_SIZE (4 * NAT_MAX_FLOWS)
 
-      struct IcmpHeader head =  {
-          .type = 3,
-          .code = 4,
-          .quench.destination_unreachable.empty = 0,
-          .quench.destination_unreachable.next_hop_mtu 
-              = htons(routingEntry.interface.mtu - sizeHeadEh),
-          .crc = 0,
-          .crc = GNUNET_CRYPTO_crc16_n(&head, sizeHeadIcmp)
-      };
+/**
+ * First and number of ports we use for translated flows.
+ */
+#define NAT_PORT_MIN 1024
+#define NAT_PORT_RANGE (65536 - NAT_PORT_MIN)
 
-      char send[(sizeHeadIPv4 * 2) + sizeHeadIcmp + 8];
-      memcpy (&send, &ipv4Head, sizeHeadIPv4);
-      memcpy (&send[sizeHeadIPv4],&head,sizeHeadIcmp);
-      memcpy (&send[sizeHeadIPv4 + sizeHeadIcmp],ip,sizeHeadIPv4);
-      memcpy (&send[(sizeHeadIPv4 * 2) + sizeHeadIcmp], payload, 8);
+/**
+ * How many ports we try before giving up on a new flow.
+ */
+#define NAT_PORT_ATTEMPTS 512
+
+#define NAT_TIMEOUT_TCP_SYN 120
+#define NAT_TIMEOUT_TCP_ESTABLISHED 7440
+#define NAT_TIMEOUT_TCP_FIN 120
+#define NAT_TIMEOUT_TCP_RST 10
+#define NAT_TIMEOUT_UDP 30
+#define NAT_TIMEOUT_UDP_STREAM 180
+#define NAT_TIMEOUT_OTHER 30
+
+#define TCP_FLAG_SYN 0x02
+#define TCP_FLAG_RST 0x04
+
+#define ICMPTYPE_ECHO_REPLY 0
+#define ICMPTYPE_ECHO_REQUEST 8
+#define ICMPTYPE_PARAMETER_PROBLEM 12
+
+/**
+ * Size of the ICMP header in front of the packet embedded in an ICMP
+ * error message.
+ */
+#define ICMP_ERROR_HEADER_SIZE 8
+
+
+/**
+ * 5-tuple identifying one direction of a flow.  All fields are in
+ * network byte order.  For ICMP echo, the identifier is used as the
+ * source port of requests and as the destination port of replies.
+ */
+struct NatKey
+{
+  uint32_t src;
+  uint32_t dst;
+  uint16_t sport;
+  uint16_t dport;
+  uint8_t protocol;
+  uint8_t pad[3];
+};
+
+
+/**
+ * A translated flow.
+ */
+struct NatFlow
+{
+  /**
+   * Key of the flow as sent by the inside host.
+   */
+  struct NatKey orig;
+
+  /**
+   * Key of the replies we expect on the NAT interface.
+   */
+  struct NatKey reply;
+
+  /**
+   * Packets and bytes translated in both directions.
+   */
+  uint64_t packets;
+  uint64_t bytes;
+
+  /**
+   * Loop timer, armed for @e expires or an earlier time.
+   */
+  struct LoopTimer timer;
+
+  /**
+   * Time (in seconds, see nat_time()) when this flow expires.
+   */
+  uint32_t expires;
+
+  /**
+   * Next free flow (index + 1, 0 for none) while the flow is free.
+   */
+  uint32_t free_next;
+
+  /**
+   * NAT interface of the flow, 0 if the flow is not in use.
+   */
+  uint16_t ifc_num;
+
+  /**
+   * Did we see a packet in the reply direction?
+   */
+  bool seen_reply;
+
+  /**
+   * Did we see a TCP FIN or RST?
+   */
+  bool closing;
+};
+
+
+/**
+ * Slot of the NAT flow index (open addressing, linear probing).
+ */
+struct NatSlot
+{
+  /**
+   * Full hash of the key, avoids touching the flow on mismatches.
+   */
+  uint32_t hash;
+
+  /**
+   * (flow index << 1 | reply direction) + 1, 0 if empty.
+   */
+  uint32_t ref;
+};
+
+
+/**
+ * NAT statistics.
+ */
+struct NatStats
+{
+  uint64_t created;
+  uint64_t expired;
+  uint64_t translated_out;
+  uint64_t translated_in;
+  uint64_t lookups;
+  uint64_t probes;
+  uint64_t drop_no_port;
+  uint64_t drop_table_full;
+  uint64_t drop_fragment;
+  uint64_t drop_untranslatable;
+};
+
+
+/**
+ * Which interfaces do masquerading (indexed by ifc_num).
+ */
+static bool *nat_ifcs;
+
+/**
+ * All flows, NULL until NAT is first enabled.
+ */
+static struct NatFlow *nat_flows;
+
+/**
+ * Index over the keys of @e nat_flows.
+ */
+static struct NatSlot *nat_index;
+
+/**
+ * Released flows (index + 1, chained via @e free_next).
+ */
+static uint32_t nat_free;
+
+/**
+ * Number of flows ever handed out; flows at and above this index were
+ * never touched, so the preallocated table is only faulted in as it
+ * fills up.
+ */
+static uint32_t nat_used;
+
+/**
+ * Number of flows in use.
+ */
+static uint32_t nat_active;
+
+/**
+ * NAT statistics.
+ */
+static struct NatStats nat_stats;
+
+
+/**
+ * Get current time for the NAT in seconds.  This is the time of the
+ * current batch, so it matches the clock of the flow timers.
+ *
+ * @return monotonic time in seconds
+ */
+static uint32_t
+nat_time ()
+{
+  return (uint32_t) (loop_now () / 1000000);
+}
+
+
+/**
+ * Hash @a key.
+ *
+ * @param key key to hash
+ * @return hash value
+ */
+static uint32_t
+nat_hash (const struct NatKey *key)
+{
+  uint32_t h = acl_hash (key->src,
+                         key->dst);
+
+  h ^= ((uint32_t) key->sport << 16 | key->dport) * 0xCC9E2D51U;
+  h ^= key->protocol;
+  h *= 0x1B873593U;
+  return h ^ (h >> 15);
+}
+
+
+/**
+ * Find the flow with @a key.
+ *
+ * @param key key to look for
+ * @param reply[out] set to true if @a key matched the reply direction
+ * @return NULL if no such flow exists
+ */
+static struct NatFlow *
+nat_lookup (const struct NatKey *key,
+            bool *reply)
+{
+  uint32_t hash = nat_hash (key);
+  uint32_t pos = hash & (NAT_INDEX_SIZE - 1);
+
+  nat_stats.lookups++;
+  while (0 != nat_index[pos].ref)
+  {
+    nat_stats.probes++;
+    if (nat_index[pos].hash == hash)
+    {
+      uint32_t ref = nat_index[pos].ref - 1;
+      struct NatFlow *f = &nat_flows[ref >> 1];
+      const struct NatKey *fk = (ref & 1) ? &f->reply : &f->orig;
+
+      if (0 == memcmp (fk,
+                       key,
+                       sizeof (*key)))
+      {
+        *reply = (ref & 1);
+        return f;
+      }
+    }
+    pos = (pos + 1) & (NAT_INDEX_SIZE - 1);
+  }
+  return NULL;
+}
+
+
+/**
+ * Add @a key of flow @a idx to the index.
+ *
+ * @param key key to add
+ * @param idx flow index
+ * @param reply true if @a key is the reply key of the flow
+ */
+static void
+nat_index_add (const struct NatKey *key,
+               uint32_t idx,
+               bool reply)
+{
+  uint32_t hash = nat_hash (key);
+  uint32_t pos = hash & (NAT_INDEX_SIZE - 1);
+
+  while (0 != nat_index[pos].ref)
+    pos = (pos + 1) & (NAT_INDEX_SIZE - 1);
+  nat_index[pos].hash = hash;
+  nat_index[pos].ref = ((idx << 1) | (reply ? 1 : 0)) + 1;
+}
+
+
+/**
+ * Remove @a key of flow @a idx from the index.  Uses backward shift
+ * deletion, so the index never accumulates tombstones.
+ *
+ * @param key key to remove
+ * @param idx flow index
+ * @param reply true if @a key is the reply key of the flow
+ */
+static void
+nat_index_remove (const struct NatKey *key,
+                  uint32_t idx,
+                  bool reply)
+{
+  uint32_t ref = ((idx << 1) | (reply ? 1 : 0)) + 1;
+  uint32_t i = nat_hash (key) & (NAT_INDEX_SIZE - 1);
+  uint32_t j;
+
+  while (nat_index[i].ref != ref)
+  {
+    if (0 == nat_index[i].ref)
+      abort ();
+    i = (i + 1) & (NAT_INDEX_SIZE - 1);
+  }
+  j = i;
+  while (1)
+  {
+    uint32_t k;
+
+    j = (j + 1) & (NAT_INDEX_SIZE - 1);
+    if (0 == nat_index[j].ref)
+      break;
+    k = nat_index[j].hash & (NAT_INDEX_SIZE - 1);
+    /* move j into the hole at i unless its home k lies in (i, j] */
+    if ( (i <= j)
+         ? ( (i < k) && (k <= j) )
+         : ( (i < k) || (k <= j) ) )
+      continue;
+    nat_index[i] = nat_index[j];
+    i = j;
+  }
+  nat_index[i].ref = 0;
+}
+
+
+/**
+ * Arm the timer of flow @a f for its expiration time.
+ *
+ * @param f the flow
+ */
+static void
+nat_timer_arm (struct NatFlow *f)
+{
+  loop_timer_arm (&f->timer,
+                  (uint64_t) f->expires * 1000000);
+}
+
+
+/**
+ * Release flow @a idx (whose timer must not be armed).
+ *
+ * @param idx flow index
+ */
+static void
+nat_flow_release (uint32_t idx)
+{
+  struct NatFlow *f = &nat_flows[idx];
+
+  nat_index_remove (&f->orig,
+                    idx,
+                    false);
+  nat_index_remove (&f->reply,
+                    idx,
+                    true);
+  f->ifc_num = 0;
+  f->free_next = nat_free;
+  nat_free = idx + 1;
+  nat_active--;
+}
+
+
+/**
+ * Expire the flow @a cls when its timer fires.  Flows whose expiration
+ * was pushed back since the timer was armed are re-armed, so
+ * refreshing a flow on the packet path is a single store.
+ *
+ * @param cls the flow
+ */
+static void
+nat_timer_run (void *cls)
+{
+  struct NatFlow *f = cls;
+
+  if ((int32_t) (f->expires - nat_time ()) > 0)
+  {
+    nat_timer_arm (f);
+    return;
+  }
+  nat_stats.expired++;
+  nat_flow_release (f - nat_flows);
+}
+
+
+/**
+ * Allocate the flow table, called when NAT is first enabled.
+ */
+static void
+nat_init ()
+{
+  if (NULL != nat_flows)
+    return;
+  nat_flows = calloc (NAT_MAX_FLOWS,
+                      sizeof (struct NatFlow));
+  nat_index = calloc (NAT_INDEX_SIZE,
+                      sizeof (struct NatSlot));
+  if ( (NULL == nat_flows) ||
+       (NULL == nat_index) )
+    abort ();
+}
+
+
+/**
+ * Extract the flow key of the IPv4 packet @a ip.
+ *
+ * @param ip IP header
+ * @param payload IP packet payload
+ * @param payload_size number of bytes in @a payload
+ * @param key[out] set to the key of the packet
+ * @return 0 on success, 1 if the packet cannot be translated
+ */
+static int
+nat_extract_key (const struct IPv4Header *ip,
+                 const void *payload,
+                 size_t payload_size,
+                 struct NatKey *key)
+{
+  const uint8_t *p = payload;
+
+  memset (key, 0, sizeof (*key));
+  key->src = ip->source_address.s_addr;
+  key->dst = ip->destination_address.s_addr;
+  key->protocol = ip->protocol;
+  if (0 != (ntohs (ip->fragmentation_info) & 0x1FFF))
+    return 1;
+  switch (ip->protocol)
+  {
+  case IPPROTO_TCP:
+  case IPPROTO_UDP:
+    if (payload_size < 8)
+      return 1;
+    memcpy (&key->sport, &p[0], sizeof (uint16_t));
+    memcpy (&key->dport, &p[2], sizeof (uint16_t));
+    return 0;
+  case IPPROTO_ICMP:
+    if (payload_size < 8)
+      return 1;
+    if (ICMPTYPE_ECHO_REQUEST == p[0])
+      memcpy (&key->sport, &p[4], sizeof (uint16_t));
+    else if (ICMPTYPE_ECHO_REPLY == p[0])
+      memcpy (&key->dport, &p[4], sizeof (uint16_t));
+    else
+      return 1;
+    return 0;
+  default:
+    /* address-only translation */
+    return 0;
+  }
+}
+
+
+/**
+ * Incrementally update checksum @a csum for a 16-bit field changing
+ * from @a old_val to @a new_val (RFC 1624).
+ *
+ * @param csum checksum to update
+ * @param old_val old value of the field
+ * @param new_val new value of the field
+ * @return updated checksum
+ */
+static uint16_t
+csum_replace2 (uint16_t csum,
+               uint16_t old_val,
+               uint16_t new_val)
+{
+  uint32_t sum = (uint16_t) ~csum + (uint16_t) ~old_val + new_val;
+
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  return ~sum;
+}
+
+
+/**
+ * Incrementally update checksum @a csum for a 32-bit field changing
+ * from @a old_val to @a new_val.
+ *
+ * @param csum checksum to update
+ * @param old_val old value of the field
+ * @param new_val new value of the field
+ * @return updated checksum
+ */
+static uint16_t
+csum_replace4 (uint16_t csum,
+               uint32_t old_val,
+               uint32_t new_val)
+{
+  csum = csum_replace2 (csum,
+                        (uint16_t) (old_val >> 16),
+                        (uint16_t) (new_val >> 16));
+  return csum_replace2 (csum,
+                        (uint16_t) old_val,
+                        (uint16_t) new_val);
+}
+
+
+/**
+ * Rewrite the L4 part of @a payload: the port at @a port_off changes
+ * to @a new_port and the address covered by the pseudo header changes
+ * from @a old_addr to @a new_addr.  The checksum is left alone if it
+ * is not within @a payload_size bytes, as in the truncated packets
+ * embedded in ICMP errors.
+ *
+ * @param protocol L4 protocol
+ * @param payload[in,out] IP packet payload
+ * @param payload_size number of bytes in @a payload, at least 8
+ * @param port_off offset of the port (or ICMP id) to rewrite
+ * @param new_port new port value (network byte order)
+ * @param old_addr old IP address (network byte order)
+ * @param new_addr new IP address (network byte order)
+ */
+static void
+nat_rewrite_l4 (uint8_t protocol,
+                uint8_t *payload,
+                size_t payload_size,
+                size_t port_off,
+                uint16_t new_port,
+                uint32_t old_addr,
+                uint32_t new_addr)
+{
+  size_t csum_off;
+  uint16_t old_port;
+  uint16_t csum;
+
+  switch (protocol)
+  {
+  case IPPROTO_TCP:
+    csum_off = offsetof (struct TcpHeader, crc);
+    break;
+  case IPPROTO_UDP:
+    csum_off = 6;
+    break;
+  case IPPROTO_ICMP:
+    csum_off = 2;
+    break;
+  default:
+    return;
+  }
+  memcpy (&old_port, &payload[port_off], sizeof (old_port));
+  memcpy (&payload[port_off], &new_port, sizeof (new_port));
+  if (payload_size < csum_off + sizeof (csum))
+    return;
+  memcpy (&csum, &payload[csum_off], sizeof (csum));
+  if ( (IPPROTO_UDP == protocol) &&
+       (0 == csum) )
+    return; /* no checksum */
+  csum = csum_replace2 (csum,
+                        old_port,
+                        new_port);
+  if (IPPROTO_ICMP != protocol)
+    csum = csum_replace4 (csum,
+                          old_addr,
+                          new_addr);
+  if ( (IPPROTO_UDP == protocol) &&
+       (0 == csum) )
+    csum = 0xFFFF;
+  memcpy (&payload[csum_off], &csum, sizeof (csum));
+}
+
+
+/**
+ * Update expiration and TCP state of flow @a f for a packet.
+ *
+ * @param f flow to refresh
+ * @param reply true if the packet is in the reply direction
+ * @param payload IP packet payload
+ * @param payload_size number of bytes in @a payload
+ * @param now current time
+ */
+static void
+nat_refresh (struct NatFlow *f,
+             bool reply,
+             const uint8_t *payload,
+             size_t payload_size,
+             uint32_t now)
+{
+  uint32_t timeout;
+
+  if (reply)
+    f->seen_reply = true;
+  f->packets++;
+  f->bytes += payload_size;
+  switch (f->orig.protocol)
+  {
+  case IPPROTO_TCP:
+    if (payload_size < sizeof (struct TcpHeader))
+    {
+      timeout = NAT_TIMEOUT_TCP_SYN;
+    }
+    else if (payload[13] & TCP_FLAG_RST)
+    {
+      f->closing = true;
+      timeout = NAT_TIMEOUT_TCP_RST;
+    }
+    else
+    {
+      if (payload[13] & TCP_FLAG_FIN)
+        f->closing = true;
+      timeout = f->closing
+                ? NAT_TIMEOUT_TCP_FIN
+                : (f->seen_reply
+                   ? NAT_TIMEOUT_TCP_ESTABLISHED
+                   : NAT_TIMEOUT_TCP_SYN);
+    }
+    break;
+  case IPPROTO_UDP:
+    timeout = f->seen_reply ? NAT_TIMEOUT_UDP_STREAM : NAT_TIMEOUT_UDP;
+    break;
+  default:
+    timeout = NAT_TIMEOUT_OTHER;
+    break;
+  }
+  f->expires = now + timeout;
+}
+
+
+/**
+ * Create a flow for a packet with @a key leaving via @a ifc.
+ *
+ * @param ifc NAT interface
+ * @param key key of the packet
+ * @param now current time
+ * @return NULL if no port is available or the table is full
+ */
+static struct NatFlow *
+nat_flow_create (const struct Interface *ifc,
+                 const struct NatKey *key,
+                 uint32_t now)
+{
+  struct NatKey reply;
+  struct NatFlow *f;
+  uint32_t idx;
+  bool ports;
+  bool dummy;
+
+  if ( (0 == nat_free) &&
+       (NAT_MAX_FLOWS == nat_used) )
+  {
+    nat_stats.drop_table_full++;
+    return NULL;
+  }
+  ports = (IPPROTO_TCP == key->protocol) ||
+          (IPPROTO_UDP == key->protocol) ||
+          (IPPROTO_ICMP == key->protocol);
+  memset (&reply, 0, sizeof (reply));
+  reply.src = key->dst;
+  reply.dst = ifc->ip.s_addr;
+  reply.sport = key->dport;
+  reply.dport = key->sport;
+  reply.protocol = key->protocol;
+  if (ports)
+  {
+    /* keep the source port if we can, otherwise hash into the range */
+    uint16_t port = ntohs (key->sport);
+    unsigned int i;
+
+    if (port < NAT_PORT_MIN)
+      port = NAT_PORT_MIN + nat_hash (key) % NAT_PORT_RANGE;
+    for (i = 0; i < NAT_PORT_ATTEMPTS; i++)
+    {
+      reply.dport = htons (port);
+      if (NULL == nat_lookup (&reply,
+                              &dummy))
+        break;
+      port = (port == UINT16_MAX) ? NAT_PORT_MIN : port + 1;
+    }
+    if (NAT_PORT_ATTEMPTS == i)
+    {
+      nat_stats.drop_no_port++;
+      return NULL;
+    }
+  }
+  else if (NULL != nat_lookup (&reply,
+                               &dummy))
+  {
+    nat_stats.drop_no_port++;
+    return NULL;
+  }
+  if (0 != nat_free)
+  {
+    idx = nat_free - 1;
+    nat_free = nat_flows[idx].free_next;
+  }
+  else
+  {
+    idx = nat_used++;
+  }
+  f = &nat_flows[idx];
+  memset (f, 0, sizeof (*f));
+  loop_timer_init (&f->timer,
+                   &nat_timer_run,
+                   f);
+  f->orig = *key;
+  f->reply = reply;
+  f->ifc_num = ifc->ifc_num;
+  f->expires = now;
+  nat_index_add (&f->orig,
+                 idx,
+                 false);
+  nat_index_add (&f->reply,
+                 idx,
+                 true);
+  nat_timer_arm (f);
+  nat_active++;
+  nat_stats.created++;
+  return f;
+}
+
+
+/**
+ * Check if @a ip / @a payload is an ICMP error message, which carries
+ * the start of the packet that caused it.
+ *
+ * @param ip IP header
+ * @param payload IP packet payload
+ * @param payload_size number of bytes in @a payload
+ * @return true for destination unreachable, time exceeded and
+ *         parameter problem messages
+ */
+static bool
+nat_is_icmp_error (const struct IPv4Header *ip,
+                   const uint8_t *payload,
+                   size_t payload_size)
+{
+  if ( (IPPROTO_ICMP != ip->protocol) ||
+       (0 == payload_size) )
+    return false;
+  return (ICMPTYPE_DESTINATION_UNREACHABLE == payload[0]) ||
+         (ICMPTYPE_TIME_EXCEEDED == payload[0]) ||
+         (ICMPTYPE_PARAMETER_PROBLEM == payload[0]);
+}
+
+
+/**
+ * Find the flow of the packet embedded in the ICMP error @a payload.
+ * The embedded packet went the opposite way of the error, so the flow
+ * is looked up with its addresses and ports swapped.
+ *
+ * @param payload ICMP error message
+ * @param payload_size number of bytes in @a payload
+ * @param inner[out] set to the offset of the embedded IP header
+ * @param inner_hlen[out] set to the length of the embedded IP header
+ * @param key[out] set to the key of the embedded packet
+ * @param reply[out] set to true if the error travels in the reply
+ *        direction of the flow
+ * @return the flow, NULL if the error cannot be translated
+ */
+static struct NatFlow *
+nat_icmp_error_flow (const uint8_t *payload,
+                     size_t payload_size,
+                     size_t *inner,
+                     size_t *inner_hlen,
+                     struct NatKey *key,
+                     bool *reply)
+{
+  struct IPv4Header eip;
+  struct NatKey rkey;
+
+  *inner = ICMP_ERROR_HEADER_SIZE;
+  if (payload_size < *inner + sizeof (eip))
+    return NULL;
+  memcpy (&eip,
+          &payload[*inner],
+          sizeof (eip));
+  *inner_hlen = eip.header_length * 4;
+  /* we need the ports (or ICMP id), the first 8 bytes of L4 */
+  if ( (4 != eip.version) ||
+       (*inner_hlen < sizeof (eip)) ||
+       (payload_size < *inner + *inner_hlen + 8) )
+    return NULL;
+  if (0 != nat_extract_key (&eip,
+                            &payload[*inner + *inner_hlen],
+                            payload_size - *inner - *inner_hlen,
+                            key))
+    return NULL;
+  memset (&rkey, 0, sizeof (rkey));
+  rkey.src = key->dst;
+  rkey.dst = key->src;
+  rkey.sport = key->dport;
+  rkey.dport = key->sport;
+  rkey.protocol = key->protocol;
+  return nat_lookup (&rkey,
+                     reply);
+}
+
+
+/**
+ * Rewrite the embedded IP header at @a inner of an ICMP error: the
+ * address at @a addr_off (12 for the source, 16 for the destination)
+ * becomes @a new_addr and the port at @a port_off of the embedded L4
+ * header becomes @a new_port.  Fixes the embedded checksums and
+ * recomputes the checksum of the ICMP message.
+ *
+ * @param payload[in,out] ICMP error message
+ * @param payload_size number of bytes in @a payload
+ * @param inner offset of the embedded IP header
+ * @param inner_hlen length of the embedded IP header
+ * @param protocol L4 protocol of the embedded packet
+ * @param addr_off offset of the address in the embedded IP header
+ * @param new_addr new address (network byte order)
+ * @param port_off offset of the port in the embedded L4 header
+ * @param new_port new port (network byte order)
+ */
+static void
+nat_icmp_error_rewrite (uint8_t *payload,
+                        size_t payload_size,
+                        size_t inner,
+                        size_t inner_hlen,
+                        uint8_t protocol,
+                        size_t addr_off,
+                        uint32_t new_addr,
+                        size_t port_off,
+                        uint16_t new_port)
+{
+  uint8_t *eip = &payload[inner];
+  uint32_t old_addr;
+  uint16_t csum;
+
+  memcpy (&old_addr, &eip[addr_off], sizeof (old_addr));
+  memcpy (&eip[addr_off], &new_addr, sizeof (new_addr));
+  memcpy (&csum, &eip[offsetof (struct IPv4Header, checksum)], sizeof (csum));
+  csum = csum_replace4 (csum,
+                        old_addr,
+                        new_addr);
+  memcpy (&eip[offsetof (struct IPv4Header, checksum)], &csum, sizeof (csum));
+  nat_rewrite_l4 (protocol,
+                  &eip[inner_hlen],
+                  payload_size - inner - inner_hlen,
+                  port_off,
+                  new_port,
+                  old_addr,
+                  new_addr);
+  memset (&payload[2], 0, sizeof (csum));
+  csum = GNUNET_CRYPTO_crc16_n (payload,
+                                payload_size);
+  memcpy (&payload[2], &csum, sizeof (csum));
+}
+
+
+/**
+ * Translate an ICMP error sent by an inside host about a packet of a
+ * flow we translated in (for example "port unreachable").
+ *
+ * @param ifc NAT interface the error leaves on
+ * @param ip[in,out] IP header (checksum is recomputed by the caller)
+ * @param payload[in,out] ICMP error message
+ * @param payload_size number of bytes in @a payload
+ * @return 0 on success, 1 if the error must be dropped
+ */
+static int
+nat_icmp_error_outbound (const struct Interface *ifc,
+                         struct IPv4Header *ip,
+                         uint8_t *payload,
+                         size_t payload_size)
+{
+  struct NatKey key;
+  struct NatFlow *f;
+  size_t inner;
+  size_t inner_hlen;
+  bool reply;
+
+  f = nat_icmp_error_flow (payload,
+                           payload_size,
+                           &inner,
+                           &inner_hlen,
+                           &key,
+                           &reply);
+  if ( (NULL == f) ||
+       reply ||
+       (f->ifc_num != ifc->ifc_num) )
+  {
+    nat_stats.drop_untranslatable++;
+    return 1;
+  }
+  /* the embedded packet is a reply as the inside host got it */
+  nat_icmp_error_rewrite (payload,
+                          payload_size,
+                          inner,
+                          inner_hlen,
+                          key.protocol,
+                          offsetof (struct IPv4Header, destination_address),
+                          f->reply.dst,
+                          (IPPROTO_ICMP == key.protocol) ? 4 : 2,
+                          f->reply.dport);
+  ip->source_address.s_addr = f->reply.dst;
+  nat_stats.translated_out++;
+  return 0;
+}
+
+
+/**
+ * Translate an ICMP error received on the NAT interface about a packet
+ * we translated out (for example "fragmentation needed" or "time
+ * exceeded"), so that path MTU discovery and traceroute work through
+ * the NAT.  Errors without a flow are left alone.
+ *
+ * @param ifc NAT interface the error was received on
+ * @param ip[in,out] IP header (checksum is recomputed by the caller)
+ * @param payload[in,out] ICMP error message
+ * @param payload_size number of bytes in @a payload
+ */
+static void
+nat_icmp_error_inbound (const struct Interface *ifc,
+                        struct IPv4Header *ip,
+                        uint8_t *payload,
+                        size_t payload_size)
+{
+  struct NatKey key;
+  struct NatFlow *f;
+  size_t inner;
+  size_t inner_hlen;
+  bool reply;
+
+  f = nat_icmp_error_flow (payload,
+                           payload_size,
+                           &inner,
+                           &inner_hlen,
+                           &key,
+                           &reply);
+  if ( (NULL == f) ||
+       (! reply) ||
+       (f->ifc_num != ifc->ifc_num) )
+    return;
+  /* the embedded packet is one we sent with the outside address */
+  nat_icmp_error_rewrite (payload,
+                          payload_size,
+                          inner,
+                          inner_hlen,
+                          key.protocol,
+                          offsetof (struct IPv4Header, source_address),
+                          f->orig.src,
+                          (IPPROTO_ICMP == key.protocol) ? 4 : 0,
+                          f->orig.sport);
+  ip->destination_address.s_addr = f->orig.src;
+  nat_stats.translated_in++;
+}
+
+
+/**
+ * Source-NAT the packet @a ip / @a payload leaving via @a ifc.
+ *
+ * @param ifc NAT interface the packet leaves on
+ * @param ip[in,out] IP header (checksum is recomputed by the caller)
+ * @param payload[in,out] IP packet payload
+ * @param payload_size number of bytes in @a payload
+ * @return 0 on success, 1 if the packet must be dropped
+ */
+static int
+nat_outbound (const struct Interface *ifc,
+              struct IPv4Header *ip,
+              uint8_t *payload,
+              size_t payload_size)
+{
+  struct NatKey key;
+  struct NatFlow *f;
+  uint32_t now;
+  bool reply;
+
+  if (0 != (ntohs (ip->fragmentation_info) & 0x1FFF))
+  {
+    nat_stats.drop_fragment++;
+    return 1;
+  }
+  if (nat_is_icmp_error (ip,
+                         payload,
+                         payload_size))
+    return nat_icmp_error_outbound (ifc,
+                                    ip,
+                                    payload,
+                                    payload_size);
+  if (0 != nat_extract_key (ip,
+                            payload,
+                            payload_size,
+                            &key))
+  {
+    nat_stats.drop_untranslatable++;
+    return 1;
+  }
+  now = nat_time ();
+  f = nat_lookup (&key,
+                  &reply);
+  if ( (NULL != f) && reply)
+    return 0; /* already the outside view of a flow */
+  if (NULL == f)
+    f = nat_flow_create (ifc,
+                         &key,
+                         now);
+  if (NULL == f)
+    return 1;
+  nat_refresh (f,
+               false,
+               payload,
+               payload_size,
+               now);
+  nat_rewrite_l4 (key.protocol,
+                  payload,
+                  payload_size,
+                  (IPPROTO_ICMP == key.protocol) ? 4 : 0,
+                  f->reply.dport,
+                  key.src,
+                  f->reply.dst);
+  ip->source_address.s_addr = f->reply.dst;
+  nat_stats.translated_out++;
+  return 0;
+}
+
+
+/**
+ * Reverse the translation for packet @a ip / @a payload received on
+ * the NAT interface @a ifc.  Packets without a flow are left alone.
+ *
+ * @param ifc NAT interface the packet was received on
+ * @param ip[in,out] IP header (checksum is recomputed by the caller)
+ * @param payload[in,out] IP packet payload
+ * @param payload_size number of bytes in @a payload
+ */
+static void
+nat_inbound (const struct Interface *ifc,
+             struct IPv4Header *ip,
+             uint8_t *payload,
+             size_t payload_size)
+{
+  struct NatKey key;
+  struct NatFlow *f;
+  bool reply;
+
+  if (nat_is_icmp_error (ip,
+                         payload,
+                         payload_size))
+  {
+    nat_icmp_error_inbound (ifc,
+                            ip,
+                            payload,
+                            payload_size);
+    return;
+  }
+  if (0 != nat_extract_key (ip,
+                            payload,
+                            payload_size,
+                            &key))
+    return;
+  f = nat_lookup (&key,
+                  &reply);
+  if ( (NULL == f) ||
+       (! reply) ||
+       (f->ifc_num != ifc->ifc_num) )
+    return;
+  nat_refresh (f,
+               true,
+               payload,
+               payload_size,
+               nat_time ());
+  nat_rewrite_l4 (key.protocol,
+                  payload,
+                  payload_size,
+                  (IPPROTO_ICMP == key.protocol) ? 4 : 2,
+                  f->orig.sport,
+                  key.dst,
+                  f->orig.src);
+  ip->destination_address.s_addr = f->orig.src;
+  nat_stats.translated_in++;
+}
+
+
+/**
+ * Maximum number of flows in the flow cache.
+ */
+#define FLOW_MAX_FLOWS 65536
+
+/**
+ * Number of hash chains of the flow cache (power of two).
+ */
+#define FLOW_HASH_SIZE 16384
+
+/**
+ * Default active timeout (us): long-lived flows are reported at least
+ * this often.
+ */
+#define FLOW_ACTIVE_TIMEOUT (60 * 1000000LLU)
+
+/**
+ * Default inactive timeout (us): flows without packets for this long
+ * are reported and removed.
+ */
+#define FLOW_INACTIVE_TIMEOUT (15 * 1000000LLU)
+
+/**
+ * Maximum size of an export message, so that a message fits into one
+ * datagram on the usual MTU.
+ */
+#define FLOW_MSG_SIZE 1400
+
+/**
+ * Records wait at most this long (us) for their message to fill up.
+ */
+#define FLOW_EXPORT_DELAY 1000000
+
+/**
+ * The template is repeated every this many messages, so collectors that
+ * start late (or read a rotated file) can decode the records.
+ */
+#define FLOW_TEMPLATE_INTERVAL 32
+
+#define IPFIX_VERSION 10
+#define IPFIX_HEADER_SIZE 16
+#define IPFIX_SET_TEMPLATE 2
+#define IPFIX_TEMPLATE_ID 256
+
+/* flowEndReason values (RFC 5102) */
+#define IPFIX_END_IDLE 1
+#define IPFIX_END_ACTIVE 2
+#define IPFIX_END_FORCED 4
+#define IPFIX_END_RESOURCES 5
+
+
+/**
+ * Information element of the template, in record order.
+ */
+struct IpfixField
+{
+  uint16_t id;
+  uint16_t length;
+};
+
+
+/**
+ * Fields of our data records (RFC 5102 information elements).
+ */
+static const struct IpfixField ipfix_fields[] = {
+  { 8, 4 },     /* sourceIPv4Address */
+  { 12, 4 },    /* destinationIPv4Address */
+  { 7, 2 },     /* sourceTransportPort */
+  { 11, 2 },    /* destinationTransportPort */
+  { 4, 1 },     /* protocolIdentifier */
+  { 10, 4 },    /* ingressInterface */
+  { 14, 4 },    /* egressInterface */
+  { 2, 8 },     /* packetDeltaCount */
+  { 1, 8 },     /* octetDeltaCount */
+  { 152, 8 },   /* flowStartMilliseconds */
+  { 153, 8 },   /* flowEndMilliseconds */
+  { 136, 1 },   /* flowEndReason */
+  { 305, 4 }    /* samplingPacketInterval */
+};
+
+/**
+ * Number of entries in #ipfix_fields.
+ */
+#define IPFIX_NUM_FIELDS (sizeof (ipfix_fields) / sizeof (ipfix_fields[0]))
+
+/**
+ * Size of one data record, sum of the lengths in #ipfix_fields.
+ */
+#define IPFIX_RECORD_SIZE 58
+
+
+/**
+ * A flow in the flow cache.
+ */
+struct Flow
+{
+  /**
+   * 5-tuple of the flow.
+   */
+  struct NatKey key;
+
+  /**
+   * Packets and bytes since the flow was last reported (sampled).
+   */
+  uint64_t packets;
+  uint64_t bytes;
+
+  /**
+   * Time (see loop_now()) of the first and last packet since the flow
+   * was last reported.
+   */
+  uint64_t first;
+  uint64_t last;
+
+  /**
+   * Hash chain (flow index + 1, 0 for none).  Also used to chain free
+   * flows.
+   */
+  uint32_t hash_next;
+
+  /**
+   * List of flows ordered by @e last (flow index + 1, 0 for none).
+   */
+  uint32_t lru_prev;
+  uint32_t lru_next;
+
+  /**
+   * Interface the flow arrived on, 0 if the flow is not in use.
+   */
+  uint16_t ingress;
+
+  /**
+   * Interface of the route the last packet took, 0 if it was not
+   * forwarded.
+   */
+  uint16_t egress;
+};
+
+
+/**
+ * Where and how flow records are exported.
+ */
+struct FlowExporter
+{
+  /**
+   * Export file or connected UNIX datagram socket, -1 if flow export
+   * is disabled.
+   */
+  int fd;
+
+  /**
+   * Export target as given by the user.
+   */
+  char *target;
+
+  /**
+   * Message being assembled.
+   */
+  uint8_t msg[FLOW_MSG_SIZE];
+
+  /**
+   * Bytes in @e msg, 0 if no message is being assembled.
+   */
+  size_t msg_len;
+
+  /**
+   * Records in @e msg.
+   */
+  unsigned int msg_records;
+
+  /**
+   * Offset of the data set header in @e msg.
+   */
+  size_t set_start;
+
+  /**
+   * Time (see loop_now()) the current message was started.
+   */
+  uint64_t opened;
+
+  /**
+   * Data records exported so far (the IPFIX sequence number).
+   */
+  uint32_t sequence;
+
+  /**
+   * Messages written since the template was last sent.
+   */
+  unsigned int messages;
+
+  /**
+   * Difference between wall clock and loop_now() (us), for the
+   * timestamps in the records.
+   */
+  uint64_t epoch;
+};
+
+
+/**
+ * Flow cache statistics.
+ */
+struct FlowStats
+{
+  uint64_t sampled;
+  uint64_t created;
+  uint64_t records;
+  uint64_t messages;
+  uint64_t evicted;
+  uint64_t export_errors;
+};
+
+
+/**
+ * All flows, NULL until flow export is first enabled.
+ */
+static struct Flow *flows;
+
+/**
+ * Heads (flow index + 1) of the hash chains.
+ */
+static uint32_t *flow_hash;
+
+/**
+ * Released flows (index + 1, chained via @e hash_next).
+ */
+static uint32_t flow_free;
+
+/**
+ * Number of flows ever handed out, see #nat_used.
+ */
+static uint32_t flow_used;
+
+/**
+ * Number of flows in use.
+ */
+static uint32_t flow_active;
+
+/**
+ * Least and most recently seen flow (index + 1).
+ */
+static uint32_t flow_lru_head;
+static uint32_t flow_lru_tail;
+
+/**
+ * Timeouts of the flow cache (us).
+ */
+static uint64_t flow_active_timeout = FLOW_ACTIVE_TIMEOUT;
+static uint64_t flow_inactive_timeout = FLOW_INACTIVE_TIMEOUT;
+
+/**
+ * Only every flow_sampling-th packet is accounted.
+ */
+static unsigned int flow_sampling = 1;
+
+/**
+ * Packets until the next sampled packet.
+ */
+static unsigned int flow_countdown = 1;
+
+/**
+ * The flow exporter.
+ */
+static struct FlowExporter flow_exporter = {
+  .fd = -1
+};
+
+/**
+ * Flow cache statistics.
+ */
+static struct FlowStats flow_stats;
+
+
+/**
+ * Append @a len bytes of @a val in network byte order to @a p.
+ *
+ * @param[in,out] p where to write, advanced by @a len
+ * @param val value to write
+ * @param len number of bytes to write
+ */
+static void
+ipfix_put (uint8_t **p,
+           uint64_t val,
+           unsigned int len)
+{
+  for (unsigned int i = len; i > 0; i--)
+  {
+    (*p)[i - 1] = (uint8_t) val;
+    val >>= 8;
+  }
+  *p += len;
+}
+
+
+/**
+ * Write the message being assembled to the export target.
+ */
+static void
+flow_export_flush (void)
+{
+  struct FlowExporter *fe = &flow_exporter;
+  uint8_t *p;
+
+  if (0 == fe->msg_len)
+    return;
+  p = fe->msg;
+  ipfix_put (&p, IPFIX_VERSION, 2);
+  ipfix_put (&p, fe->msg_len, 2);
+  ipfix_put (&p, time (NULL), 4);
+  ipfix_put (&p, fe->sequence, 4);
+  ipfix_put (&p, 0, 4); /* observation domain */
+  p = &fe->msg[fe->set_start + 2];
+  ipfix_put (&p, fe->msg_len - fe->set_start, 2);
+  if ((ssize_t) fe->msg_len !=
+      write (fe->fd,
+             fe->msg,
+             fe->msg_len))
+    flow_stats.export_errors++;
+  else
+    flow_stats.messages++;
+  fe->sequence += fe->msg_records;
+  fe->messages++;
+  fe->msg_len = 0;
+  fe->msg_records = 0;
+}
+
+
+/**
+ * Add a data record for @a f to the export message.
+ *
+ * @param f flow to report
+ * @param reason why the flow is reported, an IPFIX flowEndReason
+ */
+static void
+flow_export (const struct Flow *f,
+             uint8_t reason)
+{
+  struct FlowExporter *fe = &flow_exporter;
+  uint8_t *p;
+
+  if (fe->msg_len + IPFIX_RECORD_SIZE > FLOW_MSG_SIZE)
+    flow_export_flush ();
+  if (0 == fe->msg_len)
+  {
+    p = &fe->msg[IPFIX_HEADER_SIZE];
+    if (0 == fe->messages % FLOW_TEMPLATE_INTERVAL)
+    {
+      ipfix_put (&p, IPFIX_SET_TEMPLATE, 2);
+      ipfix_put (&p, 8 + 4 * IPFIX_NUM_FIELDS, 2);
+      ipfix_put (&p, IPFIX_TEMPLATE_ID, 2);
+      ipfix_put (&p, IPFIX_NUM_FIELDS, 2);
+      for (unsigned int i = 0; i < IPFIX_NUM_FIELDS; i++)
+      {
+        ipfix_put (&p, ipfix_fields[i].id, 2);
+        ipfix_put (&p, ipfix_fields[i].length, 2);
+      }
+    }
+    fe->set_start = p - fe->msg;
+    ipfix_put (&p, IPFIX_TEMPLATE_ID, 2);
+    ipfix_put (&p, 0, 2); /* set length, see flow_export_flush() */
+    fe->msg_len = p - fe->msg;
+    fe->opened = loop_now ();
+  }
+  p = &fe->msg[fe->msg_len];
+  ipfix_put (&p, ntohl (f->key.src), 4);
+  ipfix_put (&p, ntohl (f->key.dst), 4);
+  ipfix_put (&p, ntohs (f->key.sport), 2);
+  ipfix_put (&p, ntohs (f->key.dport), 2);
+  ipfix_put (&p, f->key.protocol, 1);
+  ipfix_put (&p, f->ingress, 4);
+  ipfix_put (&p, f->egress, 4);
+  ipfix_put (&p, f->packets, 8);
+  ipfix_put (&p, f->bytes, 8);
+  ipfix_put (&p, (f->first + fe->epoch) / 1000, 8);
+  ipfix_put (&p, (f->last + fe->epoch) / 1000, 8);
+  ipfix_put (&p, reason, 1);
+  ipfix_put (&p, flow_sampling, 4);
+  fe->msg_len = p - fe->msg;
+  fe->msg_records++;
+  flow_stats.records++;
+}
+
+
+/**
+ * Move flow @a idx to the tail of the LRU list.
+ *
+ * @param idx flow index
+ * @param linked is the flow currently on the list?
+ */
+static void
+flow_lru_touch (uint32_t idx,
+                bool linked)
+{
+  struct Flow *f = &flows[idx];
+
+  if (linked)
+  {
+    if (flow_lru_tail == idx + 1)
+      return;
+    if (0 != f->lru_prev)
+      flows[f->lru_prev - 1].lru_next = f->lru_next;
+    else
+      flow_lru_head = f->lru_next;
+    flows[f->lru_next - 1].lru_prev = f->lru_prev;
+  }
+  f->lru_next = 0;
+  f->lru_prev = flow_lru_tail;
+  if (0 != flow_lru_tail)
+    flows[flow_lru_tail - 1].lru_next = idx + 1;
+  else
+    flow_lru_head = idx + 1;
+  flow_lru_tail = idx + 1;
+}
+
+
+/**
+ * Report flow @a idx and release it.
+ *
+ * @param idx flow index
+ * @param reason why the flow ends, an IPFIX flowEndReason
+ */
+static void
+flow_release (uint32_t idx,
+              uint8_t reason)
+{
+  struct Flow *f = &flows[idx];
+  uint32_t *pos = &flow_hash[nat_hash (&f->key) & (FLOW_HASH_SIZE - 1)];
+
+  flow_export (f,
+               reason);
+  while (*pos != idx + 1)
+    pos = &flows[*pos - 1].hash_next;
+  *pos = f->hash_next;
+  if (0 != f->lru_prev)
+    flows[f->lru_prev - 1].lru_next = f->lru_next;
+  else
+    flow_lru_head = f->lru_next;
+  if (0 != f->lru_next)
+    flows[f->lru_next - 1].lru_prev = f->lru_prev;
+  else
+    flow_lru_tail = f->lru_prev;
+  f->ingress = 0;
+  f->hash_next = flow_free;
+  flow_free = idx + 1;
+  flow_active--;
+}
+
+
+/**
+ * Account an IPv4 packet in the flow cache.  With sampling, only every
+ * N-th packet gets past the first test.
+ *
+ * @param ingress interface the packet arrived on
+ * @param egress interface the packet is forwarded on
+ * @param ip IP header, after NAT
+ * @param payload IP packet payload
+ * @param payload_size number of bytes in @a payload
+ */
+static void
+flow_account (uint16_t ingress,
+              uint16_t egress,
+              const struct IPv4Header *ip,
+              const void *payload,
+              size_t payload_size)
+{
+  struct NatKey key;
+  struct Flow *f;
+  uint32_t *head;
+  uint32_t idx;
+  uint64_t now;
+
+  if ( (-1 == flow_exporter.fd) ||
+       (0 != --flow_countdown) )
+    return;
+  flow_countdown = flow_sampling;
+  flow_stats.sampled++;
+  /* fragments and unknown protocols are accounted without ports */
+  (void) nat_extract_key (ip,
+                          payload,
+                          payload_size,
+                          &key);
+  now = loop_now ();
+  head = &flow_hash[nat_hash (&key) & (FLOW_HASH_SIZE - 1)];
+  for (idx = *head; 0 != idx; idx = flows[idx - 1].hash_next)
+  {
+    f = &flows[idx - 1];
+    if ( (f->ingress == ingress) &&
+         (0 == memcmp (&f->key,
+                       &key,
+                       sizeof (key))) )
+      break;
+  }
+  if (0 != idx)
+  {
+    idx--;
+    if (now - f->first >= flow_active_timeout)
+    {
+      flow_export (f,
+                   IPFIX_END_ACTIVE);
+      f->packets = 0;
+      f->bytes = 0;
+      f->first = now;
+    }
+    flow_lru_touch (idx,
+                    true);
+  }
+  else
+  {
+    if (0 != flow_free)
+    {
+      idx = flow_free - 1;
+      flow_free = flows[idx].hash_next;
+    }
+    else if (flow_used < FLOW_MAX_FLOWS)
+    {
+      idx = flow_used++;
+    }
+    else
+    {
+      /* cache full: make room by reporting the least recent flow */
+      flow_stats.evicted++;
+      idx = flow_lru_head - 1;
+      flow_release (idx,
+                    IPFIX_END_RESOURCES);
+      flow_free = flows[idx].hash_next;
+    }
+    f = &flows[idx];
+    memset (f, 0, sizeof (*f));
+    f->key = key;
+    f->ingress = ingress;
+    f->first = now;
+    f->hash_next = *head;
+    *head = idx + 1;
+    flow_lru_touch (idx,
+                    false);
+    flow_active++;
+    flow_stats.created++;
+  }
+  f->egress = egress;
+  f->packets++;
+  f->bytes += sizeof (struct IPv4Header) + payload_size;
+  f->last = now;
+}
+
+
+/**
+ * Report and remove idle flows and write out the export message if it
+ * waited long enough.  Called at the end of each batch; asks loop() to
+ * wake us up for the next deadline.
+ */
+static void
+flow_expire (void)
+{
+  uint64_t now;
+
+  if (-1 == flow_exporter.fd)
+    return;
+  now = loop_now ();
+  while ( (0 != flow_lru_head) &&
+          (now - flows[flow_lru_head - 1].last >= flow_inactive_timeout) )
+    flow_release (flow_lru_head - 1,
+                  IPFIX_END_IDLE);
+  if ( (0 != flow_exporter.msg_len) &&
+       (now - flow_exporter.opened >= FLOW_EXPORT_DELAY) )
+    flow_export_flush ();
+  if (0 != flow_exporter.msg_len)
+    loop_wakeup_at (flow_exporter.opened + FLOW_EXPORT_DELAY);
+  if (0 != flow_lru_head)
+    loop_wakeup_at (flows[flow_lru_head - 1].last + flow_inactive_timeout);
+}
+
+
+/**
+ * Report all flows, write out the export message and stop exporting.
+ */
+static void
+flow_export_stop (void)
+{
+  if (-1 == flow_exporter.fd)
+    return;
+  while (0 != flow_lru_head)
+    flow_release (flow_lru_head - 1,
+                  IPFIX_END_FORCED);
+  flow_export_flush ();
+  close (flow_exporter.fd);
+  flow_exporter.fd = -1;
+  free (flow_exporter.target);
+  flow_exporter.target = NULL;
+}
+
+
+/**
+ * Start exporting flows to @a target, a file name or "unix:PATH" for a
+ * UNIX datagram socket.
+ *
+ * @param target where to export to
+ * @return 0 on success
+ */
+static int
+flow_export_start (const char *target)
+{
+  struct timespec ts;
+  int fd;
+
+  if (0 == strncmp (target,
+                    "unix:",
+                    strlen ("unix:")))
+  {
+    struct sockaddr_un sun;
+    const char *path = &target[strlen ("unix:")];
+
+    memset (&sun, 0, sizeof (sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen (path) >= sizeof (sun.sun_path))
+    {
+      fprintf (stderr,
+               "Socket path `%s' too long\n",
+               path);
+      return 1;
+    }
+    strcpy (sun.sun_path,
+            path);
+    /* never block the data plane on a slow collector */
+    fd = socket (AF_UNIX,
+                 SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                 0);
+    if ( (-1 != fd) &&
+         (0 != connect (fd,
+                        (const struct sockaddr *) &sun,
+                        sizeof (sun))) )
+    {
+      close (fd);
+      fd = -1;
+    }
+  }
+  else
+  {
+    fd = open (target,
+               O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+               0644);
+  }
+  if (-1 == fd)
+  {
+    fprintf (stderr,
+             "Failed to open `%s': %s\n",
+             target,
+             strerror (errno));
+    return 1;
+  }
+  if (NULL == flows)
+  {
+    flows = calloc (FLOW_MAX_FLOWS,
+                    sizeof (struct Flow));
+    flow_hash = calloc (FLOW_HASH_SIZE,
+                        sizeof (uint32_t));
+    if ( (NULL == flows) ||
+         (NULL == flow_hash) )
+      abort ();
+  }
+  flow_export_stop ();
+  clock_gettime (CLOCK_REALTIME,
+                 &ts);
+  flow_exporter.epoch = ts.tv_sec * 1000000LLU + ts.tv_nsec / 1000
+                        - loop_now ();
+  flow_exporter.fd = fd;
+  flow_exporter.target = strdup (target);
+  flow_exporter.messages = 0;
+  return 0;
+}
+
+
+/**
+ * Number of frames the capture ring holds.
+ */
+#define CAPTURE_SLOTS 4096
+
+/**
+ * Default and maximum number of bytes captured per frame.
+ */
+#define CAPTURE_SNAPLEN 128
+#define CAPTURE_MAX_SNAPLEN 1514
+
+/**
+ * pcapng block types, link type and options (draft-ietf-opsawg-pcapng).
+ */
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 1
+#define PCAPNG_EPB 6
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_LINKTYPE_ETHERNET 1
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_EPB_INBOUND 1
+#define PCAPNG_EPB_OUTBOUND 2
+
+
+/**
+ * A frame in the capture ring.
+ */
+struct CaptureRecord
+{
+  /**
+   * Wall clock time the frame was seen, in nanoseconds.
+   */
+  uint64_t timestamp;
+
+  /**
+   * Size of the frame on the wire.
+   */
+  uint32_t orig_len;
+
+  /**
+   * Bytes of the frame in @e data.
+   */
+  uint16_t caplen;
+
+  /**
+   * Interface the frame was received on or sent to.
+   */
+  uint16_t ifc_num;
+
+  /**
+   * Was the frame sent (rather than received)?
+   */
+  bool outbound;
+
+  /**
+   * The first @e caplen bytes of the frame.
+   */
+  uint8_t data[];
+};
+
+
+/**
+ * State of the packet capture.
+ */
+struct Capture
+{
+  /**
+   * #CAPTURE_SLOTS records of @e slot_size bytes each, NULL if no
+   * capture is running.
+   */
+  uint8_t *ring;
+
+  /**
+   * Size of a slot in @e ring.
+   */
+  size_t slot_size;
+
+  /**
+   * Number of frames captured; the next one goes into slot
+   * @e head % #CAPTURE_SLOTS.
+   */
+  uint64_t head;
+
+  /**
+   * Frames looked at.
+   */
+  uint64_t seen;
+
+  /**
+   * Bytes captured per frame.
+   */
+  uint16_t snaplen;
+
+  /**
+   * Only capture on this interface, 0 for all.
+   */
+  uint16_t ifc_num;
+
+  /**
+   * Only capture IPv4 to or from this address, if @e match_host.
+   */
+  struct in_addr host;
+  bool match_host;
+
+  /**
+   * Only capture this IP protocol, -1 for any.  #ETH_P_ARP and
+   * #ETH_P_IPV6 are matched as ethertypes (no IP protocol is that large).
+   */
+  int proto;
+
+  /**
+   * Only capture TCP/UDP with this source or destination port (host
+   * byte order), 0 for any.
+   */
+  uint16_t port;
+};
+
+
+/**
+ * The packet capture.
+ */
+static struct Capture capture;
+
+
+/**
+ * Number of bytes the capture writer writes at once.
+ */
+#define CAPTURE_WRITE_CHUNK 65536
+
+
+/**
+ * State of writing a stopped capture to its pcapng file.
+ */
+struct CaptureWriter
+{
+  /**
+   * Ring of the stopped capture, NULL if we are not writing.
+   */
+  uint8_t *ring;
+
+  /**
+   * File we write to.
+   */
+  char *filename;
+
+  /**
+   * Size of a slot in @e ring.
+   */
+  size_t slot_size;
+
+  /**
+   * First frame of the file, next frame to put into @e buf, and
+   * number of frames the capture had seen (see @e head of
+   * struct Capture).
+   */
+  uint64_t first;
+  uint64_t next;
+  uint64_t end;
+
+  /**
+   * Bytes of @e buf written and used.
+   */
+  size_t off;
+  size_t len;
+
+  /**
+   * File descriptor of @e filename, non-blocking.
+   */
+  int fd;
+
+  /**
+   * Bytes captured per frame.
+   */
+  uint16_t snaplen;
+
+  /**
+   * Did we ask loop() to tell us when @e fd is writable?
+   */
+  bool watching;
+
+  /**
+   * pcapng blocks for the next write.
+   */
+  uint8_t buf[CAPTURE_WRITE_CHUNK];
+};
+
+
+/**
+ * The capture writer.
+ */
+static struct CaptureWriter capture_writer;
+
+
+/**
+ * Check if the frame in @a r passes the capture filter.
+ *
+ * @param r captured frame
+ * @return true to keep the frame
+ */
+static bool
+capture_match (const struct CaptureRecord *r)
+{
+  const uint8_t *ip = &r->data[sizeof (struct EthernetHeader)];
+  uint16_t tag;
+  size_t ihl;
+
+  if ( (! capture.match_host) &&
+       (-1 == capture.proto) &&
+       (0 == capture.port) )
+    return true;
+  if (r->caplen < sizeof (struct EthernetHeader))
+    return false;
+  tag = (r->data[12] << 8) | r->data[13];
+  if ( (ETH_P_ARP == capture.proto) ||
+       (ETH_P_IPV6 == capture.proto) )
+    return tag == capture.proto;
+  if ( (ETH_P_IPV4 != tag) ||
+       (r->caplen < sizeof (struct EthernetHeader) + sizeof (struct IPv4Header)) )
+    return false;
+  if ( capture.match_host &&
+       (0 != memcmp (&ip[12], &capture.host, sizeof (struct in_addr))) &&
+       (0 != memcmp (&ip[16], &capture.host, sizeof (struct in_addr))) )
+    return false;
+  if ( (-1 != capture.proto) &&
+       (ip[9] != capture.proto) )
+    return false;
+  if (0 == capture.port)
+    return true;
+  ihl = (ip[0] & 0x0F) * 4;
+  if ( ( (IPPROTO_TCP != ip[9]) &&
+         (IPPROTO_UDP != ip[9]) ) ||
+       (r->caplen < sizeof (struct EthernetHeader) + ihl + 4) )
+    return false;
+  return ( (capture.port == ((ip[ihl] << 8) | ip[ihl + 1])) ||
+           (capture.port == ((ip[ihl + 2] << 8) | ip[ihl + 3])) );
+}
+
+
+/**
+ * Copy the start of a frame into the capture ring if it passes the
+ * filter.  The frame may be split into two parts; the parts are only
+ * copied up to the snap length.  Once the ring is full, the oldest
+ * frames are overwritten.
+ *
+ * @param ifc_num interface the frame was received on or sent to
+ * @param outbound true if the frame is being sent
+ * @param a first part of the frame
+ * @param a_size number of bytes in @a a
+ * @param b second part of the frame, may be NULL
+ * @param b_size number of bytes in @a b
+ */
+static void
+capture_frame (uint16_t ifc_num,
+               bool outbound,
+               const void *a,
+               size_t a_size,
+               const void *b,
+               size_t b_size)
+{
+  struct CaptureRecord *r;
+  struct timespec ts;
+  size_t len;
+
+  if ( (NULL == capture.ring) ||
+       ( (0 != capture.ifc_num) &&
+         (ifc_num != capture.ifc_num) ) )
+    return;
+  capture.seen++;
+  r = (struct CaptureRecord *) &capture.ring[(capture.head % CAPTURE_SLOTS)
+                                             * capture.slot_size];
+  len = (a_size < capture.snaplen) ? a_size : capture.snaplen;
+  memcpy (r->data,
+          a,
+          len);
+  if ( (len < capture.snaplen) &&
+       (NULL != b) )
+  {
+    size_t rest = capture.snaplen - len;
+
+    if (rest > b_size)
+      rest = b_size;
+    memcpy (&r->data[len],
+            b,
+            rest);
+    len += rest;
+  }
+  r->caplen = len;
+  if (! capture_match (r))
+    return;
+  clock_gettime (CLOCK_REALTIME,
+                 &ts);
+  r->timestamp = ts.tv_sec * 1000000000LLU + ts.tv_nsec;
+  r->orig_len = a_size + b_size;
+  r->ifc_num = ifc_num;
+  r->outbound = outbound;
+  capture.head++;
+}
+
+
+/**
+ * Append a pcapng block to the output buffer of the capture writer.
+ *
+ * @param type block type
+ * @param body block body, padded to a multiple of 4 bytes by us
+ * @param body_len number of bytes in @a body
+ */
+static void
+pcapng_put_block (uint32_t type,
+                  const void *body,
+                  size_t body_len)
+{
+  uint32_t total = 12 + ((body_len + 3) & ~3);
+  uint8_t *p = &capture_writer.buf[capture_writer.len];
+
+  memcpy (p, &type, sizeof (type));
+  memcpy (p + 4, &total, sizeof (total));
+  memcpy (p + 8, body, body_len);
+  memset (p + 8 + body_len, 0, total - 12 - body_len);
+  memcpy (p + total - 4, &total, sizeof (total));
+  capture_writer.len += total;
+}
+
+
+/**
+ * Append option @a code with @a value to the block body at @a p.
+ *
+ * @param[in,out] p where to write, advanced past the (padded) option
+ * @param code option code
+ * @param value option value, may be NULL if @a len is 0
+ * @param len number of bytes in @a value
+ */
+static void
+pcapng_put_option (uint8_t **p,
+                   uint16_t code,
+                   const void *value,
+                   uint16_t len)
+{
+  memcpy (*p, &code, sizeof (code));
+  memcpy (*p + 2, &len, sizeof (len));
+  if (0 != len)
+    memcpy (*p + 4, value, len);
+  memset (*p + 4 + len, 0, ((len + 3) & ~3) - len);
+  *p += 4 + ((len + 3) & ~3);
+}
+
+
+/**
+ * Put the section header and one interface description per router
+ * interface into the output buffer of the capture writer.
+ */
+static void
+capture_writer_header ()
+{
+  uint8_t body[32 + 64 + 16];
+  uint8_t *p;
+
+  {
+    uint32_t magic = PCAPNG_BYTE_ORDER_MAGIC;
+    uint16_t version[2] = { 1, 0 };
+    int64_t section_len = -1;
+
+    p = body;
+    memcpy (p, &magic, 4);
+    memcpy (p + 4, version, 4);
+    memcpy (p + 8, &section_len, 8);
+    pcapng_put_block (PCAPNG_SHB, body, 16);
+  }
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    uint16_t linktype = PCAPNG_LINKTYPE_ETHERNET;
+    uint16_t reserved = 0;
+    uint32_t snaplen = capture_writer.snaplen;
+    uint8_t tsresol = 9; /* 10^-9 s */
+    size_t name_len = strlen (gifc[i].name);
+
+    p = body;
+    memcpy (p, &linktype, 2);
+    memcpy (p + 2, &reserved, 2);
+    memcpy (p + 4, &snaplen, 4);
+    p += 8;
+    pcapng_put_option (&p, PCAPNG_OPT_IF_NAME, gifc[i].name,
+                       (name_len > 64) ? 64 : name_len);
+    pcapng_put_option (&p, PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+    pcapng_put_option (&p, PCAPNG_OPT_END, NULL, 0);
+    pcapng_put_block (PCAPNG_IDB, body, p - body);
+  }
+}
+
+
+/**
+ * Put the next captured frames, oldest first, into the output buffer
+ * of the capture writer, as many as fit.
+ */
+static void
+capture_writer_fill ()
+{
+  uint8_t body[32 + CAPTURE_MAX_SNAPLEN + 16];
+
+  while ( (capture_writer.next < capture_writer.end) &&
+          (capture_writer.len + 12 + sizeof (body)
+           <= sizeof (capture_writer.buf)) )
+  {
+    const struct CaptureRecord *r
+      = (const struct CaptureRecord *) &capture_writer.ring[
+      (capture_writer.next % CAPTURE_SLOTS) * capture_writer.slot_size];
+    uint32_t hdr[5] = {
+      r->ifc_num - 1,
+      (uint32_t) (r->timestamp >> 32),
+      (uint32_t) r->timestamp,
+      r->caplen,
+      r->orig_len
+    };
+    uint32_t flags = r->outbound ? PCAPNG_EPB_OUTBOUND : PCAPNG_EPB_INBOUND;
+    uint8_t *p;
+
+    p = body;
+    memcpy (p, hdr, sizeof (hdr));
+    p += sizeof (hdr);
+    memcpy (p, r->data, r->caplen);
+    memset (p + r->caplen, 0, ((r->caplen + 3) & ~3) - r->caplen);
+    p += (r->caplen + 3) & ~3;
+    pcapng_put_option (&p, PCAPNG_OPT_EPB_FLAGS, &flags, sizeof (flags));
+    pcapng_put_option (&p, PCAPNG_OPT_END, NULL, 0);
+    pcapng_put_block (PCAPNG_EPB, body, p - body);
+    capture_writer.next++;
+  }
+}
+
+
+/**
+ * Close the file of the capture writer and release the ring.
+ *
+ * @param ok did we write the whole file?
+ */
+static void
+capture_writer_finish (bool ok)
+{
+  if (capture_writer.watching)
+    loop_remove_fd (capture_writer.fd);
+  if ( (0 != close (capture_writer.fd)) ||
+       (! ok) )
+    fprintf (stderr,
+             "Failed to write `%s'\n",
+             capture_writer.filename);
+  else
+    print ("Capture written to `%s', %llu frames\n",
+           capture_writer.filename,
+           (unsigned long long) (capture_writer.end - capture_writer.first));
+  free (capture_writer.ring);
+  free (capture_writer.filename);
+  capture_writer.ring = NULL;
+  capture_writer.filename = NULL;
+}
+
+
+static void
+capture_writer_run (void *cls);
+
+
+/**
+ * The file of the capture writer (a pipe or socket) can take more
+ * data.
+ *
+ * @param fd the file descriptor
+ * @param events epoll events that occurred
+ * @param cls NULL
+ */
+static void
+capture_writer_ready (int fd,
+                      uint32_t events,
+                      void *cls)
+{
+  (void) fd;
+  (void) events;
+  capture_writer_run (cls);
+}
+
+
+/**
+ * Write one buffer of the capture file.  Runs as deferred work, so
+ * every call costs the forwarding path at most one write of
+ * #CAPTURE_WRITE_CHUNK bytes; if the file is a pipe or socket that
+ * is full, we continue once loop() reports it writable.
+ *
+ * @param cls NULL
+ */
+static void
+capture_writer_run (void *cls)
+{
+  ssize_t ret;
+
+  if (capture_writer.off == capture_writer.len)
+  {
+    capture_writer.off = 0;
+    capture_writer.len = 0;
+    capture_writer_fill ();
+    if (0 == capture_writer.len)
+    {
+      capture_writer_finish (true);
+      return;
+    }
+  }
+  ret = write (capture_writer.fd,
+               &capture_writer.buf[capture_writer.off],
+               capture_writer.len - capture_writer.off);
+  if (ret > 0)
+  {
+    capture_writer.off += ret;
+  }
+  else if ( (-1 == ret) &&
+            ( (EAGAIN == errno) ||
+              (EINTR == errno) ) )
+  {
+    if ( (! capture_writer.watching) &&
+         (0 == loop_add_fd (capture_writer.fd,
+                            EPOLLOUT,
+                            &capture_writer_ready,
+                            cls)) )
+    {
+      capture_writer.watching = true;
+      return;
+    }
+  }
+  else
+  {
+    capture_writer_finish (false);
+    return;
+  }
+  if (! capture_writer.watching)
+    loop_defer (&capture_writer_run,
+                cls);
+}
+
+
+/**
+ * Hand the captured frames to the capture writer, which writes them
+ * to @a filename as pcapng with nanosecond timestamps and one
+ * interface per router interface.  Only the file is opened here;
+ * see capture_writer_run() for the writing.
+ *
+ * @param filename file to create
+ * @return 0 on success
+ */
+static int
+capture_write (const char *filename)
+{
+  int fd;
+
+  fd = open (filename,
+             O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK | O_CLOEXEC,
+             0644);
+  if (-1 == fd)
+  {
+    fprintf (stderr,
+             "Failed to open `%s': %s\n",
+             filename,
+             strerror (errno));
+    return 1;
+  }
+  capture_writer.fd = fd;
+  capture_writer.watching = false;
+  capture_writer.filename = strdup (filename);
+  capture_writer.ring = capture.ring;
+  capture_writer.slot_size = capture.slot_size;
+  capture_writer.snaplen = capture.snaplen;
+  capture_writer.first = (capture.head > CAPTURE_SLOTS)
+                         ? capture.head - CAPTURE_SLOTS
+                         : 0;
+  capture_writer.next = capture_writer.first;
+  capture_writer.end = capture.head;
+  capture_writer.off = 0;
+  capture_writer.len = 0;
+  capture_writer_header ();
+  loop_defer (&capture_writer_run,
+              NULL);
+  return 0;
+}
+
+
+
+/**
+ * Number of egress traffic classes per interface.
+ */
+#define EGRESS_NUM_CLASSES 4
+
+/**
+ * Strict priority class: expedited forwarding, network control and
+ * all non-IP frames (ARP).
+ */
+#define EGRESS_CLASS_PRIORITY 0
+
+/**
+ * DRR classes, see #egress_dscp_class.
+ */
+#define EGRESS_CLASS_HIGH 1
+#define EGRESS_CLASS_NORMAL 2
+#define EGRESS_CLASS_BULK 3
+
+/**
+ * Bytes a DRR class may send per round and unit of weight.
+ */
+#define EGRESS_QUANTUM 1514
+
+/**
+ * Default limit (in bytes) of the queue of one class.
+ */
+#define EGRESS_DEFAULT_LIMIT (1024 * 1024)
+
+
+/**
+ * Names of the traffic classes (for the "qos" command).
+ */
+static const char *egress_class_names[EGRESS_NUM_CLASSES] = {
+  "priority",
+  "high",
+  "normal",
+  "bulk"
+};
+
+
+/**
+ * Map from DSCP (upper six bits of the IPv4 diff_serv field) to
+ * traffic class: EF, VOICE-ADMIT, CS5-CS7 are strict priority,
+ * AF3x/AF4x and CS3/CS4 high, CS1 and LE bulk, everything else normal.
+ */
+static const uint8_t egress_dscp_class[64] = {
+  /* 0-7: CS0, LE */
+  EGRESS_CLASS_NORMAL, EGRESS_CLASS_BULK, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL,
+  EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL,
+  /* 8-15: CS1, AF1x */
+  EGRESS_CLASS_BULK, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL,
+  EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL,
+  /* 16-23: CS2, AF2x */
+  EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL,
+  EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL,
+  /* 24-31: CS3, AF3x */
+  EGRESS_CLASS_HIGH, EGRESS_CLASS_NORMAL, EGRESS_CLASS_HIGH, EGRESS_CLASS_NORMAL,
+  EGRESS_CLASS_HIGH, EGRESS_CLASS_NORMAL, EGRESS_CLASS_HIGH, EGRESS_CLASS_NORMAL,
+  /* 32-39: CS4, AF4x */
+  EGRESS_CLASS_HIGH, EGRESS_CLASS_NORMAL, EGRESS_CLASS_HIGH, EGRESS_CLASS_NORMAL,
+  EGRESS_CLASS_HIGH, EGRESS_CLASS_NORMAL, EGRESS_CLASS_HIGH, EGRESS_CLASS_NORMAL,
+  /* 40-47: CS5, VOICE-ADMIT, EF */
+  EGRESS_CLASS_PRIORITY, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL,
+  EGRESS_CLASS_PRIORITY, EGRESS_CLASS_NORMAL, EGRESS_CLASS_PRIORITY, EGRESS_CLASS_NORMAL,
+  /* 48-55: CS6 */
+  EGRESS_CLASS_PRIORITY, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL,
+  EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL,
+  /* 56-63: CS7 */
+  EGRESS_CLASS_PRIORITY, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL,
+  EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL, EGRESS_CLASS_NORMAL
+};
+
+
+/**
+ * Default CoDel target sojourn time (us).
+ */
+#define CODEL_DEFAULT_TARGET 5000
+
+/**
+ * Default CoDel interval (us).
+ */
+#define CODEL_DEFAULT_INTERVAL 100000
+
+/**
+ * Number of buckets of a #Histogram.
+ */
+#define HISTOGRAM_BUCKETS 32
+
+
+/**
+ * Histogram with power-of-two buckets: bucket 0 counts the value 0,
+ * bucket i > 0 counts values in [2^(i-1), 2^i).
+ */
+struct Histogram
+{
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+
+/**
+ * Add @a value to @a h.
+ *
+ * @param h histogram to update
+ * @param value value to add
+ */
+static void
+histogram_add (struct Histogram *h,
+               uint64_t value)
+{
+  unsigned int b = (0 == value) ? 0 : 64 - __builtin_clzll (value);
+
+  if (b >= HISTOGRAM_BUCKETS)
+    b = HISTOGRAM_BUCKETS - 1;
+  h->buckets[b]++;
+}
+
+
+#ifndef PERF_STAGES
+/**
+ * Set to 0 (e.g. with -DPERF_STAGES=0) to compile out the per-stage
+ * timing of the forwarding path.
+ */
+#define PERF_STAGES 1
+#endif
+
+/**
+ * log2 of the number of sub-buckets per power of two of a
+ * #PerfHistogram; 3 bits keep the relative error below 12.5%.
+ */
+#define PERF_SUB_BITS 3
+
+/**
+ * Number of sub-buckets per power of two.
+ */
+#define PERF_SUB_BUCKETS (1 << PERF_SUB_BITS)
+
+/**
+ * Number of buckets of a #PerfHistogram, enough for any 64-bit value.
+ */
+#define PERF_BUCKETS ((64 - PERF_SUB_BITS + 1) << PERF_SUB_BITS)
+
+
+/**
+ * Stages of the forwarding path.  Each stage is charged the time since
+ * the end of the previous one, so the stages of a frame add up to the
+ * time it spent in the router.
+ */
+enum PerfStage
+{
+  /**
+   * From receiving the frame up to route(): parsing, ingress policing
+   * and ACL.
+   */
+  PERF_PARSE = 0,
+
+  /**
+   * FIB lookup.
+   */
+  PERF_LOOKUP,
+
+  /**
+   * Route type handling, flow accounting and the ARP cache lookup.
+   */
+  PERF_ARP,
+
+  /**
+   * Egress ACL, NAT, TTL and checksum update, building the frame and
+   * queueing it.
+   */
+  PERF_REWRITE,
+
+  /**
+   * As #PERF_REWRITE, for frames that need fragmentation.
+   */
+  PERF_FRAGMENT,
+
+  /**
+   * Writing a frame to the parent (measured separately, at the end of
+   * the batch).
+   */
+  PERF_WRITE,
+
+  PERF_NUM_STAGES
+};
+
+
+/**
+ * Names of the stages (for the "perf" command).
+ */
+static const char *perf_stage_names[PERF_NUM_STAGES] = {
+  "parse",
+  "lookup",
+  "arp",
+  "rewrite",
+  "fragment",
+  "write"
+};
+
+
+/**
+ * Histogram with logarithmic buckets, each power of two split into
+ * #PERF_SUB_BUCKETS linear sub-buckets (as in HdrHistogram).
+ */
+struct PerfHistogram
+{
+  uint64_t buckets[PERF_BUCKETS];
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+};
+
+
+/**
+ * Per-stage timing state.
+ */
+struct Perf
+{
+  /**
+   * Histograms of the time spent in each stage.
+   */
+  struct PerfHistogram stages[PERF_NUM_STAGES];
+
+  /**
+   * End of the last stage of the current frame (see perf_clock()).
+   */
+  uint64_t lap;
+
+  /**
+   * Is timing enabled (by the "perf" command)?
+   */
+  bool enabled;
+};
+
+
+/**
+ * Per-stage timing state.
+ */
+static struct Perf perf;
+
+
+/**
+ * Read the clock used for timing stages: the time stamp counter where
+ * we have one, otherwise the monotonic clock.
+ *
+ * @return current time in cycles or nanoseconds
+ */
+static inline uint64_t
+perf_clock (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc ();
+#else
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC,
+                 &ts);
+  return ts.tv_sec * 1000000000LLU + ts.tv_nsec;
+#endif
+}
+
+
+/**
+ * Get the bucket of @a value.
+ *
+ * @param value value to classify
+ * @return index into @e buckets of a #PerfHistogram
+ */
+static unsigned int
+perf_bucket (uint64_t value)
+{
+  unsigned int msb;
+
+  if (value < PERF_SUB_BUCKETS)
+    return value;
+  msb = 63 - __builtin_clzll (value);
+  return ((msb - PERF_SUB_BITS + 1) << PERF_SUB_BITS)
+         + ((value >> (msb - PERF_SUB_BITS)) & (PERF_SUB_BUCKETS - 1));
+}
+
+
+/**
+ * Get the largest value that falls into bucket @a b.
+ *
+ * @param b bucket index
+ * @return upper bound of the bucket
+ */
+static uint64_t
+perf_bucket_max (unsigned int b)
+{
+  unsigned int shift;
+
+  if (b < 2 * PERF_SUB_BUCKETS)
+    return b;
+  shift = (b >> PERF_SUB_BITS) - 1;
+  return (((uint64_t) (PERF_SUB_BUCKETS + (b & (PERF_SUB_BUCKETS - 1))) + 1)
+          << shift) - 1;
+}
+
+
+/**
+ * Add @a value to the histogram of @a stage.
+ *
+ * @param stage stage @a value was measured for
+ * @param value time spent in @a stage
+ */
+static void
+perf_record (enum PerfStage stage,
+             uint64_t value)
+{
+  struct PerfHistogram *h = &perf.stages[stage];
+
+  h->buckets[perf_bucket (value)]++;
+  if ( (0 == h->count) ||
+       (value < h->min) )
+    h->min = value;
+  if (value > h->max)
+    h->max = value;
+  h->count++;
+  h->sum += value;
+}
+
+
+/**
+ * Start timing a frame.
+ */
+static inline void
+perf_begin (void)
+{
+  if ( (! PERF_STAGES) ||
+       (! perf.enabled) )
+    return;
+  perf.lap = perf_clock ();
+}
+
+
+/**
+ * End @a stage of the current frame.
+ *
+ * @param stage stage that just ended
+ */
+static inline void
+perf_lap (enum PerfStage stage)
+{
+  uint64_t now;
+
+  if ( (! PERF_STAGES) ||
+       (! perf.enabled) )
+    return;
+  now = perf_clock ();
+  perf_record (stage,
+               now - perf.lap);
+  perf.lap = now;
+}
+
+
+/**
+ * Magic number at the start of the shared-memory export ("GLRT").
+ */
+#define SHM_MAGIC 0x474c5254
+
+/**
+ * Version of the shared-memory layout.  Bumped on incompatible changes;
+ * readers must check it.
+ */
+#define SHM_VERSION 1
+
+/**
+ * Number of bytes reserved for a metric name in the export.
+ */
+#define SHM_METRIC_NAME 48
+
+/**
+ * Default minimum time between two publications, in microseconds.
+ */
+#define SHM_INTERVAL 100000
+
+
+/**
+ * Header of the shared-memory export.  The segment holds this header
+ * followed by the route, ARP and metric arrays at the given offsets.
+ * All integers are in host byte order, addresses in network byte order.
+ *
+ * The router is the only writer.  Readers map the segment read-only
+ * and use @e seq as a seqlock: read @e seq, retry if it is odd, copy
+ * what they need, then re-read @e seq and retry if it changed.
+ */
+struct ShmHeader
+{
+  /**
+   * #SHM_MAGIC.
+   */
+  uint32_t magic;
+
+  /**
+   * #SHM_VERSION.
+   */
+  uint16_t version;
+
+  /**
+   * Size of this header.
+   */
+  uint16_t header_size;
+
+  /**
+   * Sequence counter, odd while the router is updating the segment.
+   */
+  uint64_t seq;
+
+  /**
+   * Monotonic time of the last update, in microseconds.
+   */
+  uint64_t updated;
+
+  /**
+   * Offset, number of valid entries, entry size and capacity of the
+   * route array (`struct ShmRoute`).
+   */
+  uint32_t route_offset;
+  uint32_t route_count;
+  uint32_t route_size;
+  uint32_t route_max;
+
+  /**
+   * Offset, number of valid entries, entry size and capacity of the
+   * ARP array (`struct ShmArp`).
+   */
+  uint32_t arp_offset;
+  uint32_t arp_count;
+  uint32_t arp_size;
+  uint32_t arp_max;
+
+  /**
+   * Offset, number of valid entries, entry size and capacity of the
+   * metric array (`struct ShmMetric`).
+   */
+  uint32_t metric_offset;
+  uint32_t metric_count;
+  uint32_t metric_size;
+  uint32_t metric_max;
+};
+
+
+/**
+ * A route in the shared-memory export.
+ */
+struct ShmRoute
+{
+  struct in_addr network;
+  struct in_addr netmask;
+  struct in_addr next_hop;
+
+  /**
+   * Outgoing interface.
+   */
+  uint16_t ifc_num;
+
+  /**
+   * A `enum RouteType`.
+   */
+  uint8_t type;
+
+  uint8_t reserved;
+  uint64_t packets;
+  uint64_t bytes;
+};
+
+
+/**
+ * An ARP cache entry in the shared-memory export.
+ */
+struct ShmArp
+{
+  struct in_addr ip;
+  uint16_t ifc_num;
+  struct MacAddress mac;
+};
+
+
+/**
+ * A metric in the shared-memory export.
+ */
+struct ShmMetric
+{
+  /**
+   * 0-terminated name, see metrics_name().
+   */
+  char name[SHM_METRIC_NAME];
+
+  uint64_t value;
+};
+
+
+/**
+ * State of the shared-memory export.
+ */
+struct ShmExport
+{
+  /**
+   * The mapped segment, NULL if we do not export.
+   */
+  struct ShmHeader *hdr;
+
+  /**
+   * Size of the segment.
+   */
+  size_t size;
+
+  /**
+   * File descriptor of the segment.
+   */
+  int fd;
+
+  /**
+   * Name given to shm_open(), NULL for a memfd.
+   */
+  char *name;
+
+  /**
+   * Minimum time between two publications.
+   */
+  uint64_t interval;
+
+  /**
+   * Earliest time of the next publication.
+   */
+  uint64_t next;
+
+  /**
+   * Number of publications.
+   */
+  uint64_t publications;
+};
+
+
+/**
+ * The shared-memory export.
+ */
+static struct ShmExport shm = {
+  .fd = -1,
+  .interval = SHM_INTERVAL
+};
+
+
+/**
+ * Copy the FIB, the ARP cache and the metrics into the segment.
+ */
+static void
+shm_publish (void)
+{
+  struct ShmHeader *h = shm.hdr;
+  struct ShmRoute *sr = (struct ShmRoute *) ((char *) h + h->route_offset);
+  struct ShmArp *sa = (struct ShmArp *) ((char *) h + h->arp_offset);
+  struct ShmMetric *sm = (struct ShmMetric *) ((char *) h + h->metric_offset);
+  uint64_t seq = h->seq;
+  unsigned int n;
+
+  __atomic_store_n (&h->seq,
+                    seq + 1,
+                    __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  for (int i = 0; i < routingTableIndex; i++)
+  {
+    sr[i].network = routingTable[i].target_network;
+    sr[i].netmask = routingTable[i].netmask;
+    sr[i].next_hop = routingTable[i].nextHop;
+    sr[i].ifc_num = routingTable[i].interface.ifc_num;
+    sr[i].type = routingTable[i].type;
+    sr[i].packets = routeCounters[i].packets;
+    sr[i].bytes = routeCounters[i].bytes;
+  }
+  h->route_count = routingTableIndex;
+  n = 0;
+  for (int i = 0; i < MAX_ENTRIES; i++)
+  {
+    if (0 == table[i].ip.s_addr)
+      continue;
+    sa[n].ip = table[i].ip;
+    sa[n].ifc_num = table[i].ifc_num;
+    sa[n].mac = table[i].mac;
+    n++;
+  }
+  h->arp_count = n;
+  for (n = 0; n < h->metric_max; n++)
+    sm[n].value = metrics_get (n);
+  h->metric_count = n;
+  h->updated = loop_now ();
+  __atomic_store_n (&h->seq,
+                    seq + 2,
+                    __ATOMIC_RELEASE);
+  shm.publications++;
+}
+
+
+/**
+ * Publish the tables if the export is on and the last publication is
+ * at least one interval old; otherwise make sure loop() wakes us up
+ * for the next one.  Called at the end of each batch.
+ */
+static void
+shm_update (void)
+{
+  uint64_t now = loop_now ();
+
+  if (NULL == shm.hdr)
+    return;
+  if (now < shm.next)
+  {
+    loop_wakeup_at (shm.next);
+    return;
+  }
+  shm_publish ();
+  shm.next = now + shm.interval;
+}
+
+
+/**
+ * Stop the shared-memory export, removing the segment's name.
+ */
+static void
+shm_stop (void)
+{
+  if (NULL == shm.hdr)
+    return;
+  munmap (shm.hdr,
+          shm.size);
+  close (shm.fd);
+  if (NULL != shm.name)
+    shm_unlink (shm.name);
+  free (shm.name);
+  shm.hdr = NULL;
+  shm.fd = -1;
+  shm.name = NULL;
+}
+
+
+/**
+ * Start exporting the tables to a shared-memory segment.
+ *
+ * @param name name for shm_open() (without the leading '/'), or "memfd"
+ *        for an anonymous memfd readers open via /proc/PID/fd/FD
+ * @return 0 on success
+ */
+static int
+shm_start (const char *name)
+{
+  struct ShmHeader *h;
+  unsigned int num_metrics = metrics_num ();
+  char *shm_name = NULL;
+  size_t size;
+  int fd;
+
+  size = sizeof (struct ShmHeader)
+         + MAX_ENTRIES * sizeof (struct ShmRoute)
+         + MAX_ENTRIES * sizeof (struct ShmArp)
+         + num_metrics * sizeof (struct ShmMetric);
+  if (0 == strcasecmp ("memfd",
+                       name))
+  {
+    fd = memfd_create ("glab-router",
+                       MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  }
+  else
+  {
+    if (-1 == asprintf (&shm_name,
+                        "/%s",
+                        name))
+      abort ();
+    fd = shm_open (shm_name,
+                   O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644);
+  }
+  if ( (-1 == fd) ||
+       (0 != ftruncate (fd,
+                        size)) )
+  {
+    fprintf (stderr,
+             "Failed to create segment `%s': %s\n",
+             name,
+             strerror (errno));
+    if (-1 != fd)
+      close (fd);
+    if (NULL != shm_name)
+      shm_unlink (shm_name);
+    free (shm_name);
+    return 1;
+  }
+  /* memfd readers may rely on the size never changing */
+  if (NULL == shm_name)
+    (void) fcntl (fd,
+                  F_ADD_SEALS,
+                  F_SEAL_SHRINK | F_SEAL_GROW);
+  h = mmap (NULL,
+            size,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED,
+            fd,
+            0);
+  if (MAP_FAILED == h)
+  {
+    fprintf (stderr,
+             "Failed to map segment `%s': %s\n",
+             name,
+             strerror (errno));
+    close (fd);
+    if (NULL != shm_name)
+      shm_unlink (shm_name);
+    free (shm_name);
+    return 1;
+  }
+  shm_stop ();
+  h->magic = SHM_MAGIC;
+  h->version = SHM_VERSION;
+  h->header_size = sizeof (*h);
+  h->route_offset = sizeof (*h);
+  h->route_size = sizeof (struct ShmRoute);
+  h->route_max = MAX_ENTRIES;
+  h->arp_offset = h->route_offset + MAX_ENTRIES * sizeof (struct ShmRoute);
+  h->arp_size = sizeof (struct ShmArp);
+  h->arp_max = MAX_ENTRIES;
+  h->metric_offset = h->arp_offset + MAX_ENTRIES * sizeof (struct ShmArp);
+  h->metric_size = sizeof (struct ShmMetric);
+  h->metric_max = num_metrics;
+  for (unsigned int i = 0; i < num_metrics; i++)
+  {
+    struct ShmMetric *sm = (struct ShmMetric *) ((char *) h
+                                                 + h->metric_offset);
+
+    /* names never change, write them once */
+    strncpy (sm[i].name,
+             metrics_name (i),
+             sizeof (sm[i].name) - 1);
+  }
+  shm.hdr = h;
+  shm.size = size;
+  shm.fd = fd;
+  shm.name = shm_name;
+  shm.next = 0;
+  shm_publish ();
+  return 0;
+}
+
+
+/**
+ * Scale factor of #TokenBucket tokens: one byte is worth this many
+ * tokens, so that one microsecond at one byte/s refills one token.
+ */
+#define TB_SCALE 1000000LLU
+
+
+/**
+ * Token bucket used for policing and shaping.
+ */
+struct TokenBucket
+{
+  /**
+   * Rate in bytes per second, 0 if the bucket is disabled.
+   */
+  uint64_t rate;
+
+  /**
+   * Bucket depth in bytes.
+   */
+  uint64_t burst;
+
+  /**
+   * Current fill level, in bytes times #TB_SCALE.
+   */
+  uint64_t tokens;
+
+  /**
+   * Time of the last refill (us).
+   */
+  uint64_t last;
+
+  /**
+   * Statistics: traffic within the rate, and traffic that exceeded it
+   * (dropped by a policer, held back by a shaper).
+   */
+  uint64_t conform_packets;
+  uint64_t conform_bytes;
+  uint64_t exceed_packets;
+  uint64_t exceed_bytes;
+};
+
+
+/**
+ * (Re)configure @a tb, starting with a full bucket.
+ *
+ * @param tb bucket to configure
+ * @param rate rate in bytes per second, 0 to disable
+ * @param burst depth in bytes
+ * @param now current time
+ */
+static void
+tb_configure (struct TokenBucket *tb,
+              uint64_t rate,
+              uint64_t burst,
+              uint64_t now)
+{
+  tb->rate = rate;
+  tb->burst = burst;
+  tb->tokens = burst * TB_SCALE;
+  tb->last = now;
+}
+
+
+/**
+ * Number of bytes a frame of @a size needs from @a tb.  Frames larger
+ * than the bucket need a full bucket.
+ *
+ * @param tb bucket
+ * @param size frame size in bytes
+ * @return tokens needed
+ */
+static uint64_t
+tb_need (const struct TokenBucket *tb,
+         size_t size)
+{
+  return ((size < tb->burst) ? size : tb->burst) * TB_SCALE;
+}
+
+
+/**
+ * Refill @a tb and check whether a frame of @a size fits.
+ *
+ * @param tb bucket to check
+ * @param size frame size in bytes
+ * @param now current time
+ * @return true if the frame conforms (always if @a tb is disabled)
+ */
+static bool
+tb_ready (struct TokenBucket *tb,
+          size_t size,
+          uint64_t now)
+{
+  uint64_t room;
+
+  if (0 == tb->rate)
+    return true;
+  if (now > tb->last)
+  {
+    room = tb->burst * TB_SCALE - tb->tokens;
+    if (now - tb->last >= room / tb->rate)
+      tb->tokens = tb->burst * TB_SCALE;
+    else
+      tb->tokens += (now - tb->last) * tb->rate;
+    tb->last = now;
+  }
+  return tb->tokens >= tb_need (tb, size);
+}
+
+
+/**
+ * Take the tokens for a conforming frame of @a size from @a tb.
+ * Must follow a successful tb_ready().
+ *
+ * @param tb bucket to update
+ * @param size frame size in bytes
+ */
+static void
+tb_consume (struct TokenBucket *tb,
+            size_t size)
+{
+  tb->conform_packets++;
+  tb->conform_bytes += size;
+  if (0 == tb->rate)
+    return;
+  if (tb->tokens > tb_need (tb, size))
+    tb->tokens -= tb_need (tb, size);
+  else
+    tb->tokens = 0;
+}
+
+
+/**
+ * Record that a frame of @a size exceeded @a tb.
+ *
+ * @param tb bucket to update
+ * @param size frame size in bytes
+ */
+static void
+tb_exceed (struct TokenBucket *tb,
+           size_t size)
+{
+  tb->exceed_packets++;
+  tb->exceed_bytes += size;
+}
+
+
+/**
+ * How long until a frame of @a size fits into @a tb?
+ * Only valid after tb_ready() returned false.
+ *
+ * @param tb bucket to check
+ * @param size frame size in bytes
+ * @return delay in microseconds
+ */
+static uint64_t
+tb_delay (const struct TokenBucket *tb,
+          size_t size)
+{
+  return (tb_need (tb, size) - tb->tokens + tb->rate - 1) / tb->rate;
+}
+
+
+/**
+ * Ingress policers of one interface.
+ */
+struct Policer
+{
+  /**
+   * Per traffic class policers.
+   */
+  struct TokenBucket classes[EGRESS_NUM_CLASSES];
+
+  /**
+   * Policer for all IPv4 traffic of the interface.
+   */
+  struct TokenBucket total;
+};
+
+
+/**
+ * CoDel configuration of an interface.
+ */
+struct CodelParams
+{
+  /**
+   * Is CoDel enabled?
+   */
+  bool enabled;
+
+  /**
+   * Mark ECN-capable packets instead of dropping them?
+   */
+  bool ecn;
+
+  /**
+   * Acceptable standing queue delay (us).
+   */
+  uint64_t target;
+
+  /**
+   * Sliding window over which the minimum delay is tracked (us).
+   */
+  uint64_t interval;
+};
+
+
+/**
+ * CoDel state of one queue (see RFC 8289).
+ */
+struct CodelState
+{
+  /**
+   * Time when the sojourn time first stayed above target, 0 if below.
+   */
+  uint64_t first_above_time;
+
+  /**
+   * Time of the next drop while in dropping state.
+   */
+  uint64_t drop_next;
+
+  /**
+   * Drops since entering the dropping state, and its value when
+   * we last left the dropping state.
+   */
+  uint32_t count;
+  uint32_t lastcount;
+
+  /**
+   * Are we in the dropping state?
+   */
+  bool dropping;
+};
+
+
+/**
+ * Reference-counted packet shared by several frames, for example the
+ * copies of a multicast packet that only differ in their Ethernet
+ * header.
+ */
+struct SharedPacket
+{
+  /**
+   * Number of frames referencing the packet.
+   */
+  unsigned int refcount;
+
+  /**
+   * Number of bytes in @e data.
+   */
+  size_t size;
+
+  /**
+   * The packet.
+   */
+  uint8_t data[];
+};
+
+
+/**
+ * A frame waiting in an egress queue.
+ */
+struct QueuedFrame
+{
+  /**
+   * Next frame in the queue.
+   */
+  struct QueuedFrame *next;
+
+  /**
+   * Time the frame was enqueued (see egress_clock()).
+   */
+  uint64_t enqueued;
+
+  /**
+   * Did the shaper of the traffic class already count the frame as
+   * exceeding?  See egress_shaped().
+   */
+  bool class_exceeded;
+
+  /**
+   * Did the shaper of the interface already count the frame as
+   * exceeding?
+   */
+  bool ifc_exceeded;
+
+  /**
+   * Number of bytes of the message: the bytes at @e offset followed
+   * by those of @e shared.
+   */
+  size_t size;
+
+  /**
+   * Tail of the message shared with other frames, NULL if the whole
+   * message is at @e offset.
+   */
+  struct SharedPacket *shared;
+
+  /**
+   * Offset of the message in @e msg; the bytes before it are
+   * headroom for headers pushed with frame_push().
+   */
+  size_t offset;
+
+  /**
+   * GLAB message (header followed by the frame), after headroom.
+   */
+  char msg[];
+};
+
+
+/**
+ * Headroom reserved in front of frames we build, enough for the GLAB
+ * header, an Ethernet header, an outer IPv4 and GRE header (tunnels)
+ * and an MPLS label, so that none of them requires copying the packet.
+ */
+#define FRAME_HEADROOM 64
+
+
+/**
+ * Allocate a frame buffer for @a size bytes of data preceded by
+ * #FRAME_HEADROOM bytes of headroom.
+ *
+ * @param size number of bytes of data
+ * @return the buffer, data starts at frame_data()
+ */
+static struct QueuedFrame *
+frame_alloc (size_t size)
+{
+  struct QueuedFrame *qf;
+
+  qf = malloc (sizeof (struct QueuedFrame) + FRAME_HEADROOM + size);
+  if (NULL == qf)
+    abort ();
+  qf->next = NULL;
+  qf->class_exceeded = false;
+  qf->ifc_exceeded = false;
+  qf->size = size;
+  qf->shared = NULL;
+  qf->offset = FRAME_HEADROOM;
+  return qf;
+}
+
+
+
+/**
+ * Get the start of the data in @a qf.
+ *
+ * @param qf frame buffer
+ * @return first byte of data
+ */
+static void *
+frame_data (struct QueuedFrame *qf)
+{
+  return &qf->msg[qf->offset];
+}
+
+
+/**
+ * Prepend @a len bytes to the data of @a qf, using headroom.
+ *
+ * @param qf frame buffer
+ * @param len number of bytes to prepend
+ * @return new start of the data, to be filled by the caller
+ */
+static void *
+frame_push (struct QueuedFrame *qf,
+            size_t len)
+{
+  if (len > qf->offset)
+    abort ();
+  qf->offset -= len;
+  qf->size += len;
+  return frame_data (qf);
+}
+
+
+/**
+ * Release @a qf and its reference to its shared packet.
+ *
+ * @param qf frame buffer to free
+ */
+static void
+frame_free (struct QueuedFrame *qf)
+{
+  if ( (NULL != qf->shared) &&
+       (0 == --qf->shared->refcount) )
+    free (qf->shared);
+  free (qf);
+}
+
+
+/**
+ * Allocate a frame buffer whose data is @a sp, without copying it.
+ * Headers are pushed into the headroom of the new buffer.
+ *
+ * @param sp packet to reference
+ * @return the buffer
+ */
+static struct QueuedFrame *
+frame_alloc_shared (struct SharedPacket *sp)
+{
+  struct QueuedFrame *qf = frame_alloc (0);
+
+  sp->refcount++;
+  qf->shared = sp;
+  qf->size = sp->size;
+  return qf;
+}
+
+
+/**
+ * Get the number of bytes of @a qf that are not shared.
+ *
+ * @param qf frame buffer
+ * @return number of bytes at frame_data()
+ */
+static size_t
+frame_linear_size (const struct QueuedFrame *qf)
+{
+  return qf->size - ((NULL == qf->shared) ? 0 : qf->shared->size);
+}
+
+
+/**
+ * Turn @a qf into a frame without shared data, copying if needed.
+ *
+ * @param qf frame buffer, freed if a copy is made
+ * @return frame buffer with all data at frame_data()
+ */
+static struct QueuedFrame *
+frame_linearize (struct QueuedFrame *qf)
+{
+  struct QueuedFrame *lin;
+  size_t linear = frame_linear_size (qf);
+
+  if (NULL == qf->shared)
+    return qf;
+  lin = frame_alloc (qf->size);
+  memcpy (frame_data (lin),
+          frame_data (qf),
+          linear);
+  memcpy ((char *) frame_data (lin) + linear,
+          qf->shared->data,
+          qf->shared->size);
+  frame_free (qf);
+  return lin;
+}
+
+/**
+ * Strip @a len bytes from the front of the data of @a qf.
+ *
+ * @param qf frame buffer
+ * @param len number of bytes to remove
+ */
+static void
+frame_pull (struct QueuedFrame *qf,
+            size_t len)
+{
+  if (len > frame_linear_size (qf))
+    abort ();
+  qf->offset += len;
+  qf->size -= len;
+}
+
+
+/**
+ * Queue of one traffic class of an interface.
+ */
+struct EgressClass
+{
+  /**
+   * Oldest frame in the queue.
+   */
+  struct QueuedFrame *head;
+
+  /**
+   * Newest frame in the queue.
+   */
+  struct QueuedFrame *tail;
+
+  /**
+   * Bytes currently queued.
+   */
+  size_t backlog;
+
+  /**
+   * Maximum number of bytes we queue, tail drop beyond.
+   */
+  size_t limit;
+
+  /**
+   * DRR weight (not used for the strict priority class).
+   */
+  unsigned int weight;
+
+  /**
+   * DRR deficit counter.
+   */
+  int64_t deficit;
+
+  /**
+   * AQM state.
+   */
+  struct CodelState codel;
+
+  /**
+   * Shaper of this class.
+   */
+  struct TokenBucket shaper;
+
+  /**
+   * Statistics.
+   */
+  uint64_t tx_packets;
+  uint64_t tx_bytes;
+  uint64_t drops;
+  uint64_t aqm_drops;
+  uint64_t ecn_marks;
+  uint64_t latency_sum;
+  uint64_t latency_max;
+
+  /**
+   * Queueing delay (us) of the frames sent.
+   */
+  struct Histogram delay;
+};
+
+
+/**
+ * Egress queues of one interface.
+ */
+struct EgressQueue
+{
+  struct EgressClass classes[EGRESS_NUM_CLASSES];
+
+  /**
+   * AQM configuration, applies to all classes.
+   */
+  struct CodelParams codel;
+
+  /**
+   * Shaper for all traffic of the interface.
+   */
+  struct TokenBucket shaper;
+};
+
+
+/**
+ * Egress queues, indexed by ifc_num - 1.
+ */
+static struct EgressQueue *egress;
+
+/**
+ * Ingress policers, indexed by ifc_num - 1.
+ */
+static struct Policer *policers;
+
+
+/**
+ * Initialize the egress queues of @a q with default weights and limits.
+ *
+ * @param q queues to initialize
+ */
+static void
+egress_init (struct EgressQueue *q)
+{
+  static const unsigned int weights[EGRESS_NUM_CLASSES] = { 0, 4, 2, 1 };
+
+  for (unsigned int c = 0; c < EGRESS_NUM_CLASSES; c++)
+  {
+    q->classes[c].limit = EGRESS_DEFAULT_LIMIT;
+    q->classes[c].weight = weights[c];
+  }
+  q->codel.target = CODEL_DEFAULT_TARGET;
+  q->codel.interval = CODEL_DEFAULT_INTERVAL;
+  q->codel.ecn = true;
+}
+
+
+/**
+ * Determine the traffic class of @a frame.
+ *
+ * @param frame Ethernet frame
+ * @param frame_size number of bytes in @a frame
+ * @return traffic class
+ */
+static unsigned int
+egress_classify (const void *frame,
+                 size_t frame_size)
+{
+  const uint8_t *cframe = frame;
+  struct EthernetHeader eh;
+
+  if (frame_size < sizeof (eh) + sizeof (struct IPv4Header))
+    return EGRESS_CLASS_PRIORITY;
+  memcpy (&eh,
+          frame,
+          sizeof (eh));
+  if ( (ETH_P_IPV6 == ntohs (eh.tag)) &&
+       (frame_size >= sizeof (eh) + sizeof (struct IPv6Header) + 1) )
+  {
+    const uint8_t *ip6 = &cframe[sizeof (eh)];
+
+    /* neighbor discovery is control traffic */
+    if ( (IPPROTO_ICMPV6 == ip6[offsetof (struct IPv6Header, next_header)]) &&
+         ( (ICMP6TYPE_NEIGHBOR_SOLICITATION == ip6[sizeof (struct IPv6Header)]) ||
+           (ICMP6TYPE_NEIGHBOR_ADVERTISEMENT == ip6[sizeof (struct IPv6Header)]) ) )
+      return EGRESS_CLASS_PRIORITY;
+    /* traffic class spans the low nibbles of the first two bytes */
+    return egress_dscp_class[((ip6[0] & 0x0F) << 2) | (ip6[1] >> 6)];
+  }
+  if (ETH_P_IPV4 != ntohs (eh.tag))
+    return EGRESS_CLASS_PRIORITY;
+  return egress_dscp_class[cframe[sizeof (eh)
+                                  + offsetof (struct IPv4Header, diff_serv)]
+                           >> 2];
+}
+
+
+/**
+ * Integer square root.
+ *
+ * @param v value
+ * @return floor (sqrt (@a v))
+ */
+static uint64_t
+isqrt (uint64_t v)
+{
+  uint64_t r = v;
+  uint64_t x;
+
+  if (v < 2)
+    return v;
+  x = (r + 1) / 2;
+  while (x < r)
+  {
+    r = x;
+    x = (r + v / r) / 2;
+  }
+  return r;
+}
+
+
+/**
+ * CoDel control law: time of the next drop after @a t.
+ *
+ * @param t current drop time
+ * @param interval CoDel interval
+ * @param count number of drops in this dropping state
+ * @return @a t + @a interval / sqrt (@a count)
+ */
+static uint64_t
+codel_control_law (uint64_t t,
+                   uint64_t interval,
+                   uint32_t count)
+{
+  return t + interval * 1024 / isqrt ((uint64_t) count << 20);
+}
+
+
+/**
+ * Take the frame at the head of @a cl off the queue.
+ *
+ * @param cl class to dequeue from
+ * @return NULL if @a cl is empty
+ */
+static struct QueuedFrame *
+egress_pop (struct EgressClass *cl)
+{
+  struct QueuedFrame *qf = cl->head;
+
+  if (NULL == qf)
+    return NULL;
+  cl->head = qf->next;
+  if (NULL == cl->head)
+    cl->tail = NULL;
+  cl->backlog -= qf->size;
+  return qf;
+}
+
+
+/**
+ * Set the ECN CE codepoint of @a qf if it is an ECN-capable IPv4 or
+ * IPv6 packet.
+ *
+ * @param qf frame to mark
+ * @return true if @a qf was marked
+ */
+static bool
+egress_ecn_mark (struct QueuedFrame *qf)
+{
+  size_t off = sizeof (struct GLAB_MessageHeader) + sizeof (struct EthernetHeader);
+  struct EthernetHeader eh;
+  struct IPv4Header ip;
+  uint16_t old_word;
+  uint16_t new_word;
+
+  char *msg = frame_data (qf);
+
+  if (frame_linear_size (qf) < off + sizeof (ip))
+    return false;
+  memcpy (&eh,
+          &msg[sizeof (struct GLAB_MessageHeader)],
+          sizeof (eh));
+  if (ETH_P_IPV6 == ntohs (eh.tag))
+  {
+    /* ECN is in bits 4-5 of the second byte, no header checksum */
+    if (0 == ((msg[off + 1] >> 4) & 3))
+      return false;
+    msg[off + 1] |= 3 << 4;
+    return true;
+  }
+  memcpy (&ip,
+          &msg[off],
+          sizeof (ip));
+  if ( (ETH_P_IPV4 != ntohs (eh.tag)) ||
+       (0 == (ip.diff_serv & 3)) )
+    return false;
+  memcpy (&old_word, &ip, sizeof (old_word));
+  ip.diff_serv |= 3;
+  memcpy (&new_word, &ip, sizeof (new_word));
+  ip.checksum = csum_replace2 (ip.checksum,
+                               old_word,
+                               new_word);
+  memcpy (&msg[off],
+          &ip,
+          sizeof (ip));
+  return true;
+}
+
+
+/**
+ * Decide if the sojourn time of @a qf allows CoDel to drop.
+ *
+ * @param p CoDel configuration
+ * @param cl class @a qf was taken from
+ * @param qf frame that was dequeued
+ * @param now current time
+ * @return true if CoDel may drop (or mark) @a qf
+ */
+static bool
+codel_ok_to_drop (const struct CodelParams *p,
+                  struct EgressClass *cl,
+                  const struct QueuedFrame *qf,
+                  uint64_t now)
+{
+  struct CodelState *st = &cl->codel;
+  uint64_t sojourn = now - qf->enqueued;
+
+  if ( (sojourn < p->target) ||
+       (cl->backlog <= EGRESS_QUANTUM) )
+  {
+    st->first_above_time = 0;
+    return false;
+  }
+  if (0 == st->first_above_time)
+  {
+    st->first_above_time = now + p->interval;
+    return false;
+  }
+  return now >= st->first_above_time;
+}
+
+
+/**
+ * Handle a frame CoDel decided to signal congestion on: mark it if
+ * possible, otherwise drop it.
+ *
+ * @param p CoDel configuration
+ * @param cl class of @a qf
+ * @param qf frame to mark or drop
+ * @return @a qf if it was marked, NULL if it was dropped
+ */
+static struct QueuedFrame *
+codel_signal (const struct CodelParams *p,
+              struct EgressClass *cl,
+              struct QueuedFrame *qf)
+{
+  if (p->ecn &&
+      egress_ecn_mark (qf))
+  {
+    cl->ecn_marks++;
+    return qf;
+  }
+  cl->aqm_drops++;
+  metrics_drop (0, GLAB_DROP_AQM);
+  frame_free (qf);
+  return NULL;
+}
+
+
+/**
+ * Dequeue the next frame to send from @a cl, applying CoDel if it is
+ * enabled in @a p.
+ *
+ * @param p CoDel configuration of the interface
+ * @param cl class to dequeue from
+ * @param now current time
+ * @return NULL if @a cl is (or became) empty
+ */
+static struct QueuedFrame *
+egress_dequeue (const struct CodelParams *p,
+                struct EgressClass *cl,
+                uint64_t now)
+{
+  struct CodelState *st = &cl->codel;
+  struct QueuedFrame *qf;
+  bool drop;
+
+  qf = egress_pop (cl);
+  if (! p->enabled)
+    return qf;
+  if (NULL == qf)
+  {
+    st->first_above_time = 0;
+    st->dropping = false;
+    return NULL;
+  }
+  drop = codel_ok_to_drop (p, cl, qf, now);
+  if (st->dropping)
+  {
+    if (! drop)
+    {
+      st->dropping = false;
+      return qf;
+    }
+    while ( (NULL != qf) &&
+            (now >= st->drop_next) &&
+            st->dropping)
+    {
+      st->count++;
+      if (NULL != codel_signal (p, cl, qf))
+      {
+        /* marked packets are still sent */
+        st->drop_next = codel_control_law (st->drop_next,
+                                           p->interval,
+                                           st->count);
+        return qf;
+      }
+      qf = egress_pop (cl);
+      if ( (NULL == qf) ||
+           (! codel_ok_to_drop (p, cl, qf, now)) )
+        st->dropping = false;
+      else
+        st->drop_next = codel_control_law (st->drop_next,
+                                           p->interval,
+                                           st->count);
+    }
+    return qf;
+  }
+  if (drop)
+  {
+    uint32_t delta = st->count - st->lastcount;
+
+    st->dropping = true;
+    st->count = ( (delta > 1) &&
+                  (now - st->drop_next < 16 * p->interval) )
+                ? delta
+                : 1;
+    st->drop_next = codel_control_law (now,
+                                       p->interval,
+                                       st->count);
+    st->lastcount = st->count;
+    if (NULL == codel_signal (p, cl, qf))
+      qf = egress_pop (cl);
+  }
+  return qf;
+}
+
+
+/**
+ * Frames egress_transmit() queued with send_frame(), freed by
+ * egress_drain() once send_flush() wrote them.
+ */
+static struct QueuedFrame *egress_sent;
+
+/**
+ * Bytes egress_drain() may still hand to send_flush() without blocking
+ * on stdout.
+ */
+static size_t egress_room;
+
+/**
+ * Did egress_drain() keep frames queued because stdout was full?
+ */
+static bool egress_blocked;
+
+/**
+ * Is STDOUT_FILENO registered with loop() to tell us when it has room?
+ */
+static bool egress_watching;
+
+
+/**
+ * Get the time for the sojourn time of queued frames.  Unlike
+ * loop_now(), this is not the time of the batch: frames that wait in
+ * the egress queues because stdout is full must age while we do so.
+ *
+ * @return monotonic time in microseconds
+ */
+static uint64_t
+egress_clock (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC,
+                 &ts);
+  return (uint64_t) ts.tv_sec * 1000000LLU + ts.tv_nsec / 1000;
+}
+
+
+/**
+ * Get the number of bytes we can write to stdout without blocking.
+ * If stdout is not a pipe, we cannot tell and never hold frames back.
+ *
+ * @return free space in the stdout pipe, SIZE_MAX if unknown
+ */
+static size_t
+egress_stdout_room (void)
+{
+  static int pipe_size = -2;
+  int queued;
+  size_t used;
+
+  if (-2 == pipe_size)
+    pipe_size = fcntl (STDOUT_FILENO,
+                       F_GETPIPE_SZ);
+  if ( (pipe_size < 0) ||
+       (0 != ioctl (STDOUT_FILENO,
+                    FIONREAD,
+                    &queued)) ||
+       (queued < 0) )
+    return SIZE_MAX;
+  /* the page the reader is in the middle of is not free yet */
+  used = (size_t) queued + 4096;
+  if (used >= (size_t) pipe_size)
+    return 0;
+  return pipe_size - used;
+}
+
+
+/**
+ * Send @a qf, dequeued from @a cl, to the parent.  Linear frames are
+ * queued by reference and kept on #egress_sent until written.
+ *
+ * @param cl class @a qf was taken from
+ * @param qf frame to send
+ * @param now current time
+ */
+static void
+egress_transmit (struct EgressClass *cl,
+                 struct QueuedFrame *qf,
+                 uint64_t now)
+{
+  uint64_t latency = now - qf->enqueued;
+  uint64_t write_start = 0;
+
+  cl->tx_packets++;
+  cl->tx_bytes += qf->size - sizeof (struct GLAB_MessageHeader);
+  cl->latency_sum += latency;
+  if (latency > cl->latency_max)
+    cl->latency_max = latency;
+  histogram_add (&cl->delay,
+                 latency);
+  if (NULL != capture.ring)
+  {
+    struct GLAB_MessageHeader hdr;
+
+    memcpy (&hdr,
+            frame_data (qf),
+            sizeof (hdr));
+    capture_frame (ntohs (hdr.type),
+                   true,
+                   (const char *) frame_data (qf) + sizeof (hdr),
+                   frame_linear_size (qf) - sizeof (hdr),
+                   (NULL != qf->shared) ? qf->shared->data : NULL,
+                   (NULL != qf->shared) ? qf->shared->size : 0);
+  }
+  if (PERF_STAGES && perf.enabled)
+    write_start = perf_clock ();
+  GLAB_PROBE2 (frame_tx,
+               ntohs (((const struct GLAB_MessageHeader *) frame_data (qf))->type),
+               qf->size - sizeof (struct GLAB_MessageHeader));
+  metrics_tx (ntohs (((const struct GLAB_MessageHeader *) frame_data (qf))->type),
+              qf->size - sizeof (struct GLAB_MessageHeader));
+  /* the GLAB header in front of the frame is rebuilt by send_frame()
+     and send_frame_copy() */
+  if (NULL == qf->shared)
+  {
+    send_frame (ntohs (((const struct GLAB_MessageHeader *)
+                        frame_data (qf))->type),
+                (const char *) frame_data (qf)
+                + sizeof (struct GLAB_MessageHeader),
+                qf->size - sizeof (struct GLAB_MessageHeader));
+    qf->next = egress_sent;
+    egress_sent = qf;
+  }
+  else
+  {
+    /* header and shared payload are not contiguous, copy them */
+    struct iovec iov[2] = {
+      {
+        .iov_base = (char *) frame_data (qf)
+                    + sizeof (struct GLAB_MessageHeader),
+        .iov_len = frame_linear_size (qf)
+                   - sizeof (struct GLAB_MessageHeader)
+      },
+      {
+        .iov_base = qf->shared->data,
+        .iov_len = qf->shared->size
+      }
+    };
+
+    send_frame_copy (ntohs (((const struct GLAB_MessageHeader *)
+                             frame_data (qf))->type),
+                     iov,
+                     2);
+    frame_free (qf);
+  }
+  if (PERF_STAGES && perf.enabled)
+    perf_record (PERF_WRITE,
+                 perf_clock () - write_start);
+}
+
+
+/**
+ * Check whether the shapers of @a q and @a cl hold back the frame at
+ * the head of @a cl.  If so, ask loop() to wake us up once it may be
+ * sent.  A held back frame counts as exceeding a shaper only the
+ * first time, not on every recheck.
+ *
+ * @param q queues of the interface
+ * @param cl non-empty class to check
+ * @param now current time
+ * @return true if the head of @a cl must wait
+ */
+static bool
+egress_shaped (struct EgressQueue *q,
+               struct EgressClass *cl,
+               uint64_t now)
+{
+  struct QueuedFrame *qf = cl->head;
+  size_t size = qf->size - sizeof (struct GLAB_MessageHeader);
+  uint64_t delay = 0;
+
+  if (! tb_ready (&cl->shaper,
+                  size,
+                  now))
+  {
+    if (! qf->class_exceeded)
+      tb_exceed (&cl->shaper,
+                 size);
+    qf->class_exceeded = true;
+    delay = tb_delay (&cl->shaper,
+                      size);
+  }
+  if (! tb_ready (&q->shaper,
+                  size,
+                  now))
+  {
+    uint64_t d = tb_delay (&q->shaper,
+                           size);
+
+    if (! qf->ifc_exceeded)
+      tb_exceed (&q->shaper,
+                 size);
+    qf->ifc_exceeded = true;
+    if (d > delay)
+      delay = d;
+  }
+  if (0 == delay)
+    return false;
+  loop_wakeup_at (now + delay);
+  return true;
+}
+
+
+/**
+ * Dequeue the next frame of @a cl unless it is held back by a shaper,
+ * and send it.
+ *
+ * @param q queues of the interface
+ * @param cl class to send from
+ * @param now current time
+ * @return number of bytes sent (including the GLAB header), 0 if none
+ */
+static size_t
+egress_send (struct EgressQueue *q,
+             struct EgressClass *cl,
+             uint64_t now)
+{
+  struct QueuedFrame *qf;
+  size_t size;
+
+  if (NULL == cl->head)
+    return 0;
+  if (cl->head->size > egress_room)
+  {
+    egress_blocked = true;
+    return 0;
+  }
+  if (egress_shaped (q,
+                     cl,
+                     now))
+    return 0;
+  qf = egress_dequeue (&q->codel,
+                       cl,
+                       now);
+  if (NULL == qf)
+    return 0;
+  size = qf->size;
+  egress_room = (size < egress_room) ? egress_room - size : 0;
+  tb_consume (&cl->shaper,
+              size - sizeof (struct GLAB_MessageHeader));
+  tb_consume (&q->shaper,
+              size - sizeof (struct GLAB_MessageHeader));
+  egress_transmit (cl,
+                   qf,
+                   now);
+  return size;
+}
+
+
+static void
+egress_drain (void);
+
+
+/**
+ * Stdout has room again, send the frames we kept queued.
+ *
+ * @param fd STDOUT_FILENO
+ * @param events epoll events that occurred
+ * @param cls NULL
+ */
+static void
+egress_stdout_ready (int fd,
+                     uint32_t events,
+                     void *cls)
+{
+  (void) fd;
+  (void) events;
+  (void) cls;
+  egress_drain ();
+}
+
+
+/**
+ * Drain all egress queues: first the strict priority class of every
+ * interface, then the remaining classes by deficit round robin.
+ * Classes held back by a shaper keep their frames; loop() calls us
+ * again once the shaper allows the next frame.  We only send what
+ * fits into the stdout pipe, so a slow reader makes frames wait in
+ * the queues (where CoDel sees their sojourn time) rather than in a
+ * blocking write; loop() calls us again once stdout has room.  Frames
+ * sent by reference are freed after send_flush().  Called by loop()
+ * at the end of each batch.
+ */
+static void
+egress_drain (void)
+{
+  uint64_t now;
+  bool busy;
+
+  now = egress_clock ();
+  egress_room = egress_stdout_room ();
+  egress_blocked = false;
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    struct EgressQueue *q = &egress[i];
+
+    while (0 != egress_send (q,
+                             &q->classes[EGRESS_CLASS_PRIORITY],
+                             now))
+      ;
+  }
+  do
+  {
+    busy = false;
+    for (unsigned int i = 0; i < num_ifc; i++)
+    {
+      struct EgressQueue *q = &egress[i];
+
+      for (unsigned int c = EGRESS_CLASS_PRIORITY + 1;
+           c < EGRESS_NUM_CLASSES;
+           c++)
+      {
+        struct EgressClass *cl = &q->classes[c];
+        size_t sent;
+
+        if (NULL == cl->head)
+          continue;
+        if (cl->head->size > egress_room)
+        {
+          egress_blocked = true;
+          continue;
+        }
+        if (egress_shaped (q,
+                           cl,
+                           now))
+          continue;
+        busy = true;
+        cl->deficit += cl->weight * EGRESS_QUANTUM;
+        while ( (NULL != cl->head) &&
+                ((int64_t) cl->head->size <= cl->deficit) &&
+                (0 != (sent = egress_send (q,
+                                           cl,
+                                           now))) )
+          cl->deficit -= sent;
+        if (NULL == cl->head)
+          cl->deficit = 0;
+      }
+    }
+  }
+  while (busy);
+  if (egress_blocked != egress_watching)
+  {
+    if (! egress_blocked)
+      loop_remove_fd (STDOUT_FILENO);
+    else if (0 != loop_add_fd (STDOUT_FILENO,
+                               EPOLLOUT,
+                               &egress_stdout_ready,
+                               NULL))
+      egress_blocked = false; /* try again after the next batch */
+    egress_watching = egress_blocked;
+  }
+  if (NULL == egress_sent)
+    return;
+  send_flush ();
+  while (NULL != egress_sent)
+  {
+    struct QueuedFrame *qf = egress_sent;
+
+    egress_sent = qf->next;
+    frame_free (qf);
+  }
+}
+
+
+/**
+ * Kind of encapsulation of a tunnel interface.
+ */
+enum TunnelMode
+{
+  /**
+   * Not a tunnel, a real interface.
+   */
+  TUNNEL_NONE = 0,
+
+  /**
+   * IP-in-IP: IPv4 (protocol 4) or IPv6 (protocol 41) directly in IPv4.
+   */
+  TUNNEL_IPIP,
+
+  /**
+   * GRE (RFC 2784) in IPv4, protocol 47.
+   */
+  TUNNEL_GRE
+};
+
+
+/**
+ * Configuration and counters of a tunnel interface.
+ */
+struct Tunnel
+{
+  /**
+   * Local endpoint, 0 to use the address of the underlay interface.
+   */
+  struct in_addr local;
+
+  /**
+   * Remote endpoint.
+   */
+  struct in_addr remote;
+
+  /**
+   * MTU (including the Ethernet header) configured for the tunnel;
+   * the MTU derived from the underlay may be lower.
+   */
+  size_t mtu;
+
+  /**
+   * A `enum TunnelMode`.
+   */
+  uint8_t mode;
+
+  /**
+   * Statistics.
+   */
+  uint64_t encap_packets;
+  uint64_t encap_bytes;
+  uint64_t decap_packets;
+  uint64_t decap_bytes;
+  uint64_t no_route;
+  uint64_t no_arp;
+  uint64_t too_big;
+  uint64_t malformed;
+};
+
+
+/**
+ * Tunnel configuration, indexed by interface number (1-based), mode
+ * #TUNNEL_NONE for real interfaces.
+ */
+static struct Tunnel *tunnels;
+
+
+/**
+ * Encapsulate the Ethernet frame in @a qf for tunnel @a tun and queue
+ * it on the underlay interface.
+ *
+ * @param tun tunnel interface
+ * @param qf frame to send, ownership is taken
+ */
+static void
+tunnel_output (struct Interface *tun,
+               struct QueuedFrame *qf);
+
+
+/**
+ * Queue the Ethernet frame in @a qf on interface @a dst.  The GLAB
+ * header is pushed into the headroom, the frame is put into the
+ * egress queue of its traffic class and sent by egress_drain().
+ * Frames for tunnel interfaces are encapsulated first.
+ *
+ * @param dst target interface to send the frame out on
+ * @param qf the frame to send, ownership is taken
+ */
+static void
+egress_enqueue (struct Interface *dst,
+                struct QueuedFrame *qf)
+{
+  struct EgressClass *cl;
+  struct GLAB_MessageHeader hdr;
+
+  if (qf->size > dst->mtu)
+    abort ();
+  if (TUNNEL_NONE != tunnels[dst->ifc_num].mode)
+  {
+    tunnel_output (dst,
+                   frame_linearize (qf));
+    return;
+  }
+  if (NULL == qf->shared)
+  {
+    cl = &egress[dst->ifc_num - 1].classes[egress_classify (frame_data (qf),
+                                                             qf->size)];
+  }
+  else
+  {
+    /* classify on a copy of the start of the frame */
+    uint8_t head[sizeof (struct EthernetHeader) + sizeof (struct IPv6Header) + 1];
+    size_t linear = frame_linear_size (qf);
+    size_t len = (qf->size < sizeof (head)) ? qf->size : sizeof (head);
+
+    if (linear >= len)
+    {
+      memcpy (head,
+              frame_data (qf),
+              len);
+    }
+    else
+    {
+      memcpy (head,
+              frame_data (qf),
+              linear);
+      memcpy (&head[linear],
+              qf->shared->data,
+              len - linear);
+    }
+    cl = &egress[dst->ifc_num - 1].classes[egress_classify (head,
+                                                             len)];
+  }
+  hdr.size = htons (qf->size + sizeof (hdr));
+  hdr.type = htons (dst->ifc_num);
+  memcpy (frame_push (qf,
+                      sizeof (hdr)),
+          &hdr,
+          sizeof (hdr));
+  if (cl->backlog + qf->size > cl->limit)
+  {
+    cl->drops++;
+    metrics_drop (dst->ifc_num, GLAB_DROP_QUEUE);
+    frame_free (qf);
+    return;
+  }
+  qf->enqueued = egress_clock ();
+  if (NULL == cl->tail)
+    cl->head = qf;
+  else
+    cl->tail->next = qf;
+  cl->tail = qf;
+  cl->backlog += qf->size;
+}
+
+
+/**
+ * Forward @a frame to interface @a dst.  The frame is put into the
+ * egress queue of its traffic class and sent by egress_drain().
+ *
+ * @param dst target interface to send the frame out on
+ * @param frame the frame to forward
+ * @param frame_size number of bytes in @a frame
+ */
+static void forward_to (struct Interface *dst, const void *frame, size_t frame_size) {
+  struct QueuedFrame *qf;
+
+  if (frame_size > dst->mtu)
+    abort ();
+  qf = frame_alloc (frame_size);
+  memcpy (frame_data (qf),
+          frame,
+          frame_size);
+  egress_enqueue (dst,
+                  qf);
+}
+
+
+/**
+ * Push an Ethernet header in front of the packet in @a qf and forward
+ * the resulting frame via @a ifc to @a target_ha.
+ *
+ * @param ifc interface to send frame out on
+ * @param target_ha destination MAC
+ * @param tag Ethernet tag to use
+ * @param qf packet to send, ownership is taken
+ */
+static void
+forward_frame_to (struct Interface *ifc,
+                  const struct MacAddress *target_ha,
+                  uint16_t tag,
+                  struct QueuedFrame *qf)
+{
+  struct EthernetHeader eh;
+
+  eh.dst = *target_ha;
+  eh.src = ifc->mac;
+  eh.tag = htons (tag);
+  memcpy (frame_push (qf,
+                      sizeof (eh)),
+          &eh,
+          sizeof (eh));
+  egress_enqueue (ifc,
+                  qf);
+}
+
+
+/**
+ * Create Ethernet frame and forward it via @a ifc to @a target_ha.
+ *
+ * @param ifc interface to send frame out on
+ * @param target_ha destination MAC
+ * @param tag Ethernet tag to use
+ * @param frame_payload payload to use in frame
+ * @param frame_payload_size number of bytes in @a frame_payload
+ */
+static void
+forward_frame_payload_to (struct Interface *ifc,
+                          const struct MacAddress *target_ha,
+                          uint16_t tag,
+                          const void *frame_payload,
+                          size_t frame_payload_size)
+{
+  struct QueuedFrame *qf;
+
+  if (frame_payload_size + sizeof (struct EthernetHeader) > ifc->mtu)
+    abort ();
+  qf = frame_alloc (frame_payload_size);
+  memcpy (frame_data (qf),
+          frame_payload,
+          frame_payload_size);
+  forward_frame_to (ifc,
+                    target_ha,
+                    tag,
+                    qf);
+}
+
+
+/**
+ * Software GSO: split the TCP super-packet @a ip / @a payload (which
+ * is larger than the MTU of @a ifc) into MTU-sized TCP segments and
+ * send them to @a target_ha.  Sequence numbers, IP IDs and both
+ * checksums are fixed up per segment, so the route decision taken
+ * for the super-packet covers all resulting wire packets.
+ *
+ * @param ifc interface to send the segments out on
+ * @param target_ha destination MAC
+ * @param ip IP header to use (TTL already decremented)
+ * @param payload TCP header followed by the TCP payload
+ * @param payload_size number of bytes in @a payload
+ * @return 0 on success, 1 if @a ip cannot be segmented
+ *         (not TCP, IP options, already fragmented, malformed)
+ */
+static int
+gso_segment_tcp (struct Interface *ifc,
+                 const struct MacAddress *target_ha,
+                 const struct IPv4Header *ip,
+                 const void *payload,
+                 size_t payload_size)
+{
+  const char *cpayload = payload;
+  struct TcpHeader tcp;
+  size_t tcp_hlen;
+  size_t tcp_len;
+  size_t mss;
+  size_t off;
+  uint16_t frag_info;
+
+  frag_info = ntohs (ip->fragmentation_info);
+  if ( (IPPROTO_TCP != ip->protocol) ||
+       (sizeof (struct IPv4Header) != ip->header_length * 4) ||
+       (0 != (frag_info & ~(IP_FLAGS_DO_NOT_FRAGMENT << 13))) ||
+       (payload_size < sizeof (tcp)) )
+    return 1;
+  memcpy (&tcp,
+          payload,
+          sizeof (tcp));
+  tcp_hlen = tcp.data_offset * 4;
+  tcp_len = ntohs (ip->total_length) - sizeof (struct IPv4Header);
+  if ( (tcp_hlen < sizeof (tcp)) ||
+       (ntohs (ip->total_length) < sizeof (struct IPv4Header) + tcp_hlen) ||
+       (tcp_len > payload_size) )
+    return 1;
+  if (ifc->mtu <= sizeof (struct EthernetHeader)
+      + sizeof (struct IPv4Header) + tcp_hlen)
+    return 1;
+  mss = ifc->mtu - sizeof (struct EthernetHeader)
+        - sizeof (struct IPv4Header) - tcp_hlen;
+  off = 0;
+  for (unsigned int i = 0; off < tcp_len - tcp_hlen; i++)
+  {
+    size_t seg_len = tcp_len - tcp_hlen - off;
+    bool first = (0 == off);
+    bool last;
+
+    if (seg_len > mss)
+      seg_len = mss;
+    last = (off + seg_len == tcp_len - tcp_hlen);
+    {
+      /* build IP and TCP header in place, forward_frame_to() pushes
+         the Ethernet and GLAB headers into the headroom */
+      struct QueuedFrame *qf = frame_alloc (sizeof (struct IPv4Header)
+                                            + tcp_hlen + seg_len);
+      char *pkt = frame_data (qf);
+      struct IPv4Header sip;
+      struct TcpHeader stcp;
+      struct TcpPseudoHeader ph;
+      char *stcp_pos = &pkt[sizeof (sip)];
+      uint32_t sum;
+
+      sip = *ip;
+      sip.total_length = htons (sizeof (sip) + tcp_hlen + seg_len);
+      sip.identification = htons (ntohs (ip->identification) + i);
+      sip.checksum = 0;
+      sip.checksum = GNUNET_CRYPTO_crc16_n (&sip,
+                                            sizeof (sip));
+      memcpy (pkt,
+              &sip,
+              sizeof (sip));
+      stcp = tcp;
+      stcp.sequence_number = htonl (ntohl (tcp.sequence_number) + off);
+      if (! last)
+        stcp.flags &= ~(TCP_FLAG_FIN | TCP_FLAG_PSH);
+      if (! first)
+        stcp.flags &= ~TCP_FLAG_CWR;
+      stcp.crc = 0;
+      memcpy (stcp_pos,
+              &stcp,
+              sizeof (stcp));
+      memcpy (&stcp_pos[sizeof (stcp)],
+              &cpayload[sizeof (stcp)],
+              tcp_hlen - sizeof (stcp));
+      memcpy (&stcp_pos[tcp_hlen],
+              &cpayload[tcp_hlen + off],
+              seg_len);
+      ph.source_address = sip.source_address;
+      ph.destination_address = sip.destination_address;
+      ph.zero = 0;
+      ph.protocol = IPPROTO_TCP;
+      ph.tcp_length = htons (tcp_hlen + seg_len);
+      sum = GNUNET_CRYPTO_crc16_step (0,
+                                      &ph,
+                                      sizeof (ph));
+      sum = GNUNET_CRYPTO_crc16_step (sum,
+                                      stcp_pos,
+                                      tcp_hlen + seg_len);
+      stcp.crc = GNUNET_CRYPTO_crc16_finish (sum);
+      memcpy (&stcp_pos[offsetof (struct TcpHeader, crc)],
+              &stcp.crc,
+              sizeof (stcp.crc));
+      forward_frame_to (ifc,
+                        target_ha,
+                        ETH_P_IPV4,
+                        qf);
+    }
+    off += seg_len;
+  }
+  return 0;
+}
+
+
+/**
+ * Size of an MPLS label stack entry.
+ */
+#define MPLS_HEADER_SIZE 4
+
+/**
+ * Number of MPLS labels (20 bits).
+ */
+#define MPLS_NUM_LABELS (1 << 20)
+
+/**
+ * Labels below this value are reserved (RFC 3032).
+ */
+#define MPLS_FIRST_UNRESERVED_LABEL 16
+
+/**
+ * IPv4 and IPv6 explicit null labels.
+ */
+#define MPLS_LABEL_IPV4_NULL 0
+#define MPLS_LABEL_IPV6_NULL 2
+
+
+/**
+ * Build an MPLS label stack entry.
+ *
+ * @param label 20-bit label
+ * @param tc traffic class (3 bits)
+ * @param bottom true for the bottom of the stack
+ * @param ttl time to live
+ * @return entry in network byte order
+ */
+static uint32_t
+mpls_entry (uint32_t label,
+            uint8_t tc,
+            bool bottom,
+            uint8_t ttl)
+{
+  return htonl ( (label << 12)
+                 | ((uint32_t) (tc & 7) << 9)
+                 | ((bottom ? 1u : 0u) << 8)
+                 | ttl);
+}
+
+
+/**
+ * Send the IPv4 packet in @a qf along route @a e to @a target_ha,
+ * imposing the route's MPLS label (in the headroom) if it has one.
+ * The caller must have applied the (label-reduced) MTU of the route.
+ *
+ * @param e route the packet follows
+ * @param target_ha destination MAC
+ * @param qf IPv4 header and payload, ownership is taken
+ */
+static void
+forward_routed (const struct TableEntry *e,
+                const struct MacAddress *target_ha,
+                struct QueuedFrame *qf)
+{
+  struct Interface *ifc = &gifc[e->interface.ifc_num - 1];
+  const uint8_t *ip = frame_data (qf);
+  uint32_t lse;
+
+  if (! e->has_label)
+  {
+    forward_frame_to (ifc,
+                      target_ha,
+                      ETH_P_IPV4,
+                      qf);
+    return;
+  }
+  lse = mpls_entry (e->label,
+                    ip[offsetof (struct IPv4Header, diff_serv)] >> 5,
+                    true,
+                    ip[offsetof (struct IPv4Header, ttl)]);
+  memcpy (frame_push (qf,
+                      sizeof (lse)),
+          &lse,
+          sizeof (lse));
+  forward_frame_to (ifc,
+                    target_ha,
+                    ETH_P_MPLS_UC,
+                    qf);
+}
+
+
+/**
+ * Longest prefix match of @a dst in the IPv4 routing table.
+ *
+ * @param dst destination address
+ * @return index in #routingTable, -1 if no route matches
+ */
+static int
+fib4_lookup (struct in_addr dst)
+{
+  int bestNetmaskMatch = 0;
+  int bestNetmaskMatchIndex = -1;
+
+  for(int i = 0; i < routingTableIndex; i++){
+    //vergleiche zieladresse mit Routing tabelle um zu prüfen ob target in in table gespeichert
+    int maskDestination = dst.s_addr & routingTable[i].netmask.s_addr;
+    int maskNetwork = routingTable[i].target_network.s_addr & routingTable[i].netmask.s_addr;
+
+    if (maskDestination == maskNetwork){
+	    if (routingTable[i].netmask.s_addr >= bestNetmaskMatch){
+		    bestNetmaskMatch = routingTable[i].netmask.s_addr;
+		    bestNetmaskMatchIndex = i;
+	    }
+	}
+  }
+  return bestNetmaskMatchIndex;
+}
+
+
+/**
+ * Get the number of bytes the encapsulation of tunnel @a t adds.
+ *
+ * @param t tunnel
+ * @return size of the outer headers
+ */
+static size_t
+tunnel_overhead (const struct Tunnel *t)
+{
+  return sizeof (struct IPv4Header)
+         + ((TUNNEL_GRE == t->mode) ? sizeof (struct GreHeader) : 0);
+}
+
+
+/**
+ * Find the interface packets to the remote endpoint of @a t leave on.
+ *
+ * @param t tunnel
+ * @param[out] next_hop set to the next hop towards the remote endpoint
+ * @return NULL if the remote endpoint is unreachable (or only via a tunnel)
+ */
+static struct Interface *
+tunnel_underlay (const struct Tunnel *t,
+                 struct in_addr *next_hop)
+{
+  int idx = fib4_lookup (t->remote);
+  const struct TableEntry *e;
+
+  if (-1 == idx)
+    return NULL;
+  e = &routingTable[idx];
+  if ( (0 == e->interface.ifc_num) ||
+       (TUNNEL_NONE != tunnels[e->interface.ifc_num].mode) )
+    return NULL;
+  *next_hop = (0 != e->nextHop.s_addr) ? e->nextHop : t->remote;
+  return &gifc[e->interface.ifc_num - 1];
+}
+
+
+/**
+ * Update the MTU of tunnel interface @a tun from the MTU of its
+ * underlay, so that inner packets are fragmented (or rejected) before
+ * encapsulation and the outer packet never needs fragmentation.
+ *
+ * @param tun tunnel interface
+ * @return the MTU of @a tun (including the Ethernet header)
+ */
+static size_t
+tunnel_mtu (struct Interface *tun)
+{
+  const struct Tunnel *t = &tunnels[tun->ifc_num];
+  const struct Interface *under;
+  struct in_addr next_hop;
+
+  tun->mtu = t->mtu;
+  under = tunnel_underlay (t,
+                           &next_hop);
+  if ( (NULL != under) &&
+       (under->mtu < t->mtu + tunnel_overhead (t)) )
+    tun->mtu = under->mtu - tunnel_overhead (t);
+  return tun->mtu;
+}
+
+
+/**
+ * Rate (messages per second) and burst of the ICMP errors we send.
+ */
+#define ICMP_RATE 100
+#define ICMP_BURST 10
+
+
+/**
+ * Counters of packets hitting routes that do not forward.
+ */
+struct RouteTypeStats
+{
+  uint64_t blackhole;
+  uint64_t unreachable;
+  uint64_t prohibit;
+  uint64_t local;
+  uint64_t icmp_sent;
+  uint64_t icmp_limited;
+};
+
+
+/**
+ * Packets dropped (or consumed) by route type.
+ */
+static struct RouteTypeStats route_type_stats;
+
+/**
+ * Limits the ICMP errors we generate, in messages rather than bytes.
+ */
+static struct TokenBucket icmp_limit;
+
+
+/**
+ * Check whether we may send another ICMP error now.
+ *
+ * @return true if the ICMP rate limit allows it
+ */
+static bool
+icmp_allowed (void)
+{
+  if (! tb_ready (&icmp_limit,
+                  1,
+                  loop_now ()))
+  {
+    tb_exceed (&icmp_limit,
+               1);
+    route_type_stats.icmp_limited++;
+    return false;
+  }
+  tb_consume (&icmp_limit,
+              1);
+  route_type_stats.icmp_sent++;
+  return true;
+}
+
+
+/**
+ * Send an ICMP error about @a ip back to where it came from, subject
+ * to the ICMP rate limit.
+ *
+ * @param origin interface we received @a ip on
+ * @param ip header of the offending packet
+ * @param payload payload of the offending packet
+ * @param payload_size number of bytes in @a payload
+ * @param eh Ethernet header of the offending packet
+ * @param type ICMP type
+ * @param code ICMP code
+ */
+static void
+icmp4_error (struct Interface *origin,
+             const struct IPv4Header *ip,
+             const void *payload,
+             size_t payload_size,
+             const struct EthernetHeader *eh,
+             uint8_t type,
+             uint8_t code)
+{
+  struct QueuedFrame *qf;
+  struct IPv4Header hdr;
+  struct IcmpHeader icmp;
+  char *packet;
+  size_t quote = (payload_size < 8) ? payload_size : 8;
+
+  if (! icmp_allowed ())
+    return;
+  qf = frame_alloc (2 * sizeof (hdr) + sizeof (icmp) + 8);
+  packet = frame_data (qf);
+  memcpy (&hdr, ip, sizeof (hdr));
+  hdr.destination_address = ip->source_address;
+  hdr.source_address = origin->ip;
+  hdr.total_length = htons (qf->size);
+  hdr.identification = 0;
+  hdr.diff_serv = 0;
+  hdr.ttl = 32;
+  hdr.protocol = IPPROTO_ICMP;
+  hdr.fragmentation_info = 0;
+  hdr.checksum = 0;
+  hdr.checksum = GNUNET_CRYPTO_crc16_n (&hdr, sizeof (hdr));
+  memset (&icmp, 0, sizeof (icmp));
+  icmp.type = type;
+  icmp.code = code;
+  memcpy (packet, &hdr, sizeof (hdr));
+  memcpy (&packet[sizeof (hdr)], &icmp, sizeof (icmp));
+  memcpy (&packet[sizeof (hdr) + sizeof (icmp)], ip, sizeof (hdr));
+  memset (&packet[2 * sizeof (hdr) + sizeof (icmp)], 0, 8);
+  memcpy (&packet[2 * sizeof (hdr) + sizeof (icmp)], payload, quote);
+  icmp.crc = GNUNET_CRYPTO_crc16_n (&packet[sizeof (hdr)],
+                                    sizeof (icmp) + sizeof (hdr) + 8);
+  memcpy (&packet[sizeof (hdr)], &icmp, sizeof (icmp));
+  forward_frame_to (origin,
+                    &eh->src,
+                    ETH_P_IPV4,
+                    qf);
+}
+
+
+/**
+ * Process an IPv4 packet matching a local route.  We only answer
+ * echo requests, everything else is counted and dropped.
+ *
+ * @param origin interface we received the packet on
+ * @param ip header of the packet
+ * @param payload payload of the packet
+ * @param payload_size number of bytes in @a payload
+ * @param eh Ethernet header of the packet
+ */
+static void
+ipv4_local (struct Interface *origin,
+            const struct IPv4Header *ip,
+            const void *payload,
+            size_t payload_size,
+            const struct EthernetHeader *eh)
+{
+  const uint8_t *icmp = payload;
+  struct QueuedFrame *qf;
+  struct IPv4Header hdr;
+  char *packet;
+  uint16_t old_word;
+  uint16_t new_word;
+  uint16_t crc;
+
+  route_type_stats.local++;
+  if ( (IPPROTO_ICMP != ip->protocol) ||
+       (payload_size < sizeof (struct IcmpHeader)) ||
+       (ICMPTYPE_ECHO_REQUEST != icmp[0]) ||
+       (ntohs (ip->total_length) != sizeof (hdr) + payload_size) ||
+       (sizeof (struct EthernetHeader) + sizeof (hdr) + payload_size > origin->mtu) )
+    return;
+  hdr = *ip;
+  hdr.destination_address = ip->source_address;
+  hdr.source_address = ip->destination_address;
+  hdr.ttl = 64;
+  hdr.fragmentation_info = 0;
+  hdr.checksum = 0;
+  hdr.checksum = GNUNET_CRYPTO_crc16_n (&hdr, sizeof (hdr));
+  qf = frame_alloc (sizeof (hdr) + payload_size);
+  packet = frame_data (qf);
+  memcpy (packet, &hdr, sizeof (hdr));
+  memcpy (&packet[sizeof (hdr)], payload, payload_size);
+  /* echo reply: only the type changes, update the checksum */
+  memcpy (&old_word, icmp, sizeof (old_word));
+  packet[sizeof (hdr)] = ICMPTYPE_ECHO_REPLY;
+  memcpy (&new_word, &packet[sizeof (hdr)], sizeof (new_word));
+  memcpy (&crc, &packet[sizeof (hdr) + 2], sizeof (crc));
+  crc = csum_replace2 (crc,
+                       old_word,
+                       new_word);
+  memcpy (&packet[sizeof (hdr) + 2], &crc, sizeof (crc));
+  forward_frame_to (origin,
+                    &eh->src,
+                    ETH_P_IPV4,
+                    qf);
+}
+
+
+/**
+ * Route the @a ip packet with its @a payload.
+ *
+ * @param origin interface we received the packet from
+ * @param ip IP header
+ * @param payload IP packet payload
+ * @param payload_size number of bytes in @a payload
+ */
+static void route (struct Interface *origin, const struct IPv4Header *ip, const void *payload, size_t payload_size, struct EthernetHeader eh){
+  struct MacAddress target_mac;
+  struct TableEntry routingEntry;
+  int bestNetmaskMatchIndex;
+
+  perf_lap (PERF_PARSE);
+  bestNetmaskMatchIndex = fib4_lookup (ip->destination_address);
+  perf_lap (PERF_LOOKUP);
+  GLAB_PROBE2 (route_lookup,
+               ip->destination_address.s_addr,
+               bestNetmaskMatchIndex);
+  bool foundTableEntry = (-1 != bestNetmaskMatchIndex);
+
+  // routes that do not forward are handled right at the lookup
+  if (foundTableEntry)
+  {
+    routeCounters[bestNetmaskMatchIndex].packets++;
+    routeCounters[bestNetmaskMatchIndex].bytes += sizeof (struct IPv4Header) + payload_size;
+    switch (routingTable[bestNetmaskMatchIndex].type)
+    {
+    case ROUTE_BLACKHOLE:
+      route_type_stats.blackhole++;
+      metrics_drop (origin->ifc_num, GLAB_DROP_ROUTE_TYPE);
+      return;
+    case ROUTE_UNREACHABLE:
+      route_type_stats.unreachable++;
+      metrics_drop (origin->ifc_num, GLAB_DROP_ROUTE_TYPE);
+      icmp4_error (origin, ip, payload, payload_size, &eh,
+                   ICMPTYPE_DESTINATION_UNREACHABLE,
+                   ICMPCODE_HOST_UNREACHABLE);
+      return;
+    case ROUTE_PROHIBIT:
+      route_type_stats.prohibit++;
+      metrics_drop (origin->ifc_num, GLAB_DROP_ROUTE_TYPE);
+      icmp4_error (origin, ip, payload, payload_size, &eh,
+                   ICMPTYPE_DESTINATION_UNREACHABLE,
+                   ICMPCODE_ADMINISTRATIVELY_PROHIBITED);
+      return;
+    case ROUTE_LOCAL:
+      ipv4_local (origin, ip, payload, payload_size, &eh);
+      return;
+    default:
+      break;
+    }
+  }
+  bool routeKnown = false;
+  struct Interface arpTableInterface;
+  for (int i = 0; i < tableIndex; i++){
+       if (ipCmp (&table[i].ip, &ip->destination_address) == 0){
+  			routeKnown = true;
+  			arpTableInterface = table[i];
+       }
+  }
+  perf_lap (PERF_ARP);
+
+  //es wurde ein Eintrag gefunden
+  routingEntry = routingTable[foundTableEntry ? bestNetmaskMatchIndex : 0];
+  // tunnels inherit the MTU of their underlay minus the outer headers
+  if (TUNNEL_NONE != tunnels[routingEntry.interface.ifc_num].mode)
+    routingEntry.interface.mtu = tunnel_mtu (&gifc[routingEntry.interface.ifc_num - 1]);
+  // the imposed label eats into the MTU
+  if (routingEntry.has_label)
+    routingEntry.interface.mtu -= MPLS_HEADER_SIZE;
+  /* TODO: Eintrag not found*/
+
+ if (!foundTableEntry){
+	    metrics_drop (origin->ifc_num, GLAB_DROP_NO_ROUTE);
+	    icmp4_error (origin, ip, payload, payload_size, &eh,
+	                 ICMPTYPE_DESTINATION_UNREACHABLE,
+	                 ICMPCODE_NETWORK_UNREACHABLE);
+	    return;
+	    }
+	   // FOUND ROUTER ENTRY
+	   if (! acl_permits (routingEntry.interface.ifc_num,
+	                      ACL_OUT,
+	                      ip,
+	                      payload,
+	                      payload_size))
+	     return;
+	   struct IPv4Header newHeader;
+
+	   memcpy (&newHeader, ip, sizeof (struct IPv4Header));
+	   newHeader.ttl = newHeader.ttl - 1;
+
+	   // check ttl
+	   if (newHeader.ttl < 1){
+		 metrics_drop (origin->ifc_num, GLAB_DROP_TTL);
+		 return;
+	   }
+
+	   // source NAT on the egress interface (rewrites a private copy)
+	   bool do_nat = nat_ifcs[routingEntry.interface.ifc_num];
+	   uint8_t nat_payload[do_nat ? payload_size : 1];
+
+	   if (do_nat){
+	     memcpy (nat_payload, payload, payload_size);
+	     if (0 != nat_outbound (&gifc[routingEntry.interface.ifc_num - 1],
+	                            &newHeader,
+	                            nat_payload,
+	                            payload_size))
+	       return;
+	     payload = nat_payload;
+	   }
+	   // only traffic we forward is worth a flow entry, after NAT
+	   flow_account (origin->ifc_num,
+	                 routingEntry.interface.ifc_num,
+	                 &newHeader,
+	                 payload,
+	                 payload_size);
+	   bool RemainingTTLhopNeeded = true;
+           for (int i = 0; i < routingTableIndex; i++){
+		   if (newHeader.destination_address.s_addr == 0){
+			   RemainingTTLhopNeeded = false;
+		   }
+	   }
+//____________________________________________________
+  target_mac = arpTableInterface.mac;
+//_________________________
+	   if (RemainingTTLhopNeeded){
+		for (int i = 0; i < tableIndex; i++){
+			if (ipCmp (&table[i].ip, &routingEntry.nextHop) == 0){
+				target_mac = table[i].mac;
+			}
+		}
+	   } else {
+	   }
+//____________________________
+  //If target-mac Null do arp
+  if ( &target_mac == NULL){
+	print("a\n");
+
+    //Struktur Arp-Header
+	struct EthernetHeader arpEh;
+
+	arpEh.dst = broadcastMac;
+	arpEh.src = routingEntry.interface.mac;
+	arpEh.tag = htons(2054);
+
+	struct ArpHeaderEthernetIPv4 arpHeader;
+	arpHeader.htype = htons(1);
+	arpHeader.ptype = htons(0x800);
+	arpHeader.hlen = 6;
+	arpHeader.plen = 4;
+	arpHeader.oper = htons(1);
+	arpHeader.sender_ha = routingEntry.interface.mac;
+	arpHeader.sender_pa = routingEntry.interface.ip;
+	arpHeader.target_ha = nullMac;
+	arpHeader.target_pa = routingEntry.nextHop;
+
+	void* ptr = malloc (sizeof (arpEh) + sizeof (arpHeader));
+	memcpy (ptr, &arpEh, sizeof(arpEh));
+	memcpy (ptr + sizeof(arpEh), &arpHeader, sizeof(arpHeader));
+	forward_to (&routingEntry.interface, ptr, sizeof(ptr));
+	free(ptr);
+	return;
+	}
+
+//_________________________________________________________________________
+// MTU Fragmentation Handling
+
+  uint sizeHeadIPv4 =  sizeof(struct IPv4Header);
+  uint sizeHeadIcmp = sizeof(struct IcmpHeader);
+  uint sizeHeadEh = sizeof(struct EthernetHeader);
+
+  // GSO super-frame (larger than the ingress MTU): segment at egress
+  if ( (! routingEntry.has_label) &&
+       (TUNNEL_NONE == tunnels[routingEntry.interface.ifc_num].mode) &&
+       (routingEntry.interface.mtu < sizeHeadEh + sizeHeadIPv4 + payload_size) &&
+       (origin->mtu < sizeHeadEh + sizeHeadIPv4 + payload_size) &&
+       (0 == gso_segment_tcp (&routingEntry.interface,
+                              &target_mac,
+                              &newHeader,
+                              payload,
+                              payload_size)) )
+    return;
+
+  // ok ___________________________________________________________________
+  if(routingEntry.interface.mtu >= sizeHeadEh + sizeHeadIPv4 + payload_size)
+  {
+
+    // built once in a buffer with headroom, lower headers are prepended
+    struct QueuedFrame *send = frame_alloc (sizeHeadIPv4 + payload_size);
+    char *packet = frame_data (send);
+    newHeader.checksum = 0;
+    newHeader.checksum = GNUNET_CRYPTO_crc16_n(&newHeader, sizeHeadIPv4);
+    memcpy (packet, &newHeader, sizeHeadIPv4);
+    memcpy (packet + sizeHeadIPv4, payload, payload_size);
+    	
+    forward_routed (
+        &routingEntry, 
+        &target_mac, 
+        send
+    );
+    perf_lap (PERF_REWRITE);
+    return;
+  }
+  // not ok -> fragmentaion needed __________________________________________
+  else{
+
+    // check flags
+    // fragment _____________________________________________________________
+    if (ntohs (ip->fragmentation_info) >> 13 != 2){
+      
+      // beginn fragment
+      bool hasNext  = (newHeader.fragmentation_info >> 13 == 1) 
+                          ? true 
+                          : false;
+      bool islast = false;
+      int sizeFragment, offset = 0;      
+      uint16_t mtuIfc = routingEntry.interface.mtu - sizeHeadEh - sizeHeadIPv4;
+
+      // check payload
+      while (offset < payload_size)
+      {
+        islast  = (payload_size - offset) < mtuIfc 
+              ? true 
+              : false;
+
+        sizeFragment  = (payload_size - offset) < mtuIfc 
+                      ?  (payload_size - offset)
+                      :  (mtuIfc - (mtuIfc % 8));
+
+        struct IPv4Header fragmentHead;
+        memcpy (&fragmentHead, &newHeader, sizeHeadIPv4);
+        fragmentHead.checksum = 0;
+        fragmentHead.total_length = htons(sizeFragment);
+        fragmentHead.fragmentation_info = (islast && !hasNext)
+                        ? htons(ntohs(newHeader.fragmentation_info) 
+                        + (offset >> 3)) 
+                        : htons((1 << 13) 
+                        + ntohs(newHeader.fragmentation_info) 
+                        + (offset >> 3));
+        fragmentHead.checksum = GNUNET_CRYPTO_crc16_n (&fragmentHead, sizeHeadIPv4);
+        
+        struct QueuedFrame *fragment = frame_alloc (sizeFragment + sizeHeadIPv4);
+        char *packet = frame_data (fragment);
+        memcpy (packet, &fragmentHead, sizeHeadIPv4);
+        memcpy (&packet[sizeHeadIPv4], payload + offset, sizeFragment);
+        
+        offset += sizeFragment;
+
+        forward_routed (
+            &routingEntry, 
+            &target_mac, 
+            fragment
+        );
+      }
+      perf_lap (PERF_FRAGMENT);
+      return;
+    } 
+    // do not fragment ______________________________________________________
+    else {
+      metrics_drop (origin->ifc_num, GLAB_DROP_TOO_BIG);
+
+      if (! icmp_allowed ())
+        return;
+       struct IPv4Header ipv4Head;
+      memcpy(&ipv4Head, ip, sizeHeadIPv4);
+      ipv4Head.destination_address = ip->source_address;
+      ipv4Head.source_address = origin->ip;
+      ipv4Head.identification = 0;
+      ipv4Head.diff_serv = 0;
+      ipv4Head.ttl = 32;
+      ipv4Head.protocol = IPPROTO_ICMP;
+      ipv4Head.fragmentation_info = 0;
+      ipv4Head.checksum = 0;
+      ipv4Head.checksum = GNUNET_CRYPTO_crc16_n(&ipv4Head, sizeHeadIPv4);
+
+      struct IcmpHeader head =  {
+          .type = 3,
+          .code = 4,
+          .quench.destination_unreachable.empty = 0,
+          .quench.destination_unreachable.next_hop_mtu 
+              = htons(routingEntry.interface.mtu - sizeHeadEh),
+          .crc = 0,
+          .crc = GNUNET_CRYPTO_crc16_n(&head, sizeHeadIcmp)
+      };
+
+      char send[(sizeHeadIPv4 * 2) + sizeHeadIcmp + 8];
+      memcpy (&send, &ipv4Head, sizeHeadIPv4);
+      memcpy (&send[sizeHeadIPv4],&head,sizeHeadIcmp);
+      memcpy (&send[sizeHeadIPv4 + sizeHeadIcmp],ip,sizeHeadIPv4);
+      memcpy (&send[(sizeHeadIPv4 * 2) + sizeHeadIcmp], payload, 8);
+
+      forward_frame_payload_to (
+            origin, 
+            &eh.src, 
+            0x0800,
+            &send, 
+            (sizeHeadIPv4 * 2) + sizeHeadIcmp + 8
+      ); 
+      return;
+    }
+    //__________________________________________________________________
+  } 
+  // ___________________________________________________________________
+}
+
+/**
+ * Number of bits of the destination address consumed by the root of
+ * the IPv6 FIB trie.  Together with #FIB6_STRIDE, a /48 is resolved in
+ * 5 and a /64 in 7 memory accesses.
+ */
+#define FIB6_ROOT_STRIDE 16
+
+/**
+ * Number of bits consumed by each level of the IPv6 FIB trie below the
+ * root.  8 bits keep nodes at 2 KiB, so sparse /48 and /64 tables stay
+ * small.
+ */
+#define FIB6_STRIDE 8
+
+/**
+ * Number of slots in the root of the IPv6 FIB trie.
+ */
+#define FIB6_ROOT_SIZE (1 << FIB6_ROOT_STRIDE)
+
+/**
+ * Number of slots in the other nodes of the IPv6 FIB trie.
+ */
+#define FIB6_NODE_SIZE (1 << FIB6_STRIDE)
+
+/**
+ * Maximum number of IPv6 routes.
+ */
+#define FIB6_MAX_ROUTES UINT16_MAX
+
+/**
+ * Size of the neighbor cache (must be a power of 2).
+ */
+#define NEIGH6_SIZE 256
+
+/**
+ * Minimum IPv6 MTU, limits the size of ICMPv6 errors (RFC 4443).
+ */
+#define IPV6_MIN_MTU 1280
+
+
+/**
+ * An IPv6 route.
+ */
+struct Fib6Route
+{
+  /**
+   * Destination prefix (host bits cleared).
+   */
+  struct in6_addr prefix;
+
+  /**
+   * Next hop, all zeros for directly connected networks.
+   */
+  struct in6_addr next_hop;
+
+  /**
+   * Outgoing interface.
+   */
+  uint16_t ifc_num;
+
+  /**
+   * Prefix length.
+   */
+  uint8_t len;
+};
+
+
+/**
+ * Slot of a node of the IPv6 FIB trie.  With controlled prefix
+ * expansion, every slot directly stores the longest route covering it
+ * at this level, so lookups never backtrack.
+ */
+struct Fib6Slot
+{
+  /**
+   * Index of the child node in #fib6_nodes, 0 for none.
+   */
+  uint32_t child;
+
+  /**
+   * Index + 1 of the route in #fib6_routes, 0 for none.
+   */
+  uint16_t route;
+
+  /**
+   * Prefix length of @e route.
+   */
+  uint8_t len;
+
+  uint8_t reserved;
+};
+
+
+/**
+ * Node of the IPv6 FIB trie below the root.
+ */
+struct Fib6Node
+{
+  struct Fib6Slot slots[FIB6_NODE_SIZE];
+};
+
+
+/**
+ * Entry in the IPv6 neighbor cache.
+ */
+struct Neighbor6
+{
+  /**
+   * IPv6 address of the neighbor.
+   */
+  struct in6_addr ip;
+
+  /**
+   * Its MAC address.
+   */
+  struct MacAddress mac;
+
+  /**
+   * Interface the neighbor is on, 0 if the entry is unused.
+   */
+  uint16_t ifc_num;
+};
+
+
+/**
+ * Root of the IPv6 FIB trie, #FIB6_ROOT_SIZE slots.
+ */
+static struct Fib6Slot *fib6_root;
+
+/**
+ * Trie nodes below the root; index 0 is unused.
+ */
+static struct Fib6Node *fib6_nodes;
+
+/**
+ * Number of used entries in #fib6_nodes.
+ */
+static uint32_t fib6_num_nodes;
+
+/**
+ * Allocated entries in #fib6_nodes.
+ */
+static uint32_t fib6_cap_nodes;
+
+/**
+ * IPv6 routes.
+ */
+static struct Fib6Route *fib6_routes;
+
+/**
+ * Number of entries in #fib6_routes.
+ */
+static unsigned int fib6_num_routes;
+
+/**
+ * IPv6 neighbor cache, open addressing with linear probing.
+ */
+static struct Neighbor6 neigh6[NEIGH6_SIZE];
+
+/**
+ * Neighbor used for next hops behind tunnel interfaces (the inner
+ * Ethernet header is stripped on encapsulation anyway).
+ */
+static const struct Neighbor6 tunnel_neighbor;
+
+
+/**
+ * Allocate a new, empty trie node.
+ *
+ * @return index of the node in #fib6_nodes
+ */
+static uint32_t
+fib6_node_alloc (void)
+{
+  if (fib6_num_nodes >= fib6_cap_nodes)
+  {
+    fib6_cap_nodes = (0 == fib6_cap_nodes) ? 64 : 2 * fib6_cap_nodes;
+    fib6_nodes = realloc (fib6_nodes,
+                          fib6_cap_nodes * sizeof (struct Fib6Node));
+    if (NULL == fib6_nodes)
+      abort ();
+  }
+  memset (&fib6_nodes[fib6_num_nodes],
+          0,
+          sizeof (struct Fib6Node));
+  return fib6_num_nodes++;
+}
+
+
+/**
+ * Store route @a route of length @a len in @a count slots starting at
+ * @a slots, unless a slot already has a longer route.
+ *
+ * @param slots first slot to update
+ * @param count number of slots to update
+ * @param route index + 1 of the route
+ * @param len prefix length of the route
+ */
+static void
+fib6_expand (struct Fib6Slot *slots,
+             unsigned int count,
+             uint16_t route,
+             uint8_t len)
+{
+  for (unsigned int i = 0; i < count; i++)
+  {
+    if (slots[i].len > len)
+      continue;
+    slots[i].route = route;
+    slots[i].len = len;
+  }
+}
+
+
+/**
+ * Insert route @a ri into the trie.
+ *
+ * @param ri index of the route in #fib6_routes
+ */
+static void
+fib6_insert (unsigned int ri)
+{
+  const struct Fib6Route *r = &fib6_routes[ri];
+  const uint8_t *a = r->prefix.s6_addr;
+  unsigned int idx = (a[0] << 8) | a[1];
+  unsigned int span;
+  uint32_t node;
+  unsigned int d;
+
+  if (r->len <= FIB6_ROOT_STRIDE)
+  {
+    span = 1u << (FIB6_ROOT_STRIDE - r->len);
+    fib6_expand (&fib6_root[idx & ~(span - 1)],
+                 span,
+                 ri + 1,
+                 r->len);
+    return;
+  }
+  if (0 == fib6_root[idx].child)
+  {
+    node = fib6_node_alloc ();
+    fib6_root[idx].child = node;
+  }
+  node = fib6_root[idx].child;
+  for (d = FIB6_ROOT_STRIDE; r->len > d + FIB6_STRIDE; d += FIB6_STRIDE)
+  {
+    idx = a[d / 8];
+    if (0 == fib6_nodes[node].slots[idx].child)
+    {
+      uint32_t child = fib6_node_alloc (); /* may move fib6_nodes */
+
+      fib6_nodes[node].slots[idx].child = child;
+    }
+    node = fib6_nodes[node].slots[idx].child;
+  }
+  span = 1u << (d + FIB6_STRIDE - r->len);
+  fib6_expand (&fib6_nodes[node].slots[a[d / 8] & ~(span - 1)],
+               span,
+               ri + 1,
+               r->len);
+}
+
+
+/**
+ * Rebuild the trie from #fib6_routes (after a route was removed).
+ */
+static void
+fib6_rebuild (void)
+{
+  memset (fib6_root,
+          0,
+          FIB6_ROOT_SIZE * sizeof (struct Fib6Slot));
+  fib6_num_nodes = 1;
+  for (unsigned int i = 0; i < fib6_num_routes; i++)
+    fib6_insert (i);
+}
+
+
+/**
+ * Clear the host bits of @a addr beyond @a len.
+ *
+ * @param[in,out] addr address to mask
+ * @param len prefix length
+ */
+static void
+ip6_mask (struct in6_addr *addr,
+          uint8_t len)
+{
+  for (unsigned int i = 0; i < 16; i++)
+  {
+    if (len >= 8)
+    {
+      len -= 8;
+      continue;
+    }
+    addr->s6_addr[i] &= (uint8_t) (0xFF00 >> len);
+    len = 0;
+  }
+}
+
+
+/**
+ * Find the route for @a prefix / @a len.
+ *
+ * @param prefix masked prefix
+ * @param len prefix length
+ * @return index in #fib6_routes, -1 if not found
+ */
+static int
+fib6_find (const struct in6_addr *prefix,
+           uint8_t len)
+{
+  for (unsigned int i = 0; i < fib6_num_routes; i++)
+    if ( (fib6_routes[i].len == len) &&
+         (0 == memcmp (&fib6_routes[i].prefix,
+                       prefix,
+                       sizeof (*prefix))) )
+      return i;
+  return -1;
+}
+
+
+/**
+ * Add or replace an IPv6 route.
+ *
+ * @param prefix destination prefix
+ * @param len prefix length
+ * @param next_hop next hop, all zeros for on-link
+ * @param ifc_num outgoing interface
+ * @return 0 on success
+ */
+static int
+fib6_add (const struct in6_addr *prefix,
+          uint8_t len,
+          const struct in6_addr *next_hop,
+          uint16_t ifc_num)
+{
+  struct Fib6Route r;
+  int ri;
+
+  if (NULL == fib6_root)
+  {
+    fib6_root = calloc (FIB6_ROOT_SIZE,
+                        sizeof (struct Fib6Slot));
+    if (NULL == fib6_root)
+      abort ();
+    fib6_num_nodes = 1;
+  }
+  memset (&r, 0, sizeof (r));
+  r.prefix = *prefix;
+  ip6_mask (&r.prefix,
+            len);
+  r.len = len;
+  r.next_hop = *next_hop;
+  r.ifc_num = ifc_num;
+  ri = fib6_find (&r.prefix,
+                  len);
+  if (-1 != ri)
+  {
+    fib6_routes[ri] = r;
+    return 0;
+  }
+  if (fib6_num_routes >= FIB6_MAX_ROUTES)
+  {
+    fprintf (stderr,
+             "IPv6 routing table full\n");
+    return 1;
+  }
+  fib6_routes = realloc (fib6_routes,
+                         (fib6_num_routes + 1) * sizeof (struct Fib6Route));
+  if (NULL == fib6_routes)
+    abort ();
+  fib6_routes[fib6_num_routes] = r;
+  fib6_insert (fib6_num_routes++);
+  return 0;
+}
+
+
+/**
+ * Remove an IPv6 route.
+ *
+ * @param prefix destination prefix
+ * @param len prefix length
+ * @return 0 on success, 1 if there is no such route
+ */
+static int
+fib6_del (const struct in6_addr *prefix,
+          uint8_t len)
+{
+  struct in6_addr p = *prefix;
+  int ri;
+
+  ip6_mask (&p,
+            len);
+  ri = fib6_find (&p,
+                  len);
+  if (-1 == ri)
+    return 1;
+  fib6_routes[ri] = fib6_routes[--fib6_num_routes];
+  fib6_rebuild ();
+  return 0;
+}
+
+
+/**
+ * Longest prefix match of @a dst in the IPv6 FIB.
+ *
+ * @param dst destination address
+ * @return NULL if no route matches
+ */
+static const struct Fib6Route *
+fib6_lookup (const struct in6_addr *dst)
+{
+  const uint8_t *a = dst->s6_addr;
+  const struct Fib6Slot *slot;
+  unsigned int best;
+  unsigned int d;
+  uint32_t node;
+
+  if (NULL == fib6_root)
+    return NULL;
+  slot = &fib6_root[(a[0] << 8) | a[1]];
+  best = slot->route;
+  node = slot->child;
+  for (d = FIB6_ROOT_STRIDE / 8; 0 != node; d++)
+  {
+    slot = &fib6_nodes[node].slots[a[d]];
+    if (0 != slot->route)
+      best = slot->route;
+    node = slot->child;
+  }
+  if (0 == best)
+    return NULL;
+  return &fib6_routes[best - 1];
+}
+
+
+/**
+ * Home slot of @a ip in #neigh6.
+ *
+ * @param ip address to hash
+ * @return slot index
+ */
+static unsigned int
+neigh6_hash (const struct in6_addr *ip)
+{
+  uint32_t v;
+
+  memcpy (&v,
+          &ip->s6_addr[12],
+          sizeof (v));
+  return (v * 2654435761u) >> 24 & (NEIGH6_SIZE - 1);
+}
+
+
+/**
+ * Look up @a ip on interface @a ifc_num in the neighbor cache.
+ *
+ * @param ip address to look up
+ * @param ifc_num interface the neighbor must be on
+ * @return NULL if not found
+ */
+static const struct Neighbor6 *
+neigh6_lookup (const struct in6_addr *ip,
+               uint16_t ifc_num)
+{
+  unsigned int h = neigh6_hash (ip);
+
+  for (unsigned int i = 0; i < NEIGH6_SIZE; i++)
+  {
+    const struct Neighbor6 *n = &neigh6[(h + i) & (NEIGH6_SIZE - 1)];
+
+    if (0 == n->ifc_num)
+      return NULL;
+    if ( (n->ifc_num == ifc_num) &&
+         (0 == memcmp (&n->ip,
+                       ip,
+                       sizeof (*ip))) )
+      return n;
+  }
+  return NULL;
+}
+
+
+/**
+ * Learn (or update) that @a ip is at @a mac on interface @a ifc_num.
+ * If the cache is full, the entry in the home slot of @a ip is
+ * replaced.
+ *
+ * @param ip address of the neighbor
+ * @param mac its MAC
+ * @param ifc_num interface it is on
+ */
+static void
+neigh6_learn (const struct in6_addr *ip,
+              const struct MacAddress *mac,
+              uint16_t ifc_num)
+{
+  unsigned int h = neigh6_hash (ip);
+  struct Neighbor6 *n = &neigh6[h];
+
+  for (unsigned int i = 0; i < NEIGH6_SIZE; i++)
+  {
+    struct Neighbor6 *c = &neigh6[(h + i) & (NEIGH6_SIZE - 1)];
+
+    if ( (0 == c->ifc_num) ||
+         ( (c->ifc_num == ifc_num) &&
+           (0 == memcmp (&c->ip,
+                         ip,
+                         sizeof (*ip))) ) )
+    {
+      n = c;
+      break;
+    }
+  }
+  n->ip = *ip;
+  n->mac = *mac;
+  n->ifc_num = ifc_num;
+}
+
+
+/**
+ * Is @a a a multicast address?
+ *
+ * @param a address to check
+ * @return true for ff00::/8
+ */
+static bool
+ip6_is_multicast (const struct in6_addr *a)
+{
+  return 0xFF == a->s6_addr[0];
+}
+
+
+/**
+ * Is @a a the unspecified address "::"?
+ *
+ * @param a address to check
+ * @return true if all zeros
+ */
+static bool
+ip6_is_unspecified (const struct in6_addr *a)
+{
+  static const struct in6_addr any;
+
+  return 0 == memcmp (a,
+                      &any,
+                      sizeof (any));
+}
+
+
+/**
+ * Is @a a one of the addresses of @a ifc?
+ *
+ * @param ifc interface to check
+ * @param a address to check
+ * @return true if @a a is the link-local or global address of @a ifc
+ */
+static bool
+ifc6_has_address (const struct Interface *ifc,
+                  const struct in6_addr *a)
+{
+  if (0 == memcmp (a,
+                   &ifc->ll6,
+                   sizeof (*a)))
+    return true;
+  return (0 != ifc->ip6_len) &&
+         (0 == memcmp (a,
+                       &ifc->ip6,
+                       sizeof (*a)));
+}
+
+
+/**
+ * Pick the source address of @a ifc for talking to @a dst.
+ *
+ * @param ifc interface to send on
+ * @param dst destination
+ * @return the global address, or the link-local one if @a ifc has no
+ *         global address or @a dst is link-local
+ */
+static const struct in6_addr *
+ifc6_source (const struct Interface *ifc,
+             const struct in6_addr *dst)
+{
+  if ( (0 == ifc->ip6_len) ||
+       ( (0xFE == dst->s6_addr[0]) &&
+         (0x80 == (dst->s6_addr[1] & 0xC0)) ) )
+    return &ifc->ll6;
+  return &ifc->ip6;
+}
+
+
+/**
+ * Derive the EUI-64 link-local address from @a mac.
+ *
+ * @param mac MAC of the interface
+ * @param[out] ll6 set to fe80::/64 plus the EUI-64 of @a mac
+ */
+static void
+ll6_from_mac (const struct MacAddress *mac,
+              struct in6_addr *ll6)
+{
+  memset (ll6,
+          0,
+          sizeof (*ll6));
+  ll6->s6_addr[0] = 0xFE;
+  ll6->s6_addr[1] = 0x80;
+  ll6->s6_addr[8] = mac->mac[0] ^ 0x02;
+  ll6->s6_addr[9] = mac->mac[1];
+  ll6->s6_addr[10] = mac->mac[2];
+  ll6->s6_addr[11] = 0xFF;
+  ll6->s6_addr[12] = 0xFE;
+  ll6->s6_addr[13] = mac->mac[3];
+  ll6->s6_addr[14] = mac->mac[4];
+  ll6->s6_addr[15] = mac->mac[5];
+}
+
+
+/**
+ * Compute the ICMPv6 checksum of @a msg.
+ *
+ * @param src source address
+ * @param dst destination address
+ * @param msg ICMPv6 message, with the checksum field set to zero
+ *        (or to the received checksum when verifying)
+ * @param msg_size number of bytes in @a msg
+ * @return checksum; 0 when verifying a message with a valid checksum
+ */
+static uint16_t
+icmp6_checksum (const struct in6_addr *src,
+                const struct in6_addr *dst,
+                const void *msg,
+                size_t msg_size)
+{
+  struct
+  {
+    struct in6_addr src;
+    struct in6_addr dst;
+    uint32_t len;
+    uint8_t zero[3];
+    uint8_t next_header;
+  } ph;
+  uint32_t sum;
+
+  memset (&ph,
+          0,
+          sizeof (ph));
+  ph.src = *src;
+  ph.dst = *dst;
+  ph.len = htonl (msg_size);
+  ph.next_header = IPPROTO_ICMPV6;
+  sum = GNUNET_CRYPTO_crc16_step (0,
+                                  &ph,
+                                  sizeof (ph));
+  sum = GNUNET_CRYPTO_crc16_step (sum,
+                                  msg,
+                                  msg_size);
+  return GNUNET_CRYPTO_crc16_finish (sum);
+}
+
+
+/**
+ * Send ICMPv6 message @a msg from the router.  Fills in the checksum.
+ *
+ * @param ifc interface to send on
+ * @param dst_mac destination MAC
+ * @param src source address
+ * @param dst destination address
+ * @param hop_limit hop limit to use
+ * @param msg ICMPv6 message, starting with a #Icmp6Header
+ * @param msg_size number of bytes in @a msg
+ */
+static void
+icmp6_send (struct Interface *ifc,
+            const struct MacAddress *dst_mac,
+            const struct in6_addr *src,
+            const struct in6_addr *dst,
+            uint8_t hop_limit,
+            void *msg,
+            size_t msg_size)
+{
+  char packet[sizeof (struct IPv6Header) + msg_size];
+  struct IPv6Header ip6;
+  struct Icmp6Header hdr;
+
+  memcpy (&hdr,
+          msg,
+          sizeof (hdr));
+  hdr.crc = 0;
+  memcpy (msg,
+          &hdr,
+          sizeof (hdr));
+  hdr.crc = icmp6_checksum (src,
+                            dst,
+                            msg,
+                            msg_size);
+  memcpy (msg,
+          &hdr,
+          sizeof (hdr));
+  memset (&ip6,
+          0,
+          sizeof (ip6));
+  ip6.ver_tc_flow = htonl (6 << 28);
+  ip6.payload_length = htons (msg_size);
+  ip6.next_header = IPPROTO_ICMPV6;
+  ip6.hop_limit = hop_limit;
+  ip6.source_address = *src;
+  ip6.destination_address = *dst;
+  memcpy (packet,
+          &ip6,
+          sizeof (ip6));
+  memcpy (&packet[sizeof (ip6)],
+          msg,
+          msg_size);
+  forward_frame_payload_to (ifc,
+                            dst_mac,
+                            ETH_P_IPV6,
+                            packet,
+                            sizeof (packet));
+}
+
+
+/**
+ * Send an ICMPv6 error about the packet @a ip6 / @a payload back to
+ * its source (RFC 4443).  No error is sent about errors, multicast
+ * packets or packets without a source.
+ *
+ * @param origin interface the packet was received on
+ * @param eh Ethernet header of the packet
+ * @param ip6 IPv6 header of the packet
+ * @param payload payload of the packet
+ * @param payload_size number of bytes in @a payload
+ * @param type ICMPv6 type
+ * @param code ICMPv6 code
+ * @param data type-specific data (in host byte order)
+ */
+static void
+icmp6_error (struct Interface *origin,
+             const struct EthernetHeader *eh,
+             const struct IPv6Header *ip6,
+             const void *payload,
+             size_t payload_size,
+             uint8_t type,
+             uint8_t code,
+             uint32_t data)
+{
+  size_t quote = sizeof (*ip6) + payload_size;
+  size_t max = IPV6_MIN_MTU - sizeof (*ip6) - sizeof (struct Icmp6Header);
+  struct Icmp6Header hdr;
+
+  if ( ip6_is_unspecified (&ip6->source_address) ||
+       ip6_is_multicast (&ip6->source_address) ||
+       ip6_is_multicast (&ip6->destination_address) )
+    return;
+  if ( (IPPROTO_ICMPV6 == ip6->next_header) &&
+       (payload_size > 0) &&
+       (((const uint8_t *) payload)[0] < ICMP6TYPE_ECHO_REQUEST) )
+    return;
+  if (quote > max)
+    quote = max;
+  {
+    char msg[sizeof (hdr) + quote];
+
+    hdr.type = type;
+    hdr.code = code;
+    hdr.crc = 0;
+    hdr.data = htonl (data);
+    memcpy (msg,
+            &hdr,
+            sizeof (hdr));
+    memcpy (&msg[sizeof (hdr)],
+            ip6,
+            sizeof (*ip6));
+    memcpy (&msg[sizeof (hdr) + sizeof (*ip6)],
+            payload,
+            quote - sizeof (*ip6));
+    icmp6_send (origin,
+                &eh->src,
+                ifc6_source (origin,
+                             &ip6->source_address),
+                &ip6->source_address,
+                64,
+                msg,
+                sizeof (msg));
+  }
+}
+
+
+/**
+ * Send a neighbor solicitation for @a target on @a ifc to the
+ * solicited-node multicast group of @a target.
+ *
+ * @param ifc interface to send on
+ * @param target address to resolve
+ */
+static void
+nd_solicit (struct Interface *ifc,
+            const struct in6_addr *target)
+{
+  struct NdMessage ns;
+  struct in6_addr dst;
+  struct MacAddress dst_mac = { { 0x33, 0x33, 0xFF } };
+
+  memset (&ns,
+          0,
+          sizeof (ns));
+  ns.hdr.type = ICMP6TYPE_NEIGHBOR_SOLICITATION;
+  ns.target = *target;
+  ns.opt_type = ND_OPT_SOURCE_LINKADDR;
+  ns.opt_len = 1;
+  ns.opt_mac = ifc->mac;
+  memset (&dst,
+          0,
+          sizeof (dst));
+  dst.s6_addr[0] = 0xFF;
+  dst.s6_addr[1] = 0x02;
+  dst.s6_addr[11] = 0x01;
+  dst.s6_addr[12] = 0xFF;
+  memcpy (&dst.s6_addr[13],
+          &target->s6_addr[13],
+          3);
+  memcpy (&dst_mac.mac[3],
+          &target->s6_addr[13],
+          3);
+  icmp6_send (ifc,
+              &dst_mac,
+              ifc6_source (ifc,
+                           target),
+              &dst,
+              255,
+              &ns,
+              sizeof (ns));
+}
+
+
+/**
+ * Find the link-layer address option of type @a type in the options
+ * of a neighbor discovery message.
+ *
+ * @param opts first option
+ * @param opts_size number of bytes of options
+ * @param type option type to look for
+ * @param[out] mac set to the address in the option
+ * @return true if found
+ */
+static bool
+nd_find_linkaddr (const uint8_t *opts,
+                  size_t opts_size,
+                  uint8_t type,
+                  struct MacAddress *mac)
+{
+  while (opts_size >= 8)
+  {
+    size_t len = opts[1] * 8;
+
+    if ( (0 == len) ||
+         (len > opts_size) )
+      return false;
+    if (type == opts[0])
+    {
+      memcpy (mac,
+              &opts[2],
+              sizeof (*mac));
+      return true;
+    }
+    opts += len;
+    opts_size -= len;
+  }
+  return false;
+}
+
+
+/**
+ * Process a neighbor solicitation or advertisement (RFC 4861): learn
+ * the sender and answer solicitations for our addresses.
+ *
+ * @param ifc interface we received the message on
+ * @param eh Ethernet header of the message
+ * @param ip6 IPv6 header of the message
+ * @param payload the ICMPv6 message
+ * @param payload_size number of bytes in @a payload
+ */
+static void
+nd_input (struct Interface *ifc,
+          const struct EthernetHeader *eh,
+          const struct IPv6Header *ip6,
+          const uint8_t *payload,
+          size_t payload_size)
+{
+  size_t base = sizeof (struct Icmp6Header) + sizeof (struct in6_addr);
+  struct in6_addr target;
+  struct MacAddress mac;
+
+  if ( (255 != ip6->hop_limit) ||
+       (payload_size < base) ||
+       (0 != payload[1]) ||
+       (0 != icmp6_checksum (&ip6->source_address,
+                             &ip6->destination_address,
+                             payload,
+                             payload_size)) )
+    return;
+  memcpy (&target,
+          &payload[sizeof (struct Icmp6Header)],
+          sizeof (target));
+  if (ICMP6TYPE_NEIGHBOR_ADVERTISEMENT == payload[0])
+  {
+    if (! nd_find_linkaddr (&payload[base],
+                            payload_size - base,
+                            ND_OPT_TARGET_LINKADDR,
+                            &mac))
+      mac = eh->src;
+    neigh6_learn (&target,
+                  &mac,
+                  ifc->ifc_num);
+    return;
+  }
+  /* neighbor solicitation */
+  if (! nd_find_linkaddr (&payload[base],
+                          payload_size - base,
+                          ND_OPT_SOURCE_LINKADDR,
+                          &mac))
+    mac = eh->src;
+  if (! ip6_is_unspecified (&ip6->source_address))
+    neigh6_learn (&ip6->source_address,
+                  &mac,
+                  ifc->ifc_num);
+  if (! ifc6_has_address (ifc,
+                          &target))
+    return;
+  {
+    struct NdMessage na;
+    struct in6_addr dst = ip6->source_address;
+    uint8_t flags = ND_NA_FLAG_ROUTER | ND_NA_FLAG_OVERRIDE;
+
+    if (ip6_is_unspecified (&dst))
+    {
+      /* duplicate address detection: answer to all-nodes */
+      inet_pton (AF_INET6,
+                 "ff02::1",
+                 &dst);
+      mac = (struct MacAddress) { { 0x33, 0x33, 0, 0, 0, 1 } };
+    }
+    else
+    {
+      flags |= ND_NA_FLAG_SOLICITED;
+    }
+    memset (&na,
+            0,
+            sizeof (na));
+    na.hdr.type = ICMP6TYPE_NEIGHBOR_ADVERTISEMENT;
+    memcpy (&na.hdr.data,
+            &flags,
+            sizeof (flags));
+    na.target = target;
+    na.opt_type = ND_OPT_TARGET_LINKADDR;
+    na.opt_len = 1;
+    na.opt_mac = ifc->mac;
+    icmp6_send (ifc,
+                &mac,
+                &target,
+                &dst,
+                255,
+                &na,
+                sizeof (na));
+  }
+}
+
+
+/**
+ * Process an IPv6 packet addressed to the router itself.  We only
+ * answer echo requests.
+ *
+ * @param ifc interface we received the packet on
+ * @param eh Ethernet header of the packet
+ * @param ip6 IPv6 header of the packet
+ * @param payload payload of the packet
+ * @param payload_size number of bytes in @a payload
+ */
+static void
+ipv6_local (struct Interface *ifc,
+            const struct EthernetHeader *eh,
+            const struct IPv6Header *ip6,
+            const uint8_t *payload,
+            size_t payload_size)
+{
+  if ( (IPPROTO_ICMPV6 != ip6->next_header) ||
+       (payload_size < sizeof (struct Icmp6Header)) ||
+       (ICMP6TYPE_ECHO_REQUEST != payload[0]) ||
+       (payload_size + sizeof (*ip6) + sizeof (*eh) > ifc->mtu) ||
+       (0 != icmp6_checksum (&ip6->source_address,
+                             &ip6->destination_address,
+                             payload,
+                             payload_size)) )
+    return;
+  {
+    char reply[payload_size];
+
+    memcpy (reply,
+            payload,
+            payload_size);
+    reply[0] = ICMP6TYPE_ECHO_REPLY;
+    icmp6_send (ifc,
+                &eh->src,
+                &ip6->destination_address,
+                &ip6->source_address,
+                64,
+                reply,
+                payload_size);
+  }
+}
+
+
+/**
+ * Forward an IPv6 packet: local delivery, hop limit, FIB lookup,
+ * neighbor resolution and ICMPv6 errors.
+ *
+ * @param origin interface we received the packet on
+ * @param eh Ethernet header of the packet
+ * @param ip6 IPv6 header of the packet
+ * @param payload payload of the packet
+ * @param payload_size number of bytes in @a payload
+ */
+static void
+route6 (struct Interface *origin,
+        const struct EthernetHeader *eh,
+        const struct IPv6Header *ip6,
+        const uint8_t *payload,
+        size_t payload_size)
+{
+  const struct Fib6Route *r;
+  const struct Neighbor6 *n;
+  const struct in6_addr *next_hop;
+  struct Interface *out;
+  struct IPv6Header hdr;
+
+  if ( (IPPROTO_ICMPV6 == ip6->next_header) &&
+       (payload_size > 0) &&
+       ( (ICMP6TYPE_NEIGHBOR_SOLICITATION == payload[0]) ||
+         (ICMP6TYPE_NEIGHBOR_ADVERTISEMENT == payload[0]) ) )
+  {
+    nd_input (origin,
+              eh,
+              ip6,
+              payload,
+              payload_size);
+    return;
+  }
+  if (ip6_is_multicast (&ip6->destination_address))
+    return; /* no multicast routing */
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    if (ifc6_has_address (&gifc[i],
+                          &ip6->destination_address))
+    {
+      ipv6_local (origin,
+                  eh,
+                  ip6,
+                  payload,
+                  payload_size);
+      return;
+    }
+  }
+  if (ip6->hop_limit <= 1)
+  {
+    icmp6_error (origin,
+                 eh,
+                 ip6,
+                 payload,
+                 payload_size,
+                 ICMP6TYPE_TIME_EXCEEDED,
+                 0,
+                 0);
+    return;
+  }
+  r = fib6_lookup (&ip6->destination_address);
+  if (NULL == r)
+  {
+    icmp6_error (origin,
+                 eh,
+                 ip6,
+                 payload,
+                 payload_size,
+                 ICMP6TYPE_DESTINATION_UNREACHABLE,
+                 ICMP6CODE_NO_ROUTE,
+                 0);
+    return;
+  }
+  out = &gifc[r->ifc_num - 1];
+  if (TUNNEL_NONE != tunnels[out->ifc_num].mode)
+    tunnel_mtu (out);
+  if (sizeof (*eh) + sizeof (*ip6) + payload_size > out->mtu)
+  {
+    /* IPv6 routers never fragment */
+    icmp6_error (origin,
+                 eh,
+                 ip6,
+                 payload,
+                 payload_size,
+                 ICMP6TYPE_PACKET_TOO_BIG,
+                 0,
+                 out->mtu - sizeof (*eh));
+    return;
+  }
+  next_hop = ip6_is_unspecified (&r->next_hop)
+             ? &ip6->destination_address
+             : &r->next_hop;
+  /* tunnels are point-to-point, no neighbor discovery */
+  n = (TUNNEL_NONE != tunnels[out->ifc_num].mode)
+      ? &tunnel_neighbor
+      : neigh6_lookup (next_hop,
+                       out->ifc_num);
+  if (NULL == n)
+  {
+    nd_solicit (out,
+                next_hop);
+    return;
+  }
+  hdr = *ip6;
+  hdr.hop_limit--;
+  {
+    char packet[sizeof (hdr) + payload_size];
+
+    memcpy (packet,
+            &hdr,
+            sizeof (hdr));
+    memcpy (&packet[sizeof (hdr)],
+            payload,
+            payload_size);
+    forward_frame_payload_to (out,
+                              &n->mac,
+                              ETH_P_IPV6,
+                              packet,
+                              sizeof (packet));
+  }
+}
+
+
+/**
+ * What to do with packets carrying a label.
+ */
+enum LabelOperation
+{
+  /**
+   * Unknown label, drop.
+   */
+  LABEL_NONE = 0,
+
+  /**
+   * Replace the top label (and optionally push another one).
+   */
+  LABEL_SWAP,
+
+  /**
+   * Remove the top label and process what is below.
+   */
+  LABEL_POP
+};
+
+
+/**
+ * Entry of the label table, indexed by the incoming label.
+ */
+struct LabelEntry
+{
+  /**
+   * Outgoing label for #LABEL_SWAP.
+   */
+  uint32_t out_label;
+
+  /**
+   * Label pushed on top of @e out_label, if @e push is set.
+   */
+  uint32_t push_label;
+
+  /**
+   * Next hop for #LABEL_SWAP.
+   */
+  struct in_addr next_hop;
+
+  /**
+   * Outgoing interface for #LABEL_SWAP.
+   */
+  uint16_t ifc_num;
+
+  /**
+   * A `enum LabelOperation`.
+   */
+  uint8_t op;
+
+  /**
+   * Push @e push_label after swapping?
+   */
+  bool push;
+
+  /**
+   * Statistics.
+   */
+  uint64_t packets;
+  uint64_t bytes;
+};
+
+
+/**
+ * Counters for labelled traffic we could not forward.
+ */
+struct MplsStats
+{
+  uint64_t unknown_label;
+  uint64_t ttl_expired;
+  uint64_t no_arp;
+  uint64_t too_big;
+  uint64_t malformed;
+};
+
+
+/**
+ * Label table, #MPLS_NUM_LABELS entries, allocated on first use.
+ */
+static struct LabelEntry *label_table;
+
+/**
+ * Drop counters of the label switching path.
+ */
+static struct MplsStats mpls_stats;
+
+
+/**
+ * Find the MAC of @a ip on @a ifc in the ARP cache.  If it is not
+ * known, send an ARP request for it.
+ *
+ * @param ifc interface @a ip is on
+ * @param ip address to resolve
+ * @param[out] mac set to the MAC of @a ip
+ * @return true if @a mac was set
+ */
+static bool
+arp_resolve (struct Interface *ifc,
+             const struct in_addr *ip,
+             struct MacAddress *mac)
+{
+  struct EthernetHeader eh;
+  struct ArpHeaderEthernetIPv4 ah;
+  char frame[sizeof (eh) + sizeof (ah)];
+
+  for (int i = 0; i < MAX_ENTRIES; i++)
+  {
+    if ( (table[i].ifc_num == ifc->ifc_num) &&
+         (0 == ipCmp (&table[i].ip,
+                      ip)) )
+    {
+      *mac = table[i].mac;
+      return true;
+    }
+  }
+  eh.dst = broadcastMac;
+  eh.src = ifc->mac;
+  eh.tag = htons (ETH_P_ARP);
+  ah.htype = htons (1);
+  ah.ptype = htons (ETH_P_IPV4);
+  ah.hlen = MAC_ADDR_SIZE;
+  ah.plen = sizeof (struct in_addr);
+  ah.oper = htons (1);
+  ah.sender_ha = ifc->mac;
+  ah.sender_pa = ifc->ip;
+  ah.target_ha = nullMac;
+  ah.target_pa = *ip;
+  memcpy (frame,
+          &eh,
+          sizeof (eh));
+  memcpy (&frame[sizeof (eh)],
+          &ah,
+          sizeof (ah));
+  forward_to (ifc,
+              frame,
+              sizeof (frame));
+  return false;
+}
+
+
+/**
+ * Process a labelled frame: one direct table lookup per label, no IP
+ * processing unless the last label is popped.
+ *
+ * @param ifc interface we received the frame on
+ * @param eh Ethernet header of the frame
+ * @param stack label stack followed by the payload
+ * @param stack_size number of bytes in @a stack
+ */
+static void
+mpls_input (struct Interface *ifc,
+            const struct EthernetHeader *eh,
+            const uint8_t *stack,
+            size_t stack_size)
+{
+  struct LabelEntry *le;
+  struct Interface *out;
+  struct MacAddress mac;
+  uint32_t lse;
+  uint32_t label;
+  uint8_t ttl;
+  uint8_t tc;
+  bool bottom;
+
+  for (;;)
+  {
+    if (stack_size < MPLS_HEADER_SIZE)
+    {
+      mpls_stats.malformed++;
+      return;
+    }
+    memcpy (&lse,
+            stack,
+            sizeof (lse));
+    lse = ntohl (lse);
+    label = lse >> 12;
+    tc = (lse >> 9) & 7;
+    bottom = 0 != (lse & 0x100);
+    ttl = lse & 0xFF;
+    if ( (MPLS_LABEL_IPV4_NULL == label) ||
+         (MPLS_LABEL_IPV6_NULL == label) )
+    {
+      le = NULL;
+    }
+    else
+    {
+      le = (NULL == label_table) ? NULL : &label_table[label];
+      if ( (NULL == le) ||
+           (LABEL_NONE == le->op) )
+      {
+        mpls_stats.unknown_label++;
+        return;
+      }
+      le->packets++;
+      le->bytes += stack_size;
+    }
+    if ( (NULL != le) &&
+         (LABEL_SWAP == le->op) )
+      break;
+    /* pop */
+    stack += MPLS_HEADER_SIZE;
+    stack_size -= MPLS_HEADER_SIZE;
+    if (! bottom)
+      continue;
+    if (stack_size >= sizeof (struct IPv4Header) &&
+        (4 == stack[0] >> 4))
+    {
+      struct IPv4Header ip;
+
+      memcpy (&ip,
+              stack,
+              sizeof (ip));
+      route (ifc,
+             &ip,
+             &stack[sizeof (ip)],
+             stack_size - sizeof (ip),
+             *eh);
+    }
+    else if (stack_size >= sizeof (struct IPv6Header) &&
+             (6 == stack[0] >> 4))
+    {
+      struct IPv6Header ip6;
+      size_t payload_size;
+
+      memcpy (&ip6,
+              stack,
+              sizeof (ip6));
+      payload_size = ntohs (ip6.payload_length);
+      if (payload_size > stack_size - sizeof (ip6))
+      {
+        mpls_stats.malformed++;
+        return;
+      }
+      route6 (ifc,
+              eh,
+              &ip6,
+              &stack[sizeof (ip6)],
+              payload_size);
+    }
+    else
+    {
+      mpls_stats.malformed++;
+    }
+    return;
+  }
+  /* swap (and maybe push) */
+  if (ttl <= 1)
+  {
+    mpls_stats.ttl_expired++;
+    return;
+  }
+  out = &gifc[le->ifc_num - 1];
+  {
+    size_t extra = le->push ? MPLS_HEADER_SIZE : 0;
+    uint8_t frame[extra + stack_size];
+    uint32_t top;
+
+    if (sizeof (struct EthernetHeader) + sizeof (frame) > out->mtu)
+    {
+      mpls_stats.too_big++;
+      return;
+    }
+    if (! arp_resolve (out,
+                       &le->next_hop,
+                       &mac))
+    {
+      mpls_stats.no_arp++;
+      return;
+    }
+    top = mpls_entry (le->out_label,
+                      tc,
+                      bottom,
+                      ttl - 1);
+    if (le->push)
+    {
+      uint32_t outer = mpls_entry (le->push_label,
+                                   tc,
+                                   false,
+                                   ttl - 1);
+
+      memcpy (frame,
+              &outer,
+              sizeof (outer));
+    }
+    memcpy (&frame[extra],
+            &top,
+            sizeof (top));
+    memcpy (&frame[extra + MPLS_HEADER_SIZE],
+            &stack[MPLS_HEADER_SIZE],
+            stack_size - MPLS_HEADER_SIZE);
+    forward_frame_payload_to (out,
+                              &mac,
+                              ETH_P_MPLS_UC,
+                              frame,
+                              sizeof (frame));
+  }
+}
+
+
+/**
+ * IP identification for the outer header of encapsulated packets.
+ */
+static uint16_t tunnel_ip_id;
+
+
+static void
+tunnel_output (struct Interface *tun,
+               struct QueuedFrame *qf)
+{
+  struct Tunnel *t = &tunnels[tun->ifc_num];
+  const uint8_t *inner;
+  struct EthernetHeader eh;
+  struct IPv4Header outer;
+  struct Interface *under;
+  struct MacAddress mac;
+  struct in_addr next_hop;
+  uint16_t tag;
+
+  memcpy (&eh,
+          frame_data (qf),
+          sizeof (eh));
+  frame_pull (qf,
+              sizeof (eh));
+  tag = ntohs (eh.tag);
+  inner = frame_data (qf);
+  memset (&outer,
+          0,
+          sizeof (outer));
+  /* copy the DSCP of the inner packet so egress queueing can use it */
+  if ( (ETH_P_IPV4 == tag) &&
+       (qf->size >= sizeof (struct IPv4Header)) )
+    outer.diff_serv = inner[1] & ~3;
+  else if ( (ETH_P_IPV6 == tag) &&
+            (qf->size >= sizeof (struct IPv6Header)) )
+    outer.diff_serv = ((inner[0] << 4) | (inner[1] >> 4)) & ~3;
+  under = tunnel_underlay (t,
+                           &next_hop);
+  if (NULL == under)
+  {
+    t->no_route++;
+    frame_free (qf);
+    return;
+  }
+  if (TUNNEL_GRE == t->mode)
+  {
+    struct GreHeader gre;
+
+    gre.flags_version = htons (0);
+    gre.protocol = htons (tag);
+    memcpy (frame_push (qf,
+                        sizeof (gre)),
+            &gre,
+            sizeof (gre));
+    outer.protocol = IPPROTO_GRE;
+  }
+  else if (ETH_P_IPV4 == tag)
+    outer.protocol = IPPROTO_IPIP;
+  else if (ETH_P_IPV6 == tag)
+    outer.protocol = IPPROTO_IPV6;
+  else
+  {
+    t->malformed++;
+    frame_free (qf);
+    return;
+  }
+  if (sizeof (eh) + sizeof (outer) + qf->size > under->mtu)
+  {
+    t->too_big++;
+    frame_free (qf);
+    return;
+  }
+  if (! arp_resolve (under,
+                     &next_hop,
+                     &mac))
+  {
+    t->no_arp++;
+    frame_free (qf);
+    return;
+  }
+  outer.version = 4;
+  outer.header_length = sizeof (outer) / 4;
+  outer.total_length = htons (sizeof (outer) + qf->size);
+  outer.identification = htons (tunnel_ip_id++);
+  outer.ttl = 64;
+  outer.source_address = (0 != t->local.s_addr) ? t->local : under->ip;
+  outer.destination_address = t->remote;
+  outer.checksum = GNUNET_CRYPTO_crc16_n (&outer,
+                                          sizeof (outer));
+  memcpy (frame_push (qf,
+                      sizeof (outer)),
+          &outer,
+          sizeof (outer));
+  t->encap_packets++;
+  t->encap_bytes += qf->size;
+  forward_frame_to (under,
+                    &mac,
+                    ETH_P_IPV4,
+                    qf);
+}
+
+
+/**
+ * Check whether @a ip is addressed to one of our tunnels and if so,
+ * decapsulate it.  The inner packet is processed where it is in the
+ * received frame, as if it had arrived on the tunnel interface.
+ *
+ * @param eh Ethernet header of the packet
+ * @param ip outer IPv4 header
+ * @param payload payload of the outer packet
+ * @param payload_size number of bytes in @a payload
+ * @return true if the packet was for a tunnel (and was consumed)
+ */
+static bool
+tunnel_input (const struct EthernetHeader *eh,
+              const struct IPv4Header *ip,
+              const uint8_t *payload,
+              size_t payload_size)
+{
+  struct Interface *tun = NULL;
+  struct Tunnel *t = NULL;
+  size_t off = 0;
+  uint16_t tag;
+
+  if ( (IPPROTO_IPIP != ip->protocol) &&
+       (IPPROTO_IPV6 != ip->protocol) &&
+       (IPPROTO_GRE != ip->protocol) )
+    return false;
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    struct Tunnel *c = &tunnels[i + 1];
+    bool local = false;
+
+    if ( (TUNNEL_NONE == c->mode) ||
+         ((TUNNEL_GRE == c->mode) != (IPPROTO_GRE == ip->protocol)) ||
+         (c->remote.s_addr != ip->source_address.s_addr) )
+      continue;
+    if (0 != c->local.s_addr)
+      local = (c->local.s_addr == ip->destination_address.s_addr);
+    else
+      for (unsigned int j = 0; j < num_ifc; j++)
+        if (gifc[j].ip.s_addr == ip->destination_address.s_addr)
+          local = true;
+    if (local)
+    {
+      t = c;
+      tun = &gifc[i];
+      break;
+    }
+  }
+  if (NULL == t)
+    return false;
+  /* no reassembly of outer fragments, options are not expected */
+  if ( (sizeof (struct IPv4Header) != ip->header_length * 4) ||
+       (0 != (ntohs (ip->fragmentation_info) & 0x3FFF)) ||
+       (ntohs (ip->total_length) < sizeof (struct IPv4Header)) ||
+       (ntohs (ip->total_length) - sizeof (struct IPv4Header) > payload_size) )
+  {
+    t->malformed++;
+    return true;
+  }
+  payload_size = ntohs (ip->total_length) - sizeof (struct IPv4Header);
+  if (IPPROTO_GRE == ip->protocol)
+  {
+    struct GreHeader gre;
+    uint16_t flags;
+
+    if (payload_size < sizeof (gre))
+    {
+      t->malformed++;
+      return true;
+    }
+    memcpy (&gre,
+            payload,
+            sizeof (gre));
+    flags = ntohs (gre.flags_version);
+    if (0 != (flags & GRE_VERSION_MASK))
+    {
+      t->malformed++;
+      return true;
+    }
+    off = sizeof (gre);
+    if (0 != (flags & GRE_FLAG_CHECKSUM))
+      off += 4;
+    if (0 != (flags & GRE_FLAG_KEY))
+      off += 4;
+    if (0 != (flags & GRE_FLAG_SEQUENCE))
+      off += 4;
+    tag = ntohs (gre.protocol);
+  }
+  else
+  {
+    tag = (IPPROTO_IPIP == ip->protocol) ? ETH_P_IPV4 : ETH_P_IPV6;
+  }
+  if (off > payload_size)
+  {
+    t->malformed++;
+    return true;
+  }
+  payload += off;
+  payload_size -= off;
+  t->decap_packets++;
+  t->decap_bytes += payload_size;
+  if ( (ETH_P_IPV4 == tag) &&
+       (payload_size >= sizeof (struct IPv4Header)) &&
+       (4 == payload[0] >> 4) )
+  {
+    struct IPv4Header inner;
+
+    memcpy (&inner,
+            payload,
+            sizeof (inner));
+    if (! acl_permits (tun->ifc_num,
+                       ACL_IN,
+                       &inner,
+                       &payload[sizeof (inner)],
+                       payload_size - sizeof (inner)))
+      return true;
+    route (tun,
+           &inner,
+           &payload[sizeof (inner)],
+           payload_size - sizeof (inner),
+           *eh);
+  }
+  else if ( (ETH_P_IPV6 == tag) &&
+            (payload_size >= sizeof (struct IPv6Header)) &&
+            (6 == payload[0] >> 4) )
+  {
+    struct IPv6Header inner;
+
+    memcpy (&inner,
+            payload,
+            sizeof (inner));
+    if (ntohs (inner.payload_length) > payload_size - sizeof (inner))
+    {
+      t->malformed++;
+      return true;
+    }
+    route6 (tun,
+            eh,
+            &inner,
+            &payload[sizeof (inner)],
+            ntohs (inner.payload_length));
+  }
+  else
+  {
+    t->malformed++;
+  }
+  return true;
+}
+
+
+/**
+ * Maximum number of outgoing interfaces of a multicast route.
+ */
+#define MCAST_MAX_OIFS 32
+
+/**
+ * Number of hash buckets of the multicast forwarding cache.
+ */
+#define MCAST_HASH_SIZE 256
+
+
+/**
+ * Entry of the multicast forwarding cache.
+ */
+struct McastRoute
+{
+  /**
+   * Next entry in the same hash bucket.
+   */
+  struct McastRoute *next;
+
+  /**
+   * Source, 0 for a (*,G) entry.
+   */
+  struct in_addr source;
+
+  /**
+   * Group address.
+   */
+  struct in_addr group;
+
+  /**
+   * Interface packets must arrive on, 0 for any.
+   */
+  uint16_t iif;
+
+  /**
+   * Number of entries in @e oifs.
+   */
+  uint16_t num_oifs;
+
+  /**
+   * Outgoing interfaces.
+   */
+  uint16_t oifs[MCAST_MAX_OIFS];
+
+  /**
+   * Statistics.
+   */
+  uint64_t packets;
+  uint64_t bytes;
+};
+
+
+/**
+ * Counters for multicast packets we did not forward.
+ */
+struct McastStats
+{
+  uint64_t no_route;
+  uint64_t wrong_iif;
+  uint64_t ttl_expired;
+  uint64_t too_big;
+};
+
+
+/**
+ * Multicast forwarding cache, chained hash table over (S,G).
+ */
+static struct McastRoute *mfc[MCAST_HASH_SIZE];
+
+/**
+ * Drop counters of the multicast forwarding path.
+ */
+static struct McastStats mcast_stats;
+
+
+/**
+ * Check if @a ip is an IPv4 multicast address (224.0.0.0/4).
+ *
+ * @param ip address to check
+ * @return true if @a ip is multicast
+ */
+static bool
+ip4_is_multicast (struct in_addr ip)
+{
+  return 0xE0000000 == (ntohl (ip.s_addr) & 0xF0000000);
+}
+
+
+/**
+ * Get the hash bucket of (@a source, @a group).
+ *
+ * @param source source address, 0 for (*,G)
+ * @param group group address
+ * @return index into #mfc
+ */
+static unsigned int
+mfc_hash (struct in_addr source,
+          struct in_addr group)
+{
+  return ((uint32_t) ((source.s_addr ^ group.s_addr) * 2654435761u))
+         >> 24;
+}
+
+
+/**
+ * Find the entry for exactly (@a source, @a group).
+ *
+ * @param source source address, 0 for (*,G)
+ * @param group group address
+ * @return NULL if there is no such entry
+ */
+static struct McastRoute *
+mfc_find (struct in_addr source,
+          struct in_addr group)
+{
+  for (struct McastRoute *r = mfc[mfc_hash (source, group)];
+       NULL != r;
+       r = r->next)
+    if ( (r->source.s_addr == source.s_addr) &&
+         (r->group.s_addr == group.s_addr) )
+      return r;
+  return NULL;
+}
+
+
+/**
+ * Find the entry @a source sending to @a group matches: the (S,G)
+ * entry if there is one, otherwise the (*,G) entry.
+ *
+ * @param source source address of the packet
+ * @param group destination address of the packet
+ * @return NULL if the group is not routed
+ */
+static struct McastRoute *
+mfc_lookup (struct in_addr source,
+            struct in_addr group)
+{
+  static const struct in_addr any;
+  struct McastRoute *r;
+
+  r = mfc_find (source,
+                group);
+  if (NULL == r)
+    r = mfc_find (any,
+                  group);
+  return r;
+}
+
+
+/**
+ * Get (or create) the entry for (@a source, @a group).
+ *
+ * @param source source address, 0 for (*,G)
+ * @param group group address
+ * @return the entry
+ */
+static struct McastRoute *
+mfc_get (struct in_addr source,
+         struct in_addr group)
+{
+  struct McastRoute *r = mfc_find (source,
+                                   group);
+  unsigned int h;
+
+  if (NULL != r)
+    return r;
+  r = calloc (1,
+              sizeof (struct McastRoute));
+  if (NULL == r)
+    abort ();
+  h = mfc_hash (source,
+                group);
+  r->source = source;
+  r->group = group;
+  r->next = mfc[h];
+  mfc[h] = r;
+  return r;
+}
+
+
+/**
+ * Remove @a r from the multicast forwarding cache and free it.
+ *
+ * @param r entry to remove
+ */
+static void
+mfc_remove (struct McastRoute *r)
+{
+  struct McastRoute **pos = &mfc[mfc_hash (r->source,
+                                           r->group)];
+
+  while (*pos != r)
+    pos = &(*pos)->next;
+  *pos = r->next;
+  free (r);
+}
+
+
+/**
+ * Forward the multicast packet @a ip / @a payload received on @a ifc
+ * to the outgoing interfaces of its forwarding cache entry.  All
+ * copies share one packet buffer, only the Ethernet header is
+ * written per copy.
+ *
+ * @param ifc interface we received the packet on
+ * @param ip IPv4 header of the packet
+ * @param payload payload of the packet
+ * @param payload_size number of bytes in @a payload
+ */
+static void
+mcast_forward (struct Interface *ifc,
+               const struct IPv4Header *ip,
+               const uint8_t *payload,
+               size_t payload_size)
+{
+  struct McastRoute *r;
+  struct SharedPacket *sp;
+  struct IPv4Header hdr;
+  struct MacAddress mac;
+  uint32_t group = ntohl (ip->destination_address.s_addr);
+
+  /* 224.0.0.0/24 is link-local and never forwarded */
+  if (0xE0000000 == (group & 0xFFFFFF00))
+    return;
+  r = mfc_lookup (ip->source_address,
+                  ip->destination_address);
+  if (NULL == r)
+  {
+    mcast_stats.no_route++;
+    return;
+  }
+  if ( (0 != r->iif) &&
+       (r->iif != ifc->ifc_num) )
+  {
+    mcast_stats.wrong_iif++;
+    return;
+  }
+  if (ip->ttl <= 1)
+  {
+    mcast_stats.ttl_expired++;
+    return;
+  }
+  if ( (ntohs (ip->total_length) >= sizeof (hdr)) &&
+       (ntohs (ip->total_length) - sizeof (hdr) < payload_size) )
+    payload_size = ntohs (ip->total_length) - sizeof (hdr);
+  hdr = *ip;
+  hdr.ttl--;
+  hdr.checksum = 0;
+  hdr.checksum = GNUNET_CRYPTO_crc16_n (&hdr,
+                                        sizeof (hdr));
+  sp = malloc (sizeof (struct SharedPacket) + sizeof (hdr) + payload_size);
+  if (NULL == sp)
+    abort ();
+  sp->refcount = 1; /* ours, until all copies are queued */
+  sp->size = sizeof (hdr) + payload_size;
+  memcpy (sp->data,
+          &hdr,
+          sizeof (hdr));
+  memcpy (&sp->data[sizeof (hdr)],
+          payload,
+          payload_size);
+  r->packets++;
+  r->bytes += sp->size;
+  mac.mac[0] = 0x01;
+  mac.mac[1] = 0x00;
+  mac.mac[2] = 0x5E;
+  mac.mac[3] = (group >> 16) & 0x7F;
+  mac.mac[4] = (group >> 8) & 0xFF;
+  mac.mac[5] = group & 0xFF;
+  for (unsigned int i = 0; i < r->num_oifs; i++)
+  {
+    struct Interface *out = &gifc[r->oifs[i] - 1];
+    size_t mtu = out->mtu;
+
+    if (out == ifc)
+      continue;
+    if (TUNNEL_NONE != tunnels[out->ifc_num].mode)
+      mtu = tunnel_mtu (out);
+    if (sizeof (struct EthernetHeader) + sp->size > mtu)
+    {
+      mcast_stats.too_big++;
+      continue;
+    }
+    if (! acl_permits (out->ifc_num,
+                       ACL_OUT,
+                       &hdr,
+                       payload,
+                       payload_size))
+      continue;
+    forward_frame_to (out,
+                      &mac,
+                      ETH_P_IPV4,
+                      frame_alloc_shared (sp));
+  }
+  if (0 == --sp->refcount)
+    free (sp);
+}
+
+
+/**
+ * Process ARP (request or response!)
+ *
+ * @param ifc interface we received the ARP request from
+ * @param eh ethernet header
+ * @param ah ARP header
+ */
+static void handle_arp (struct Interface *ifc, const struct EthernetHeader *eh, const struct ArpHeaderEthernetIPv4 *ah){
+  /* TODO: do work here */
+
+  void *ptr = malloc(sizeof(struct EthernetHeader) + sizeof(struct ArpHeaderEthernetIPv4));
+
+  if (macComp ((const uint8_t *) &eh->src,(const uint8_t *) &ah->sender_ha) != 0
+        || eh->tag != 0x0608
+		|| ah->htype != 0x100
+		|| ah->ptype != 0x8
+		|| ah->hlen != 0x6
+		|| ah->plen != 0x4
+		|| !(ah->oper == 0x100 || ah->oper == 0x200)){
+      return;
+  }
+
+ if (ah->oper == ntohs(1)){
+      struct EthernetHeader neh;
+      neh.dst = ah->sender_ha;
+      neh.src = ifc->mac;
+      neh.tag = ntohs(0x0806);
+
+      // build arphead
+      struct ArpHeaderEthernetIPv4 newHeader = {
+     .htype = htons(1),
+	 .ptype = htons(0x0800),
+	 .hlen = 6,
+	 .plen = 4,
+	 .oper = htons (1),
+	 .sender_ha = {0},
+	 .sender_pa = {0},
+	 .target_ha = {0},
+	 .target_pa = {0},
+     };
+
+        //sender is mac and ip
+     memcpy (&newHeader.sender_ha, &ifc->mac.mac, 6);
+     newHeader.sender_pa = ifc->ip;
+
+        //target is the old source mac and ip
+     memcpy (&newHeader.target_ha, &ah->sender_ha, 6);
+     newHeader.target_pa = ah->sender_pa;
+
+        //insert in frame
+     memcpy (ptr, &neh, sizeof(struct EthernetHeader));
+     memcpy (ptr + sizeof(struct EthernetHeader), &newHeader, sizeof(struct ArpHeaderEthernetIPv4));
+     uint8_t size = sizeof (struct EthernetHeader) + sizeof (struct ArpHeaderEthernetIPv4);
+
+	forward_to (ifc, ptr,size);
+	}
+
+  if (ah->oper == ntohs(2)) {
+
+    bool contained = false;
+
+    // Insert or update in the table
+    for (int i = 0; i < MAX_ENTRIES; i++) {
+      if (ipCmp(&table[i].ip, &ah->sender_pa) == 0) {
+        // Update existing entry
+        contained = true;
+        table[i].mac = ah->sender_ha;
+        table[i].netmask = ifc->netmask;
+        memcpy(&table[i].name, ifc->name, sizeof(ifc->name));
+        table[i].ifc_num = ifc->ifc_num;
+        table[i].mtu = ifc->mtu;
+        GLAB_PROBE2 (arp_learn, ah->sender_pa.s_addr, ifc->ifc_num);
+        break;
+      }
+    }
+
+    // Add to the table if not already contained
+    if (!contained) {
+      if (0 != table[tableIndex].ip.s_addr)
+        GLAB_PROBE2 (arp_expire,
+                     table[tableIndex].ip.s_addr,
+                     table[tableIndex].ifc_num);
+      GLAB_PROBE2 (arp_learn, ah->sender_pa.s_addr, ifc->ifc_num);
+      table[tableIndex].mac = ah->sender_ha;
+      table[tableIndex].ip = ah->sender_pa;
+      table[tableIndex].netmask = ifc->netmask;
+      memcpy(&table[tableIndex].name, ifc->name, sizeof(ifc->name));
+      table[tableIndex].ifc_num = ifc->ifc_num;
+      table[tableIndex].mtu = ifc->mtu;
+
+      tableIndex++;
+      if (tableIndex >= MAX_ENTRIES) {
+        tableIndex = 0;
+      }
+    }
+
+    free(ptr);
+  }
+}
+
+/**
+ * Run the ingress policers of @a ifc on an IPv4 frame.  Uses the
+ * batch time of loop(), so the clock is read once per batch.
+ *
+ * @param ifc interface we got the frame on
+ * @param frame the frame
+ * @param frame_size number of bytes in @a frame
+ * @return true if the frame conforms, false to drop it
+ */
+static bool
+police (const struct Interface *ifc,
+        const void *frame,
+        size_t frame_size)
+{
+  struct Policer *p = &policers[ifc->ifc_num - 1];
+  struct TokenBucket *cl;
+  uint64_t now;
+
+  cl = &p->classes[egress_classify (frame,
+                                    frame_size)];
+  now = loop_now ();
+  if (! tb_ready (cl,
+                  frame_size,
+                  now))
+  {
+    tb_exceed (cl,
+               frame_size);
+    metrics_drop (ifc->ifc_num, GLAB_DROP_POLICER);
+    return false;
+  }
+  if (! tb_ready (&p->total,
+                  frame_size,
+                  now))
+  {
+    tb_exceed (&p->total,
+               frame_size);
+    metrics_drop (ifc->ifc_num, GLAB_DROP_POLICER);
+    return false;
+  }
+  tb_consume (cl,
+              frame_size);
+  tb_consume (&p->total,
+              frame_size);
+  return true;
+}
+
+
+/**
+ * Parse and process frame received on @a ifc.
+ *
+ * @param ifc interface we got the frame on
+ * @param frame raw frame data
+ * @param frame_size number of bytes in @a frame
+ */
+static void
+parse_frame (struct Interface *ifc,
+             const void *frame,
+             size_t frame_size)
+{
+  struct EthernetHeader eh;
+  const char *cframe = frame;
+
+  if (frame_size < sizeof (eh))
+  {
+    metrics_drop (ifc->ifc_num, GLAB_DROP_MALFORMED);
+    fprintf (stderr,
+             "Malformed frame\n");
+    return;
+  }
+  memcpy (&eh,
+          frame,
+          sizeof (eh));
+  switch (ntohs (eh.tag))
+  {
+  case ETH_P_IPV4:
+    {
+      struct IPv4Header ip;
+
+      if (frame_size < sizeof (struct EthernetHeader) + sizeof (struct
+                                                                IPv4Header))
+      {
+        metrics_drop (ifc->ifc_num, GLAB_DROP_MALFORMED);
+        fprintf (stderr,
+                 "Malformed frame\n");
+        return;
+      }
+      memcpy (&ip,
+              &cframe[sizeof (struct EthernetHeader)],
+              sizeof (struct IPv4Header));
+      if (! acl_permits (ifc->ifc_num,
+                         ACL_IN,
+                         &ip,
+                         &cframe[sizeof (struct EthernetHeader) + sizeof (struct IPv4Header)],
+                         frame_size - sizeof (struct EthernetHeader) - sizeof (struct IPv4Header)))
+        return;
+      if (! police (ifc,
+                    frame,
+                    frame_size))
+        return;
+      if (ip4_is_multicast (ip.destination_address))
+      {
+        mcast_forward (ifc,
+                       &ip,
+                       (const uint8_t *) &cframe[sizeof (struct EthernetHeader) + sizeof (struct IPv4Header)],
+                       frame_size - sizeof (struct EthernetHeader) - sizeof (struct IPv4Header));
+        break;
+      }
+      if (tunnel_input (&eh,
+                        &ip,
+                        (const uint8_t *) &cframe[sizeof (struct EthernetHeader) + sizeof (struct IPv4Header)],
+                        frame_size - sizeof (struct EthernetHeader) - sizeof (struct IPv4Header)))
+        break;
+      if ( (nat_ifcs[ifc->ifc_num]) &&
+           (ip.destination_address.s_addr == ifc->ip.s_addr) )
+      {
+        /* reverse source NAT on a private copy of the payload */
+        size_t payload_size = frame_size - sizeof (struct EthernetHeader) - sizeof (struct IPv4Header);
+        uint8_t payload[payload_size];
+
+        memcpy (payload,
+                &cframe[sizeof (struct EthernetHeader) + sizeof (struct IPv4Header)],
+                payload_size);
+        nat_inbound (ifc,
+                     &ip,
+                     payload,
+                     payload_size);
+        route (ifc, &ip, payload, payload_size, eh);
+        break;
+      }
+      /* TODO: possibly do work here (ARP learning) */
+      route (ifc, &ip, &cframe[sizeof (struct EthernetHeader) + sizeof (struct IPv4Header)],
+            frame_size - sizeof (struct EthernetHeader) - sizeof (struct IPv4Header),eh);
+      break;
+    }
+  case ETH_P_IPV6:
+    {
+      struct IPv6Header ip6;
+      size_t payload_size;
+
+      if (frame_size < sizeof (struct EthernetHeader) + sizeof (struct IPv6Header))
+      {
+        metrics_drop (ifc->ifc_num, GLAB_DROP_MALFORMED);
+        fprintf (stderr,
+                 "Malformed frame\n");
+        return;
+      }
+      memcpy (&ip6,
+              &cframe[sizeof (struct EthernetHeader)],
+              sizeof (struct IPv6Header));
+      payload_size = ntohs (ip6.payload_length);
+      if ( (6 != ntohl (ip6.ver_tc_flow) >> 28) ||
+           (payload_size > frame_size - sizeof (struct EthernetHeader) - sizeof (struct IPv6Header)) )
+      {
+        metrics_drop (ifc->ifc_num, GLAB_DROP_MALFORMED);
+        fprintf (stderr,
+                 "Malformed frame\n");
+        return;
+      }
+      if (! police (ifc,
+                    frame,
+                    frame_size))
+        return;
+      route6 (ifc,
+              &eh,
+              &ip6,
+              (const uint8_t *) &cframe[sizeof (struct EthernetHeader) + sizeof (struct IPv6Header)],
+              payload_size);
+      break;
+    }
+  case ETH_P_MPLS_UC:
+    mpls_input (ifc,
+                &eh,
+                (const uint8_t *) &cframe[sizeof (struct EthernetHeader)],
+                frame_size - sizeof (struct EthernetHeader));
+    break;
+  case ETH_P_ARP:
+    {
+      struct ArpHeaderEthernetIPv4 ah;
+
+      if (frame_size < sizeof (struct EthernetHeader) + sizeof (struct ArpHeaderEthernetIPv4)){
+        metrics_drop (ifc->ifc_num, GLAB_DROP_MALFORMED);
+#if DEBUG
+        fprintf (stderr, "Unsupported ARP frame\n");
+#endif
+        return;
+      }
+      memcpy (&ah, &cframe[sizeof (struct EthernetHeader)], sizeof (struct ArpHeaderEthernetIPv4));
+      handle_arp (ifc, &eh, &ah);
+      break;
+    }
+  default:
+#if DEBUG
+    fprintf (stderr, "Unsupported Ethernet tag %04X\n", ntohs (eh.tag));
+#endif
+    return;
+  }
+}
+
+
+/**
+ * Number of overload levels; each level sheds one more traffic class.
+ */
+#define OVERLOAD_LEVELS 3
+
+/**
+ * Default input backlog (bytes waiting in the pipe) per overload level.
+ */
+#define OVERLOAD_DEFAULT_BACKLOG (16 * 1024)
+
+/**
+ * Default lag (us behind the input) per overload level.
+ */
+#define OVERLOAD_DEFAULT_LAG 20000
+
+
+/**
+ * Overload level from which frames of an egress class are shed: bulk
+ * first, priority (ARP, neighbor discovery, network control) never.
+ */
+static const unsigned int overload_shed_level[EGRESS_NUM_CLASSES] = {
+  [EGRESS_CLASS_PRIORITY] = OVERLOAD_LEVELS + 1,
+  [EGRESS_CLASS_HIGH] = 3,
+  [EGRESS_CLASS_NORMAL] = 2,
+  [EGRESS_CLASS_BULK] = 1
+};
+
+
+/**
+ * Load shedding configuration and counters.
+ */
+struct Overload
+{
+  /**
+   * Backlog in bytes per overload level, 0 to ignore the backlog.
+   */
+  uint64_t backlog;
+
+  /**
+   * Lag in microseconds per overload level, 0 to ignore the lag.
+   */
+  uint64_t lag;
+
+  /**
+   * Highest level reached so far.
+   */
+  unsigned int max_level;
+
+  /**
+   * Frames shed per egress class.
+   */
+  uint64_t shed_packets[EGRESS_NUM_CLASSES];
+  uint64_t shed_bytes[EGRESS_NUM_CLASSES];
+};
+
+
+/**
+ * Load shedding state of the router.
+ */
+static struct Overload overload = {
+  .backlog = OVERLOAD_DEFAULT_BACKLOG,
+  .lag = OVERLOAD_DEFAULT_LAG
+};
+
+
+/**
+ * Compute how overloaded we are from the input backlog and lag that
+ * loop() measured for the current batch.
+ *
+ * @return 0 if we keep up, up to #OVERLOAD_LEVELS
+ */
+static unsigned int
+overload_level (void)
+{
+  uint64_t level = 0;
+
+  if (0 != overload.backlog)
+    level = loop_backlog () / overload.backlog;
+  if ( (0 != overload.lag) &&
+       (loop_lag () / overload.lag > level) )
+    level = loop_lag () / overload.lag;
+  if (level > OVERLOAD_LEVELS)
+    level = OVERLOAD_LEVELS;
+  if (level > overload.max_level)
+    overload.max_level = level;
+  return level;
+}
+
+
+/**
+ * Decide whether to drop @a frame before parsing it because we are
+ * overloaded.  Transit data is shed by traffic class; ARP, neighbor
+ * discovery, network control and IPv4 packets addressed to the router
+ * are always processed.
+ *
+ * @param frame the frame
+ * @param frame_size number of bytes in @a frame
+ * @return true if the frame was shed
+ */
+static bool
+overload_shed (const void *frame,
+               size_t frame_size)
+{
+  const uint8_t *cframe = frame;
+  unsigned int level = overload_level ();
+  unsigned int cls;
+  struct EthernetHeader eh;
+
+  if ( (0 == level) ||
+       (frame_size < sizeof (eh)) )
+    return false;
+  memcpy (&eh,
+          frame,
+          sizeof (eh));
+  switch (ntohs (eh.tag))
+  {
+  case ETH_P_IPV4:
+    if (frame_size >= sizeof (eh) + sizeof (struct IPv4Header))
+    {
+      struct in_addr dst;
+
+      memcpy (&dst,
+              &cframe[sizeof (eh) + offsetof (struct IPv4Header,
+                                              destination_address)],
+              sizeof (dst));
+      for (unsigned int i = 0; i < num_ifc; i++)
+        if (gifc[i].ip.s_addr == dst.s_addr)
+          return false;
+    }
+    cls = egress_classify (frame,
+                           frame_size);
+    break;
+  case ETH_P_IPV6:
+    cls = egress_classify (frame,
+                           frame_size);
+    break;
+  case ETH_P_MPLS_UC:
+    cls = EGRESS_CLASS_NORMAL;
+    break;
+  default:
+    return false;
+  }
+  if (level < overload_shed_level[cls])
+    return false;
+  overload.shed_packets[cls]++;
+  overload.shed_bytes[cls] += frame_size;
+  return true;
+}
+
+
+/**
+ * Process frame received from @a interface.
+ *
+ * @param interface number of the interface on which we received @a frame
+ * @param frame the frame
+ * @param frame_size number of bytes in @a frame
+ */
+static void
+handle_frame (uint16_t interface,
+              const void *frame,
+              size_t frame_size)
+{
+  if (interface > num_ifc)
+    abort ();
+  perf_begin ();
+  capture_frame (interface,
+                 false,
+                 frame,
+                 frame_size,
+                 NULL,
+                 0);
+  if (overload_shed (frame,
+                     frame_size))
+  {
+    metrics_drop (interface, GLAB_DROP_OVERLOAD);
+    return;
+  }
+  parse_frame (&gifc[interface - 1],
+               frame,
+               frame_size);
+}
+
+
+/**
+ * Find network interface by @a name.
+ *
+ * @param name name to look up by
+ * @return NULL if @a name was not found
+ */
+static struct Interface *
+find_interface (const char *name)
+{
+  for (int i = 0; i<num_ifc; i++)
+    if (0 == strcasecmp (name,
+                         gifc[i].name))
+      return &gifc[i];
+  return NULL;
+}
+
+/**
+ * The user entered an "arp" command.  The remaining
+ * arguments can be obtained via 'strtok()'.
+ */
+static void process_cmd_arp () {
+  const char *tok = strtok (NULL, " ");
+  struct in_addr v4;
+  struct MacAddress mac;
+  struct Interface *ifc;
+
+  if (NULL == tok){
+    // print_arp_cache ();
+    return;
+  }
+  if (1 != inet_pton (AF_INET, tok, &v4)){
+    fprintf (stderr,"`%s' is not a valid IPv4 address\n", tok);
+    return;
+  }
+  tok = strtok (NULL, " ");
+  if (NULL == tok) {
+    fprintf (stderr,"No network interface provided\n");
+    return;
+  }
+  ifc = find_interface (tok);
+  if (NULL == ifc){
+    fprintf (stderr,"Interface `%s' unknown\n", tok);
+    return;
+  }
+  /* TODO: do MAC lookup */
+ for (int i = 0; i < MAX_ENTRIES; i++){
+      if (ipCmp (&table[i].ip, &v4) == 0){
+          if (memcmp (&table[i].name, tok, sizeof(char)*4) == 0){
+	      print ("%02x:%02x:%02x:%02x:%02x:%02x\n",
+			table[i].mac.mac[0],
+			table[i].mac.mac[1],
+			table[i].mac.mac[2],
+			table[i].mac.mac[3],
+			table[i].mac.mac[4],
+			table[i].mac.mac[5]);
+	      return;
+          }
+      }
+  }
+
+  if (check_ip_network (ifc->ip, v4, ifc->netmask) == 0){
+  }
+
+  // arp request on actual ip
+  void* ptr = malloc (sizeof(struct EthernetHeader) + sizeof(struct ArpHeaderEthernetIPv4));
+  uint8_t frame_size = sizeof (struct EthernetHeader) + sizeof(struct ArpHeaderEthernetIPv4);
+
+  struct EthernetHeader neh;
+  neh.dst = broadcastMac;
+  neh.src = ifc->mac;
+  neh.tag = htons(0x0806);
+
+  // build arp_header
+  struct ArpHeaderEthernetIPv4 newHeader ={
+     .htype = htons(1),
+     .ptype = htons(0x0800),
+     .hlen = 6,
+     .plen = 4,
+     .oper = htons(1),
+     .sender_ha = {0},
+     .sender_pa = {0},
+     .target_ha = {0},
+     .target_pa = {0},
+  };
+
+  memcpy (&newHeader.sender_ha, &ifc->mac.mac, 6);
+  newHeader.sender_pa = ifc->ip;
+
+  memcpy (&newHeader.target_ha, &nullMac, 6);
+  newHeader.target_pa = v4;
+
+  //insert into frame
+  memcpy (ptr, &neh, sizeof(struct EthernetHeader));
+  memcpy (ptr + sizeof(struct EthernetHeader), &newHeader, sizeof(struct ArpHeaderEthernetIPv4));
+  forward_to (ifc, ptr, frame_size);
+  free(ptr);
+}
+
+
+/**
+ * Parse network specification in @a net, initializing @a network and @a netmask.
+ * Format of @a net is "IP/NETMASK".
+ *
+ * @param network[out] network specification to initialize
+ * @param netmask[out] netmask specification to initialize
+ * @param arg interface specification to parse
+ * @return 0 on success
+ */
+static int
+parse_network (struct in_addr *network,
+               struct in_addr *netmask,
+               const char *net)
+{
+  const char *tok;
+  char *ip;
+  int mask;
+
+  tok = strchr (net, '/');
+  if (NULL == tok)
+  {
+    fprintf (stderr,
+             "Error in network specification: lacks '/'\n");
+    return 1;
+  }
+  ip = strndup (net,
+                tok - net);
+  if (1 !=
+      inet_pton (AF_INET,
+                 ip,
+                 network))
+  {
+    fprintf (stderr,
+             "IP address `%s' malformed\n",
+             ip);
+    free (ip);
+    return 1;
+  }
+  free (ip);
+  tok++;
+  if (1 !=
+      sscanf (tok,
+              "%u",
+              &mask))
+  {
+    fprintf (stderr,
+             "Netmask `%s' malformed\n",
+             tok);
+    return 1;
+  }
+  if (mask > 32)
+  {
+    fprintf (stderr,
+             "Netmask invalid (too large)\n");
+    return 1;
+  }
+  netmask->s_addr = htonl (~(uint32_t) ((1LLU << (32 - mask)) - 1LLU));
+  return 0;
+}
+
+
+/**
+ * Parse route from arguments in strtok() buffer.  Instead of "via
+ * NEXTHOP dev IFC" the network may be followed by a route type
+ * ("blackhole", "unreachable", "prohibit" or "local"), in which case
+ * @a next_hop is zero and @a ifc is NULL.
+ *
+ * @param target_network[out] set to target network
+ * @param target_netmask[out] set to target netmask
+ * @param next_hop[out] set to next hop
+ * @param ifc[out] set to target interface
+ * @param type[out] set to the `enum RouteType`
+ */
+static int
+parse_route (struct in_addr *target_network,
+             struct in_addr *target_netmask,
+             struct in_addr *next_hop,
+             struct Interface **ifc,
+             uint8_t *type)
+{
+  char *tok;
+
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (0 != parse_network (target_network,
+                            target_netmask,
+                            tok)) )
+  {
+    fprintf (stderr,
+             "Expected network specification, not `%s'\n",
+             tok);
+    return 1;
+  }
+  tok = strtok (NULL, " ");
+  *type = ROUTE_UNICAST;
+  for (unsigned int t = ROUTE_BLACKHOLE; t <= ROUTE_LOCAL; t++)
+  {
+    if ( (NULL != tok) &&
+         (0 == strcasecmp (route_type_names[t],
+                           tok)) )
+    {
+      *type = t;
+      next_hop->s_addr = 0;
+      *ifc = NULL;
+      return 0;
+    }
+  }
+  if ( (NULL == tok) ||
+       (0 != strcasecmp ("via",
+                         tok)))
+  {
+    fprintf (stderr,
+             "Expected `via', not `%s'\n",
+             tok);
+    return 1;
+  }
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (1 != inet_pton (AF_INET,
+                        tok,
+                        next_hop)) )
+  {
+    fprintf (stderr,
+             "Expected next hop, not `%s'\n",
+             tok);
+    return 1;
+  }
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (0 != strcasecmp ("dev",
+                         tok)))
+  {
+    fprintf (stderr,
+             "Expected `dev', not `%s'\n",
+             tok);
+    return 1;
+  }
+  tok = strtok (NULL, " ");
+  *ifc = find_interface (tok);
+  if (NULL == *ifc)
+  {
+    fprintf (stderr,
+             "Interface `%s' unknown\n",
+             tok);
+    return 1;
+  }
+  return 0;
+}
+
+void updateInterfaceSettings(struct Interface *ifc, struct in_addr *target_network, struct in_addr *target_netmask) {
+  if (ifc == NULL || target_network == NULL || target_netmask == NULL) {
+    return;
+  }
+  ifc->ip = *target_network;
+  ifc->netmask = *target_netmask;
+}
+
+/**
+ * Parse an unreserved MPLS label.
+ *
+ * @param tok text to parse, may be NULL
+ * @param[out] label set to the label
+ * @return 0 on success
+ */
+static int
+mpls_parse_label (const char *tok,
+                  uint32_t *label)
+{
+  unsigned int v;
+
+  if ( (NULL == tok) ||
+       (1 != sscanf (tok,
+                     "%u",
+                     &v)) ||
+       (v < MPLS_FIRST_UNRESERVED_LABEL) ||
+       (v >= MPLS_NUM_LABELS) )
+  {
+    fprintf (stderr,
+             "Expected MPLS label in [%u,%u], not `%s'\n",
+             MPLS_FIRST_UNRESERVED_LABEL,
+             MPLS_NUM_LABELS - 1,
+             tok);
+    return 1;
+  }
+  *label = v;
+  return 0;
+}
+
+
+/**
+ * Add a label table entry.  Syntax: "mpls add LABEL pop" or
+ * "mpls add LABEL swap OUT [push LABEL] via NEXTHOP dev IFC".
+ */
+static void
+process_cmd_mpls_add ()
+{
+  struct LabelEntry le;
+  struct Interface *ifc;
+  uint32_t label;
+  const char *tok;
+
+  if (0 != mpls_parse_label (strtok (NULL, " "),
+                             &label))
+    return;
+  memset (&le, 0, sizeof (le));
+  tok = strtok (NULL, " ");
+  if ( (NULL != tok) &&
+       (0 == strcasecmp ("pop",
+                         tok)) )
+  {
+    le.op = LABEL_POP;
+  }
+  else if ( (NULL != tok) &&
+            (0 == strcasecmp ("swap",
+                              tok)) )
+  {
+    le.op = LABEL_SWAP;
+    if (0 != mpls_parse_label (strtok (NULL, " "),
+                               &le.out_label))
+      return;
+    tok = strtok (NULL, " ");
+    if ( (NULL != tok) &&
+         (0 == strcasecmp ("push",
+                           tok)) )
+    {
+      le.push = true;
+      if (0 != mpls_parse_label (strtok (NULL, " "),
+                                 &le.push_label))
+        return;
+      tok = strtok (NULL, " ");
+    }
+    if ( (NULL == tok) ||
+         (0 != strcasecmp ("via",
+                           tok)) )
+    {
+      fprintf (stderr,
+               "Expected `via', not `%s'\n",
+               tok);
+      return;
+    }
+    tok = strtok (NULL, " ");
+    if ( (NULL == tok) ||
+         (1 != inet_pton (AF_INET,
+                          tok,
+                          &le.next_hop)) )
+    {
+      fprintf (stderr,
+               "Expected next hop, not `%s'\n",
+               tok);
+      return;
+    }
+    tok = strtok (NULL, " ");
+    if ( (NULL == tok) ||
+         (0 != strcasecmp ("dev",
+                           tok)) )
+    {
+      fprintf (stderr,
+               "Expected `dev', not `%s'\n",
+               tok);
+      return;
+    }
+    tok = strtok (NULL, " ");
+    ifc = (NULL == tok) ? NULL : find_interface (tok);
+    if (NULL == ifc)
+    {
+      fprintf (stderr,
+               "Interface `%s' unknown\n",
+               tok);
+      return;
+    }
+    le.ifc_num = ifc->ifc_num;
+  }
+  else
+  {
+    fprintf (stderr,
+             "Expected `swap' or `pop', not `%s'\n",
+             tok);
+    return;
+  }
+  if (NULL == label_table)
+  {
+    label_table = calloc (MPLS_NUM_LABELS,
+                          sizeof (struct LabelEntry));
+    if (NULL == label_table)
+      abort ();
+  }
+  label_table[label] = le;
+}
+
+
+/**
+ * Delete a label table entry.  Syntax: "mpls del LABEL".
+ */
+static void
+process_cmd_mpls_del ()
+{
+  uint32_t label;
+
+  if (0 != mpls_parse_label (strtok (NULL, " "),
+                             &label))
+    return;
+  if ( (NULL == label_table) ||
+       (LABEL_NONE == label_table[label].op) )
+  {
+    fprintf (stderr,
+             "Label %u unknown\n",
+             (unsigned int) label);
+    return;
+  }
+  memset (&label_table[label],
+          0,
+          sizeof (struct LabelEntry));
+}
+
+
+/**
+ * Print the label table.
+ */
+static void
+process_cmd_mpls_list ()
+{
+  if (NULL == label_table)
+    return;
+  for (uint32_t l = MPLS_FIRST_UNRESERVED_LABEL; l < MPLS_NUM_LABELS; l++)
+  {
+    const struct LabelEntry *le = &label_table[l];
+    char buf[INET_ADDRSTRLEN];
+    char push[32] = "";
+
+    if (LABEL_POP == le->op)
+      print ("%u pop, %llu pkts %llu bytes\n",
+             (unsigned int) l,
+             (unsigned long long) le->packets,
+             (unsigned long long) le->bytes);
+    else if (LABEL_SWAP == le->op)
+    {
+      if (le->push)
+        snprintf (push,
+                  sizeof (push),
+                  " push %u",
+                  (unsigned int) le->push_label);
+      print ("%u swap %u%s via %s (%4s), %llu pkts %llu bytes\n",
+             (unsigned int) l,
+             (unsigned int) le->out_label,
+             push,
+             inet_ntop (AF_INET, &le->next_hop, buf, sizeof (buf)),
+             gifc[le->ifc_num - 1].name,
+             (unsigned long long) le->packets,
+             (unsigned long long) le->bytes);
+    }
+  }
+}
+
+
+/**
+ * The user entered an "mpls" command.  The remaining
+ * arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_mpls ()
+{
+  char *subcommand = strtok (NULL, " ");
+
+  if (NULL == subcommand)
+    subcommand = "list";
+  if (0 == strcasecmp ("add",
+                       subcommand))
+    process_cmd_mpls_add ();
+  else if (0 == strcasecmp ("del",
+                            subcommand))
+    process_cmd_mpls_del ();
+  else if (0 == strcasecmp ("list",
+                            subcommand))
+    process_cmd_mpls_list ();
+  else if (0 == strcasecmp ("stats",
+                            subcommand))
+    print ("%llu unknown label, %llu ttl expired, %llu no arp, %llu too big, %llu malformed\n",
+           (unsigned long long) mpls_stats.unknown_label,
+           (unsigned long long) mpls_stats.ttl_expired,
+           (unsigned long long) mpls_stats.no_arp,
+           (unsigned long long) mpls_stats.too_big,
+           (unsigned long long) mpls_stats.malformed);
+  else
+    fprintf (stderr,
+             "Subcommand `%s' not understood\n",
+             subcommand);
+}
+
+
+/**
+ * The user entered a "tunnel" command: print the tunnel interfaces
+ * with their current MTU and counters.
+ */
+static void
+process_cmd_tunnel ()
+{
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    const struct Tunnel *t = &tunnels[i + 1];
+    char lbuf[INET_ADDRSTRLEN];
+    char rbuf[INET_ADDRSTRLEN];
+
+    if (TUNNEL_NONE == t->mode)
+      continue;
+    print ("%4s %s %s -> %s mtu %u, encap %llu pkts %llu bytes, decap %llu pkts %llu bytes, "
+           "%llu no route, %llu no arp, %llu too big, %llu malformed\n",
+           gifc[i].name,
+           (TUNNEL_GRE == t->mode) ? "gre" : "ipip",
+           (0 != t->local.s_addr)
+           ? inet_ntop (AF_INET, &t->local, lbuf, sizeof (lbuf))
+           : "any",
+           inet_ntop (AF_INET, &t->remote, rbuf, sizeof (rbuf)),
+           (unsigned int) (tunnel_mtu (&gifc[i]) - sizeof (struct EthernetHeader)),
+           (unsigned long long) t->encap_packets,
+           (unsigned long long) t->encap_bytes,
+           (unsigned long long) t->decap_packets,
+           (unsigned long long) t->decap_bytes,
+           (unsigned long long) t->no_route,
+           (unsigned long long) t->no_arp,
+           (unsigned long long) t->too_big,
+           (unsigned long long) t->malformed);
+  }
+}
+
+
+/**
+ * Parse a multicast group from the strtok() buffer.
+ *
+ * @param[out] group set to the multicast group
+ * @return 0 on success
+ */
+static int
+mroute_parse_group (struct in_addr *group)
+{
+  const char *tok = strtok (NULL, " ");
+
+  if ( (NULL == tok) ||
+       (1 != inet_pton (AF_INET,
+                        tok,
+                        group)) ||
+       (! ip4_is_multicast (*group)) )
+  {
+    fprintf (stderr,
+             "Expected multicast group, not `%s'\n",
+             tok);
+    return 1;
+  }
+  return 0;
+}
+
+
+/**
+ * Parse "SOURCE|* GROUP" from the strtok() buffer.
+ *
+ * @param[out] source set to the source, 0 for "*"
+ * @param[out] group set to the multicast group
+ * @return 0 on success
+ */
+static int
+mroute_parse_sg (struct in_addr *source,
+                 struct in_addr *group)
+{
+  const char *tok = strtok (NULL, " ");
+
+  if ( (NULL != tok) &&
+       (0 == strcmp ("*",
+                     tok)) )
+    source->s_addr = 0;
+  else if ( (NULL == tok) ||
+            (1 != inet_pton (AF_INET,
+                             tok,
+                             source)) )
+  {
+    fprintf (stderr,
+             "Expected source or `*', not `%s'\n",
+             tok);
+    return 1;
+  }
+  return mroute_parse_group (group);
+}
+
+
+/**
+ * Add or replace a multicast route.  Syntax:
+ * "mroute add SOURCE|* GROUP [iif IFC] oif IFC[,IFC...]".
+ */
+static void
+process_cmd_mroute_add ()
+{
+  struct in_addr source;
+  struct in_addr group;
+  struct McastRoute *r;
+  uint16_t oifs[MCAST_MAX_OIFS];
+  unsigned int num_oifs = 0;
+  uint16_t iif = 0;
+  char *tok;
+  char *save;
+
+  if (0 != mroute_parse_sg (&source,
+                            &group))
+    return;
+  tok = strtok (NULL, " ");
+  if ( (NULL != tok) &&
+       (0 == strcasecmp ("iif",
+                         tok)) )
+  {
+    struct Interface *ifc;
+
+    tok = strtok (NULL, " ");
+    ifc = (NULL == tok) ? NULL : find_interface (tok);
+    if (NULL == ifc)
+    {
+      fprintf (stderr,
+               "Interface `%s' unknown\n",
+               tok);
+      return;
+    }
+    iif = ifc->ifc_num;
+    tok = strtok (NULL, " ");
+  }
+  if ( (NULL == tok) ||
+       (0 != strcasecmp ("oif",
+                         tok)) )
+  {
+    fprintf (stderr,
+             "Expected `oif', not `%s'\n",
+             tok);
+    return;
+  }
+  tok = strtok (NULL, " ");
+  if (NULL == tok)
+  {
+    fprintf (stderr,
+             "No outgoing interface provided\n");
+    return;
+  }
+  for (char *name = strtok_r (tok, ",", &save);
+       NULL != name;
+       name = strtok_r (NULL, ",", &save))
+  {
+    struct Interface *ifc = find_interface (name);
+
+    if (NULL == ifc)
+    {
+      fprintf (stderr,
+               "Interface `%s' unknown\n",
+               name);
+      return;
+    }
+    if (MCAST_MAX_OIFS == num_oifs)
+    {
+      fprintf (stderr,
+               "Too many outgoing interfaces\n");
+      return;
+    }
+    oifs[num_oifs++] = ifc->ifc_num;
+  }
+  r = mfc_get (source,
+               group);
+  r->iif = iif;
+  r->num_oifs = num_oifs;
+  memcpy (r->oifs,
+          oifs,
+          num_oifs * sizeof (uint16_t));
+}
+
+
+/**
+ * Delete a multicast route.  Syntax: "mroute del SOURCE|* GROUP".
+ */
+static void
+process_cmd_mroute_del ()
+{
+  struct in_addr source;
+  struct in_addr group;
+  struct McastRoute *r;
+
+  if (0 != mroute_parse_sg (&source,
+                            &group))
+    return;
+  r = mfc_find (source,
+                group);
+  if (NULL == r)
+  {
+    fprintf (stderr,
+             "No such multicast route\n");
+    return;
+  }
+  mfc_remove (r);
+}
+
+
+/**
+ * Add or remove an interface with members of a group to or from the
+ * (*,G) route of the group.  Syntax: "mroute join|leave GROUP IFC".
+ *
+ * @param join true to add the interface, false to remove it
+ */
+static void
+process_cmd_mroute_membership (bool join)
+{
+  static const struct in_addr any;
+  struct in_addr group;
+  struct Interface *ifc;
+  struct McastRoute *r;
+  const char *tok;
+  unsigned int i;
+
+  if (0 != mroute_parse_group (&group))
+    return;
+  tok = strtok (NULL, " ");
+  ifc = (NULL == tok) ? NULL : find_interface (tok);
+  if (NULL == ifc)
+  {
+    fprintf (stderr,
+             "Interface `%s' unknown\n",
+             tok);
+    return;
+  }
+  r = join ? mfc_get (any, group) : mfc_find (any, group);
+  if (NULL == r)
+    return;
+  for (i = 0; i < r->num_oifs; i++)
+    if (r->oifs[i] == ifc->ifc_num)
+      break;
+  if (join)
+  {
+    if (i < r->num_oifs)
+      return;
+    if (MCAST_MAX_OIFS == r->num_oifs)
+    {
+      fprintf (stderr,
+               "Too many outgoing interfaces\n");
+      return;
+    }
+    r->oifs[r->num_oifs++] = ifc->ifc_num;
+    return;
+  }
+  if (i == r->num_oifs)
+    return;
+  r->oifs[i] = r->oifs[--r->num_oifs];
+  if (0 == r->num_oifs)
+    mfc_remove (r);
+}
+
+
+/**
+ * Print the multicast forwarding cache.
+ */
+static void
+process_cmd_mroute_list ()
+{
+  for (unsigned int h = 0; h < MCAST_HASH_SIZE; h++)
+  {
+    for (const struct McastRoute *r = mfc[h]; NULL != r; r = r->next)
+    {
+      char sbuf[INET_ADDRSTRLEN];
+      char gbuf[INET_ADDRSTRLEN];
+      char oifs[MCAST_MAX_OIFS * (IFNAMSIZ + 1) + 1] = "";
+      size_t off = 0;
+
+      for (unsigned int i = 0; (i < r->num_oifs) && (off < sizeof (oifs)); i++)
+        off += snprintf (&oifs[off],
+                         sizeof (oifs) - off,
+                         "%s%s",
+                         (0 == i) ? "" : ",",
+                         gifc[r->oifs[i] - 1].name);
+      print ("(%s, %s) iif %s oif %s, %llu pkts %llu bytes\n",
+             (0 == r->source.s_addr)
+             ? "*"
+             : inet_ntop (AF_INET, &r->source, sbuf, sizeof (sbuf)),
+             inet_ntop (AF_INET, &r->group, gbuf, sizeof (gbuf)),
+             (0 == r->iif) ? "any" : gifc[r->iif - 1].name,
+             oifs,
+             (unsigned long long) r->packets,
+             (unsigned long long) r->bytes);
+    }
+  }
+}
+
+
+/**
+ * The user entered an "mroute" command.  The remaining
+ * arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_mroute ()
+{
+  char *subcommand = strtok (NULL, " ");
+
+  if (NULL == subcommand)
+    subcommand = "list";
+  if (0 == strcasecmp ("add",
+                       subcommand))
+    process_cmd_mroute_add ();
+  else if (0 == strcasecmp ("del",
+                            subcommand))
+    process_cmd_mroute_del ();
+  else if (0 == strcasecmp ("join",
+                            subcommand))
+    process_cmd_mroute_membership (true);
+  else if (0 == strcasecmp ("leave",
+                            subcommand))
+    process_cmd_mroute_membership (false);
+  else if (0 == strcasecmp ("list",
+                            subcommand))
+    process_cmd_mroute_list ();
+  else if (0 == strcasecmp ("stats",
+                            subcommand))
+    print ("%llu no route, %llu wrong iif, %llu ttl expired, %llu too big\n",
+           (unsigned long long) mcast_stats.no_route,
+           (unsigned long long) mcast_stats.wrong_iif,
+           (unsigned long long) mcast_stats.ttl_expired,
+           (unsigned long long) mcast_stats.too_big);
+  else
+    fprintf (stderr,
+             "Subcommand `%s' not understood\n",
+             subcommand);
+}
+
+
+/**
+ * Add a route.
+ */
+static void process_cmd_route_add () {
+  struct in_addr target_network;
+  struct in_addr target_netmask;
+  struct in_addr next_hop;
+  struct Interface *ifc;
+
+  uint8_t type;
+
+  if (0 != parse_route (&target_network,
+                        &target_netmask,
+                        &next_hop,
+                        &ifc,
+                        &type))
+    return;
+  //add entry to routing table
+  struct TableEntry content;
+  memset (&content, 0, sizeof (content));
+  content.target_network = target_network;
+  content.netmask = target_netmask;
+  content.nextHop = next_hop;
+  content.type = type;
+  if (ROUTE_UNICAST != type)
+  {
+    // no next hop, the route is handled at the lookup
+    memcpy(&routingTable[routingTableIndex], &content,sizeof(struct TableEntry));
+    routingTableIndex++;
+    return;
+  }
+
+  // optional "label N": impose an MPLS label
+  const char *tok = strtok (NULL, " ");
+  if (NULL != tok)
+  {
+    if ( (0 != strcasecmp ("label",
+                           tok)) ||
+         (0 != mpls_parse_label (strtok (NULL, " "),
+                                 &content.label)) )
+    {
+      fprintf (stderr,
+               "Expected `label N' after the route\n");
+      return;
+    }
+    content.has_label = true;
+  }
+
+  struct Interface interface = *ifc;
+
+  // Update interface
+  updateInterfaceSettings(&interface, &target_network, &target_netmask);
+  content.interface = interface;
+
+  memcpy(&routingTable[routingTableIndex], &content,sizeof(struct TableEntry));
+  routingTableIndex++;
+}
+
+
+
+/**
+ * Delete a route.
+ */
+static void process_cmd_route_del (){
+  struct in_addr target_network;
+  struct in_addr target_netmask;
+  struct in_addr next_hop;
+  struct Interface *ifc;
+
+  uint8_t type;
+
+  if (0 != parse_route (&target_network, &target_netmask, &next_hop, &ifc, &type))
+    return;
+
+  /* TODO: Delete routing table entry */
+  for (int i = 0; i < MAX_ENTRIES; i++){
+    if (ipCmp (&routingTable[i].target_network, &target_network) == 0
+  	  && ipCmp (&routingTable[i].netmask, &target_netmask) == 0
+  	  && ipCmp (&routingTable[i].nextHop, &next_hop) == 0){
+  	  }
+
+  }
+}
+
+
+/**
+ * Number of routes "route list" prints per chunk.  After each chunk,
+ * the listing yields to packet processing and continues in the next
+ * batch.
+ */
+#define ROUTE_LIST_CHUNK 4
+
+/**
+ * Buffer space for one line of "route list".
+ */
+#define ROUTE_LIST_LINE 160
+
+
+/**
+ * State of a "route list" that is being printed.  The routes to list
+ * are copied and sorted once when the command is entered; the chunks
+ * print from this snapshot, so later route changes do not affect it.
+ */
+struct RouteListing
+{
+  /**
+   * Are we printing a listing?
+   */
+  bool active;
+
+  /**
+   * Has the header been printed?
+   */
+  bool started;
+
+  /**
+   * The routes to list, sorted by route_list_cmp().
+   */
+  struct TableEntry routes[MAX_ENTRIES];
+
+  /**
+   * Counters of @e routes, taken with the snapshot.
+   */
+  struct RouteCounters counters[MAX_ENTRIES];
+
+  /**
+   * Number of entries in @e routes.
+   */
+  unsigned int count;
+
+  /**
+   * Index in @e routes after the last route to print, less than
+   * @e count if the user's limit cuts the listing short.
+   */
+  unsigned int end;
+
+  /**
+   * Index in @e routes of the next route to print.
+   */
+  unsigned int pos;
+};
+
+
+/**
+ * The "route list" being printed.
+ */
+static struct RouteListing route_listing;
+
+
+/**
+ * Compute the key by which "route list" sorts: network, then prefix
+ * length, both in host byte order.
+ *
+ * @param network the network
+ * @param netmask its netmask
+ * @return the key
+ */
+static uint64_t
+route_list_key (struct in_addr network,
+                struct in_addr netmask)
+{
+  return ((uint64_t) ntohl (network.s_addr) << 32)
+         | ntohl (netmask.s_addr);
+}
+
+
+/**
+ * Order route indices for "route list".  Routes with the same prefix
+ * are kept in the order they were added.
+ *
+ * @param a pointer to first index
+ * @param b pointer to second index
+ * @return negative if @a a sorts before @a b
+ */
+static int
+route_list_cmp (const void *a,
+                const void *b)
+{
+  int ia = *(const int *) a;
+  int ib = *(const int *) b;
+  uint64_t ka = route_list_key (routingTable[ia].target_network,
+                                routingTable[ia].netmask);
+  uint64_t kb = route_list_key (routingTable[ib].target_network,
+                                routingTable[ib].netmask);
+
+  if (ka == kb)
+    return ia - ib;
+  return (ka < kb) ? -1 : 1;
+}
+
+
+/**
+ * Format route @a e as a line of "route list".
+ *
+ * @param e the route
+ * @param c its counters
+ * @param buf where to write the line
+ * @param buf_size number of bytes in @a buf
+ * @return number of bytes written (excluding the 0-terminator)
+ */
+static int
+route_list_format (const struct TableEntry *e,
+                   const struct RouteCounters *c,
+                   char *buf,
+                   size_t buf_size)
+{
+  char net[INET_ADDRSTRLEN];
+  char mask[INET_ADDRSTRLEN];
+  char hop[INET_ADDRSTRLEN];
+  unsigned long long packets = c->packets;
+  unsigned long long bytes = c->bytes;
+  int ret;
+
+  inet_ntop (AF_INET, &e->target_network, net, sizeof (net));
+  inet_ntop (AF_INET, &e->netmask, mask, sizeof (mask));
+  inet_ntop (AF_INET, &e->nextHop, hop, sizeof (hop));
+  if (ROUTE_UNICAST != e->type)
+    ret = snprintf (buf,
+                    buf_size,
+                    "%s/%s %s, %llu pkts %llu bytes\n",
+                    net,
+                    mask,
+                    route_type_names[e->type],
+                    packets,
+                    bytes);
+  else if (e->has_label)
+    ret = snprintf (buf,
+                    buf_size,
+                    "%s/%s -> %s (%4s) label %u, %llu pkts %llu bytes\n",
+                    net,
+                    mask,
+                    hop,
+                    e->interface.name,
+                    (unsigned int) e->label,
+                    packets,
+                    bytes);
+  else
+    ret = snprintf (buf,
+                    buf_size,
+                    "%s/%s -> %s (%4s), %llu pkts %llu bytes\n",
+                    net,
+                    mask,
+                    hop,
+                    e->interface.name,
+                    packets,
+                    bytes);
+  if (ret < 0)
+    return 0;
+  if ((size_t) ret >= buf_size)
+    return buf_size - 1;
+  return ret;
+}
+
+
+/**
+ * Start a "route list": copy the matching routes, sorted, into
+ * #route_listing.  A listing that is still being printed is replaced.
+ *
+ * @param network only list routes within @a network / @a netmask,
+ *        NULL for all
+ * @param netmask netmask of @a network
+ * @param cursor if not NULL, only list routes sorting after this key,
+ *        see route_list_key()
+ * @param limit list at most this many routes, 0 for no limit
+ */
+static void
+route_list_start (const struct in_addr *network,
+                  const struct in_addr *netmask,
+                  const uint64_t *cursor,
+                  unsigned int limit)
+{
+  struct RouteListing *rl = &route_listing;
+  int order[MAX_ENTRIES];
+  unsigned int matches = 0;
+
+  for (int i = 0; i < routingTableIndex; i++)
+  {
+    const struct TableEntry *e = &routingTable[i];
+
+    if ( (NULL != network) &&
+         ( (ntohl (e->netmask.s_addr) < ntohl (netmask->s_addr)) ||
+           ( (e->target_network.s_addr & netmask->s_addr) !=
+             network->s_addr) ) )
+      continue;
+    if ( (NULL != cursor) &&
+         (route_list_key (e->target_network,
+                          e->netmask) <= *cursor) )
+      continue;
+    order[matches++] = i;
+  }
+  qsort (order,
+         matches,
+         sizeof (int),
+         &route_list_cmp);
+  for (unsigned int n = 0; n < matches; n++)
+  {
+    rl->routes[n] = routingTable[order[n]];
+    rl->counters[n] = routeCounters[order[n]];
+  }
+  rl->active = true;
+  rl->started = false;
+  rl->count = matches;
+  rl->pos = 0;
+  rl->end = matches;
+  if ( (0 != limit) &&
+       (limit < matches) )
+  {
+    /* never split routes with the same prefix, "from" could not
+       tell them apart */
+    rl->end = limit;
+    while ( (rl->end < matches) &&
+            (route_list_key (rl->routes[rl->end].target_network,
+                             rl->routes[rl->end].netmask) ==
+             route_list_key (rl->routes[rl->end - 1].target_network,
+                             rl->routes[rl->end - 1].netmask)) )
+      rl->end++;
+  }
+}
+
+
+/**
+ * Print the next chunk of the active "route list" with a single
+ * print().  If routes remain, ask loop() to call us again after the
+ * next batch.  Called at the end of each batch.
+ */
+static void
+route_list_continue (void)
+{
+  struct RouteListing *rl = &route_listing;
+  char buf[ROUTE_LIST_CHUNK * ROUTE_LIST_LINE + 128];
+  unsigned int stop;
+  size_t off = 0;
+
+  if (! rl->active)
+    return;
+  if (! rl->started)
+  {
+    off += snprintf (buf,
+                     sizeof (buf),
+                     "Route List\n");
+    rl->started = true;
+  }
+  stop = rl->pos + ROUTE_LIST_CHUNK;
+  if (stop > rl->end)
+    stop = rl->end;
+  for (; rl->pos < stop; rl->pos++)
+    off += route_list_format (&rl->routes[rl->pos],
+                              &rl->counters[rl->pos],
+                              &buf[off],
+                              sizeof (buf) - off);
+  if ( (rl->pos == rl->end) &&
+       (rl->end < rl->count) )
+  {
+    const struct TableEntry *last = &rl->routes[rl->end - 1];
+    char net[INET_ADDRSTRLEN];
+
+    off += snprintf (&buf[off],
+                     sizeof (buf) - off,
+                     "More routes follow, continue with `from %s/%u'\n",
+                     inet_ntop (AF_INET, &last->target_network, net, sizeof (net)),
+                     (unsigned int) __builtin_popcount (last->netmask.s_addr));
+  }
+  print ("%s",
+         buf);
+  if (rl->pos == rl->end)
+  {
+    rl->active = false;
+    return;
+  }
+  loop_wakeup_at (loop_now ());
+}
+
+
+/**
+ * Print out the routing table, sorted by prefix.  Syntax:
+ * "route list [NETWORK/MASK] [limit N] [from NETWORK/MASK]".  Only
+ * routes within the first prefix are listed, at most N of them,
+ * starting after the route given with "from" (as printed when a
+ * limited listing is cut short).  Large tables are printed in chunks
+ * between which packets are processed.
+ */
+static void process_cmd_route_list (){
+  struct in_addr network;
+  struct in_addr netmask;
+  bool filtered = false;
+  uint64_t cursor = 0;
+  bool have_cursor = false;
+  unsigned int limit = 0;
+  const char *tok;
+
+  while (NULL != (tok = strtok (NULL, " ")))
+  {
+    if (0 == strcasecmp ("limit",
+                         tok))
+    {
+      tok = strtok (NULL, " ");
+      if ( (NULL == tok) ||
+           (1 != sscanf (tok,
+                         "%u",
+                         &limit)) ||
+           (0 == limit) )
+      {
+        fprintf (stderr,
+                 "Expected `limit N'\n");
+        return;
+      }
+    }
+    else if (0 == strcasecmp ("from",
+                              tok))
+    {
+      struct in_addr from_network;
+      struct in_addr from_netmask;
+
+      tok = strtok (NULL, " ");
+      if (NULL == tok)
+      {
+        fprintf (stderr,
+                 "Expected `from NETWORK/MASK'\n");
+        return;
+      }
+      if (0 != parse_network (&from_network,
+                              &from_netmask,
+                              tok))
+        return;
+      from_network.s_addr &= from_netmask.s_addr;
+      cursor = route_list_key (from_network,
+                               from_netmask);
+      have_cursor = true;
+    }
+    else
+    {
+      if (0 != parse_network (&network,
+                              &netmask,
+                              tok))
+        return;
+      network.s_addr &= netmask.s_addr;
+      filtered = true;
+    }
+  }
+  route_list_start (filtered ? &network : NULL,
+                    &netmask,
+                    have_cursor ? &cursor : NULL,
+                    limit);
+  route_list_continue ();
+}
+
+
+/**
+ * Order route indices by the bytes routed, most first.
+ *
+ * @param a pointer to first index
+ * @param b pointer to second index
+ * @return negative if @a a carried more bytes than @a b
+ */
+static int
+route_bytes_cmp (const void *a,
+                 const void *b)
+{
+  uint64_t ba = routeCounters[*(const int *) a].bytes;
+  uint64_t bb = routeCounters[*(const int *) b].bytes;
+
+  if (ba == bb)
+    return *(const int *) a - *(const int *) b;
+  return (ba > bb) ? -1 : 1;
+}
+
+
+/**
+ * Print the traffic of the route at index @a i.
+ *
+ * @param i index into #routingTable
+ */
+static void
+route_stats_print (int i)
+{
+  char buf[INET_ADDRSTRLEN];
+  char buf1[INET_ADDRSTRLEN];
+
+  print ("%s/%s: %llu pkts %llu bytes\n",
+         inet_ntop (AF_INET, &routingTable[i].target_network, buf, sizeof (buf)),
+         inet_ntop (AF_INET, &routingTable[i].netmask, buf1, sizeof (buf1)),
+         (unsigned long long) routeCounters[i].packets,
+         (unsigned long long) routeCounters[i].bytes);
+}
+
+
+/**
+ * Show route statistics.  Syntax: "route stats [NETWORK/MASK | top N]".
+ * Without a prefix, the N (default 10) routes that carried the most
+ * bytes are listed after the per-type counters.
+ */
+static void
+process_cmd_route_stats ()
+{
+  struct in_addr network;
+  struct in_addr netmask;
+  int order[MAX_ENTRIES];
+  unsigned int top = 10;
+  char *tok;
+
+  tok = strtok (NULL, " ");
+  if ( (NULL != tok) &&
+       (0 != strcasecmp ("top",
+                         tok)) )
+  {
+    if (0 != parse_network (&network,
+                            &netmask,
+                            tok))
+      return;
+    network.s_addr &= netmask.s_addr;
+    for (int i = 0; i < routingTableIndex; i++)
+    {
+      if ( (routingTable[i].target_network.s_addr == network.s_addr) &&
+           (routingTable[i].netmask.s_addr == netmask.s_addr) )
+      {
+        route_stats_print (i);
+        return;
+      }
+    }
+    fprintf (stderr,
+             "No such route\n");
+    return;
+  }
+  if (NULL != tok)
+  {
+    tok = strtok (NULL, " ");
+    if ( (NULL == tok) ||
+         (1 != sscanf (tok,
+                       "%u",
+                       &top)) )
+    {
+      fprintf (stderr,
+               "Expected `top N'\n");
+      return;
+    }
+  }
+  print ("%llu blackhole, %llu unreachable, %llu prohibit, %llu local, "
+         "%llu icmp sent, %llu icmp rate limited\n",
+         (unsigned long long) route_type_stats.blackhole,
+         (unsigned long long) route_type_stats.unreachable,
+         (unsigned long long) route_type_stats.prohibit,
+         (unsigned long long) route_type_stats.local,
+         (unsigned long long) route_type_stats.icmp_sent,
+         (unsigned long long) route_type_stats.icmp_limited);
+  for (int i = 0; i < routingTableIndex; i++)
+    order[i] = i;
+  qsort (order,
+         routingTableIndex,
+         sizeof (int),
+         &route_bytes_cmp);
+  for (int i = 0; (i < routingTableIndex) && ((unsigned int) i < top); i++)
+    route_stats_print (order[i]);
+}
+
+
+/**
+ * The user entered a "route" command.  The remaining
+ * arguments can be obtained via 'strtok()'.
+ */
+static void process_cmd_route (){
+  char *subcommand = strtok (NULL, " ");
+
+  if (NULL == subcommand)
+    subcommand = "list";
+  if (0 == strcasecmp ("add",
+                       subcommand))
+    process_cmd_route_add ();
+  else if (0 == strcasecmp ("del",
+                            subcommand))
+    process_cmd_route_del ();
+  else if (0 == strcasecmp ("list",
+                            subcommand))
+    process_cmd_route_list ();
+  else if (0 == strcasecmp ("stats",
+                            subcommand))
+    process_cmd_route_stats ();
+  else
+    fprintf (stderr,
+             "Subcommand `%s' not understood\n",
+             subcommand);
+}
+
+
+/**
+ * Parse IPv6 network specification "ADDRESS/LENGTH".
+ *
+ * @param network[out] set to the address
+ * @param len[out] set to the prefix length
+ * @param net specification to parse
+ * @return 0 on success
+ */
+static int
+parse_network6 (struct in6_addr *network,
+                uint8_t *len,
+                const char *net)
+{
+  const char *tok;
+  char *ip;
+  unsigned int plen;
+
+  tok = strchr (net, '/');
+  if (NULL == tok)
+  {
+    fprintf (stderr,
+             "Error in network specification: lacks '/'\n");
+    return 1;
+  }
+  ip = strndup (net,
+                tok - net);
+  if (1 !=
+      inet_pton (AF_INET6,
+                 ip,
+                 network))
+  {
+    fprintf (stderr,
+             "IPv6 address `%s' malformed\n",
+             ip);
+    free (ip);
+    return 1;
+  }
+  free (ip);
+  if ( (1 !=
+        sscanf (tok + 1,
+                "%u",
+                &plen)) ||
+       (plen > 128) )
+  {
+    fprintf (stderr,
+             "Prefix length `%s' invalid\n",
+             tok + 1);
+    return 1;
+  }
+  *len = plen;
+  return 0;
+}
+
+
+/**
+ * Add an IPv6 route.  Syntax: "route6 add PREFIX/LEN via NEXTHOP dev
+ * IFC"; use "::" as NEXTHOP for directly connected networks.
+ */
+static void
+process_cmd_route6_add ()
+{
+  struct in6_addr prefix;
+  struct in6_addr next_hop;
+  struct Interface *ifc;
+  uint8_t len;
+  char *tok;
+
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (0 != parse_network6 (&prefix,
+                             &len,
+                             tok)) )
+  {
+    fprintf (stderr,
+             "Expected network specification, not `%s'\n",
+             tok);
+    return;
+  }
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (0 != strcasecmp ("via",
+                         tok)))
+  {
+    fprintf (stderr,
+             "Expected `via', not `%s'\n",
+             tok);
+    return;
+  }
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (1 != inet_pton (AF_INET6,
+                        tok,
+                        &next_hop)) )
+  {
+    fprintf (stderr,
+             "Expected next hop, not `%s'\n",
+             tok);
+    return;
+  }
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (0 != strcasecmp ("dev",
+                         tok)))
+  {
+    fprintf (stderr,
+             "Expected `dev', not `%s'\n",
+             tok);
+    return;
+  }
+  tok = strtok (NULL, " ");
+  ifc = (NULL == tok) ? NULL : find_interface (tok);
+  if (NULL == ifc)
+  {
+    fprintf (stderr,
+             "Interface `%s' unknown\n",
+             tok);
+    return;
+  }
+  fib6_add (&prefix,
+            len,
+            &next_hop,
+            ifc->ifc_num);
+}
+
+
+/**
+ * Delete an IPv6 route.  Syntax: "route6 del PREFIX/LEN".
+ */
+static void
+process_cmd_route6_del ()
+{
+  struct in6_addr prefix;
+  uint8_t len;
+  char *tok;
+
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (0 != parse_network6 (&prefix,
+                             &len,
+                             tok)) )
+  {
+    fprintf (stderr,
+             "Expected network specification, not `%s'\n",
+             tok);
+    return;
+  }
+  if (0 != fib6_del (&prefix,
+                     len))
+    fprintf (stderr,
+             "No such route\n");
+}
+
+
+/**
+ * Print out the IPv6 routing table.
+ */
+static void
+process_cmd_route6_list ()
+{
+  print ("Route List\n");
+  for (unsigned int i = 0; i < fib6_num_routes; i++)
+  {
+    const struct Fib6Route *r = &fib6_routes[i];
+    char buf[INET6_ADDRSTRLEN];
+    char buf1[INET6_ADDRSTRLEN];
+
+    print ("%s/%u -> %s (%4s)\n",
+           inet_ntop (AF_INET6, &r->prefix, buf, sizeof (buf)),
+           (unsigned int) r->len,
+           inet_ntop (AF_INET6, &r->next_hop, buf1, sizeof (buf1)),
+           gifc[r->ifc_num - 1].name);
+  }
+}
+
+
+/**
+ * Simple xorshift PRNG for the benchmark.
+ *
+ * @param[in,out] state generator state, must not be 0
+ * @return next pseudo-random number
+ */
+static uint64_t
+bench_random (uint64_t *state)
+{
+  uint64_t x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  return x;
+}
+
+
+/**
+ * Benchmark IPv6 against IPv4 route lookups.  Syntax: "route6 bench
+ * [LOOKUPS]".  Destinations are drawn from the configured prefixes
+ * (with random host bits), so that lookups go as deep as the routes.
+ */
+static void
+process_cmd_route6_bench ()
+{
+#define BENCH_ADDRS 4096
+  static struct in6_addr dst6[BENCH_ADDRS];
+  static struct in_addr dst4[BENCH_ADDRS];
+  const char *tok = strtok (NULL, " ");
+  unsigned int lookups = 1000000;
+  uint64_t state = 0x9E3779B97F4A7C15LLU;
+  volatile uintptr_t sink = 0;
+  struct timespec t0;
+  struct timespec t1;
+  struct timespec t2;
+  uint64_t ns6;
+  uint64_t ns4;
+
+  if ( (NULL != tok) &&
+       ( (1 != sscanf (tok,
+                       "%u",
+                       &lookups)) ||
+         (0 == lookups) ) )
+  {
+    fprintf (stderr,
+             "Expected number of lookups, not `%s'\n",
+             tok);
+    return;
+  }
+  for (unsigned int i = 0; i < BENCH_ADDRS; i++)
+  {
+    uint64_t rnd[2] = { bench_random (&state), bench_random (&state) };
+
+    memcpy (&dst6[i],
+            rnd,
+            sizeof (rnd));
+    if (0 != fib6_num_routes)
+    {
+      const struct Fib6Route *r = &fib6_routes[rnd[0] % fib6_num_routes];
+
+      for (unsigned int b = 0; b < r->len; b++)
+        if (r->prefix.s6_addr[b / 8] & (0x80 >> (b % 8)))
+          dst6[i].s6_addr[b / 8] |= 0x80 >> (b % 8);
+        else
+          dst6[i].s6_addr[b / 8] &= ~(0x80 >> (b % 8));
+    }
+    dst4[i].s_addr = (uint32_t) rnd[1];
+    if (0 != routingTableIndex)
+    {
+      const struct TableEntry *e = &routingTable[rnd[0] % routingTableIndex];
+
+      dst4[i].s_addr = (e->target_network.s_addr & e->netmask.s_addr)
+                       | (dst4[i].s_addr & ~e->netmask.s_addr);
+    }
+  }
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+  for (unsigned int i = 0; i < lookups; i++)
+    sink += (uintptr_t) fib6_lookup (&dst6[i % BENCH_ADDRS]);
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  for (unsigned int i = 0; i < lookups; i++)
+    sink += (uintptr_t) fib4_lookup (dst4[i % BENCH_ADDRS]);
+  clock_gettime (CLOCK_MONOTONIC, &t2);
+  (void) sink;
+  ns6 = (t1.tv_sec - t0.tv_sec) * 1000000000LLU + t1.tv_nsec - t0.tv_nsec;
+  ns4 = (t2.tv_sec - t1.tv_sec) * 1000000000LLU + t2.tv_nsec - t1.tv_nsec;
+  print ("%u lookups: IPv6 %llu ns/lookup (%u routes, %u trie nodes, %llu KiB), IPv4 %llu ns/lookup (%d routes)\n",
+         lookups,
+         (unsigned long long) (ns6 / lookups),
+         fib6_num_routes,
+         (0 == fib6_num_nodes) ? 0 : fib6_num_nodes - 1,
+         (unsigned long long) ( ( (NULL == fib6_root) ? 0 : FIB6_ROOT_SIZE * sizeof (struct Fib6Slot))
+                                + fib6_cap_nodes * sizeof (struct Fib6Node)) / 1024,
+         (unsigned long long) (ns4 / lookups),
+         routingTableIndex);
+#undef BENCH_ADDRS
+}
+
+
+/**
+ * The user entered a "route6" command.  The remaining
+ * arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_route6 ()
+{
+  char *subcommand = strtok (NULL, " ");
+
+  if (NULL == subcommand)
+    subcommand = "list";
+  if (0 == strcasecmp ("add",
+                       subcommand))
+    process_cmd_route6_add ();
+  else if (0 == strcasecmp ("del",
+                            subcommand))
+    process_cmd_route6_del ();
+  else if (0 == strcasecmp ("list",
+                            subcommand))
+    process_cmd_route6_list ();
+  else if (0 == strcasecmp ("bench",
+                            subcommand))
+    process_cmd_route6_bench ();
+  else
+    fprintf (stderr,
+             "Subcommand `%s' not understood\n",
+             subcommand);
+}
+
+
+/**
+ * The user entered an "ndp" command: print the IPv6 neighbor cache.
+ */
+static void
+process_cmd_ndp ()
+{
+  for (unsigned int i = 0; i < NEIGH6_SIZE; i++)
+  {
+    const struct Neighbor6 *n = &neigh6[i];
+    char buf[INET6_ADDRSTRLEN];
+
+    if (0 == n->ifc_num)
+      continue;
+    print ("%s -> %02x:%02x:%02x:%02x:%02x:%02x (%4s)\n",
+           inet_ntop (AF_INET6, &n->ip, buf, sizeof (buf)),
+           n->mac.mac[0],
+           n->mac.mac[1],
+           n->mac.mac[2],
+           n->mac.mac[3],
+           n->mac.mac[4],
+           n->mac.mac[5],
+           gifc[n->ifc_num - 1].name);
+  }
+}
+
+
+/**
+ * Get the ACL selected by the next two tokens ("IFC in|out") in the
+ * strtok() buffer.
+ *
+ * @return NULL on error
+ */
+static struct Acl *
+acl_parse_target ()
+{
+  const char *tok;
+  struct Interface *ifc;
+
+  tok = strtok (NULL, " ");
+  if (NULL == tok)
+  {
+    fprintf (stderr,
+             "No network interface provided\n");
+    return NULL;
+  }
+  ifc = find_interface (tok);
+  if (NULL == ifc)
+  {
+    fprintf (stderr,
+             "Interface `%s' unknown\n",
+             tok);
+    return NULL;
+  }
+  tok = strtok (NULL, " ");
+  if ( (NULL != tok) &&
+       (0 == strcasecmp ("in",
+                         tok)) )
+    return &acls[(ifc->ifc_num - 1) * 2 + ACL_IN];
+  if ( (NULL != tok) &&
+       (0 == strcasecmp ("out",
+                         tok)) )
+    return &acls[(ifc->ifc_num - 1) * 2 + ACL_OUT];
+  if (NULL == tok)
+    fprintf (stderr,
+             "Expected `in' or `out'\n");
+  else
+    fprintf (stderr,
+             "Expected `in' or `out', not `%s'\n",
+             tok);
+  return NULL;
+}
+
+
+/**
+ * Parse port range "N" or "N-M" in @a spec.
+ *
+ * @param lo[out] set to lower bound
+ * @param hi[out] set to upper bound
+ * @param spec range to parse
+ * @return 0 on success
+ */
+static int
+acl_parse_ports (uint16_t *lo,
+                 uint16_t *hi,
+                 const char *spec)
+{
+  unsigned int l;
+  unsigned int h;
+  char dummy;
+
+  if (2 == sscanf (spec,
+                   "%u-%u%c",
+                   &l,
+                   &h,
+                   &dummy))
+    ;
+  else if (1 == sscanf (spec,
+                        "%u%c",
+                        &l,
+                        &dummy))
+    h = l;
+  else
+    return 1;
+  if ( (l > h) ||
+       (h > UINT16_MAX) )
+    return 1;
+  *lo = (uint16_t) l;
+  *hi = (uint16_t) h;
+  return 0;
+}
+
+
+/**
+ * Parse L4 protocol @a spec ("tcp", "udp", "icmp", "any" or a number).
+ *
+ * @param spec protocol to parse
+ * @return -1 for any, -2 on error, otherwise the protocol number
+ */
+static int
+acl_parse_protocol (const char *spec)
+{
+  unsigned int proto;
+  char dummy;
+
+  if (0 == strcasecmp ("any", spec))
+    return -1;
+  if (0 == strcasecmp ("tcp", spec))
+    return IPPROTO_TCP;
+  if (0 == strcasecmp ("udp", spec))
+    return IPPROTO_UDP;
+  if (0 == strcasecmp ("icmp", spec))
+    return IPPROTO_ICMP;
+  if ( (1 == sscanf (spec,
+                     "%u%c",
+                     &proto,
+                     &dummy)) &&
+       (proto <= UINT8_MAX) )
+    return (int) proto;
+  return -2;
+}
+
+
+/**
+ * Add a rule to an ACL (not active until "acl commit").
+ * Syntax: "acl add IFC in|out SEQ permit|deny [proto P] [src NET]
+ * [dst NET] [sport N[-M]] [dport N[-M]]".
+ */
+static void
+process_cmd_acl_add ()
+{
+  struct Acl *acl;
+  struct AclRule r;
+  struct in_addr mask;
+  const char *tok;
+  unsigned int pos;
+
+  acl = acl_parse_target ();
+  if (NULL == acl)
+    return;
+  memset (&r, 0, sizeof (r));
+  r.protocol = -1;
+  r.sport_hi = UINT16_MAX;
+  r.dport_hi = UINT16_MAX;
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (1 != sscanf (tok,
+                     "%u",
+                     &r.seq)) )
+  {
+    if (NULL == tok)
+      fprintf (stderr,
+               "Expected sequence number\n");
+    else
+      fprintf (stderr,
+               "Expected sequence number, not `%s'\n",
+               tok);
+    return;
+  }
+  tok = strtok (NULL, " ");
+  if ( (NULL != tok) &&
+       (0 == strcasecmp ("permit",
+                         tok)) )
+    r.permit = true;
+  else if ( (NULL == tok) ||
+            (0 != strcasecmp ("deny",
+                              tok)) )
+  {
+    if (NULL == tok)
+      fprintf (stderr,
+               "Expected `permit' or `deny'\n");
+    else
+      fprintf (stderr,
+               "Expected `permit' or `deny', not `%s'\n",
+               tok);
+    return;
+  }
+  while (NULL != (tok = strtok (NULL, " ")))
+  {
+    const char *arg = strtok (NULL, " ");
+
+    if (NULL == arg)
+    {
+      fprintf (stderr,
+               "Missing argument for `%s'\n",
+               tok);
+      return;
+    }
+    if (0 == strcasecmp ("proto", tok))
+    {
+      r.protocol = acl_parse_protocol (arg);
+      if (-2 == r.protocol)
+      {
+        fprintf (stderr,
+                 "Protocol `%s' malformed\n",
+                 arg);
+        return;
+      }
+    }
+    else if (0 == strcasecmp ("src", tok))
+    {
+      if (0 != parse_network (&r.src,
+                              &mask,
+                              arg))
+        return;
+      r.src.s_addr &= mask.s_addr;
+      r.src_len = __builtin_popcount (mask.s_addr);
+    }
+    else if (0 == strcasecmp ("dst", tok))
+    {
+      if (0 != parse_network (&r.dst,
+                              &mask,
+                              arg))
+        return;
+      r.dst.s_addr &= mask.s_addr;
+      r.dst_len = __builtin_popcount (mask.s_addr);
+    }
+    else if (0 == strcasecmp ("sport", tok))
+    {
+      if (0 != acl_parse_ports (&r.sport_lo,
+                                &r.sport_hi,
+                                arg))
+      {
+        fprintf (stderr,
+                 "Port range `%s' malformed\n",
+                 arg);
+        return;
+      }
+    }
+    else if (0 == strcasecmp ("dport", tok))
+    {
+      if (0 != acl_parse_ports (&r.dport_lo,
+                                &r.dport_hi,
+                                arg))
+      {
+        fprintf (stderr,
+                 "Port range `%s' malformed\n",
+                 arg);
+        return;
+      }
+    }
+    else
+    {
+      fprintf (stderr,
+               "Unexpected `%s'\n",
+               tok);
+      return;
+    }
+  }
+  /* keep @e staged sorted by seq, replace rule with the same seq */
+  pos = 0;
+  while ( (pos < acl->num_staged) &&
+          (acl->staged[pos].seq < r.seq) )
+    pos++;
+  if ( (pos < acl->num_staged) &&
+       (acl->staged[pos].seq == r.seq) )
+  {
+    acl->staged[pos] = r;
+    return;
+  }
+  if (acl->num_staged == acl->staged_size)
+  {
+    acl->staged_size = (0 == acl->staged_size) ? 16 : 2 * acl->staged_size;
+    acl->staged = realloc (acl->staged,
+                           acl->staged_size * sizeof (struct AclRule));
+    if (NULL == acl->staged)
+      abort ();
+  }
+  memmove (&acl->staged[pos + 1],
+           &acl->staged[pos],
+           (acl->num_staged - pos) * sizeof (struct AclRule));
+  acl->staged[pos] = r;
+  acl->num_staged++;
+}
+
+
+/**
+ * Remove a rule from an ACL (not active until "acl commit").
+ * Syntax: "acl del IFC in|out SEQ".
+ */
+static void
+process_cmd_acl_del ()
+{
+  struct Acl *acl;
+  const char *tok;
+  unsigned int seq;
+
+  acl = acl_parse_target ();
+  if (NULL == acl)
+    return;
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (1 != sscanf (tok,
+                     "%u",
+                     &seq)) )
+  {
+    if (NULL == tok)
+      fprintf (stderr,
+               "Expected sequence number\n");
+    else
+      fprintf (stderr,
+               "Expected sequence number, not `%s'\n",
+               tok);
+    return;
+  }
+  for (unsigned int i = 0; i < acl->num_staged; i++)
+  {
+    if (acl->staged[i].seq != seq)
+      continue;
+    memmove (&acl->staged[i],
+             &acl->staged[i + 1],
+             (acl->num_staged - i - 1) * sizeof (struct AclRule));
+    acl->num_staged--;
+    return;
+  }
+  fprintf (stderr,
+           "No rule with sequence number %u\n",
+           seq);
+}
+
+
+/**
+ * One (src, dst, protocol, port prefixes) key of a rule, used while
+ * compiling a classifier.
+ */
+struct AclEntry
+{
+  /**
+   * Masked addresses and ports, as in #AclSlot.
+   */
+  uint32_t src;
+  uint32_t dst;
+  uint32_t ports;
+
+  /**
+   * Prefix lengths of the addresses and ports.
+   */
+  uint8_t src_len;
+  uint8_t dst_len;
+  uint8_t sport_len;
+  uint8_t dport_len;
+
+  /**
+   * Protocol to match, -1 for any.
+   */
+  int protocol;
+
+  /**
+   * Sequence number of the rule.
+   */
+  unsigned int seq;
+
+  /**
+   * Offset of the rule in the classifier's rule array.
+   */
+  uint32_t rule;
+};
+
+
+/**
+ * Maximum number of prefixes a port range is split into.
+ */
+#define ACL_MAX_PORT_PREFIXES 30
+
+
+/**
+ * Split the port range @a lo - @a hi into the smallest set of
+ * prefixes covering it.
+ *
+ * @param lo lower bound of the range
+ * @param hi upper bound of the range
+ * @param ports[out] set to the first port of each prefix
+ * @param lens[out] set to the length of each prefix
+ * @return number of prefixes, at most #ACL_MAX_PORT_PREFIXES
+ */
+static unsigned int
+acl_port_prefixes (uint32_t lo,
+                   uint32_t hi,
+                   uint16_t ports[ACL_MAX_PORT_PREFIXES],
+                   uint8_t lens[ACL_MAX_PORT_PREFIXES])
+{
+  unsigned int n = 0;
+
+  while (lo <= hi)
+  {
+    uint32_t size = 1;
+    uint8_t len = 16;
+
+    /* grow the block at @a lo while it stays aligned and in range */
+    while ( (len > 0) &&
+            (0 == (lo & (2 * size - 1))) &&
+            (lo + 2 * size - 1 <= hi) )
+    {
+      size *= 2;
+      len--;
+    }
+    ports[n] = (uint16_t) lo;
+    lens[n] = len;
+    n++;
+    lo += size;
+  }
+  return n;
+}
+
+
+/**
+ * Order entries by tuple (prefix lengths and protocol kind), key and
+ * seq.
+ */
+static int
+acl_cmp_entry (const void *a,
+               const void *b)
+{
+  const struct AclEntry *ea = a;
+  const struct AclEntry *eb = b;
+
+  if (ea->src_len != eb->src_len)
+    return (ea->src_len < eb->src_len) ? -1 : 1;
+  if (ea->dst_len != eb->dst_len)
+    return (ea->dst_len < eb->dst_len) ? -1 : 1;
+  if (ea->sport_len != eb->sport_len)
+    return (ea->sport_len < eb->sport_len) ? -1 : 1;
+  if (ea->dport_len != eb->dport_len)
+    return (ea->dport_len < eb->dport_len) ? -1 : 1;
+  if ( (-1 == ea->protocol) != (-1 == eb->protocol) )
+    return (-1 == ea->protocol) ? -1 : 1;
+  if (ea->src != eb->src)
+    return (ea->src < eb->src) ? -1 : 1;
+  if (ea->dst != eb->dst)
+    return (ea->dst < eb->dst) ? -1 : 1;
+  if (ea->ports != eb->ports)
+    return (ea->ports < eb->ports) ? -1 : 1;
+  if (ea->protocol != eb->protocol)
+    return (ea->protocol < eb->protocol) ? -1 : 1;
+  if (ea->seq != eb->seq)
+    return (ea->seq < eb->seq) ? -1 : 1;
+  return 0;
+}
+
+
+/**
+ * Check if entries @a a and @a b belong to the same tuple.
+ */
+static bool
+acl_same_tuple (const struct AclEntry *a,
+                const struct AclEntry *b)
+{
+  return (a->src_len == b->src_len) &&
+         (a->dst_len == b->dst_len) &&
+         (a->sport_len == b->sport_len) &&
+         (a->dport_len == b->dport_len) &&
+         ( (-1 == a->protocol) == (-1 == b->protocol) );
+}
+
+
+/**
+ * Check if entries @a a and @a b of the same tuple have the same key.
+ */
+static bool
+acl_same_key (const struct AclEntry *a,
+              const struct AclEntry *b)
+{
+  return (a->src == b->src) &&
+         (a->dst == b->dst) &&
+         (a->ports == b->ports) &&
+         (a->protocol == b->protocol);
+}
+
+
+/**
+ * Get the netmask for a prefix of @a len bits out of @a bits.
+ *
+ * @param len prefix length
+ * @param bits width of the field
+ * @return mask in host byte order
+ */
+static uint32_t
+acl_prefix_mask (uint8_t len,
+                 uint8_t bits)
+{
+  if (0 == len)
+    return 0;
+  return (~(uint32_t) 0 << (bits - len)) & (~(uint32_t) 0 >> (32 - bits));
+}
+
+
+/**
+ * Order tuples by their smallest sequence number.
+ */
+static int
+acl_cmp_min_seq (const void *a,
+                 const void *b)
+{
+  const struct AclTuple *ta = a;
+  const struct AclTuple *tb = b;
+
+  if (ta->min_seq != tb->min_seq)
+    return (ta->min_seq < tb->min_seq) ? -1 : 1;
+  return 0;
+}
+
+
+/**
+ * Release the memory of classifier @a c.
+ *
+ * @param c classifier to free
+ */
+static void
+acl_classifier_free (struct AclClassifier *c)
+{
+  for (unsigned int i = 0; i < c->num_tuples; i++)
+    free (c->tuples[i].slots);
+  free (c->tuples);
+  free (c->rules);
+  memset (c, 0, sizeof (*c));
+}
+
+
+/**
+ * Compile the staged rules of @a acl into its active classifier.
+ * Hit counters of rules that are still present are preserved.
+ *
+ * @param acl ACL to compile
+ */
+static void
+acl_compile (struct Acl *acl)
+{
+  struct AclClassifier c;
+  struct AclEntry *entries;
+  unsigned int num_entries;
+  unsigned int start;
+
+  /* carry hit counters over to the staged rules */
+  for (unsigned int i = 0; i < acl->num_staged; i++)
+    acl->staged[i].hits = 0;
+  for (unsigned int i = 0; i < acl->active.num_rules; i++)
+    for (unsigned int j = 0; j < acl->num_staged; j++)
+      if (acl->staged[j].seq == acl->active.rules[i].seq)
+      {
+        acl->staged[j].hits = acl->active.rules[i].hits;
+        break;
+      }
+  acl_classifier_free (&acl->active);
+  if (0 == acl->num_staged)
+    return;
+  memset (&c, 0, sizeof (c));
+  c.num_rules = acl->num_staged;
+  c.rules = malloc (c.num_rules * sizeof (struct AclRule));
+  if (NULL == c.rules)
+    abort ();
+  memcpy (c.rules,
+          acl->staged,
+          c.num_rules * sizeof (struct AclRule));
+
+  /* split port ranges, one entry per pair of port prefixes */
+  num_entries = 0;
+  entries = NULL;
+  for (unsigned int i = 0; i < c.num_rules; i++)
+  {
+    const struct AclRule *r = &c.rules[i];
+    uint16_t sports[ACL_MAX_PORT_PREFIXES];
+    uint8_t slens[ACL_MAX_PORT_PREFIXES];
+    uint16_t dports[ACL_MAX_PORT_PREFIXES];
+    uint8_t dlens[ACL_MAX_PORT_PREFIXES];
+    unsigned int ns;
+    unsigned int nd;
+
+    ns = acl_port_prefixes (r->sport_lo,
+                            r->sport_hi,
+                            sports,
+                            slens);
+    nd = acl_port_prefixes (r->dport_lo,
+                            r->dport_hi,
+                            dports,
+                            dlens);
+    entries = realloc (entries,
+                       (num_entries + ns * nd) * sizeof (struct AclEntry));
+    if (NULL == entries)
+      abort ();
+    for (unsigned int s = 0; s < ns; s++)
+      for (unsigned int d = 0; d < nd; d++)
+      {
+        struct AclEntry *e = &entries[num_entries++];
+
+        e->src = r->src.s_addr;
+        e->dst = r->dst.s_addr;
+        e->ports = (uint32_t) sports[s] << 16 | dports[d];
+        e->src_len = r->src_len;
+        e->dst_len = r->dst_len;
+        e->sport_len = slens[s];
+        e->dport_len = dlens[d];
+        e->protocol = r->protocol;
+        e->seq = r->seq;
+        e->rule = i;
+      }
+  }
+  qsort (entries,
+         num_entries,
+         sizeof (struct AclEntry),
+         &acl_cmp_entry);
+
+  c.tuples = calloc (num_entries, sizeof (struct AclTuple));
+  if (NULL == c.tuples)
+    abort ();
+  start = 0;
+  while (start < num_entries)
+  {
+    const struct AclEntry *first = &entries[start];
+    struct AclTuple *t = &c.tuples[c.num_tuples++];
+    unsigned int end = start;
+    unsigned int num_keys = 0;
+    uint32_t size = 2;
+
+    t->min_seq = UINT_MAX;
+    while ( (end < num_entries) &&
+            acl_same_tuple (&entries[end],
+                            first) )
+    {
+      if ( (end == start) ||
+           (! acl_same_key (&entries[end],
+                            &entries[end - 1])) )
+        num_keys++;
+      if (entries[end].seq < t->min_seq)
+        t->min_seq = entries[end].seq;
+      end++;
+    }
+    while (size < 2 * num_keys)
+      size *= 2;
+    t->slot_mask = size - 1;
+    t->slots = calloc (size, sizeof (struct AclSlot));
+    if (NULL == t->slots)
+      abort ();
+    t->src_mask = htonl (acl_prefix_mask (first->src_len, 32));
+    t->dst_mask = htonl (acl_prefix_mask (first->dst_len, 32));
+    t->port_mask = acl_prefix_mask (first->sport_len, 16) << 16
+                   | acl_prefix_mask (first->dport_len, 16);
+    t->protocol_mask = (-1 == first->protocol) ? 0 : 0xFF;
+    for (unsigned int i = start; i < end; i++)
+    {
+      const struct AclEntry *e = &entries[i];
+      uint8_t protocol = (-1 == e->protocol) ? 0 : (uint8_t) e->protocol;
+      uint32_t pos;
+
+      /* sorted by seq within a key, only the first can match */
+      if ( (i != start) &&
+           acl_same_key (e,
+                         &entries[i - 1]) )
+        continue;
+      pos = acl_key_hash (e->src,
+                          e->dst,
+                          e->ports,
+                          protocol) & t->slot_mask;
+      while (t->slots[pos].used)
+        pos = (pos + 1) & t->slot_mask;
+      t->slots[pos].src = e->src;
+      t->slots[pos].dst = e->dst;
+      t->slots[pos].ports = e->ports;
+      t->slots[pos].protocol = protocol;
+      t->slots[pos].used = true;
+      t->slots[pos].rule = e->rule;
+    }
+    start = end;
+  }
+  free (entries);
+  qsort (c.tuples,
+         c.num_tuples,
+         sizeof (struct AclTuple),
+         &acl_cmp_min_seq);
+  acl->active = c;
+}
+
+
+/**
+ * Print one ACL rule.
+ *
+ * @param ifc interface the rule belongs to
+ * @param dir direction of the rule
+ * @param r rule to print
+ */
+static void
+acl_print_rule (const struct Interface *ifc,
+                enum AclDirection dir,
+                const struct AclRule *r)
+{
+  char sbuf[INET_ADDRSTRLEN];
+  char dbuf[INET_ADDRSTRLEN];
+
+  print ("%s %s %u %s proto %d src %s/%u dst %s/%u sport %u-%u dport %u-%u (%llu hits)\n",
+         ifc->name,
+         (ACL_IN == dir) ? "in" : "out",
+         r->seq,
+         r->permit ? "permit" : "deny",
+         r->protocol,
+         inet_ntop (AF_INET, &r->src, sbuf, sizeof (sbuf)),
+         (unsigned int) r->src_len,
+         inet_ntop (AF_INET, &r->dst, dbuf, sizeof (dbuf)),
+         (unsigned int) r->dst_len,
+         (unsigned int) r->sport_lo,
+         (unsigned int) r->sport_hi,
+         (unsigned int) r->dport_lo,
+         (unsigned int) r->dport_hi,
+         (unsigned long long) r->hits);
+}
+
+
+/**
+ * Print the active ACLs, optionally only for the interface named
+ * by the next token.
+ */
+static void
+process_cmd_acl_list ()
+{
+  const char *tok = strtok (NULL, " ");
+  struct Interface *only = NULL;
+
+  if (NULL != tok)
+  {
+    only = find_interface (tok);
+    if (NULL == only)
+    {
+      fprintf (stderr,
+               "Interface `%s' unknown\n",
+               tok);
+      return;
+    }
+  }
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    if ( (NULL != only) &&
+         (only != &gifc[i]) )
+      continue;
+    for (unsigned int dir = ACL_IN; dir <= ACL_OUT; dir++)
+    {
+      const struct AclClassifier *c = &acls[i * 2 + dir].active;
+
+      for (unsigned int j = 0; j < c->num_rules; j++)
+        acl_print_rule (&gifc[i],
+                        dir,
+                        &c->rules[j]);
+    }
+  }
+}
+
+
+/**
+ * The user entered an "acl" command.  The remaining
+ * arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_acl ()
+{
+  char *subcommand = strtok (NULL, " ");
+
+  if (NULL == subcommand)
+    subcommand = "list";
+  if (0 == strcasecmp ("add",
+                       subcommand))
+    process_cmd_acl_add ();
+  else if (0 == strcasecmp ("del",
+                            subcommand))
+    process_cmd_acl_del ();
+  else if (0 == strcasecmp ("commit",
+                            subcommand))
+    for (unsigned int i = 0; i < 2 * num_ifc; i++)
+      acl_compile (&acls[i]);
+  else if (0 == strcasecmp ("list",
+                            subcommand))
+    process_cmd_acl_list ();
+  else
+    fprintf (stderr,
+             "Subcommand `%s' not understood\n",
+             subcommand);
+}
+
+
+/**
+ * Enable or disable masquerading on the interface named by the next
+ * token.
+ *
+ * @param enable true to enable
+ */
+static void
+process_cmd_nat_set (bool enable)
+{
+  const char *tok = strtok (NULL, " ");
+  struct Interface *ifc;
+
+  if (NULL == tok)
+  {
+    fprintf (stderr,
+             "No network interface provided\n");
+    return;
+  }
+  ifc = find_interface (tok);
+  if (NULL == ifc)
+  {
+    fprintf (stderr,
+             "Interface `%s' unknown\n",
+             tok);
+    return;
+  }
+  if (enable)
+  {
+    nat_init ();
+    nat_ifcs[ifc->ifc_num] = true;
+    return;
+  }
+  nat_ifcs[ifc->ifc_num] = false;
+  if (NULL == nat_flows)
+    return;
+  for (uint32_t i = 0; i < nat_used; i++)
+  {
+    if (nat_flows[i].ifc_num != ifc->ifc_num)
+      continue;
+    loop_timer_cancel (&nat_flows[i].timer);
+    nat_flow_release (i);
+  }
+}
+
+
+/**
+ * Print the NAT flows, at most as many as given by the next token
+ * (default: 100).
+ */
+static void
+process_cmd_nat_list ()
+{
+  const char *tok = strtok (NULL, " ");
+  unsigned int limit = 100;
+  uint32_t now;
+
+  if ( (NULL != tok) &&
+       (1 != sscanf (tok,
+                     "%u",
+                     &limit)) )
+  {
+    fprintf (stderr,
+             "Expected number of flows, not `%s'\n",
+             tok);
+    return;
+  }
+  if (NULL == nat_flows)
+    return;
+  now = nat_time ();
+  for (uint32_t i = 0; (i < nat_used) && (limit > 0); i++)
+  {
+    const struct NatFlow *f = &nat_flows[i];
+    char sbuf[INET_ADDRSTRLEN];
+    char dbuf[INET_ADDRSTRLEN];
+    char nbuf[INET_ADDRSTRLEN];
+
+    if (0 == f->ifc_num)
+      continue;
+    limit--;
+    print ("%u %s:%u -> %s:%u via %s:%u (%s) %llu pkts %llu bytes, expires in %ds\n",
+           (unsigned int) f->orig.protocol,
+           inet_ntop (AF_INET, &f->orig.src, sbuf, sizeof (sbuf)),
+           (unsigned int) ntohs (f->orig.sport),
+           inet_ntop (AF_INET, &f->orig.dst, dbuf, sizeof (dbuf)),
+           (unsigned int) ntohs (f->orig.dport),
+           inet_ntop (AF_INET, &f->reply.dst, nbuf, sizeof (nbuf)),
+           (unsigned int) ntohs (f->reply.dport),
+           gifc[f->ifc_num - 1].name,
+           (unsigned long long) f->packets,
+           (unsigned long long) f->bytes,
+           (int) (f->expires - now));
+  }
+}
+
+
+/**
+ * Print NAT statistics.
+ */
+static void
+process_cmd_nat_stats ()
+{
+  print ("flows: %u/%u, created: %llu, expired: %llu\n",
+         (unsigned int) nat_active,
+         (unsigned int) NAT_MAX_FLOWS,
+         (unsigned long long) nat_stats.created,
+         (unsigned long long) nat_stats.expired);
+  print ("translated out: %llu, in: %llu, lookups: %llu, avg probes: %.2f\n",
+         (unsigned long long) nat_stats.translated_out,
+         (unsigned long long) nat_stats.translated_in,
+         (unsigned long long) nat_stats.lookups,
+         (0 == nat_stats.lookups)
+         ? 0.0
+         : (double) nat_stats.probes / nat_stats.lookups);
+  print ("dropped: %llu no port, %llu table full, %llu fragments, %llu untranslatable\n",
+         (unsigned long long) nat_stats.drop_no_port,
+         (unsigned long long) nat_stats.drop_table_full,
+         (unsigned long long) nat_stats.drop_fragment,
+         (unsigned long long) nat_stats.drop_untranslatable);
+}
+
+
+/**
+ * The user entered a "nat" command.  The remaining
+ * arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_nat ()
+{
+  char *subcommand = strtok (NULL, " ");
+
+  if (NULL == subcommand)
+    subcommand = "list";
+  if (0 == strcasecmp ("add",
+                       subcommand))
+    process_cmd_nat_set (true);
+  else if (0 == strcasecmp ("del",
+                            subcommand))
+    process_cmd_nat_set (false);
+  else if (0 == strcasecmp ("list",
+                            subcommand))
+    process_cmd_nat_list ();
+  else if (0 == strcasecmp ("stats",
+                            subcommand))
+    process_cmd_nat_stats ();
+  else
+    fprintf (stderr,
+             "Subcommand `%s' not understood\n",
+             subcommand);
+}
+
+
+/**
+ * Parse a rate such as "10mbit" or "512kbit".  Supported units are
+ * "bit", "kbit", "mbit" and "gbit" (powers of 1000); without a unit,
+ * the value is in bit/s.
+ *
+ * @param val text to parse
+ * @param[out] rate set to the rate in bytes per second
+ * @return 0 on success
+ */
+static int
+parse_rate (const char *val,
+            uint64_t *rate)
+{
+  unsigned long long v;
+  char unit[5] = "bit";
+
+  if ( (NULL == val) ||
+       (1 > sscanf (val,
+                    "%llu%4s",
+                    &v,
+                    unit)) )
+    return 1;
+  if (0 == strcasecmp (unit, "kbit"))
+    v *= 1000;
+  else if (0 == strcasecmp (unit, "mbit"))
+    v *= 1000 * 1000;
+  else if (0 == strcasecmp (unit, "gbit"))
+    v *= 1000 * 1000 * 1000;
+  else if (0 != strcasecmp (unit, "bit"))
+    return 1;
+  *rate = v / 8;
+  return (0 == *rate) ? 1 : 0;
+}
+
+
+/**
+ * Parse a size such as "1500", "32k" or "1m" (powers of 1024).
+ *
+ * @param val text to parse
+ * @param[out] size set to the size in bytes
+ * @return 0 on success
+ */
+static int
+parse_size (const char *val,
+            uint64_t *size)
+{
+  unsigned long long v;
+  char unit[2] = "";
+
+  if ( (NULL == val) ||
+       (1 > sscanf (val,
+                    "%llu%1s",
+                    &v,
+                    unit)) ||
+       (0 == v) )
+    return 1;
+  if ('\0' == unit[0])
+    *size = v;
+  else if ('k' == tolower ((unsigned char) unit[0]))
+    *size = v * 1024;
+  else if ('m' == tolower ((unsigned char) unit[0]))
+    *size = v * 1024 * 1024;
+  else
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Find the policer or shaper of @a ifc for the traffic class named
+ * @a name, or for the whole interface if @a name is "all".
+ *
+ * @param ifc interface
+ * @param shaper true for the egress shaper, false for the ingress policer
+ * @param name class name
+ * @return NULL if @a name is not a class
+ */
+static struct TokenBucket *
+qos_find_bucket (const struct Interface *ifc,
+                 bool shaper,
+                 const char *name)
+{
+  struct EgressQueue *q = &egress[ifc->ifc_num - 1];
+  struct Policer *p = &policers[ifc->ifc_num - 1];
+
+  if (NULL == name)
+    return NULL;
+  if (0 == strcasecmp ("all",
+                       name))
+    return shaper ? &q->shaper : &p->total;
+  for (unsigned int c = 0; c < EGRESS_NUM_CLASSES; c++)
+    if (0 == strcasecmp (egress_class_names[c],
+                         name))
+      return shaper ? &q->classes[c].shaper : &p->classes[c];
+  return NULL;
+}
+
+
+/**
+ * Configure policer or shaper @a tb of @a ifc from text.
+ *
+ * @param ifc interface @a tb belongs to
+ * @param tb bucket to configure
+ * @param rate rate (see parse_rate()), or "off" to disable
+ * @param burst bucket depth (see parse_size()), NULL for the default
+ *        of 10ms at @a rate but at least one frame of the interface MTU
+ * @return 0 on success
+ */
+static int
+qos_configure_bucket (const struct Interface *ifc,
+                      struct TokenBucket *tb,
+                      const char *rate,
+                      const char *burst)
+{
+  uint64_t r;
+  uint64_t b;
+
+  if ( (NULL != rate) &&
+       (0 == strcasecmp ("off",
+                         rate)) )
+  {
+    tb_configure (tb,
+                  0,
+                  0,
+                  0);
+    return 0;
+  }
+  if (0 != parse_rate (rate,
+                       &r))
+  {
+    fprintf (stderr,
+             "Rate `%s' invalid\n",
+             rate);
+    return 1;
+  }
+  if (NULL == burst)
+  {
+    b = r / 100;
+    if (b < ifc->mtu)
+      b = ifc->mtu;
+  }
+  else if (0 != parse_size (burst,
+                            &b))
+  {
+    fprintf (stderr,
+             "Burst `%s' invalid\n",
+             burst);
+    return 1;
+  }
+  tb_configure (tb,
+                r,
+                b,
+                loop_now ());
+  return 0;
+}
+
+
+/**
+ * Parse "IFC CLASS" from the strtok() buffer.
+ *
+ * @param ifc[out] set to the interface
+ * @return NULL on error, otherwise the egress class
+ */
+static struct EgressClass *
+qos_parse_class (struct Interface **ifc)
+{
+  const char *tok;
+
+  tok = strtok (NULL, " ");
+  if (NULL == tok)
+  {
+    fprintf (stderr,
+             "No network interface provided\n");
+    return NULL;
+  }
+  *ifc = find_interface (tok);
+  if (NULL == *ifc)
+  {
+    fprintf (stderr,
+             "Interface `%s' unknown\n",
+             tok);
+    return NULL;
+  }
+  tok = strtok (NULL, " ");
+  for (unsigned int c = 0; (NULL != tok) && (c < EGRESS_NUM_CLASSES); c++)
+    if (0 == strcasecmp (egress_class_names[c],
+                         tok))
+      return &egress[(*ifc)->ifc_num - 1].classes[c];
+  fprintf (stderr,
+           "Traffic class `%s' unknown\n",
+           tok);
+  return NULL;
+}
+
+
+/**
+ * Set DRR weight or queue limit of a class.
+ * Syntax: "qos weight IFC CLASS WEIGHT" or "qos limit IFC CLASS BYTES".
+ *
+ * @param weight true to set the weight, false for the limit
+ */
+static void
+process_cmd_qos_set (bool weight)
+{
+  struct EgressClass *cl;
+  struct Interface *ifc;
+  const char *tok;
+  unsigned int val;
+
+  cl = qos_parse_class (&ifc);
+  if (NULL == cl)
+    return;
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (1 != sscanf (tok,
+                     "%u",
+                     &val)) ||
+       (0 == val) )
+  {
+    fprintf (stderr,
+             "Expected positive number, not `%s'\n",
+             tok);
+    return;
+  }
+  if (weight)
+  {
+    if (cl == &egress[ifc->ifc_num - 1].classes[EGRESS_CLASS_PRIORITY])
+    {
+      fprintf (stderr,
+               "The priority class has no weight\n");
+      return;
+    }
+    cl->weight = val;
+  }
+  else
+  {
+    cl->limit = val;
+  }
+}
 
-      forward_frame_payload_to (
-            origin, 
-            &eh.src, 
-            0x0800,
-            &send, 
-            (sizeHeadIPv4 * 2) + sizeHeadIcmp + 8
-      ); 
+
+/**
+ * Print egress queue statistics, optionally only for the interface
+ * named by the next token.
+ */
+static void
+process_cmd_qos_stats ()
+{
+  const char *tok = strtok (NULL, " ");
+  struct Interface *only = NULL;
+
+  if (NULL != tok)
+  {
+    only = find_interface (tok);
+    if (NULL == only)
+    {
+      fprintf (stderr,
+               "Interface `%s' unknown\n",
+               tok);
       return;
     }
-    //__________________________________________________________________
-  } 
-  // ___________________________________________________________________
+  }
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    if ( (NULL != only) &&
+         (only != &gifc[i]) )
+      continue;
+    for (unsigned int c = 0; c < EGRESS_NUM_CLASSES; c++)
+    {
+      const struct EgressClass *cl = &egress[i].classes[c];
+
+      print ("%s %s: weight %u, limit %llu, backlog %llu, tx %llu pkts %llu bytes, %llu drops, latency avg %llu us max %llu us\n",
+             gifc[i].name,
+             egress_class_names[c],
+             cl->weight,
+             (unsigned long long) cl->limit,
+             (unsigned long long) cl->backlog,
+             (unsigned long long) cl->tx_packets,
+             (unsigned long long) cl->tx_bytes,
+             (unsigned long long) cl->drops,
+             (unsigned long long) ( (0 == cl->tx_packets)
+                                    ? 0
+                                    : cl->latency_sum / cl->tx_packets),
+             (unsigned long long) cl->latency_max);
+      if (egress[i].codel.enabled)
+        print ("%s %s: codel %s, %llu aqm drops, %llu ecn marks\n",
+               gifc[i].name,
+               egress_class_names[c],
+               cl->codel.dropping ? "dropping" : "idle",
+               (unsigned long long) cl->aqm_drops,
+               (unsigned long long) cl->ecn_marks);
+    }
+  }
 }
 
+
 /**
- * Process ARP (request or response!)
+ * Configure a policer or shaper.  Syntax:
+ * "qos police|shape IFC CLASS|all RATE [BURST]" or
+ * "qos police|shape IFC CLASS|all off".
  *
- * @param ifc interface we received the ARP request from
- * @param eh ethernet header
- * @param ah ARP header
+ * @param shaper true for "shape", false for "police"
  */
-static void handle_arp (struct Interface *ifc, const struct EthernetHeader *eh, const struct ArpHeaderEthernetIPv4 *ah){
-  /* TODO: do work here */
-
-  void *ptr = malloc(sizeof(struct EthernetHeader) + sizeof(struct ArpHeaderEthernetIPv4));
+static void
+process_cmd_qos_bucket (bool shaper)
+{
+  const char *tok;
+  struct Interface *ifc;
+  struct TokenBucket *tb;
+  const char *rate;
 
-  if (macComp ((const uint8_t *) &eh->src,(const uint8_t *) &ah->sender_ha) != 0
-        || eh->tag != 0x0608
-		|| ah->htype != 0x100
-		|| ah->ptype != 0x8
-		|| ah->hlen != 0x6
-		|| ah->plen != 0x4
-		|| !(ah->oper == 0x100 || ah->oper == 0x200)){
-      return;
+  tok = strtok (NULL, " ");
+  if (NULL == tok)
+  {
+    fprintf (stderr,
+             "No network interface provided\n");
+    return;
+  }
+  ifc = find_interface (tok);
+  if (NULL == ifc)
+  {
+    fprintf (stderr,
+             "Interface `%s' unknown\n",
+             tok);
+    return;
+  }
+  tok = strtok (NULL, " ");
+  tb = qos_find_bucket (ifc,
+                        shaper,
+                        tok);
+  if (NULL == tb)
+  {
+    fprintf (stderr,
+             "Traffic class `%s' unknown\n",
+             tok);
+    return;
   }
+  rate = strtok (NULL, " ");
+  qos_configure_bucket (ifc,
+                        tb,
+                        rate,
+                        strtok (NULL, " "));
+}
 
- if (ah->oper == ntohs(1)){
-      struct EthernetHeader neh;
-      neh.dst = ah->sender_ha;
-      neh.src = ifc->mac;
-      neh.tag = ntohs(0x0806);
 
-      // build arphead
-      struct ArpHeaderEthernetIPv4 newHeader = {
-     .htype = htons(1),
-	 .ptype = htons(0x0800),
-	 .hlen = 6,
-	 .plen = 4,
-	 .oper = htons (1),
-	 .sender_ha = {0},
-	 .sender_pa = {0},
-	 .target_ha = {0},
-	 .target_pa = {0},
-     };
+/**
+ * Print one policer or shaper, if it is enabled.
+ *
+ * @param ifc interface @a tb belongs to
+ * @param what "police" or "shape"
+ * @param name class name or "all"
+ * @param tb bucket to print
+ */
+static void
+print_bucket (const struct Interface *ifc,
+              const char *what,
+              const char *name,
+              const struct TokenBucket *tb)
+{
+  if (0 == tb->rate)
+    return;
+  print ("%s %s %s: rate %llu bit/s, burst %llu, conform %llu pkts %llu bytes, exceed %llu pkts %llu bytes\n",
+         ifc->name,
+         what,
+         name,
+         (unsigned long long) tb->rate * 8,
+         (unsigned long long) tb->burst,
+         (unsigned long long) tb->conform_packets,
+         (unsigned long long) tb->conform_bytes,
+         (unsigned long long) tb->exceed_packets,
+         (unsigned long long) tb->exceed_bytes);
+}
 
-        //sender is mac and ip
-     memcpy (&newHeader.sender_ha, &ifc->mac.mac, 6);
-     newHeader.sender_pa = ifc->ip;
 
-        //target is the old source mac and ip
-     memcpy (&newHeader.target_ha, &ah->sender_ha, 6);
-     newHeader.target_pa = ah->sender_pa;
+/**
+ * Print the policers and shapers, optionally only for the interface
+ * named by the next token.
+ */
+static void
+process_cmd_qos_rates ()
+{
+  const char *tok = strtok (NULL, " ");
+  struct Interface *only = NULL;
 
-        //insert in frame
-     memcpy (ptr, &neh, sizeof(struct EthernetHeader));
-     memcpy (ptr + sizeof(struct EthernetHeader), &newHeader, sizeof(struct ArpHeaderEthernetIPv4));
-     uint8_t size = sizeof (struct EthernetHeader) + sizeof (struct ArpHeaderEthernetIPv4);
+  if (NULL != tok)
+  {
+    only = find_interface (tok);
+    if (NULL == only)
+    {
+      fprintf (stderr,
+               "Interface `%s' unknown\n",
+               tok);
+      return;
+    }
+  }
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    if ( (NULL != only) &&
+         (only != &gifc[i]) )
+      continue;
+    print_bucket (&gifc[i],
+                  "police",
+                  "all",
+                  &policers[i].total);
+    for (unsigned int c = 0; c < EGRESS_NUM_CLASSES; c++)
+      print_bucket (&gifc[i],
+                    "police",
+                    egress_class_names[c],
+                    &policers[i].classes[c]);
+    print_bucket (&gifc[i],
+                  "shape",
+                  "all",
+                  &egress[i].shaper);
+    for (unsigned int c = 0; c < EGRESS_NUM_CLASSES; c++)
+      print_bucket (&gifc[i],
+                    "shape",
+                    egress_class_names[c],
+                    &egress[i].classes[c].shaper);
+  }
+}
 
-	forward_to (ifc, ptr,size);
-	}
 
-  if (ah->oper == ntohs(2)) {
+/**
+ * Print the queueing delay histograms, optionally only for the
+ * interface named by the next token.  Only non-empty buckets are shown.
+ */
+static void
+process_cmd_qos_hist ()
+{
+  const char *tok = strtok (NULL, " ");
+  struct Interface *only = NULL;
 
-    bool contained = false;
+  if (NULL != tok)
+  {
+    only = find_interface (tok);
+    if (NULL == only)
+    {
+      fprintf (stderr,
+               "Interface `%s' unknown\n",
+               tok);
+      return;
+    }
+  }
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    if ( (NULL != only) &&
+         (only != &gifc[i]) )
+      continue;
+    for (unsigned int c = 0; c < EGRESS_NUM_CLASSES; c++)
+    {
+      const struct Histogram *h = &egress[i].classes[c].delay;
 
-    // Insert or update in the table
-    for (int i = 0; i < MAX_ENTRIES; i++) {
-      if (ipCmp(&table[i].ip, &ah->sender_pa) == 0) {
-        // Update existing entry
-        contained = true;
-        table[i].mac = ah->sender_ha;
-        table[i].netmask = ifc->netmask;
-        memcpy(&table[i].name, ifc->name, sizeof(ifc->name));
-        table[i].ifc_num = ifc->ifc_num;
-        table[i].mtu = ifc->mtu;
-        break;
+      for (unsigned int b = 0; b < HISTOGRAM_BUCKETS; b++)
+      {
+        if (0 == h->buckets[b])
+          continue;
+        print ("%s %s: delay < %llu us: %llu\n",
+               gifc[i].name,
+               egress_class_names[c],
+               1LLU << b,
+               (unsigned long long) h->buckets[b]);
       }
     }
+  }
+}
 
-    // Add to the table if not already contained
-    if (!contained) {
-      table[tableIndex].mac = ah->sender_ha;
-      table[tableIndex].ip = ah->sender_pa;
-      table[tableIndex].netmask = ifc->netmask;
-      memcpy(&table[tableIndex].name, ifc->name, sizeof(ifc->name));
-      table[tableIndex].ifc_num = ifc->ifc_num;
-      table[tableIndex].mtu = ifc->mtu;
 
-      tableIndex++;
-      if (tableIndex >= MAX_ENTRIES) {
-        tableIndex = 0;
-      }
-    }
+/**
+ * The user entered a "qos" command.  The remaining
+ * arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_qos ()
+{
+  char *subcommand = strtok (NULL, " ");
 
-    free(ptr);
+  if (NULL == subcommand)
+    subcommand = "stats";
+  if (0 == strcasecmp ("weight",
+                       subcommand))
+    process_cmd_qos_set (true);
+  else if (0 == strcasecmp ("limit",
+                            subcommand))
+    process_cmd_qos_set (false);
+  else if (0 == strcasecmp ("stats",
+                            subcommand))
+    process_cmd_qos_stats ();
+  else if (0 == strcasecmp ("hist",
+                            subcommand))
+    process_cmd_qos_hist ();
+  else if (0 == strcasecmp ("police",
+                            subcommand))
+    process_cmd_qos_bucket (false);
+  else if (0 == strcasecmp ("shape",
+                            subcommand))
+    process_cmd_qos_bucket (true);
+  else if (0 == strcasecmp ("rates",
+                            subcommand))
+    process_cmd_qos_rates ();
+  else
+    fprintf (stderr,
+             "Subcommand `%s' not understood\n",
+             subcommand);
+}
+
+
+/**
+ * Parse network specification in @a net, initializing @a ifc.
+ * Format of @a net is "IPV4:IP/NETMASK", optionally followed by
+ * ",IPV6:IP/LENGTH".
+ *
+ * @param ifc[out] interface specification to initialize
+ * @param arg interface specification to parse (modified)
+ * @return 0 on success
+ */
+static int parse_network_arg(struct Interface *ifc, char *net) {
+  char *v6;
+
+  if (0 != strncasecmp(net, "IPV4:", strlen("IPV4:"))) {
+    fprintf(stderr, "Interface specification `%s' does not start with `IPV4:'\n", net);
+    return 1;
+  }
+  v6 = strchr (net, ',');
+  if (NULL != v6)
+  {
+    *v6++ = '\0';
+    if (0 != strncasecmp (v6, "IPV6:", strlen ("IPV6:")))
+    {
+      fprintf (stderr,
+               "Expected `IPV6:' in interface specification, not `%s'\n",
+               v6);
+      return 1;
+    }
+    if (0 != parse_network6 (&ifc->ip6,
+                             &ifc->ip6_len,
+                             v6 + strlen ("IPV6:")))
+      return 1;
+    if (0 == ifc->ip6_len)
+    {
+      fprintf (stderr,
+               "IPv6 prefix length must not be 0\n");
+      return 1;
+    }
   }
+
+  net += strlen("IPV4:");
+  return parse_network(&ifc->ip, &ifc->netmask, net);
 }
 
+
 /**
- * Parse and process frame received on @a ifc.
+ * Parse a duration such as "5ms", "250us" or "1s".  Without a unit,
+ * the value is in milliseconds.
  *
- * @param ifc interface we got the frame on
- * @param frame raw frame data
- * @param frame_size number of bytes in @a frame
+ * @param val text to parse
+ * @param[out] us set to the duration in microseconds
+ * @return 0 on success
+ */
+static int
+parse_duration (const char *val,
+                uint64_t *us)
+{
+  unsigned long long v;
+  char unit[3] = "ms";
+
+  if ( (1 > sscanf (val,
+                    "%llu%2s",
+                    &v,
+                    unit)) ||
+       (0 == v) )
+    return 1;
+  if (0 == strcmp (unit, "us"))
+    *us = v;
+  else if (0 == strcmp (unit, "ms"))
+    *us = v * 1000;
+  else if (0 == strcmp (unit, "s"))
+    *us = v * 1000000;
+  else
+    return 1;
+  return 0;
+}
+
+
+/**
+ * The user entered an "overload" command.  Syntax: "overload
+ * [backlog SIZE|off] [lag DURATION|off]"; without arguments, print the
+ * load shedding state and counters.
  */
 static void
-parse_frame (struct Interface *ifc,
-             const void *frame,
-             size_t frame_size)
+process_cmd_overload ()
 {
-  struct EthernetHeader eh;
-  const char *cframe = frame;
+  const char *tok;
 
-  if (frame_size < sizeof (eh))
+  tok = strtok (NULL, " ");
+  if (NULL == tok)
   {
-    fprintf (stderr,
-             "Malformed frame\n");
+    print ("level %u (max %u), backlog %llu bytes (step %llu), lag %llu us (step %llu)\n",
+           overload_level (),
+           overload.max_level,
+           (unsigned long long) loop_backlog (),
+           (unsigned long long) overload.backlog,
+           (unsigned long long) loop_lag (),
+           (unsigned long long) overload.lag);
+    for (unsigned int c = 0; c < EGRESS_NUM_CLASSES; c++)
+      print ("%8s: %llu pkts %llu bytes shed\n",
+             egress_class_names[c],
+             (unsigned long long) overload.shed_packets[c],
+             (unsigned long long) overload.shed_bytes[c]);
     return;
   }
-  memcpy (&eh,
-          frame,
-          sizeof (eh));
-  switch (ntohs (eh.tag))
+  while (NULL != tok)
   {
-  case ETH_P_IPV4:
-    {
-      struct IPv4Header ip;
+    const char *val = strtok (NULL, " ");
+    bool off = (NULL != val) && (0 == strcasecmp ("off",
+                                                  val));
 
-      if (frame_size < sizeof (struct EthernetHeader) + sizeof (struct
-                                                                IPv4Header))
+    if (NULL == val)
+    {
+      fprintf (stderr,
+               "Expected value after `%s'\n",
+               tok);
+      return;
+    }
+    if (0 == strcasecmp ("backlog",
+                         tok))
+    {
+      if (off)
+        overload.backlog = 0;
+      else if (0 != parse_size (val,
+                                &overload.backlog))
       {
-        fprintf (stderr,
-                 "Malformed frame\n");
-        return;
-      }
-      memcpy (&ip,
-              &cframe[sizeof (struct EthernetHeader)],
-              sizeof (struct IPv4Header));
-      /* TODO: possibly do work here (ARP learning) */
-      route (ifc, &ip, &cframe[sizeof (struct EthernetHeader) + sizeof (struct IPv4Header)],
-            frame_size - sizeof (struct EthernetHeader) - sizeof (struct IPv4Header),eh);
-      break;
+        fprintf (stderr,
+                 "Size `%s' invalid\n",
+                 val);
+        return;
+      }
     }
-  case ETH_P_ARP:
+    else if (0 == strcasecmp ("lag",
+                              tok))
     {
-      struct ArpHeaderEthernetIPv4 ah;
-
-      if (frame_size < sizeof (struct EthernetHeader) + sizeof (struct ArpHeaderEthernetIPv4)){
-#if DEBUG
-        fprintf (stderr, "Unsupported ARP frame\n");
-#endif
+      if (off)
+        overload.lag = 0;
+      else if (0 != parse_duration (val,
+                                    &overload.lag))
+      {
+        fprintf (stderr,
+                 "Duration `%s' invalid\n",
+                 val);
         return;
       }
-      memcpy (&ah, &cframe[sizeof (struct EthernetHeader)], sizeof (struct ArpHeaderEthernetIPv4));
-      handle_arp (ifc, &eh, &ah);
-      break;
     }
-  default:
-#if DEBUG
-    fprintf (stderr, "Unsupported Ethernet tag %04X\n", ntohs (eh.tag));
-#endif
-    return;
+    else
+    {
+      fprintf (stderr,
+               "Expected `backlog' or `lag', not `%s'\n",
+               tok);
+      return;
+    }
+    tok = strtok (NULL, " ");
   }
 }
 
 
 /**
- * Process frame received from @a interface.
- *
- * @param interface number of the interface on which we received @a frame
- * @param frame the frame
- * @param frame_size number of bytes in @a frame
+ * Print the flows in the flow cache, most recently seen first.
+ * Syntax: "flow list [N]", by default at most 20 flows are shown.
  */
 static void
-handle_frame (uint16_t interface,
-              const void *frame,
-              size_t frame_size)
+process_cmd_flow_list ()
 {
-  if (interface > num_ifc)
-    abort ();
-  parse_frame (&gifc[interface - 1],
-               frame,
-               frame_size);
+  const char *tok = strtok (NULL, " ");
+  unsigned int max = 20;
+  uint64_t now = loop_now ();
+
+  if ( (NULL != tok) &&
+       (1 != sscanf (tok,
+                     "%u",
+                     &max)) )
+  {
+    fprintf (stderr,
+             "Expected number of flows, not `%s'\n",
+             tok);
+    return;
+  }
+  print ("%u flows\n",
+         (unsigned int) flow_active);
+  for (uint32_t idx = flow_lru_tail; (0 != idx) && (0 != max); max--)
+  {
+    const struct Flow *f = &flows[idx - 1];
+    char src[INET_ADDRSTRLEN];
+    char dst[INET_ADDRSTRLEN];
+
+    print ("%s:%u -> %s:%u proto %u %s -> %s, %llu pkts %llu bytes, idle %llu ms\n",
+           inet_ntop (AF_INET, &f->key.src, src, sizeof (src)),
+           (unsigned int) ntohs (f->key.sport),
+           inet_ntop (AF_INET, &f->key.dst, dst, sizeof (dst)),
+           (unsigned int) ntohs (f->key.dport),
+           (unsigned int) f->key.protocol,
+           gifc[f->ingress - 1].name,
+           (0 == f->egress) ? "-" : gifc[f->egress - 1].name,
+           (unsigned long long) f->packets,
+           (unsigned long long) f->bytes,
+           (unsigned long long) (now - f->last) / 1000);
+    idx = f->lru_prev;
+  }
 }
 
 
 /**
- * Find network interface by @a name.
- *
- * @param name name to look up by
- * @return NULL if @a name was not found
+ * The user entered a "flow" command.  Syntax: "flow [export
+ * FILE|unix:PATH|off] [active DURATION] [inactive DURATION] [sample N]"
+ * or "flow list [N]"; without arguments, print the flow export state
+ * and counters.
  */
-static struct Interface *
-find_interface (const char *name)
+static void
+process_cmd_flow ()
 {
-  for (int i = 0; i<num_ifc; i++)
-    if (0 == strcasecmp (name,
-                         gifc[i].name))
-      return &gifc[i];
-  return NULL;
-}
-
-/**
- * The user entered an "arp" command.  The remaining
- * arguments can be obtained via 'strtok()'.
- */
-static void process_cmd_arp () {
-  const char *tok = strtok (NULL, " ");
-  struct in_addr v4;
-  struct MacAddress mac;
-  struct Interface *ifc;
+  const char *tok;
 
-  if (NULL == tok){
-    // print_arp_cache ();
-    return;
-  }
-  if (1 != inet_pton (AF_INET, tok, &v4)){
-    fprintf (stderr,"`%s' is not a valid IPv4 address\n", tok);
-    return;
-  }
   tok = strtok (NULL, " ");
-  if (NULL == tok) {
-    fprintf (stderr,"No network interface provided\n");
+  if (NULL == tok)
+  {
+    print ("export %s, active %llu us, inactive %llu us, sampling 1:%u\n",
+           (-1 == flow_exporter.fd) ? "off" : flow_exporter.target,
+           (unsigned long long) flow_active_timeout,
+           (unsigned long long) flow_inactive_timeout,
+           flow_sampling);
+    print ("%u flows, %llu sampled pkts, %llu created, %llu evicted, "
+           "%llu records in %llu messages, %llu export errors\n",
+           (unsigned int) flow_active,
+           (unsigned long long) flow_stats.sampled,
+           (unsigned long long) flow_stats.created,
+           (unsigned long long) flow_stats.evicted,
+           (unsigned long long) flow_stats.records,
+           (unsigned long long) flow_stats.messages,
+           (unsigned long long) flow_stats.export_errors);
     return;
   }
-  ifc = find_interface (tok);
-  if (NULL == ifc){
-    fprintf (stderr,"Interface `%s' unknown\n", tok);
+  if (0 == strcasecmp ("list",
+                       tok))
+  {
+    process_cmd_flow_list ();
     return;
   }
-  /* TODO: do MAC lookup */
- for (int i = 0; i < MAX_ENTRIES; i++){
-      if (ipCmp (&table[i].ip, &v4) == 0){
-          if (memcmp (&table[i].name, tok, sizeof(char)*4) == 0){
-	      print ("%02x:%02x:%02x:%02x:%02x:%02x\n",
-			table[i].mac.mac[0],
-			table[i].mac.mac[1],
-			table[i].mac.mac[2],
-			table[i].mac.mac[3],
-			table[i].mac.mac[4],
-			table[i].mac.mac[5]);
-	      return;
-          }
-      }
-  }
+  while (NULL != tok)
+  {
+    const char *val = strtok (NULL, " ");
 
-  if (check_ip_network (ifc->ip, v4, ifc->netmask) == 0){
+    if (NULL == val)
+    {
+      fprintf (stderr,
+               "Expected value after `%s'\n",
+               tok);
+      return;
+    }
+    if (0 == strcasecmp ("export",
+                         tok))
+    {
+      if (0 == strcasecmp ("off",
+                           val))
+        flow_export_stop ();
+      else if (0 != flow_export_start (val))
+        return;
+    }
+    else if (0 == strcasecmp ("active",
+                              tok))
+    {
+      if (0 != parse_duration (val,
+                               &flow_active_timeout))
+      {
+        fprintf (stderr,
+                 "Duration `%s' invalid\n",
+                 val);
+        return;
+      }
+    }
+    else if (0 == strcasecmp ("inactive",
+                              tok))
+    {
+      if (0 != parse_duration (val,
+                               &flow_inactive_timeout))
+      {
+        fprintf (stderr,
+                 "Duration `%s' invalid\n",
+                 val);
+        return;
+      }
+    }
+    else if (0 == strcasecmp ("sample",
+                              tok))
+    {
+      if ( (1 != sscanf (val,
+                         "%u",
+                         &flow_sampling)) ||
+           (0 == flow_sampling) )
+      {
+        fprintf (stderr,
+                 "Sampling interval `%s' invalid\n",
+                 val);
+        flow_sampling = 1;
+        return;
+      }
+      flow_countdown = flow_sampling;
+    }
+    else
+    {
+      fprintf (stderr,
+               "Expected `export', `active', `inactive' or `sample', not `%s'\n",
+               tok);
+      return;
+    }
+    tok = strtok (NULL, " ");
   }
-
-  // arp request on actual ip
-  void* ptr = malloc (sizeof(struct EthernetHeader) + sizeof(struct ArpHeaderEthernetIPv4));
-  uint8_t frame_size = sizeof (struct EthernetHeader) + sizeof(struct ArpHeaderEthernetIPv4);
-
-  struct EthernetHeader neh;
-  neh.dst = broadcastMac;
-  neh.src = ifc->mac;
-  neh.tag = htons(0x0806);
-
-  // build arp_header
-  struct ArpHeaderEthernetIPv4 newHeader ={
-     .htype = htons(1),
-     .ptype = htons(0x0800),
-     .hlen = 6,
-     .plen = 4,
-     .oper = htons(1),
-     .sender_ha = {0},
-     .sender_pa = {0},
-     .target_ha = {0},
-     .target_pa = {0},
-  };
-
-  memcpy (&newHeader.sender_ha, &ifc->mac.mac, 6);
-  newHeader.sender_pa = ifc->ip;
-
-  memcpy (&newHeader.target_ha, &nullMac, 6);
-  newHeader.target_pa = v4;
-
-  //insert into frame
-  memcpy (ptr, &neh, sizeof(struct EthernetHeader));
-  memcpy (ptr + sizeof(struct EthernetHeader), &newHeader, sizeof(struct ArpHeaderEthernetIPv4));
-  forward_to (ifc, ptr, frame_size);
-  free(ptr);
 }
 
 
 /**
- * Parse network specification in @a net, initializing @a network and @a netmask.
- * Format of @a net is "IP/NETMASK".
- *
- * @param network[out] network specification to initialize
- * @param netmask[out] netmask specification to initialize
- * @param arg interface specification to parse
- * @return 0 on success
+ * Start capturing.  Syntax: "capture start [IFC] [host IP] [proto
+ * tcp|udp|icmp|arp|ipv6|N] [port N] [snaplen N]".  Restarting drops
+ * the frames captured so far.
  */
-static int
-parse_network (struct in_addr *network,
-               struct in_addr *netmask,
-               const char *net)
+static void
+process_cmd_capture_start ()
 {
+  struct Capture c;
   const char *tok;
-  char *ip;
-  int mask;
 
-  tok = strchr (net, '/');
-  if (NULL == tok)
-  {
-    fprintf (stderr,
-             "Error in network specification: lacks '/'\n");
-    return 1;
-  }
-  ip = strndup (net,
-                tok - net);
-  if (1 !=
-      inet_pton (AF_INET,
-                 ip,
-                 network))
-  {
-    fprintf (stderr,
-             "IP address `%s' malformed\n",
-             ip);
-    free (ip);
-    return 1;
-  }
-  free (ip);
-  tok++;
-  if (1 !=
-      sscanf (tok,
-              "%u",
-              &mask))
+  memset (&c, 0, sizeof (c));
+  c.snaplen = CAPTURE_SNAPLEN;
+  c.proto = -1;
+  tok = strtok (NULL, " ");
+  if ( (NULL != tok) &&
+       (NULL != find_interface (tok)) )
   {
-    fprintf (stderr,
-             "Netmask `%s' malformed\n",
-             tok);
-    return 1;
+    c.ifc_num = find_interface (tok)->ifc_num;
+    tok = strtok (NULL, " ");
   }
-  if (mask > 32)
+  while (NULL != tok)
   {
-    fprintf (stderr,
-             "Netmask invalid (too large)\n");
-    return 1;
+    const char *val = strtok (NULL, " ");
+    unsigned int v;
+
+    if (NULL == val)
+    {
+      fprintf (stderr,
+               "Expected value after `%s'\n",
+               tok);
+      return;
+    }
+    if (0 == strcasecmp ("host",
+                         tok))
+    {
+      if (1 != inet_pton (AF_INET,
+                          val,
+                          &c.host))
+      {
+        fprintf (stderr,
+                 "IP address `%s' malformed\n",
+                 val);
+        return;
+      }
+      c.match_host = true;
+    }
+    else if (0 == strcasecmp ("proto",
+                              tok))
+    {
+      if (0 == strcasecmp ("arp",
+                           val))
+        c.proto = ETH_P_ARP;
+      else if (0 == strcasecmp ("ipv6",
+                                val))
+        c.proto = ETH_P_IPV6;
+      else if (-2 == (c.proto = acl_parse_protocol (val)))
+      {
+        fprintf (stderr,
+                 "Protocol `%s' invalid\n",
+                 val);
+        return;
+      }
+    }
+    else if ( (0 == strcasecmp ("port",
+                                tok)) ||
+              (0 == strcasecmp ("snaplen",
+                                tok)) )
+    {
+      bool port = (0 == strcasecmp ("port",
+                                    tok));
+
+      if ( (1 != sscanf (val,
+                         "%u",
+                         &v)) ||
+           (0 == v) ||
+           (v > (port ? UINT16_MAX : CAPTURE_MAX_SNAPLEN)) )
+      {
+        fprintf (stderr,
+                 "Value `%s' for `%s' invalid\n",
+                 val,
+                 tok);
+        return;
+      }
+      if (port)
+        c.port = v;
+      else
+        c.snaplen = v;
+    }
+    else
+    {
+      fprintf (stderr,
+               "Expected `host', `proto', `port' or `snaplen', not `%s'\n",
+               tok);
+      return;
+    }
+    tok = strtok (NULL, " ");
   }
-  netmask->s_addr = htonl (~(uint32_t) ((1LLU << (32 - mask)) - 1LLU));
-  return 0;
+  free (capture.ring);
+  c.slot_size = (sizeof (struct CaptureRecord) + c.snaplen + 7) & ~7;
+  c.ring = malloc (CAPTURE_SLOTS * c.slot_size);
+  if (NULL == c.ring)
+    abort ();
+  capture = c;
 }
 
 
-/**
- * Parse route from arguments in strtok() buffer.
- *
- * @param target_network[out] set to target network
- * @param target_netmask[out] set to target netmask
- * @param next_hop[out] set to next hop
- * @param ifc[out] set to target interface
- */
-static int
-parse_route (struct in_addr *target_network,
-             struct in_addr *target_netmask,
-             struct in_addr *next_hop,
-             struct Interface **ifc)
+/**
+ * The user entered a "capture" command.  Syntax: "capture start ...",
+ * see process_cmd_capture_start(), or "capture stop FILE" to write
+ * the captured frames to FILE (pcapng) in the background, which
+ * prints a message when done; without arguments, print the capture
+ * state.
+ */
+static void
+process_cmd_capture ()
 {
-  char *tok;
+  const char *tok;
 
   tok = strtok (NULL, " ");
-  if ( (NULL == tok) ||
-       (0 != parse_network (target_network,
-                            target_netmask,
-                            tok)) )
+  if (NULL == tok)
   {
-    fprintf (stderr,
-             "Expected network specification, not `%s'\n",
-             tok);
-    return 1;
+    print ("capture %s, %llu frames seen, %llu captured, %llu overwritten\n",
+           (NULL == capture.ring) ? "stopped" : "running",
+           (unsigned long long) capture.seen,
+           (unsigned long long) capture.head,
+           (unsigned long long) ((capture.head > CAPTURE_SLOTS)
+                                 ? capture.head - CAPTURE_SLOTS
+                                 : 0));
+    return;
   }
-  tok = strtok (NULL, " ");
-  if ( (NULL == tok) ||
-       (0 != strcasecmp ("via",
-                         tok)))
+  if (0 == strcasecmp ("start",
+                       tok))
   {
-    fprintf (stderr,
-             "Expected `via', not `%s'\n",
-             tok);
-    return 1;
+    process_cmd_capture_start ();
+    return;
   }
-  tok = strtok (NULL, " ");
-  if ( (NULL == tok) ||
-       (1 != inet_pton (AF_INET,
-                        tok,
-                        next_hop)) )
+  if (0 != strcasecmp ("stop",
+                       tok))
   {
     fprintf (stderr,
-             "Expected next hop, not `%s'\n",
+             "Subcommand `%s' not understood\n",
              tok);
-    return 1;
+    return;
   }
   tok = strtok (NULL, " ");
-  if ( (NULL == tok) ||
-       (0 != strcasecmp ("dev",
-                         tok)))
+  if (NULL == capture.ring)
   {
     fprintf (stderr,
-             "Expected `dev', not `%s'\n",
-             tok);
-    return 1;
+             "No capture running\n");
+    return;
   }
-  tok = strtok (NULL, " ");
-  *ifc = find_interface (tok);
-  if (NULL == *ifc)
+  if (NULL == tok)
   {
     fprintf (stderr,
-             "Interface `%s' unknown\n",
-             tok);
-    return 1;
+             "Expected file name after `stop'\n");
+    return;
   }
-  return 0;
-}
-
-void updateInterfaceSettings(struct Interface *ifc, struct in_addr *target_network, struct in_addr *target_netmask) {
-  if (ifc == NULL || target_network == NULL || target_netmask == NULL) {
+  if (NULL != capture_writer.ring)
+  {
+    fprintf (stderr,
+             "Still writing `%s'\n",
+             capture_writer.filename);
     return;
   }
-  ifc->ip = *target_network;
-  ifc->netmask = *target_netmask;
-}
-
-/**
- * Add a route.
- */
-static void process_cmd_route_add () {
-  struct in_addr target_network;
-  struct in_addr target_netmask;
-  struct in_addr next_hop;
-  struct Interface *ifc;
-
-  if (0 != parse_route (&target_network,
-                        &target_netmask,
-                        &next_hop,
-                        &ifc))
+  if (0 != capture_write (tok))
     return;
-  //add entry to routing table
-  struct TableEntry content;
-  content.target_network = target_network;
-  content.netmask = target_netmask;
-  content.nextHop = next_hop;
-
-  struct Interface interface = *ifc;
-
-  // Update interface
-  updateInterfaceSettings(&interface, &target_network, &target_netmask);
-  content.interface = interface;
-
-  memcpy(&routingTable[routingTableIndex], &content,sizeof(struct TableEntry));
-  routingTableIndex++;
+  /* the writer owns the ring now */
+  capture.ring = NULL;
 }
 
 
-
 /**
- * Delete a route.
+ * Get the value below which @a permille per mille of the samples in
+ * @a h lie (rounded up to the end of its bucket).
+ *
+ * @param h histogram to evaluate
+ * @param permille which quantile to return
+ * @return the quantile
  */
-static void process_cmd_route_del (){
-  struct in_addr target_network;
-  struct in_addr target_netmask;
-  struct in_addr next_hop;
-  struct Interface *ifc;
-
-  if (0 != parse_route (&target_network, &target_netmask, &next_hop, &ifc))
-    return;
-
-  /* TODO: Delete routing table entry */
-  for (int i = 0; i < MAX_ENTRIES; i++){
-    if (ipCmp (&routingTable[i].target_network, &target_network) == 0
-  	  && ipCmp (&routingTable[i].netmask, &target_netmask) == 0
-  	  && ipCmp (&routingTable[i].nextHop, &next_hop) == 0){
-  	  }
+static unsigned long long
+perf_quantile (const struct PerfHistogram *h,
+               unsigned int permille)
+{
+  uint64_t rank = (h->count * permille + 999) / 1000;
+  uint64_t seen = 0;
 
+  for (unsigned int b = 0; b < PERF_BUCKETS; b++)
+  {
+    seen += h->buckets[b];
+    if (seen >= rank)
+      return (perf_bucket_max (b) < h->max) ? perf_bucket_max (b) : h->max;
   }
+  return h->max;
 }
 
 
 /**
- * Print out the routing table.
+ * The user entered a "perf" command.  Syntax: "perf [on|off|reset]"
+ * or "perf hist STAGE"; without arguments, print a summary of the
+ * time spent per stage of the forwarding path.
  */
-static void process_cmd_route_list (){
-  print("Route List\n");
-  for (int i = 0; i < routingTableIndex; i++){
-    char buf[INET_ADDRSTRLEN];
-    char buf1[INET_ADDRSTRLEN];
-    char buf2[INET_ADDRSTRLEN];
-    struct in_addr *target_network = &routingTable[i].target_network;
-    struct in_addr *netmask = &routingTable[i].netmask;
-    struct in_addr *nextHop = &routingTable[i].nextHop;
-    struct Interface *ifc = &routingTable[i].interface;
-    print("%s/%s -> %s (%4s)\n",
-              inet_ntop(AF_INET, target_network, buf, sizeof(buf)),
-              inet_ntop(AF_INET, netmask, buf1, sizeof(buf1)),
-              inet_ntop(AF_INET, nextHop, buf2, sizeof(buf2)),
-              ifc->name);
-    }
-}
+static void
+process_cmd_perf ()
+{
+  const char *tok = strtok (NULL, " ");
 
+  if (! PERF_STAGES)
+  {
+    fprintf (stderr,
+             "Router was built without PERF_STAGES\n");
+    return;
+  }
+  if (NULL == tok)
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    const char *unit = "cycles";
+#else
+    const char *unit = "ns";
+#endif
 
-/**
- * The user entered a "route" command.  The remaining
- * arguments can be obtained via 'strtok()'.
- */
-static void process_cmd_route (){
-  char *subcommand = strtok (NULL, " ");
+    print ("perf %s, times in %s\n",
+           perf.enabled ? "on" : "off",
+           unit);
+    for (unsigned int s = 0; s < PERF_NUM_STAGES; s++)
+    {
+      const struct PerfHistogram *h = &perf.stages[s];
+
+      if (0 == h->count)
+        continue;
+      print ("%8s: %llu samples, min %llu p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu mean %llu\n",
+             perf_stage_names[s],
+             (unsigned long long) h->count,
+             (unsigned long long) h->min,
+             perf_quantile (h, 500),
+             perf_quantile (h, 900),
+             perf_quantile (h, 990),
+             perf_quantile (h, 999),
+             (unsigned long long) h->max,
+             (unsigned long long) (h->sum / h->count));
+    }
+    return;
+  }
+  if (0 == strcasecmp ("on",
+                       tok))
+    perf.enabled = true;
+  else if (0 == strcasecmp ("off",
+                            tok))
+    perf.enabled = false;
+  else if (0 == strcasecmp ("reset",
+                            tok))
+    memset (perf.stages,
+            0,
+            sizeof (perf.stages));
+  else if (0 == strcasecmp ("hist",
+                            tok))
+  {
+    unsigned int s;
 
-  if (NULL == subcommand)
-    subcommand = "list";
-  if (0 == strcasecmp ("add",
-                       subcommand))
-    process_cmd_route_add ();
-  else if (0 == strcasecmp ("del",
-                            subcommand))
-    process_cmd_route_del ();
-  else if (0 == strcasecmp ("list",
-                            subcommand))
-    process_cmd_route_list ();
+    tok = strtok (NULL, " ");
+    for (s = 0; s < PERF_NUM_STAGES; s++)
+      if ( (NULL != tok) &&
+           (0 == strcasecmp (perf_stage_names[s],
+                             tok)) )
+        break;
+    if (PERF_NUM_STAGES == s)
+    {
+      fprintf (stderr,
+               "Stage `%s' unknown\n",
+               tok);
+      return;
+    }
+    for (unsigned int b = 0; b < PERF_BUCKETS; b++)
+    {
+      if (0 == perf.stages[s].buckets[b])
+        continue;
+      print ("%s <= %llu: %llu\n",
+             perf_stage_names[s],
+             (unsigned long long) perf_bucket_max (b),
+             (unsigned long long) perf.stages[s].buckets[b]);
+    }
+  }
   else
     fprintf (stderr,
              "Subcommand `%s' not understood\n",
-             subcommand);
+             tok);
 }
 
 
 /**
- * Parse network specification in @a net, initializing @a ifc.
- * Format of @a net is "IPV4:IP/NETMASK".
+ * Parse the comma-separated interface options in @a opts and apply
+ * them to the queues of @a ifc.  Supported options are
+ * "aqm=codel|none", "target=DURATION", "interval=DURATION",
+ * "ecn=on|off", "police[.CLASS]=RATE[:BURST]" and
+ * "shape[.CLASS]=RATE[:BURST]" for ingress policing and egress shaping
+ * of one traffic class or (without CLASS) of the whole interface, and
+ * "tunnel=ipip|gre", "remote=IP" and "local=IP" to make @a ifc a
+ * virtual tunnel interface.
  *
- * @param ifc[out] interface specification to initialize
- * @param arg interface specification to parse
+ * @param ifc interface the options are for
+ * @param opts options to parse
  * @return 0 on success
  */
-static int parse_network_arg(struct Interface *ifc, const char *net) {
-  if (0 != strncasecmp(net, "IPV4:", strlen("IPV4:"))) {
-    fprintf(stderr, "Interface specification `%s' does not start with `IPV4:'\n", net);
-    return 1;
-  }
+static int
+parse_ifc_options (const struct Interface *ifc,
+                   const char *opts)
+{
+  struct CodelParams *p = &egress[ifc->ifc_num - 1].codel;
+  char *copy = strdup (opts);
+  char *save;
+  int ret = 0;
+
+  for (char *opt = strtok_r (copy, ",", &save);
+       NULL != opt;
+       opt = strtok_r (NULL, ",", &save))
+  {
+    char *val = strchr (opt, '=');
 
-  net += strlen("IPV4:");
-  return parse_network(&ifc->ip, &ifc->netmask, net);
+    if (NULL == val)
+    {
+      ret = 1;
+      break;
+    }
+    *val++ = '\0';
+    if (0 == strcasecmp (opt, "aqm"))
+    {
+      if (0 == strcasecmp (val, "codel"))
+        p->enabled = true;
+      else if (0 == strcasecmp (val, "none"))
+        p->enabled = false;
+      else
+        ret = 1;
+    }
+    else if (0 == strcasecmp (opt, "target"))
+      ret = parse_duration (val, &p->target);
+    else if (0 == strcasecmp (opt, "interval"))
+      ret = parse_duration (val, &p->interval);
+    else if ( (0 == strncasecmp (opt, "police", strlen ("police"))) ||
+              (0 == strncasecmp (opt, "shape", strlen ("shape"))) )
+    {
+      bool shaper = ('s' == tolower ((unsigned char) opt[0]));
+      const char *cls = strchr (opt, '.');
+      char *burst = strchr (val, ':');
+      struct TokenBucket *tb;
+
+      if (NULL != burst)
+        *burst++ = '\0';
+      tb = qos_find_bucket (ifc,
+                            shaper,
+                            (NULL == cls) ? "all" : cls + 1);
+      if ( (NULL == tb) ||
+           ( (NULL == cls) &&
+             (strlen (opt) != strlen (shaper ? "shape" : "police")) ) )
+        ret = 1;
+      else
+        ret = qos_configure_bucket (ifc,
+                                    tb,
+                                    val,
+                                    burst);
+    }
+    else if (0 == strcasecmp (opt, "ecn"))
+    {
+      if (0 == strcasecmp (val, "on"))
+        p->ecn = true;
+      else if (0 == strcasecmp (val, "off"))
+        p->ecn = false;
+      else
+        ret = 1;
+    }
+    else if (0 == strcasecmp (opt, "tunnel"))
+    {
+      if (0 == strcasecmp (val, "ipip"))
+        tunnels[ifc->ifc_num].mode = TUNNEL_IPIP;
+      else if (0 == strcasecmp (val, "gre"))
+        tunnels[ifc->ifc_num].mode = TUNNEL_GRE;
+      else
+        ret = 1;
+    }
+    else if (0 == strcasecmp (opt, "remote"))
+      ret = (1 != inet_pton (AF_INET,
+                             val,
+                             &tunnels[ifc->ifc_num].remote));
+    else if (0 == strcasecmp (opt, "local"))
+      ret = (1 != inet_pton (AF_INET,
+                             val,
+                             &tunnels[ifc->ifc_num].local));
+    else
+      ret = 1;
+    if (0 != ret)
+      break;
+  }
+  if (0 != ret)
+    fprintf (stderr,
+             "Error in interface specification: bad option in `%s'\n",
+             opts);
+  free (copy);
+  return ret;
 }
 
 
 /**
  * Parse interface specification @a arg and update @a ifc.  Format is
- * "IFCNAME[IPV4:IP/NETMASK]=MTU".  The "=MTU" is optional.
+ * "IFCNAME[IPV4:IP/NETMASK,IPV6:IP/LENGTH]=MTU,OPTIONS".  The IPv6
+ * address, the "=MTU" and the comma-separated OPTIONS (see
+ * parse_ifc_options()) are optional, for example
+ * "eth0[IPV4:10.0.0.1/24,IPV6:2001:db8::1/64]=1500,aqm=codel".
+ * Tunnel interfaces, for example
+ * "tun0[IPV4:192.168.0.1/30],tunnel=gre,remote=10.0.1.7", must come
+ * after the real interfaces; their MTU is an upper bound, the MTU of
+ * the underlay minus the outer headers applies if it is lower.
  *
  * @param ifc[out] interface specification to initialize
  * @param arg interface specification to parse
@@ -1334,7 +12800,30 @@ parse_cmd_arg (struct Interface *ifc,
              ifc->name,
              (int) ifc->mtu);
 #endif
+    arg += 1 + strspn (&arg[1],
+                       "0123456789");
+  }
+  if (',' == arg[0])
+  {
+    if (0 != parse_ifc_options (ifc,
+                                &arg[1]))
+      return 1;
+  }
+  else if ('\0' != arg[0])
+  {
+    fprintf (stderr,
+             "Error in interface specification: trailing `%s'\n",
+             arg);
+    return 1;
   }
+  if ( (TUNNEL_NONE != tunnels[ifc->ifc_num].mode) &&
+       (0 == tunnels[ifc->ifc_num].remote.s_addr) )
+  {
+    fprintf (stderr,
+             "Error in interface specification: tunnel lacks remote endpoint\n");
+    return 1;
+  }
+  tunnels[ifc->ifc_num].mtu = ifc->mtu;
   //add the interface to the routingTable
   struct Interface* temp = ifc;
 
@@ -1349,10 +12838,104 @@ parse_cmd_arg (struct Interface *ifc,
 
   routingTableIndex++;
 
+  if (0 != ifc->ip6_len)
+  {
+    static const struct in6_addr on_link;
+
+    fib6_add (&ifc->ip6,
+              ifc->ip6_len,
+              &on_link,
+              ifc->ifc_num);
+  }
   return 0;
 }
 
 
+/**
+ * Process "shm [export NAME|memfd|off] [interval DURATION]" command:
+ * publish the FIB, ARP cache and counters to a shared-memory segment
+ * (see `struct ShmHeader`), at most once per interval.  Without
+ * arguments, show the state of the export.
+ */
+static void
+process_cmd_shm ()
+{
+  const char *tok;
+
+  tok = strtok (NULL, " ");
+  if (NULL == tok)
+  {
+    if (NULL == shm.hdr)
+      print ("export off, interval %llu us\n",
+             (unsigned long long) shm.interval);
+    else if (NULL != shm.name)
+      print ("export /dev/shm%s, %llu bytes, interval %llu us, %llu updates\n",
+             shm.name,
+             (unsigned long long) shm.size,
+             (unsigned long long) shm.interval,
+             (unsigned long long) shm.publications);
+    else
+      print ("export /proc/%d/fd/%d, %llu bytes, interval %llu us, %llu updates\n",
+             (int) getpid (),
+             shm.fd,
+             (unsigned long long) shm.size,
+             (unsigned long long) shm.interval,
+             (unsigned long long) shm.publications);
+    return;
+  }
+  while (NULL != tok)
+  {
+    const char *val = strtok (NULL, " ");
+
+    if (NULL == val)
+    {
+      fprintf (stderr,
+               "Expected value after `%s'\n",
+               tok);
+      return;
+    }
+    if (0 == strcasecmp ("export",
+                         tok))
+    {
+      if (0 == strcasecmp ("off",
+                           val))
+        shm_stop ();
+      else if (NULL != strchr (val,
+                               '/'))
+      {
+        fprintf (stderr,
+                 "Segment name `%s' may not contain `/'\n",
+                 val);
+        return;
+      }
+      else if (0 != shm_start (val))
+        return;
+    }
+    else if (0 == strcasecmp ("interval",
+                              tok))
+    {
+      if (0 != parse_duration (val,
+                               &shm.interval))
+      {
+        fprintf (stderr,
+                 "Duration `%s' invalid\n",
+                 val);
+        return;
+      }
+      shm.next = 0;
+    }
+    else
+    {
+      fprintf (stderr,
+               "Expected `export' or `interval', not `%s'\n",
+               tok);
+      return;
+    }
+    tok = strtok (NULL, " ");
+  }
+}
+
+
 /**
  * Handle control message @a cmd.
  *
@@ -1363,6 +12946,8 @@ static void handle_control (char *cmd, size_t cmd_len){
   const char *tok;
 
   cmd[cmd_len - 1] = '\0';
+  if (metrics_command (cmd))
+    return;
   tok = strtok (cmd,
                 " ");
   if (NULL == tok)
@@ -1373,6 +12958,45 @@ static void handle_control (char *cmd, size_t cmd_len){
   else if (0 == strcasecmp (tok,
                             "route"))
     process_cmd_route ();
+  else if (0 == strcasecmp (tok,
+                            "acl"))
+    process_cmd_acl ();
+  else if (0 == strcasecmp (tok,
+                            "nat"))
+    process_cmd_nat ();
+  else if (0 == strcasecmp (tok,
+                            "qos"))
+    process_cmd_qos ();
+  else if (0 == strcasecmp (tok,
+                            "route6"))
+    process_cmd_route6 ();
+  else if (0 == strcasecmp (tok,
+                            "ndp"))
+    process_cmd_ndp ();
+  else if (0 == strcasecmp (tok,
+                            "mpls"))
+    process_cmd_mpls ();
+  else if (0 == strcasecmp (tok,
+                            "tunnel"))
+    process_cmd_tunnel ();
+  else if (0 == strcasecmp (tok,
+                            "mroute"))
+    process_cmd_mroute ();
+  else if (0 == strcasecmp (tok,
+                            "overload"))
+    process_cmd_overload ();
+  else if (0 == strcasecmp (tok,
+                            "flow"))
+    process_cmd_flow ();
+  else if (0 == strcasecmp (tok,
+                            "capture"))
+    process_cmd_capture ();
+  else if (0 == strcasecmp (tok,
+                            "perf"))
+    process_cmd_perf ();
+  else if (0 == strcasecmp (tok,
+                            "shm"))
+    process_cmd_shm ();
   else
     fprintf (stderr,
              "Unsupported command `%s'\n",
@@ -1390,6 +13014,8 @@ static void handle_mac (uint16_t ifc_num, const struct MacAddress *mac) {
   if (ifc_num > num_ifc)
     abort ();
   gifc[ifc_num - 1].mac = *mac;
+  ll6_from_mac (mac,
+                &gifc[ifc_num - 1].ll6);
 
    for(int i = 0; i < num_ifc; i++){
         routingTable[i].interface = gifc[i];
@@ -1397,6 +13023,20 @@ static void handle_mac (uint16_t ifc_num, const struct MacAddress *mac) {
 }
 
 
+/**
+ * Finish the work deferred while processing a batch.  Called by
+ * loop() at the end of each batch.
+ */
+static void
+handle_batch (void)
+{
+  egress_drain ();
+  flow_expire ();
+  route_list_continue ();
+  shm_update ();
+}
+
+
 /**
  * Launches the router.
  *
@@ -1410,6 +13050,23 @@ int main (int argc, char **argv){
   memset (ifc, 0, sizeof (ifc));
   num_ifc = argc - 1;
   gifc = ifc;
+  acls = calloc (2 * num_ifc + 1, sizeof (struct Acl));
+  nat_ifcs = calloc (num_ifc + 1, sizeof (bool));
+  egress = calloc (num_ifc + 1, sizeof (struct EgressQueue));
+  policers = calloc (num_ifc + 1, sizeof (struct Policer));
+  tunnels = calloc (num_ifc + 1, sizeof (struct Tunnel));
+  if ( (NULL == acls) ||
+       (NULL == nat_ifcs) ||
+       (NULL == egress) ||
+       (NULL == policers) ||
+       (NULL == tunnels) )
+    abort ();
+  for (unsigned int i = 0; i < num_ifc; i++)
+    egress_init (&egress[i]);
+  tb_configure (&icmp_limit,
+                ICMP_RATE,
+                ICMP_BURST,
+                0);
   for (int i = 1; i<argc; i++){
     struct Interface *p = &ifc[i - 1];
 
@@ -1420,9 +13077,43 @@ int main (int argc, char **argv){
   memset (broadcastMac.mac, 0xff, sizeof(uint8_t)*6);
   memset (nullMac.mac, 0x00, sizeof(uint8_t)*6);
   memset (&nullInAddr, 0x00, sizeof(struct in_addr));
+  {
+    const char *names[num_ifc + 1];
 
+    for (unsigned int i = 0; i < num_ifc; i++)
+      names[i] = ifc[i].name;
+    metrics_init_interfaces (num_ifc,
+                             names);
+  }
+
+  loop_set_batch_handler (&handle_batch);
   loop (&handle_frame,&handle_control,&handle_mac);
+  egress_drain ();
+  flow_export_stop ();
+  shm_stop ();
   for (int i = 1; i<argc; i++)
     free (ifc[i - 1].name);
+  for (unsigned int i = 0; i < 2 * num_ifc; i++)
+  {
+    acl_classifier_free (&acls[i].active);
+    free (acls[i].staged);
+  }
+  free (acls);
+  free (nat_ifcs);
+  free (nat_flows);
+  free (nat_index);
+  free (flows);
+  free (flow_hash);
+  free (capture.ring);
+  free (egress);
+  free (policers);
+  free (tunnels);
+  for (unsigned int h = 0; h < MCAST_HASH_SIZE; h++)
+    while (NULL != mfc[h])
+      mfc_remove (mfc[h]);
+  free (fib6_root);
+  free (fib6_nodes);
+  free (fib6_routes);
+  free (label_table);
   return 0;
 }
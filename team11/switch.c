@@ -112,20 +112,12 @@ forward_to (struct Interface *dst,
             const void *frame,
             size_t frame_size)
 {
-  char iob[frame_size + sizeof (struct GLAB_MessageHeader)];
-  struct GLAB_MessageHeader hdr;
-
-  hdr.size = htons (sizeof (iob));
-  hdr.type = htons (dst->ifc_num);
-  memcpy (iob,
-          &hdr,
-          sizeof (hdr));
-  memcpy (&iob[sizeof (hdr)],
-          frame,
-          frame_size);
-  write_all (STDOUT_FILENO,
-             iob,
-             sizeof (iob));
+  GLAB_PROBE2 (frame_tx, dst->ifc_num, frame_size);
+  metrics_tx (dst->ifc_num, frame_size);
+  /* we only forward frames loop() gave us, no need to copy */
+  send_frame (dst->ifc_num,
+              frame,
+              frame_size);
 }
 
 /**
@@ -144,6 +136,7 @@ parse_frame (struct Interface *ifc,
 
   if (frame_size < sizeof (eh))
   {
+    metrics_drop (ifc->ifc_num, GLAB_DROP_MALFORMED);
     fprintf (stderr,
              "Malformed frame\n");
     return;
@@ -155,6 +148,7 @@ parse_frame (struct Interface *ifc,
 
   //src-mac-address should not be dst-mac-address
   if (macComp(eh.dst.mac, eh.src.mac)==0){
+    metrics_drop (ifc->ifc_num, GLAB_DROP_LOOP);
     fprintf (stderr,"SRC is DST\n");
     return;
   }
@@ -188,12 +182,18 @@ parse_frame (struct Interface *ifc,
   for (int i = 0; i < MAX_ENTRIES; i++) {
     if (macComp(macTable[i].macAddress.mac, eh.src.mac)==0) {
       containedMac = 0;
+      if (macTable[i].portNumber != entry.portNumber)
+        GLAB_PROBE3 (mac_move,
+                     eh.src.mac,
+                     macTable[i].portNumber,
+                     entry.portNumber);
       macTable[i].portNumber = entry.portNumber;
       break;
     }
   }
   //If mac address isn't in table -> copy new entry in table
   if(!containedMac == 0){
+    GLAB_PROBE2 (mac_learn, eh.src.mac, entry.portNumber);
     macTable[numEntries] = entry;
     numEntries++;
 
@@ -262,6 +262,8 @@ handle_control (char *cmd,
                 size_t cmd_len)
 {
   cmd[cmd_len - 1] = '\0';
+  if (metrics_command (cmd))
+    return;
   print ("Received command `%s' (ignored)\n",
          cmd);
 }
@@ -303,6 +305,8 @@ main (int argc,
   gifc = ifc;
   for (unsigned int i = 1; i<argc; i++)
     ifc[i - 1].ifc_num = i;
+  metrics_init_interfaces (num_ifc,
+                           NULL);
 
   loop (&handle_frame,
         &handle_control,
@@ -316,6 +316,80 @@ static int test_arp1(const char *prog){
     };
     return meta (cmd, (sizeof (argv) / sizeof (char *)) - 1, argv);  
 }
+
+/**
+ * Run test with @a prog.  Check the "stats" counters after the ARP
+ * request was sent.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int test_stats(const char *prog)
+{
+    char arp_frame[18] = "arp 10.0.0.4 eth2\0";
+
+    int send_frame() {
+        tsend(0, arp_frame, sizeof(arp_frame));
+        return 0;
+    }
+
+    int expect_request() {
+        // any frame on eth2 will do, test 1 checks its content
+        uint64_t ifcs = 1 << 2;
+        char request[sizeof(struct EthernetHeader)];
+
+        memset(request, 0xFF, sizeof(request));
+        return trecv(0,
+                     &expect_frame,
+                     NULL,
+                     request,
+                     - (ssize_t) MAC_ADDR_SIZE,
+                     3);
+    }
+
+    int send_stats() {
+        char stats[] = "stats eth2.tx";
+
+        tsend(0, stats, sizeof(stats));
+        return 0;
+    }
+
+    int expect_line(const char *line) {
+        return trecv(0,
+                     &expect_frame2,
+                     NULL,
+                     line,
+                     - (ssize_t) strlen(line),
+                     0);
+    }
+
+    int expect_tx_packets() {
+        return expect_line("eth2.tx_packets 1\n");
+    }
+
+    int expect_tx_bytes() {
+        return expect_line("eth2.tx_bytes 42\n");
+    }
+
+    char *argv[] = {
+        (char *) prog,
+        "eth0[IPV4:10.0.0.2/24]",
+        "eth1[IPV4:10.0.0.3/24]",
+        "eth2[IPV4:10.0.0.4/24]",
+        NULL
+    };
+
+    struct Command cmd[] = {
+        { "send arp frame", &send_frame },
+        { "check request", &expect_request },
+        { "query counters", &send_stats },
+        { "check sent packets", &expect_tx_packets },
+        { "check sent bytes", &expect_tx_bytes },
+        { "end", &expect_silence },
+        { NULL }
+    };
+    return meta (cmd, (sizeof (argv) / sizeof (char *)) - 1, argv);
+}
 /////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////
 // MAIN:
@@ -334,6 +408,7 @@ main (int argc, char **argv){
   } tests[] = {
     { "test 1", &test_arp0 }, // test arp
     { "test 2", &test_arp1 }, // test arp list
+    { "test 3", &test_stats }, // test stats
     { NULL, NULL }
   };
 
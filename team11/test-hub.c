@@ -237,6 +237,323 @@ test_bc_large (const char *prog)
 }
 
 
+/**
+ * Run test with @a prog.  Check the "stats" counters after forwarding
+ * one frame.  The hub names its interfaces "ifc1", "ifc2", ...
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_stats (const char *prog)
+{
+  char my_frame[1400];
+  int
+  send_frame ()
+  {
+    tsend (1,
+           my_frame,
+           sizeof (my_frame));
+    return 0;
+  };
+  int
+  expect_broadcast ()
+  {
+    uint64_t ifcs = (1 << 1) | (1 << 2); /* eth1 and eth2 */
+
+    return trecv (1, /* expect *two* replies */
+                  &expect_multicast,
+                  &ifcs,
+                  my_frame,
+                  sizeof (my_frame),
+                  UINT16_MAX /* ignored */);
+  };
+  int
+  send_stats_rx ()
+  {
+    char cmd[] = "stats ifc1.rx";
+
+    tsend (0,
+           cmd,
+           sizeof (cmd));
+    return 0;
+  };
+  int
+  send_stats_tx ()
+  {
+    char cmd[] = "stats ifc3.tx";
+
+    tsend (0,
+           cmd,
+           sizeof (cmd));
+    return 0;
+  };
+  int
+  expect_line (const char *line)
+  {
+    return trecv (0,
+                  &expect_frame2,
+                  NULL,
+                  line,
+                  - (ssize_t) strlen (line),
+                  0);
+  };
+  int
+  expect_rx_packets ()
+  {
+    return expect_line ("ifc1.rx_packets 1\n");
+  };
+  int
+  expect_rx_bytes ()
+  {
+    return expect_line ("ifc1.rx_bytes 1400\n");
+  };
+  int
+  expect_tx_packets ()
+  {
+    return expect_line ("ifc3.tx_packets 1\n");
+  };
+  int
+  expect_tx_bytes ()
+  {
+    return expect_line ("ifc3.tx_bytes 1400\n");
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0",
+    "eth1",
+    "eth2",
+    NULL
+  };
+  struct Command cmd[] = {
+    { "send frame", &send_frame },
+    { "check broadcast", &expect_broadcast },
+    { "query receive counters", &send_stats_rx },
+    { "check received packets", &expect_rx_packets },
+    { "check received bytes", &expect_rx_bytes },
+    { "query transmit counters", &send_stats_tx },
+    { "check sent packets", &expect_tx_packets },
+    { "check sent bytes", &expect_tx_bytes },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  for (unsigned int i = 0; i<sizeof (my_frame); i++)
+    my_frame[i] = random (); /* completely randomize frame */
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * Run test with @a prog.  Send so many commands in one write that the
+ * replies do not fit into the output buffer of the hub, so print()
+ * has to flush and retry; check every reply arrives intact and in
+ * order.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_long_output (const char *prog)
+{
+  /* 250 replies of ~280 bytes each exceed the 64 KiB print buffer */
+  const unsigned int num_cmds = 250;
+  char pad[231];
+  int
+  send_commands ()
+  {
+    char line[sizeof (pad) + 16];
+
+    for (unsigned int i = 0; i < num_cmds; i++)
+    {
+      snprintf (line,
+                sizeof (line),
+                "line %03u %s",
+                i,
+                pad);
+      tqueue (0,
+              line,
+              strlen (line) + 1);
+    }
+    tflush (SIZE_MAX);
+    return 0;
+  };
+  int
+  expect_replies ()
+  {
+    char reply[sizeof (pad) + 64];
+
+    for (unsigned int i = 0; i < num_cmds; i++)
+    {
+      snprintf (reply,
+                sizeof (reply),
+                "Received command `line %03u %s' (ignored)\n",
+                i,
+                pad);
+      if (0 != trecv (0,
+                      &expect_frame2,
+                      NULL,
+                      reply,
+                      - (ssize_t) strlen (reply),
+                      0))
+        return 1;
+    }
+    return 0;
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0",
+    "eth1",
+    NULL
+  };
+  struct Command cmd[] = {
+    { "send commands", &send_commands },
+    { "check replies", &expect_replies },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  memset (pad,
+          'x',
+          sizeof (pad) - 1);
+  pad[sizeof (pad) - 1] = '\0';
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * Run test with @a prog.  Split frames across the reads of the hub so
+ * that a partial message has to be moved to the front of its input
+ * buffer, including one split inside the message header.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_split (const char *prog)
+{
+  static char frame_a[30000];
+  static char frame_b[30000];
+  static char frame_c[20000];
+  static char frame_d[10000];
+  const size_t hdr = sizeof (struct GLAB_MessageHeader);
+  int
+  expect_forward (const char *frame,
+                  size_t frame_size)
+  {
+    uint64_t ifcs = (1 << 1) | (1 << 2); /* eth1 and eth2 */
+
+    return trecv (1, /* expect *two* replies */
+                  &expect_multicast,
+                  &ifcs,
+                  frame,
+                  frame_size,
+                  UINT16_MAX /* ignored */);
+  };
+  int
+  send_first ()
+  {
+    tqueue (1,
+            frame_a,
+            sizeof (frame_a));
+    tqueue (1,
+            frame_b,
+            sizeof (frame_b));
+    tqueue (1,
+            frame_c,
+            sizeof (frame_c));
+    tqueue (1,
+            frame_d,
+            sizeof (frame_d));
+    /* all of A and two thirds of B */
+    tflush (hdr + sizeof (frame_a) + hdr + 20000);
+    return 0;
+  };
+  int
+  expect_a ()
+  {
+    return expect_forward (frame_a,
+                           sizeof (frame_a));
+  };
+  int
+  send_second ()
+  {
+    /* rest of B and half of C; C is then moved to the front */
+    tflush (sizeof (frame_b) - 20000 + hdr + 10000);
+    return 0;
+  };
+  int
+  expect_b ()
+  {
+    return expect_forward (frame_b,
+                           sizeof (frame_b));
+  };
+  int
+  send_third ()
+  {
+    /* rest of C and the first two bytes of the header of D */
+    tflush (sizeof (frame_c) - 10000 + 2);
+    return 0;
+  };
+  int
+  expect_c ()
+  {
+    return expect_forward (frame_c,
+                           sizeof (frame_c));
+  };
+  int
+  send_fourth ()
+  {
+    tflush (SIZE_MAX);
+    return 0;
+  };
+  int
+  expect_d ()
+  {
+    return expect_forward (frame_d,
+                           sizeof (frame_d));
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0",
+    "eth1",
+    "eth2",
+    NULL
+  };
+  struct Command cmd[] = {
+    { "send A and part of B", &send_first },
+    { "check A", &expect_a },
+    { "send rest of B and part of C", &send_second },
+    { "check B", &expect_b },
+    { "send rest of C and part of D", &send_third },
+    { "check C", &expect_c },
+    { "send rest of D", &send_fourth },
+    { "check D", &expect_d },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  for (unsigned int i = 0; i<sizeof (frame_a); i++)
+    frame_a[i] = random (); /* completely randomize frames */
+  for (unsigned int i = 0; i<sizeof (frame_b); i++)
+    frame_b[i] = random ();
+  for (unsigned int i = 0; i<sizeof (frame_c); i++)
+    frame_c[i] = random ();
+  for (unsigned int i = 0; i<sizeof (frame_d); i++)
+    frame_d[i] = random ();
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
 /**
  * Call with path to the hub program to test.
  */
@@ -255,6 +572,9 @@ main (int argc,
     { "normal broadcast", &test_bc1 },
     { "back and forth", &test_bc123 },
     { "large frame", &test_bc_large },
+    { "stats", &test_stats },
+    { "long output", &test_long_output },
+    { "split frames", &test_split },
     { NULL, NULL }
   };
 
@@ -4,6 +4,8 @@
  * @author Christian Schmidhalter, Roman Schneiter, Gabril Iskender, Basil Clematide
  */
 #include "harness.h"
+#include <sys/mman.h>
+#include <poll.h>
 
 /**
  * Set to 1 to enable debug statments.
@@ -15,59 +17,4367 @@
 // TESTS:
 
 
+/**
+ * Build an ARP reply from the host @a host_ip (with a MAC derived
+ * from @a host_id) to the router interface @a ifc_num at @a router_ip.
+ *
+ * @param frame[out] buffer for the frame, must be 42 bytes
+ * @param ifc_num interface the reply is sent to
+ * @param host_id last byte of the host's MAC
+ * @param host_ip IPv4 address of the host
+ * @param router_ip IPv4 address of the router interface
+ */
+static void
+build_arp_reply (char *frame,
+                 uint16_t ifc_num,
+                 uint8_t host_id,
+                 const char *host_ip,
+                 const char *router_ip)
+{
+  struct EthernetHeader eh;
+  struct MacAddress host_mac = { { 0x02, 0, 0, 0, 0, host_id } };
+  struct in_addr ip;
+  uint16_t v;
+
+  set_dest_mac (frame,
+                ifc_num);
+  memcpy (&eh,
+          frame,
+          sizeof (eh));
+  eh.src = host_mac;
+  eh.tag = htons (ETH_P_ARP);
+  memcpy (frame,
+          &eh,
+          sizeof (eh));
+  frame += sizeof (eh);
+  v = htons (ARP_HTYPE_ETHERNET);
+  memcpy (&frame[0], &v, 2);
+  v = htons (ARP_PTYPE_IPV4);
+  memcpy (&frame[2], &v, 2);
+  frame[4] = MAC_ADDR_SIZE;
+  frame[5] = sizeof (struct in_addr);
+  v = htons (2);
+  memcpy (&frame[6], &v, 2);
+  memcpy (&frame[8], &host_mac, MAC_ADDR_SIZE);
+  inet_pton (AF_INET, host_ip, &ip);
+  memcpy (&frame[14], &ip, sizeof (ip));
+  memcpy (&frame[18], &eh.dst, MAC_ADDR_SIZE);
+  inet_pton (AF_INET, router_ip, &ip);
+  memcpy (&frame[24], &ip, sizeof (ip));
+}
+
+
+/**
+ * Compute the Internet checksum over the TCP segment at @a tcp
+ * including the pseudo header from the IPv4 header @a ip.
+ *
+ * @param ip IPv4 header (without options)
+ * @param tcp TCP header and payload
+ * @param tcp_len number of bytes at @a tcp
+ * @return checksum, 0 if the segment's checksum is correct
+ */
+static uint16_t
+tcp_checksum (const uint8_t *ip,
+              const uint8_t *tcp,
+              size_t tcp_len)
+{
+  uint32_t sum = 0;
+
+  for (unsigned int i = 12; i < 20; i += 2)
+    sum += (ip[i] << 8) | ip[i + 1];
+  sum += IPPROTO_TCP + tcp_len;
+  for (size_t i = 0; i < tcp_len; i += 2)
+    sum += (tcp[i] << 8) | ((i + 1 < tcp_len) ? tcp[i + 1] : 0);
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  return (uint16_t) ~sum;
+}
+
+
+/**
+ * Recompute the TCP checksum of the TCP/IPv4 frame @a frame.
+ *
+ * @param frame[in,out] frame to update
+ * @param frame_size number of bytes in @a frame
+ */
+static void
+fix_tcp_checksum (char *frame,
+                  size_t frame_size)
+{
+  uint8_t *ip = (uint8_t *) &frame[sizeof (struct EthernetHeader)];
+  uint16_t v;
+
+  memset (&ip[20 + 16], 0, 2);
+  v = htons (tcp_checksum (ip, &ip[20], frame_size - 34));
+  memcpy (&ip[20 + 16], &v, 2);
+}
+
+
+/**
+ * Build a TCP/IPv4 frame to interface @a ifc_num with @a data_len
+ * bytes of payload.
+ *
+ * @param frame[out] buffer for the frame, must be 54 + @a data_len bytes
+ * @param ifc_num interface the frame is sent to
+ * @param src source IPv4 address
+ * @param dst destination IPv4 address
+ * @param seq TCP sequence number
+ * @param data_len number of payload bytes
+ */
+static void
+build_tcp_frame (char *frame,
+                 uint16_t ifc_num,
+                 const char *src,
+                 const char *dst,
+                 uint32_t seq,
+                 size_t data_len)
+{
+  uint8_t *ip = (uint8_t *) &frame[sizeof (struct EthernetHeader)];
+  uint8_t *tcp = &ip[20];
+  uint16_t v;
+
+  set_dest_mac (frame,
+                ifc_num);
+  memset (&frame[MAC_ADDR_SIZE], 0x02, MAC_ADDR_SIZE);
+  v = htons (ETH_P_IPV4);
+  memcpy (&frame[2 * MAC_ADDR_SIZE], &v, 2);
+  memset (ip, 0, 40);
+  ip[0] = 0x45;
+  v = htons (40 + data_len);
+  memcpy (&ip[2], &v, 2);
+  ip[4] = 0x12;
+  ip[6] = 0x40; /* DF */
+  ip[8] = 64;
+  ip[9] = IPPROTO_TCP;
+  inet_pton (AF_INET, src, &ip[12]);
+  inet_pton (AF_INET, dst, &ip[16]);
+  tcp[1] = 80;
+  tcp[3] = 80;
+  seq = htonl (seq);
+  memcpy (&tcp[4], &seq, 4);
+  tcp[12] = 5 << 4;
+  tcp[13] = 0x18; /* ACK, PSH */
+  tcp[14] = 0xff;
+  for (size_t i = 0; i<data_len; i++)
+    tcp[20 + i] = (uint8_t) i;
+  v = htons (tcp_checksum (ip, tcp, 20 + data_len));
+  memcpy (&tcp[16], &v, 2);
+}
+
+
+/**
+ * We expect the next TCP segment of a GSO super-frame.
+ *
+ * @param cls pointer to the next sequence number we expect
+ * @param ifc interface we got a frame from
+ * @param msg frame we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 ignored
+ * @param cls2 maximum frame size
+ * @param cls3 interface we expect to receive from
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_segment (void *cls,
+                uint16_t ifc,
+                const void *msg,
+                size_t msg_len,
+                const void *cls1,
+                ssize_t cls2,
+                uint16_t cls3)
+{
+  uint32_t *next_seq = cls;
+  const uint8_t *b = msg;
+  uint32_t seq;
+  uint16_t tlen;
+
+  (void) cls1;
+  if ( (cls3 != ifc) ||
+       (msg_len > cls2) ||
+       (msg_len <= 54) )
+    return 1;
+  memcpy (&tlen, &b[16], 2);
+  memcpy (&seq, &b[38], 4);
+  if ( (ntohs (tlen) != msg_len - sizeof (struct EthernetHeader)) ||
+       (ntohl (seq) != *next_seq) ||
+       (0 != tcp_checksum (&b[14], &b[34], msg_len - 34)) )
+    return 1;
+  *next_seq += msg_len - 54;
+  return 0;
+}
+
+
+/**
+ * Send a TCP super-frame with @a data_len bytes of payload through the
+ * router and check that it leaves as three MTU-sized TCP segments with
+ * consecutive sequence numbers and correct checksums.
+ *
+ * @param prog command to test
+ * @param data_len number of payload bytes in the super-frame
+ * @return 0 on success, non-zero on failure
+ */
+static int
+gso_run (const char *prog,
+         size_t data_len)
+{
+  char arp_frame[42];
+  char gso_frame[54 + data_len];
+  uint32_t next_seq = 1000;
+
+  int
+  send_arp ()
+  {
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    return 0;
+  };
+
+  int
+  send_gso ()
+  {
+    build_tcp_frame (gso_frame, 1, "10.0.0.7", "10.0.1.7", 1000, data_len);
+    tsend (1,
+           gso_frame,
+           sizeof (gso_frame));
+    return 0;
+  };
+
+  int
+  expect_seg ()
+  {
+    return trecv (0,
+                  &expect_segment,
+                  &next_seq,
+                  NULL,
+                  1514,
+                  2);
+  };
+
+  int
+  expect_all ()
+  {
+    return (1000 + data_len == next_seq) ? 0 : 1;
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "send ARP reply", &send_arp },
+    { "send super-frame", &send_gso },
+    { "expect segment 1", &expect_seg },
+    { "expect segment 2", &expect_seg },
+    { "expect segment 3", &expect_seg },
+    { "check sequence", &expect_all },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * Test that a TCP super-frame larger than the ingress MTU leaves the
+ * router as MTU-sized TCP segments with consecutive sequence numbers.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_gso (const char *prog)
+{
+  return gso_run (prog,
+                  4000);
+}
+
+
+/**
+ * Test that the TCP checksum of the last segment is right when that
+ * segment has an odd number of payload bytes.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_gso_odd (const char *prog)
+{
+  return gso_run (prog,
+                  3001);
+}
+
+
+/**
+ * Test that an ingress ACL drops matching packets and lets the
+ * rest pass.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_acl (const char *prog)
+{
+  char arp_frame[42];
+  char tcp_frame[54 + 100];
+  uint32_t next_seq = 1;
+
+  int
+  send_arp ()
+  {
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    return 0;
+  };
+
+  int
+  send_acl ()
+  {
+    char udp[] = "acl add eth0 in 5 permit proto udp src 10.0.0.0/24 dport 80";
+    char deny[] = "acl add eth0 in 10 deny proto tcp src 10.0.0.0/24 dport 80";
+    char range[] = "acl add eth0 in 15 deny proto tcp dport 82-1000";
+    char permit[] = "acl add eth0 in 20 permit";
+    char commit[] = "acl commit";
+
+    tsend (0, udp, sizeof (udp));
+    tsend (0, deny, sizeof (deny));
+    tsend (0, range, sizeof (range));
+    tsend (0, permit, sizeof (permit));
+    tsend (0, commit, sizeof (commit));
+    return 0;
+  };
+
+  int
+  send_http ()
+  {
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.1.7", 1, 100);
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  send_ranged ()
+  {
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.1.7", 1, 100);
+    tcp_frame[54 - 20 + 2] = 500 >> 8;
+    tcp_frame[54 - 20 + 3] = 500 & 0xFF;
+    fix_tcp_checksum (tcp_frame,
+                      sizeof (tcp_frame));
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  send_other ()
+  {
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.1.7", 1, 100);
+    tcp_frame[54 - 20 + 3] = 81;
+    fix_tcp_checksum (tcp_frame,
+                      sizeof (tcp_frame));
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  expect_other ()
+  {
+    return trecv (0,
+                  &expect_segment,
+                  &next_seq,
+                  NULL,
+                  1514,
+                  2);
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "send ARP reply", &send_arp },
+    { "configure ACL", &send_acl },
+    { "send denied frame", &send_http },
+    { "expect drop", &expect_silence },
+    { "send frame denied by port range", &send_ranged },
+    { "expect range drop", &expect_silence },
+    { "send permitted frame", &send_other },
+    { "expect forward", &expect_other },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * We expect a translated TCP segment.
+ *
+ * @param cls port of the segment, set if @a cls3 is the NAT interface,
+ *        otherwise checked as the destination port
+ * @param ifc interface we got a frame from
+ * @param msg frame we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 expected source (if @a cls is set) or destination IPv4 address
+ * @param cls2 ignored
+ * @param cls3 interface we expect to receive from
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_translated (void *cls,
+                   uint16_t ifc,
+                   const void *msg,
+                   size_t msg_len,
+                   const void *cls1,
+                   ssize_t cls2,
+                   uint16_t cls3)
+{
+  uint16_t *port = cls;
+  const uint8_t *b = msg;
+  const uint8_t *ip = &b[sizeof (struct EthernetHeader)];
+  uint16_t p;
+
+  (void) cls2;
+  if ( (cls3 != ifc) ||
+       (msg_len <= 54) ||
+       (0 != tcp_checksum (ip, &ip[20], msg_len - 34)) )
+    return 1;
+  if (0 == *port)
+  {
+    if (0 != memcmp (&ip[12], cls1, 4))
+      return 1;
+    memcpy (port, &ip[20], 2);
+    return 0;
+  }
+  memcpy (&p, &ip[22], 2);
+  if ( (0 != memcmp (&ip[16], cls1, 4)) ||
+       (p != *port) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Test that masquerading rewrites the source of outbound packets
+ * (with a valid TCP checksum) and translates the replies back.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_nat (const char *prog)
+{
+  char arp_frame[42];
+  char tcp_frame[54 + 99];
+  uint16_t nat_port = 0;
+  uint16_t inside_port = htons (80);
+  struct in_addr outside;
+  struct in_addr inside;
+
+  int
+  send_arp ()
+  {
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    build_arp_reply (arp_frame, 1, 8, "10.0.0.7", "10.0.0.1");
+    tsend (1,
+           arp_frame,
+           sizeof (arp_frame));
+    return 0;
+  };
+
+  int
+  send_nat ()
+  {
+    char add[] = "nat add eth1";
+
+    tsend (0, add, sizeof (add));
+    return 0;
+  };
+
+  int
+  send_out ()
+  {
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.1.7", 1, 99);
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  expect_out ()
+  {
+    inet_pton (AF_INET, "10.0.1.1", &outside);
+    return trecv (0,
+                  &expect_translated,
+                  &nat_port,
+                  &outside,
+                  0,
+                  2);
+  };
+
+  int
+  send_in ()
+  {
+    build_tcp_frame (tcp_frame, 2, "10.0.1.7", "10.0.1.1", 1, 99);
+    memcpy (&tcp_frame[36], &nat_port, 2);
+    fix_tcp_checksum (tcp_frame,
+                      sizeof (tcp_frame));
+    tsend (2,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  expect_in ()
+  {
+    inet_pton (AF_INET, "10.0.0.7", &inside);
+    return trecv (0,
+                  &expect_translated,
+                  &inside_port,
+                  &inside,
+                  0,
+                  1);
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "send ARP replies", &send_arp },
+    { "enable NAT", &send_nat },
+    { "send outbound frame", &send_out },
+    { "expect translated frame", &expect_out },
+    { "send reply", &send_in },
+    { "expect reverse translation", &expect_in },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * Compute the Internet checksum over @a len bytes at @a buf.
+ *
+ * @param buf data to sum
+ * @param len number of bytes at @a buf
+ * @return checksum, 0 if @a buf includes a correct checksum
+ */
+static uint16_t
+inet_checksum (const uint8_t *buf,
+               size_t len)
+{
+  uint32_t sum = 0;
+
+  for (size_t i = 0; i < len; i += 2)
+    sum += (buf[i] << 8) | ((i + 1 < len) ? buf[i + 1] : 0);
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  return (uint16_t) ~sum;
+}
+
+
+/**
+ * Build an ICMP error frame to interface @a ifc_num about a TCP
+ * segment, embedding its IP header and the first 8 bytes of TCP.
+ *
+ * @param frame[out] buffer for the frame, must be 70 bytes
+ * @param ifc_num interface the frame is sent to
+ * @param src source IPv4 address of the error
+ * @param dst destination IPv4 address of the error
+ * @param type ICMP type
+ * @param code ICMP code
+ * @param inner_src source IPv4 address of the embedded segment
+ * @param inner_dst destination IPv4 address of the embedded segment
+ * @param inner_sport source port of the embedded segment (network byte order)
+ * @param inner_dport destination port of the embedded segment (network byte order)
+ */
+static void
+build_icmp_error (char *frame,
+                  uint16_t ifc_num,
+                  const char *src,
+                  const char *dst,
+                  uint8_t type,
+                  uint8_t code,
+                  const char *inner_src,
+                  const char *inner_dst,
+                  uint16_t inner_sport,
+                  uint16_t inner_dport)
+{
+  uint8_t *ip = (uint8_t *) &frame[sizeof (struct EthernetHeader)];
+  uint8_t *icmp = &ip[20];
+  uint8_t *eip = &icmp[8];
+  uint16_t v;
+
+  set_dest_mac (frame,
+                ifc_num);
+  memset (&frame[MAC_ADDR_SIZE], 0x02, MAC_ADDR_SIZE);
+  v = htons (ETH_P_IPV4);
+  memcpy (&frame[2 * MAC_ADDR_SIZE], &v, 2);
+  memset (ip, 0, 56);
+  ip[0] = 0x45;
+  v = htons (56);
+  memcpy (&ip[2], &v, 2);
+  ip[8] = 64;
+  ip[9] = IPPROTO_ICMP;
+  inet_pton (AF_INET, src, &ip[12]);
+  inet_pton (AF_INET, dst, &ip[16]);
+  v = htons (inet_checksum (ip, 20));
+  memcpy (&ip[10], &v, 2);
+  eip[0] = 0x45;
+  v = htons (40);
+  memcpy (&eip[2], &v, 2);
+  eip[8] = 1;
+  eip[9] = IPPROTO_TCP;
+  inet_pton (AF_INET, inner_src, &eip[12]);
+  inet_pton (AF_INET, inner_dst, &eip[16]);
+  v = htons (inet_checksum (eip, 20));
+  memcpy (&eip[10], &v, 2);
+  memcpy (&eip[20], &inner_sport, 2);
+  memcpy (&eip[22], &inner_dport, 2);
+  icmp[0] = type;
+  icmp[1] = code;
+  v = htons (inet_checksum (icmp, 36));
+  memcpy (&icmp[2], &v, 2);
+}
+
+
+/**
+ * What a translated ICMP error must look like.
+ */
+struct ExpectedIcmpError
+{
+  /**
+   * Offset of the translated address in the outer IP header.
+   */
+  size_t outer_off;
+
+  /**
+   * Offset of the translated address in the embedded IP header.
+   */
+  size_t inner_off;
+
+  /**
+   * Address expected at both offsets.
+   */
+  struct in_addr addr;
+
+  /**
+   * Offset of the translated port in the embedded TCP header.
+   */
+  size_t port_off;
+
+  /**
+   * Port expected there (network byte order).
+   */
+  uint16_t port;
+};
+
+
+/**
+ * We expect a translated ICMP error with valid checksums.
+ *
+ * @param cls the `struct ExpectedIcmpError`
+ * @param ifc interface we got a frame from
+ * @param msg frame we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 ignored
+ * @param cls2 ignored
+ * @param cls3 interface we expect to receive from
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_icmp_error (void *cls,
+                   uint16_t ifc,
+                   const void *msg,
+                   size_t msg_len,
+                   const void *cls1,
+                   ssize_t cls2,
+                   uint16_t cls3)
+{
+  const struct ExpectedIcmpError *ee = cls;
+  const uint8_t *b = msg;
+  const uint8_t *ip = &b[sizeof (struct EthernetHeader)];
+  const uint8_t *eip = &ip[28];
+  uint16_t p;
+
+  (void) cls1;
+  (void) cls2;
+  if ( (cls3 != ifc) ||
+       (70 != msg_len) ||
+       (IPPROTO_ICMP != ip[9]) ||
+       (0 != inet_checksum (&ip[20], 36)) ||
+       (0 != inet_checksum (eip, 20)) )
+    return 1;
+  memcpy (&p, &eip[20 + ee->port_off], 2);
+  if ( (0 != memcmp (&ip[ee->outer_off], &ee->addr, 4)) ||
+       (0 != memcmp (&eip[ee->inner_off], &ee->addr, 4)) ||
+       (p != ee->port) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Test that an idle flow expires: a TCP reset leaves the flow 10s to
+ * live, which its timer counts down on loop()'s timer wheel.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_nat_expiry (const char *prog)
+{
+  char arp_frame[42];
+  char tcp_frame[54 + 10];
+  uint16_t nat_port = 0;
+  struct in_addr outside;
+
+  int
+  send_arp ()
+  {
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    return 0;
+  };
+
+  int
+  send_nat ()
+  {
+    char add[] = "nat add eth1";
+
+    tsend (0, add, sizeof (add));
+    return 0;
+  };
+
+  int
+  send_reset ()
+  {
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.1.7", 1, 10);
+    tcp_frame[14 + 20 + 13] = 0x04; /* RST */
+    fix_tcp_checksum (tcp_frame,
+                      sizeof (tcp_frame));
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  expect_out ()
+  {
+    inet_pton (AF_INET, "10.0.1.1", &outside);
+    return trecv (0,
+                  &expect_translated,
+                  &nat_port,
+                  &outside,
+                  0,
+                  2);
+  };
+
+  int
+  send_stats ()
+  {
+    char stats[] = "nat stats";
+
+    tsend (0, stats, sizeof (stats));
+    return 0;
+  };
+
+  int
+  expect_stats (const char *flows)
+  {
+    const char *dropped
+      = "dropped: 0 no port, 0 table full, 0 fragments, 0 untranslatable\n";
+
+    if (0 != trecv (0,
+                    &expect_frame2,
+                    NULL,
+                    flows,
+                    - (ssize_t) strlen (flows),
+                    0))
+      return 1;
+    return trecv (1, /* skip the translation counters */
+                  &expect_frame2,
+                  NULL,
+                  dropped,
+                  - (ssize_t) strlen (dropped),
+                  0);
+  };
+
+  int
+  expect_active ()
+  {
+    return expect_stats ("flows: 1/2097152, created: 1, expired: 0\n");
+  };
+
+  int
+  wait_for_expiry ()
+  {
+    sleep (11);
+    return 0;
+  };
+
+  int
+  expect_expired ()
+  {
+    return expect_stats ("flows: 0/2097152, created: 1, expired: 1\n");
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "send ARP reply", &send_arp },
+    { "enable NAT", &send_nat },
+    { "send outbound reset", &send_reset },
+    { "expect translated frame", &expect_out },
+    { "query NAT statistics", &send_stats },
+    { "check active flow", &expect_active },
+    { "wait for the flow to expire", &wait_for_expiry },
+    { "query NAT statistics again", &send_stats },
+    { "check expired flow", &expect_expired },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * Test that ICMP errors about translated flows are translated too:
+ * "fragmentation needed" from the outside reaches the inside host
+ * with the embedded header mapped back, and "port unreachable" from
+ * the inside host leaves with the outside address and port.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_nat_icmp (const char *prog)
+{
+  char arp_frame[42];
+  char tcp_frame[54 + 99];
+  char icmp_frame[70];
+  struct in_addr outside;
+  struct ExpectedIcmpError ee;
+  uint16_t nat_port = 0;
+
+  int
+  send_arp ()
+  {
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    build_arp_reply (arp_frame, 1, 8, "10.0.0.7", "10.0.0.1");
+    tsend (1,
+           arp_frame,
+           sizeof (arp_frame));
+    return 0;
+  };
+
+  int
+  send_nat ()
+  {
+    char add[] = "nat add eth1";
+
+    tsend (0, add, sizeof (add));
+    return 0;
+  };
+
+  int
+  send_out ()
+  {
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.1.7", 1, 99);
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  expect_out ()
+  {
+    inet_pton (AF_INET, "10.0.1.1", &outside);
+    return trecv (0,
+                  &expect_translated,
+                  &nat_port,
+                  &outside,
+                  0,
+                  2);
+  };
+
+  int
+  send_frag_needed ()
+  {
+    build_icmp_error (icmp_frame, 2, "10.0.1.7", "10.0.1.1", 3, 4,
+                      "10.0.1.1", "10.0.1.7", nat_port, htons (80));
+    tsend (2,
+           icmp_frame,
+           sizeof (icmp_frame));
+    return 0;
+  };
+
+  int
+  expect_frag_needed ()
+  {
+    ee.outer_off = 16;
+    ee.inner_off = 12;
+    inet_pton (AF_INET, "10.0.0.7", &ee.addr);
+    ee.port_off = 0;
+    ee.port = htons (80);
+    return trecv (0,
+                  &expect_icmp_error,
+                  &ee,
+                  NULL,
+                  0,
+                  1);
+  };
+
+  int
+  send_port_unreachable ()
+  {
+    build_icmp_error (icmp_frame, 1, "10.0.0.7", "10.0.1.7", 3, 3,
+                      "10.0.1.7", "10.0.0.7", htons (80), htons (80));
+    tsend (1,
+           icmp_frame,
+           sizeof (icmp_frame));
+    return 0;
+  };
+
+  int
+  expect_port_unreachable ()
+  {
+    ee.outer_off = 12;
+    ee.inner_off = 16;
+    ee.addr = outside;
+    ee.port_off = 2;
+    ee.port = nat_port;
+    return trecv (0,
+                  &expect_icmp_error,
+                  &ee,
+                  NULL,
+                  0,
+                  2);
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "send ARP replies", &send_arp },
+    { "enable NAT", &send_nat },
+    { "send outbound frame", &send_out },
+    { "expect translated frame", &expect_out },
+    { "send fragmentation needed", &send_frag_needed },
+    { "expect frag needed inside", &expect_frag_needed },
+    { "send port unreachable", &send_port_unreachable },
+    { "expect port unreachable outside", &expect_port_unreachable },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * Test that an ingress policer drops traffic above its rate, and that
+ * an egress shaper delays (but still delivers) traffic above its rate
+ * even if no further input arrives.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_qos_rate (const char *prog)
+{
+  char arp_frame[42];
+  char tcp_frame[54 + 100];
+  uint32_t next_seq = 1;
+
+  int
+  send_arp ()
+  {
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    return 0;
+  };
+
+  int
+  send_policed ()
+  {
+    /* the second frame exceeds the 200 byte burst of eth0 */
+    for (uint32_t i = 0; i < 2; i++)
+    {
+      build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.1.7", 1 + 100 * i, 100);
+      tsend (1,
+             tcp_frame,
+             sizeof (tcp_frame));
+    }
+    return 0;
+  };
+
+  int
+  send_shaped ()
+  {
+    /* the second frame must wait ~100ms for the eth1 shaper */
+    for (uint32_t i = 0; i < 2; i++)
+    {
+      build_tcp_frame (tcp_frame, 3, "10.0.2.7", "10.0.1.7", 101 + 100 * i, 100);
+      tsend (3,
+             tcp_frame,
+             sizeof (tcp_frame));
+    }
+    return 0;
+  };
+
+  int
+  expect_seg ()
+  {
+    return trecv (0,
+                  &expect_segment,
+                  &next_seq,
+                  NULL,
+                  1514,
+                  2);
+  };
+
+  int
+  send_rates ()
+  {
+    char cmd[] = "qos rates eth1";
+
+    tsend (0, cmd, sizeof (cmd));
+    return 0;
+  };
+
+  int
+  expect_rates ()
+  {
+    /* three frames left via eth1, the delayed one exceeded the
+       shaper once and not on every recheck */
+    const char rates[] =
+      "eth1 shape all: rate 8000 bit/s, burst 200, conform 3 pkts 462 bytes, exceed 1 pkts 154 bytes\n";
+
+    return trecv (0,
+                  &expect_frame2,
+                  NULL,
+                  rates,
+                  - (ssize_t) strlen (rates),
+                  0);
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24],police=8000bit:200",
+    "eth1[IPV4:10.0.1.1/24]=1500,shape=8kbit:200",
+    "eth2[IPV4:10.0.2.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "send ARP reply", &send_arp },
+    { "send frames above policed rate", &send_policed },
+    { "expect conforming frame", &expect_seg },
+    { "expect exceeding frame dropped", &expect_silence },
+    { "send frames above shaped rate", &send_shaped },
+    { "expect first frame", &expect_seg },
+    { "expect delayed frame", &expect_seg },
+    { "query shaper counters", &send_rates },
+    { "check shaper counters", &expect_rates },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * We expect a forwarded TCP/IPv4 frame with a given DSCP.
+ *
+ * @param cls ignored
+ * @param ifc interface we got a frame from
+ * @param msg frame we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 ignored
+ * @param cls2 DSCP we expect
+ * @param cls3 interface we expect to receive from
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_dscp (void *cls,
+             uint16_t ifc,
+             const void *msg,
+             size_t msg_len,
+             const void *cls1,
+             ssize_t cls2,
+             uint16_t cls3)
+{
+  const uint8_t *b = msg;
+
+  (void) cls;
+  (void) cls1;
+  if ( (cls3 != ifc) ||
+       (msg_len <= 54) ||
+       (0x08 != b[12]) ||
+       (0x00 != b[13]) ||
+       (cls2 != (b[15] >> 2)) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Test the egress scheduler: frames queued in one batch leave the
+ * strict priority class first, then the DRR classes in proportion
+ * to their weights.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_qos_weight (const char *prog)
+{
+  /* one quantum per frame, including the GLAB header */
+  char tcp_frame[1514 - sizeof (struct GLAB_MessageHeader)];
+  static const uint8_t order[] = {
+    46,
+    0, 0, 0, 8,
+    0, 0, 0, 8,
+    8, 8, 8, 8
+  };
+  unsigned int pos = 0;
+
+  int
+  send_arp ()
+  {
+    char arp_frame[42];
+
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    return 0;
+  };
+
+  int
+  send_weight ()
+  {
+    char cmd[] = "qos weight eth1 normal 3";
+
+    tsend (0, cmd, sizeof (cmd));
+    return 0;
+  };
+
+  void
+  queue_class (uint8_t dscp,
+               unsigned int num)
+  {
+    for (unsigned int i = 0; i < num; i++)
+    {
+      build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.1.7", 1,
+                       sizeof (tcp_frame) - 54);
+      tcp_frame[15] = dscp << 2;
+      tqueue (1,
+              tcp_frame,
+              sizeof (tcp_frame));
+    }
+  };
+
+  int
+  send_burst ()
+  {
+    /* bulk (CS1) and normal frames first, EF last */
+    queue_class (8, 6);
+    queue_class (0, 6);
+    queue_class (46, 1);
+    tflush (SIZE_MAX);
+    return 0;
+  };
+
+  int
+  expect_next ()
+  {
+    return trecv (0,
+                  &expect_dscp,
+                  NULL,
+                  NULL,
+                  order[pos++],
+                  2);
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "send ARP reply", &send_arp },
+    { "set normal weight", &send_weight },
+    { "send burst", &send_burst },
+    { "expect EF frame", &expect_next },
+    { "expect round 1 normal", &expect_next },
+    { "expect round 1 normal", &expect_next },
+    { "expect round 1 normal", &expect_next },
+    { "expect round 1 bulk", &expect_next },
+    { "expect round 2 normal", &expect_next },
+    { "expect round 2 normal", &expect_next },
+    { "expect round 2 normal", &expect_next },
+    { "expect round 2 bulk", &expect_next },
+    { "expect bulk", &expect_next },
+    { "expect bulk", &expect_next },
+    { "expect bulk", &expect_next },
+    { "expect bulk", &expect_next },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * We expect a forwarded ECN-capable TCP/IPv4 frame, and count it if
+ * it carries the CE codepoint.
+ *
+ * @param cls pointer to the number of CE marks seen so far
+ * @param ifc interface we got a frame from
+ * @param msg frame we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 ignored
+ * @param cls2 ignored
+ * @param cls3 interface we expect to receive from
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_ecn (void *cls,
+            uint16_t ifc,
+            const void *msg,
+            size_t msg_len,
+            const void *cls1,
+            ssize_t cls2,
+            uint16_t cls3)
+{
+  unsigned int *marks = cls;
+  const uint8_t *b = msg;
+
+  (void) cls1;
+  (void) cls2;
+  if ( (cls3 != ifc) ||
+       (msg_len <= 54) ||
+       (0x08 != b[12]) ||
+       (0x00 != b[13]) ||
+       (0 == (b[15] & 3)) )
+    return 1;
+  if (3 == (b[15] & 3))
+    (*marks)++;
+  return 0;
+}
+
+
+/**
+ * We expect a forwarded IPv4 frame, and count it.
+ *
+ * @param cls pointer to the number of frames seen so far
+ * @param ifc interface we got a frame from
+ * @param msg frame we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 ignored
+ * @param cls2 ignored
+ * @param cls3 interface we expect to receive from
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_ipv4 (void *cls,
+             uint16_t ifc,
+             const void *msg,
+             size_t msg_len,
+             const void *cls1,
+             ssize_t cls2,
+             uint16_t cls3)
+{
+  unsigned int *frames = cls;
+  const uint8_t *b = msg;
+
+  (void) cls1;
+  (void) cls2;
+  if ( (cls3 != ifc) ||
+       (msg_len <= 34) ||
+       (0x08 != b[12]) ||
+       (0x00 != b[13]) )
+    return 1;
+  (*frames)++;
+  return 0;
+}
+
+
+/**
+ * We expect the CoDel line of the normal class of eth1 in the output
+ * of "qos stats" to report AQM drops and, unless @a cls is set, ECN
+ * marks.
+ *
+ * @param cls NULL, or pointer to an int that is non-zero if we only
+ *        expect drops
+ * @param type message type, must be 0 (text)
+ * @param msg text we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 ignored
+ * @param cls2 ignored
+ * @param cls3 ignored
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_aqm_stats (void *cls,
+                  uint16_t type,
+                  const void *msg,
+                  size_t msg_len,
+                  const void *cls1,
+                  ssize_t cls2,
+                  uint16_t cls3)
+{
+  const char prefix[] = "eth1 normal: codel ";
+  char line[256];
+  unsigned long long drops;
+  unsigned long long marks;
+
+  const int *drops_only = cls;
+
+  (void) cls1;
+  (void) cls2;
+  (void) cls3;
+  if ( (0 != type) ||
+       (msg_len >= sizeof (line)) )
+    return 1;
+  memcpy (line,
+          msg,
+          msg_len);
+  line[msg_len] = '\0';
+  if ( (0 != strncmp (line,
+                      prefix,
+                      strlen (prefix))) ||
+       (2 != sscanf (line,
+                     "eth1 normal: codel %*s %llu aqm drops, %llu ecn marks",
+                     &drops,
+                     &marks)) )
+    return 1;
+  return ( (0 == drops) ||
+           ( (0 == marks) &&
+             ( (NULL == drops_only) ||
+               (0 == *drops_only) ) ) ) ? 1 : 0;
+}
+
+
+/**
+ * We expect a line of "qos hist" showing that frames of the normal
+ * class of eth1 waited at least 16 ms.
+ *
+ * @param cls ignored
+ * @param type message type, must be 0 (text)
+ * @param msg text we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 ignored
+ * @param cls2 ignored
+ * @param cls3 ignored
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_long_delay (void *cls,
+                   uint16_t type,
+                   const void *msg,
+                   size_t msg_len,
+                   const void *cls1,
+                   ssize_t cls2,
+                   uint16_t cls3)
+{
+  char line[256];
+  unsigned long long bound;
+  unsigned long long frames;
+
+  (void) cls;
+  (void) cls1;
+  (void) cls2;
+  (void) cls3;
+  if ( (0 != type) ||
+       (msg_len >= sizeof (line)) )
+    return 1;
+  memcpy (line,
+          msg,
+          msg_len);
+  line[msg_len] = '\0';
+  if (2 != sscanf (line,
+                   "eth1 normal: delay < %llu us: %llu",
+                   &bound,
+                   &frames))
+    return 1;
+  return ( (bound <= 16384) ||
+           (0 == frames) ) ? 1 : 0;
+}
+
+
+/**
+ * Test CoDel on a shaped interface: a burst of ECN-capable frames
+ * must leave with CE marks and without losses, a burst of frames that
+ * are not ECN-capable must see drops.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_qos_codel (const char *prog)
+{
+  char tcp_frame[54 + 100];
+  unsigned int marks = 0;
+
+  int
+  send_arp ()
+  {
+    char arp_frame[42];
+
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    return 0;
+  };
+
+  void
+  queue_burst (uint8_t tos)
+  {
+    for (uint32_t i = 0; i < 20; i++)
+    {
+      build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.1.7", 1 + 100 * i, 100);
+      tcp_frame[15] = tos;
+      tqueue (1,
+              tcp_frame,
+              sizeof (tcp_frame));
+    }
+  };
+
+  int
+  send_ect_burst ()
+  {
+    /* ECT(0) */
+    queue_burst (2);
+    tflush (SIZE_MAX);
+    return 0;
+  };
+
+  int
+  expect_ect ()
+  {
+    return trecv (0,
+                  &expect_ecn,
+                  &marks,
+                  NULL,
+                  0,
+                  2);
+  };
+
+  int
+  check_marks ()
+  {
+    return (0 == marks) ? 1 : 0;
+  };
+
+  int
+  send_plain_burst ()
+  {
+    queue_burst (0);
+    tflush (SIZE_MAX);
+    /* let the shaper drain the queue */
+    sleep (1);
+    return 0;
+  };
+
+  int
+  send_stats ()
+  {
+    char cmd[] = "qos stats eth1";
+
+    tsend (0, cmd, sizeof (cmd));
+    return 0;
+  };
+
+  int
+  expect_stats ()
+  {
+    /* skip the frames of the second burst and the other classes */
+    return trecv (40,
+                  &expect_aqm_stats,
+                  NULL,
+                  NULL,
+                  0,
+                  0);
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24],aqm=codel,target=1ms,interval=20ms,shape=80kbit:200",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "send ARP reply", &send_arp },
+    { "send ECN-capable burst", &send_ect_burst },
+    { "expect frame 1", &expect_ect },
+    { "expect frame 2", &expect_ect },
+    { "expect frame 3", &expect_ect },
+    { "expect frame 4", &expect_ect },
+    { "expect frame 5", &expect_ect },
+    { "expect frame 6", &expect_ect },
+    { "expect frame 7", &expect_ect },
+    { "expect frame 8", &expect_ect },
+    { "expect frame 9", &expect_ect },
+    { "expect frame 10", &expect_ect },
+    { "expect frame 11", &expect_ect },
+    { "expect frame 12", &expect_ect },
+    { "expect frame 13", &expect_ect },
+    { "expect frame 14", &expect_ect },
+    { "expect frame 15", &expect_ect },
+    { "expect frame 16", &expect_ect },
+    { "expect frame 17", &expect_ect },
+    { "expect frame 18", &expect_ect },
+    { "expect frame 19", &expect_ect },
+    { "expect frame 20", &expect_ect },
+    { "check CE marks", &check_marks },
+    { "send plain burst", &send_plain_burst },
+    { "query queue stats", &send_stats },
+    { "expect AQM drops", &expect_stats },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * Test CoDel on a queue without a shaper that backs up because the
+ * parent reads slowly: frames have to wait in the router's queue,
+ * not in a blocked write, so that CoDel sees their sojourn time.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_qos_backlog (const char *prog)
+{
+  char tcp_frame[1400];
+  unsigned int frames = 0;
+  int drops_only = 1;
+
+  int
+  send_arp ()
+  {
+    char arp_frame[42];
+
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    return 0;
+  };
+
+  int
+  send_backlog ()
+  {
+    /* we do not read, so all but the first ~64 KiB stay queued */
+    for (uint32_t r = 0; r < 6; r++)
+    {
+      for (uint32_t i = 0; i < 40; i++)
+      {
+        build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.1.7",
+                         1 + 1346 * (40 * r + i), sizeof (tcp_frame) - 54);
+        tqueue (1,
+                tcp_frame,
+                sizeof (tcp_frame));
+      }
+      tflush (SIZE_MAX);
+      usleep (20000);
+    }
+    return 0;
+  };
+
+  int
+  read_slowly ()
+  {
+    for (unsigned int i = 0; i < 150; i++)
+    {
+      if (0 != trecv (0,
+                      &expect_ipv4,
+                      &frames,
+                      NULL,
+                      0,
+                      2))
+        return 1;
+      usleep (2000);
+    }
+    return 0;
+  };
+
+  int
+  send_stats ()
+  {
+    char cmd[] = "qos stats eth1";
+
+    tsend (0, cmd, sizeof (cmd));
+    return 0;
+  };
+
+  int
+  expect_stats ()
+  {
+    /* skip the frames still queued and the other classes */
+    return trecv (300,
+                  &expect_aqm_stats,
+                  &drops_only,
+                  NULL,
+                  0,
+                  0);
+  };
+
+  int
+  send_hist ()
+  {
+    char cmd[] = "qos hist eth1";
+
+    tsend (0, cmd, sizeof (cmd));
+    return 0;
+  };
+
+  int
+  expect_hist ()
+  {
+    return trecv (300,
+                  &expect_long_delay,
+                  NULL,
+                  NULL,
+                  0,
+                  0);
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24],aqm=codel,target=1ms,interval=20ms",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "send ARP reply", &send_arp },
+    { "build backlog", &send_backlog },
+    { "read frames slowly", &read_slowly },
+    { "query queue stats", &send_stats },
+    { "expect AQM drops", &expect_stats },
+    { "query queue delays", &send_hist },
+    { "expect queue delay", &expect_hist },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * Compute the ICMPv6 checksum of @a msg including the pseudo header
+ * from the IPv6 header @a ip6.
+ *
+ * @param ip6 IPv6 header
+ * @param msg ICMPv6 message
+ * @param msg_len number of bytes at @a msg
+ * @return checksum, 0 if the message's checksum is correct
+ */
+static uint16_t
+icmp6_checksum (const uint8_t *ip6,
+                const uint8_t *msg,
+                size_t msg_len)
+{
+  uint32_t sum = 0;
+
+  for (unsigned int i = 8; i < 40; i += 2)
+    sum += (ip6[i] << 8) | ip6[i + 1];
+  sum += IPPROTO_ICMPV6 + msg_len;
+  for (size_t i = 0; i < msg_len; i += 2)
+    sum += (msg[i] << 8) | ((i + 1 < msg_len) ? msg[i + 1] : 0);
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  return (uint16_t) ~sum;
+}
+
+
+/**
+ * Build an IPv6 frame to interface @a ifc_num from the host with MAC
+ * 02:00:00:00:00:@a host_id.  ICMPv6 payloads get their checksum
+ * filled in.
+ *
+ * @param frame[out] buffer for the frame, must be 54 + @a payload_len bytes
+ * @param ifc_num interface the frame is sent to
+ * @param host_id last byte of the sender's MAC
+ * @param src source IPv6 address
+ * @param dst destination IPv6 address
+ * @param hop_limit hop limit
+ * @param next_header protocol of @a payload
+ * @param payload the payload
+ * @param payload_len number of bytes in @a payload
+ */
+static void
+build_ipv6_frame (uint8_t *frame,
+                  uint16_t ifc_num,
+                  uint8_t host_id,
+                  const char *src,
+                  const char *dst,
+                  uint8_t hop_limit,
+                  uint8_t next_header,
+                  const uint8_t *payload,
+                  size_t payload_len)
+{
+  uint8_t *ip6 = &frame[sizeof (struct EthernetHeader)];
+  uint16_t v;
+
+  set_dest_mac (frame,
+                ifc_num);
+  memset (&frame[MAC_ADDR_SIZE], 0, MAC_ADDR_SIZE);
+  frame[MAC_ADDR_SIZE] = 0x02;
+  frame[2 * MAC_ADDR_SIZE - 1] = host_id;
+  v = htons (0x86DD);
+  memcpy (&frame[2 * MAC_ADDR_SIZE], &v, 2);
+  memset (ip6, 0, 40);
+  ip6[0] = 0x60;
+  v = htons (payload_len);
+  memcpy (&ip6[4], &v, 2);
+  ip6[6] = next_header;
+  ip6[7] = hop_limit;
+  inet_pton (AF_INET6, src, &ip6[8]);
+  inet_pton (AF_INET6, dst, &ip6[24]);
+  memcpy (&ip6[40], payload, payload_len);
+  if (IPPROTO_ICMPV6 == next_header)
+  {
+    v = htons (icmp6_checksum (ip6, &ip6[40], payload_len));
+    memcpy (&ip6[42], &v, 2);
+  }
+}
+
+
+/**
+ * We expect an IPv6 frame with an ICMPv6 message of a given type.
+ *
+ * @param cls pointer to the ICMPv6 type we expect (uint8_t)
+ * @param ifc interface we got a frame from
+ * @param msg frame we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 NULL, or the target address a neighbor solicitation
+ *        must ask for
+ * @param cls2 ignored
+ * @param cls3 interface we expect to receive from
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_icmp6 (void *cls,
+              uint16_t ifc,
+              const void *msg,
+              size_t msg_len,
+              const void *cls1,
+              ssize_t cls2,
+              uint16_t cls3)
+{
+  const uint8_t *type = cls;
+  const uint8_t *b = msg;
+
+  (void) cls2;
+  if ( (cls3 != ifc) ||
+       (msg_len < 14 + 40 + 8) ||
+       (0x86 != b[12]) ||
+       (0xDD != b[13]) ||
+       (IPPROTO_ICMPV6 != b[20]) ||
+       (*type != b[54]) ||
+       (0 != icmp6_checksum (&b[14], &b[54], msg_len - 54)) )
+    return 1;
+  if ( (NULL != cls1) &&
+       ( (msg_len < 14 + 40 + 24) ||
+         (0 != memcmp (&b[62], cls1, 16)) ) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * We expect a forwarded IPv6 frame.
+ *
+ * @param cls pointer to the hop limit we expect (uint8_t)
+ * @param ifc interface we got a frame from
+ * @param msg frame we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 MAC the frame must be addressed to
+ * @param cls2 expected frame size
+ * @param cls3 interface we expect to receive from
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_ipv6 (void *cls,
+             uint16_t ifc,
+             const void *msg,
+             size_t msg_len,
+             const void *cls1,
+             ssize_t cls2,
+             uint16_t cls3)
+{
+  const uint8_t *hop_limit = cls;
+  const uint8_t *b = msg;
+
+  if ( (cls3 != ifc) ||
+       (msg_len != cls2) ||
+       (0 != memcmp (b, cls1, MAC_ADDR_SIZE)) ||
+       (0x86 != b[12]) ||
+       (0xDD != b[13]) ||
+       (*hop_limit != b[21]) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Test IPv6 forwarding: neighbor discovery for the next hop, hop
+ * limit decrement, and ICMPv6 time exceeded.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_ipv6 (const char *prog)
+{
+  uint8_t frame[54 + 32];
+  uint8_t udp[8] = { 0x12, 0x34, 0x00, 0x35, 0x00, 0x08, 0x00, 0x00 };
+  uint8_t host_mac[MAC_ADDR_SIZE] = { 0x02, 0, 0, 0, 0, 7 };
+  struct in6_addr target;
+  uint8_t type;
+  uint8_t hop_limit = 63;
+
+  int
+  send_udp ()
+  {
+    build_ipv6_frame (frame, 1, 8, "2001:db8::8", "2001:db8:1::7",
+                      64, IPPROTO_UDP, udp, sizeof (udp));
+    tsend (1,
+           frame,
+           54 + sizeof (udp));
+    return 0;
+  };
+
+  int
+  expect_ns ()
+  {
+    type = 135;
+    inet_pton (AF_INET6, "2001:db8:1::7", &target);
+    return trecv (0,
+                  &expect_icmp6,
+                  &type,
+                  &target,
+                  0,
+                  2);
+  };
+
+  int
+  send_na ()
+  {
+    uint8_t na[32] = { 136, 0, 0, 0, 0x60 };
+
+    inet_pton (AF_INET6, "2001:db8:1::7", &na[8]);
+    na[24] = 2; /* target link-layer address */
+    na[25] = 1;
+    memcpy (&na[26], host_mac, MAC_ADDR_SIZE);
+    build_ipv6_frame (frame, 2, 7, "2001:db8:1::7", "ff02::1",
+                      255, IPPROTO_ICMPV6, na, sizeof (na));
+    tsend (2,
+           frame,
+           54 + sizeof (na));
+    return 0;
+  };
+
+  int
+  expect_forward ()
+  {
+    return trecv (0,
+                  &expect_ipv6,
+                  &hop_limit,
+                  host_mac,
+                  54 + sizeof (udp),
+                  2);
+  };
+
+  int
+  send_expiring ()
+  {
+    build_ipv6_frame (frame, 1, 8, "2001:db8::8", "2001:db8:1::7",
+                      1, IPPROTO_UDP, udp, sizeof (udp));
+    tsend (1,
+           frame,
+           54 + sizeof (udp));
+    return 0;
+  };
+
+  int
+  expect_time_exceeded ()
+  {
+    type = 3;
+    return trecv (0,
+                  &expect_icmp6,
+                  &type,
+                  NULL,
+                  0,
+                  1);
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24,IPV6:2001:db8::1/64]",
+    "eth1[IPV4:10.0.1.1/24,IPV6:2001:db8:1::1/64]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "send packet to unknown neighbor", &send_udp },
+    { "expect neighbor solicitation", &expect_ns },
+    { "send neighbor advertisement", &send_na },
+    { "send packet again", &send_udp },
+    { "expect forwarded packet", &expect_forward },
+    { "send packet with hop limit 1", &send_expiring },
+    { "expect time exceeded", &expect_time_exceeded },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * We expect an MPLS frame with a given top label and TTL 63.
+ *
+ * @param cls pointer to the label we expect (uint32_t)
+ * @param ifc interface we got a frame from
+ * @param msg frame we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 ignored
+ * @param cls2 expected frame size
+ * @param cls3 interface we expect to receive from
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_mpls (void *cls,
+             uint16_t ifc,
+             const void *msg,
+             size_t msg_len,
+             const void *cls1,
+             ssize_t cls2,
+             uint16_t cls3)
+{
+  const uint32_t *label = cls;
+  const uint8_t *b = msg;
+  uint32_t lse;
+
+  (void) cls1;
+  if ( (cls3 != ifc) ||
+       (msg_len != cls2) ||
+       (0x88 != b[12]) ||
+       (0x47 != b[13]) )
+    return 1;
+  memcpy (&lse, &b[14], 4);
+  lse = ntohl (lse);
+  if ( (*label != lse >> 12) ||
+       (0 == (lse & 0x100)) ||
+       (63 != (lse & 0xFF)) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Test MPLS label swapping and label imposition by a route.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_mpls (const char *prog)
+{
+  char arp_frame[42];
+  char tcp_frame[54 + 100];
+  char mpls_frame[4 + 54 + 100];
+  uint32_t label;
+
+  int
+  send_arp ()
+  {
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    return 0;
+  };
+
+  int
+  send_config ()
+  {
+    char swap[] = "mpls add 100 swap 200 via 10.0.1.7 dev eth1";
+    char impose[] = "route add 10.0.2.0/24 via 10.0.1.7 dev eth1 label 300";
+
+    tsend (0, swap, sizeof (swap));
+    tsend (0, impose, sizeof (impose));
+    return 0;
+  };
+
+  int
+  send_labelled ()
+  {
+    uint32_t lse = htonl ((100 << 12) | 0x100 | 64);
+    uint16_t v = htons (0x8847);
+
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.3.7", 1, 100);
+    memcpy (mpls_frame, tcp_frame, 12);
+    memcpy (&mpls_frame[12], &v, 2);
+    memcpy (&mpls_frame[14], &lse, 4);
+    memcpy (&mpls_frame[18], &tcp_frame[14], sizeof (tcp_frame) - 14);
+    tsend (1,
+           mpls_frame,
+           sizeof (mpls_frame));
+    return 0;
+  };
+
+  int
+  expect_swapped ()
+  {
+    label = 200;
+    return trecv (0,
+                  &expect_mpls,
+                  &label,
+                  NULL,
+                  sizeof (mpls_frame),
+                  2);
+  };
+
+  int
+  send_ip ()
+  {
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.2.9", 1, 100);
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  expect_imposed ()
+  {
+    label = 300;
+    return trecv (0,
+                  &expect_mpls,
+                  &label,
+                  NULL,
+                  sizeof (mpls_frame),
+                  2);
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "send ARP reply", &send_arp },
+    { "configure label table and route", &send_config },
+    { "send labelled frame", &send_labelled },
+    { "expect swapped label", &expect_swapped },
+    { "send IPv4 frame", &send_ip },
+    { "expect imposed label", &expect_imposed },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * We expect an IPv4 frame carrying a TCP/IPv4 packet whose TTL was
+ * decremented, either directly or encapsulated in GRE.
+ *
+ * @param cls pointer to the outer IP protocol we expect, 0 for none
+ * @param ifc interface we got a frame from
+ * @param msg frame we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 ignored
+ * @param cls2 expected frame size
+ * @param cls3 interface we expect to receive from
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_tunnelled (void *cls,
+                  uint16_t ifc,
+                  const void *msg,
+                  size_t msg_len,
+                  const void *cls1,
+                  ssize_t cls2,
+                  uint16_t cls3)
+{
+  const uint8_t *proto = cls;
+  const uint8_t *b = msg;
+  const uint8_t *inner = &b[14];
+  struct in_addr remote;
+
+  (void) cls1;
+  if ( (cls3 != ifc) ||
+       (msg_len != cls2) ||
+       (0x08 != b[12]) ||
+       (0x00 != b[13]) )
+    return 1;
+  if (0 != *proto)
+  {
+    inet_pton (AF_INET, "10.0.1.7", &remote);
+    if ( (*proto != b[14 + 9]) ||
+         (0 != memcmp (&b[14 + 16], &remote, 4)) ||
+         (0x08 != b[14 + 20 + 2]) ||
+         (0x00 != b[14 + 20 + 3]) )
+      return 1;
+    inner = &b[14 + 20 + 4];
+  }
+  if ( (IPPROTO_TCP != inner[9]) ||
+       (63 != inner[8]) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Test GRE encapsulation via a tunnel route and decapsulation.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_tunnel (const char *prog)
+{
+  char arp_frame[42];
+  char tcp_frame[54 + 100];
+  char gre_frame[14 + 20 + 4 + 40 + 100];
+  uint8_t proto;
+
+  int
+  send_arp ()
+  {
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    return 0;
+  };
+
+  int
+  send_config ()
+  {
+    char route[] = "route add 10.0.5.0/24 via 192.168.0.2 dev tun0";
+
+    tsend (0, route, sizeof (route));
+    return 0;
+  };
+
+  int
+  send_ip ()
+  {
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.5.9", 1, 100);
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  expect_encapsulated ()
+  {
+    proto = IPPROTO_GRE;
+    return trecv (0,
+                  &expect_tunnelled,
+                  &proto,
+                  NULL,
+                  sizeof (gre_frame),
+                  2);
+  };
+
+  int
+  send_gre ()
+  {
+    uint8_t *ip = (uint8_t *) &gre_frame[14];
+    uint16_t v;
+
+    build_tcp_frame (tcp_frame, 2, "10.0.5.9", "10.0.0.7", 1, 100);
+    memcpy (gre_frame, tcp_frame, 14);
+    memset (ip, 0, 24);
+    ip[0] = 0x45;
+    v = htons (20 + 4 + 40 + 100);
+    memcpy (&ip[2], &v, 2);
+    ip[8] = 64;
+    ip[9] = IPPROTO_GRE;
+    inet_pton (AF_INET, "10.0.1.7", &ip[12]);
+    inet_pton (AF_INET, "10.0.1.1", &ip[16]);
+    v = htons (ETH_P_IPV4);
+    memcpy (&ip[22], &v, 2);
+    memcpy (&ip[24], &tcp_frame[14], sizeof (tcp_frame) - 14);
+    tsend (2,
+           gre_frame,
+           sizeof (gre_frame));
+    return 0;
+  };
+
+  int
+  expect_decapsulated ()
+  {
+    proto = 0;
+    return trecv (0,
+                  &expect_tunnelled,
+                  &proto,
+                  NULL,
+                  sizeof (tcp_frame),
+                  1);
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    "tun0[IPV4:192.168.0.1/30],tunnel=gre,remote=10.0.1.7",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "send ARP reply", &send_arp },
+    { "configure route via tunnel", &send_config },
+    { "send IPv4 frame", &send_ip },
+    { "expect GRE encapsulated frame", &expect_encapsulated },
+    { "send GRE frame", &send_gre },
+    { "expect decapsulated frame", &expect_decapsulated },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * We expect a copy of the multicast packet to 239.1.1.1.
+ *
+ * @param cls NULL
+ * @param ifc interface we got a frame from
+ * @param msg frame we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 ignored
+ * @param cls2 expected frame size
+ * @param cls3 interface we expect to receive from
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_mcast (void *cls,
+              uint16_t ifc,
+              const void *msg,
+              size_t msg_len,
+              const void *cls1,
+              ssize_t cls2,
+              uint16_t cls3)
+{
+  static const uint8_t group_mac[] = { 0x01, 0x00, 0x5E, 0x01, 0x01, 0x01 };
+  const uint8_t *b = msg;
+
+  (void) cls;
+  (void) cls1;
+  if ( (cls3 != ifc) ||
+       (msg_len != cls2) ||
+       (0 != memcmp (b, group_mac, sizeof (group_mac))) ||
+       (63 != b[14 + 8]) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Test multicast replication to a (*,G) route and to joined members.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_multicast (const char *prog)
+{
+  char tcp_frame[54 + 100];
+
+  int
+  send_config ()
+  {
+    char route[] = "mroute add * 239.1.1.1 iif eth0 oif eth1";
+    char join[] = "mroute join 239.1.1.1 eth2";
+
+    tsend (0, route, sizeof (route));
+    tsend (0, join, sizeof (join));
+    return 0;
+  };
+
+  int
+  send_mcast ()
+  {
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "239.1.1.1", 1, 100);
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  expect_copy1 ()
+  {
+    return trecv (0,
+                  &expect_mcast,
+                  NULL,
+                  NULL,
+                  sizeof (tcp_frame),
+                  2);
+  };
+
+  int
+  expect_copy2 ()
+  {
+    return trecv (0,
+                  &expect_mcast,
+                  NULL,
+                  NULL,
+                  sizeof (tcp_frame),
+                  3);
+  };
+
+  int
+  send_wrong_iif ()
+  {
+    build_tcp_frame (tcp_frame, 2, "10.0.1.7", "239.1.1.1", 1, 100);
+    tsend (2,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    "eth2[IPV4:10.0.2.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "configure multicast route", &send_config },
+    { "send multicast frame", &send_mcast },
+    { "expect copy on eth1", &expect_copy1 },
+    { "expect copy on eth2", &expect_copy2 },
+    { "send multicast frame on wrong interface", &send_wrong_iif },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * We expect an ICMP message of a given type and code.
+ *
+ * @param cls pointer to the ICMP type and code we expect (uint8_t[2])
+ * @param ifc interface we got a frame from
+ * @param msg frame we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 ignored
+ * @param cls2 ignored
+ * @param cls3 interface we expect to receive from
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_icmp4 (void *cls,
+              uint16_t ifc,
+              const void *msg,
+              size_t msg_len,
+              const void *cls1,
+              ssize_t cls2,
+              uint16_t cls3)
+{
+  const uint8_t *type_code = cls;
+  const uint8_t *b = msg;
+
+  (void) cls1;
+  (void) cls2;
+  if ( (cls3 != ifc) ||
+       (msg_len < 14 + 20 + 8) ||
+       (0x08 != b[12]) ||
+       (0x00 != b[13]) ||
+       (IPPROTO_ICMP != b[14 + 9]) ||
+       (type_code[0] != b[14 + 20]) ||
+       (type_code[1] != b[14 + 20 + 1]) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Test blackhole, unreachable and local routes.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_route_types (const char *prog)
+{
+  char tcp_frame[54 + 100];
+  uint8_t type_code[2];
+
+  int
+  send_config ()
+  {
+    char blackhole[] = "route add 10.0.9.0/24 blackhole";
+    char unreachable[] = "route add 10.0.8.0/24 unreachable";
+    char local[] = "route add 10.0.0.1/32 local";
+
+    tsend (0, blackhole, sizeof (blackhole));
+    tsend (0, unreachable, sizeof (unreachable));
+    tsend (0, local, sizeof (local));
+    return 0;
+  };
+
+  int
+  send_blackholed ()
+  {
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.9.9", 1, 100);
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  send_unreachable ()
+  {
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.8.9", 1, 100);
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  expect_unreachable ()
+  {
+    type_code[0] = 3;
+    type_code[1] = 1;
+    return trecv (0,
+                  &expect_icmp4,
+                  type_code,
+                  NULL,
+                  0,
+                  1);
+  };
+
+  int
+  send_echo ()
+  {
+    uint8_t *ip = (uint8_t *) &tcp_frame[14];
+
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.0.1", 1, 100);
+    ip[9] = IPPROTO_ICMP;
+    memset (&ip[20], 0, 8);
+    ip[20] = 8; /* echo request */
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  expect_echo_reply ()
+  {
+    type_code[0] = 0;
+    type_code[1] = 0;
+    return trecv (0,
+                  &expect_icmp4,
+                  type_code,
+                  NULL,
+                  0,
+                  1);
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "configure route types", &send_config },
+    { "send frame to blackhole", &send_blackholed },
+    { "send frame to unreachable route", &send_unreachable },
+    { "expect host unreachable", &expect_unreachable },
+    { "send echo request to local route", &send_echo },
+    { "expect echo reply", &expect_echo_reply },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+/**
+ * Check the IPFIX export in @a filename: a single data record for two
+ * packets from 10.0.0.7 that ended because export was turned off.
+ *
+ * @param filename file the router exported to
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+check_flow_export (const char *filename)
+{
+  uint8_t buf[1400];
+  ssize_t len;
+  size_t off;
+  int fd;
+
+  fd = open (filename,
+             O_RDONLY);
+  if (-1 == fd)
+    return 1;
+  len = read (fd,
+              buf,
+              sizeof (buf));
+  close (fd);
+  unlink (filename);
+  if ( (len < 16) ||
+       (0 != buf[0]) ||
+       (10 != buf[1]) ||
+       (len != ((buf[2] << 8) | buf[3])) )
+    return 1;
+  /* skip the template set, look for the data set */
+  for (off = 16; off + 4 <= (size_t) len; off += (buf[off + 2] << 8) | buf[off + 3])
+  {
+    const uint8_t *r = &buf[off + 4];
+    struct in_addr src;
+
+    if ( (0 == ((buf[off + 2] << 8) | buf[off + 3])) )
+      return 1;
+    if (256 != ((buf[off] << 8) | buf[off + 1]))
+      continue;
+    inet_pton (AF_INET, "10.0.0.7", &src);
+    if ( (off + 4 + 58 > (size_t) len) ||
+         (4 + 58 != ((buf[off + 2] << 8) | buf[off + 3])) ||
+         (0 != memcmp (r, &src, 4)) ||
+         (2 != r[28]) ||   /* packetDeltaCount */
+         (4 != r[53]) )    /* flowEndReason: forced end */
+      return 1;
+    return 0;
+  }
+  return 1;
+}
+
+
+/**
+ * Test that forwarded flows are accounted and exported as IPFIX, and
+ * that traffic to a blackhole route, without a route or with an
+ * expired TTL gets no flow entry.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_flow (const char *prog)
+{
+  char tcp_frame[54 + 100];
+  char filename[64];
+  uint32_t next_seq = 1;
+  uint8_t type_code[2] = { 3, 0 }; /* network unreachable */
+
+  snprintf (filename,
+            sizeof (filename),
+            "/tmp/test-router-flows-%d",
+            (int) getpid ());
+  unlink (filename);
+
+  int
+  send_config ()
+  {
+    char blackhole[] = "route add 10.0.9.0/24 blackhole";
+    char export[128];
+
+    snprintf (export,
+              sizeof (export),
+              "flow export %s",
+              filename);
+    tsend (0, blackhole, sizeof (blackhole));
+    tsend (0, export, strlen (export) + 1);
+    return 0;
+  };
+
+  int
+  send_dropped ()
+  {
+    char arp_frame[42];
+
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    build_tcp_frame (tcp_frame, 1, "10.0.0.8", "10.0.9.9", 1, 100);
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    build_tcp_frame (tcp_frame, 1, "10.0.0.9", "10.0.1.7", 1, 100);
+    tcp_frame[sizeof (struct EthernetHeader) + 8] = 1; /* TTL */
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    build_tcp_frame (tcp_frame, 1, "10.0.0.10", "192.168.5.5", 1, 100);
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  expect_unreachable ()
+  {
+    return trecv (0,
+                  &expect_icmp4,
+                  type_code,
+                  NULL,
+                  0,
+                  1);
+  };
+
+  int
+  send_frames ()
+  {
+    for (uint32_t i = 0; i < 2; i++)
+    {
+      build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.1.7", 1 + 100 * i, 100);
+      tsend (1,
+             tcp_frame,
+             sizeof (tcp_frame));
+    }
+    return 0;
+  };
+
+  int
+  expect_forwarded ()
+  {
+    return trecv (0,
+                  &expect_segment,
+                  &next_seq,
+                  NULL,
+                  1514,
+                  2);
+  };
+
+  int
+  send_stop ()
+  {
+    char off[] = "flow export off";
+
+    tsend (0, off, sizeof (off));
+    return 0;
+  };
+
+  int
+  check_export ()
+  {
+    return check_flow_export (filename);
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "configure flow export", &send_config },
+    { "send blackholed, expiring and unroutable frames", &send_dropped },
+    { "expect network unreachable", &expect_unreachable },
+    { "send two frames of one flow", &send_frames },
+    { "expect first frame", &expect_forwarded },
+    { "expect second frame", &expect_forwarded },
+    { "wait for the frames", &expect_silence },
+    { "stop flow export", &send_stop },
+    { "wait for the export", &expect_silence },
+    { "check exported record", &check_export },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+/**
+ * Check the pcapng file @a filename: a section header, then one
+ * enhanced packet block holding the inbound frame @a frame.
+ *
+ * @param filename file the router wrote
+ * @param frame frame we expect
+ * @param frame_size number of bytes in @a frame
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+check_capture (const char *filename,
+               const void *frame,
+               size_t frame_size)
+{
+  uint8_t buf[4096];
+  ssize_t len;
+  size_t off;
+  uint32_t v;
+  int fd;
+
+  fd = open (filename,
+             O_RDONLY);
+  if (-1 == fd)
+    return 1;
+  len = read (fd,
+              buf,
+              sizeof (buf));
+  close (fd);
+  unlink (filename);
+  memcpy (&v, buf, sizeof (v));
+  if ( (len < 28) ||
+       (0x0A0D0D0A != v) )
+    return 1;
+  for (off = 0; off + 12 <= (size_t) len; off += v)
+  {
+    uint32_t type;
+    uint32_t caplen;
+
+    memcpy (&type, &buf[off], sizeof (type));
+    memcpy (&v, &buf[off + 4], sizeof (v));
+    if ( (v < 12) ||
+         (off + v > (size_t) len) )
+      return 1;
+    if (6 != type)
+      continue;
+    memcpy (&caplen, &buf[off + 20], sizeof (caplen));
+    if ( (caplen != frame_size) ||
+         (0 != memcmp (&buf[off + 28],
+                       frame,
+                       frame_size)) )
+      return 1;
+    return 0;
+  }
+  return 1;
+}
+
+
+/**
+ * Test capturing a frame and writing it as pcapng.  The file is
+ * written after the rest of the batch with "capture stop" is handled.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_capture (const char *prog)
+{
+  char tcp_frame[54 + 100];
+  char filename[64];
+
+  snprintf (filename,
+            sizeof (filename),
+            "/tmp/test-router-capture-%d",
+            (int) getpid ());
+  unlink (filename);
+
+  int
+  send_config ()
+  {
+    char blackhole[] = "route add 10.0.9.0/24 blackhole";
+    char start[] = "capture start eth0 proto tcp snaplen 200";
+
+    tsend (0, blackhole, sizeof (blackhole));
+    tsend (0, start, sizeof (start));
+    return 0;
+  };
+
+  int
+  send_frame ()
+  {
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.9.9", 1, 100);
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  send_stop ()
+  {
+    char stop[128];
+    char status[] = "capture";
+
+    snprintf (stop,
+              sizeof (stop),
+              "capture stop %s",
+              filename);
+    /* the file is written as deferred work, after the whole batch */
+    tqueue (0, stop, strlen (stop) + 1);
+    tqueue (0, status, sizeof (status));
+    tflush (SIZE_MAX);
+    return 0;
+  };
+
+  int
+  expect_status ()
+  {
+    const char *msg
+      = "capture stopped, 1 frames seen, 1 captured, 0 overwritten\n";
+
+    return trecv (0,
+                  &expect_frame2,
+                  NULL,
+                  msg,
+                  - (ssize_t) strlen (msg),
+                  0);
+  };
+
+  int
+  expect_written ()
+  {
+    char msg[128];
+
+    snprintf (msg,
+              sizeof (msg),
+              "Capture written to `%s', 1 frames\n",
+              filename);
+    return trecv (0,
+                  &expect_frame2,
+                  NULL,
+                  msg,
+                  - (ssize_t) strlen (msg),
+                  0);
+  };
+
+  int
+  check_file ()
+  {
+    return check_capture (filename,
+                          tcp_frame,
+                          sizeof (tcp_frame));
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "start capture", &send_config },
+    { "send frame", &send_frame },
+    { "wait for the frame", &expect_silence },
+    { "stop capture and query it", &send_stop },
+    { "check capture state", &expect_status },
+    { "wait for the file", &expect_written },
+    { "check captured frame", &check_file },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * Test writing a capture to a pipe that holds less than the capture:
+ * the router has to wait until the pipe is writable again, without
+ * blocking.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_capture_pipe (const char *prog)
+{
+  const unsigned int num_frames = 80;
+  static uint8_t data[256 * 1024];
+  char tcp_frame[1400];
+  char filename[64];
+  size_t data_len = 0;
+  int fd;
+
+  snprintf (filename,
+            sizeof (filename),
+            "/tmp/test-router-capture-pipe-%d",
+            (int) getpid ());
+  unlink (filename);
+  if (0 != mkfifo (filename,
+                   0600))
+    return 1;
+  /* read-write, so that the router can open it without blocking */
+  fd = open (filename,
+             O_RDWR | O_NONBLOCK);
+  if (-1 == fd)
+  {
+    unlink (filename);
+    return 1;
+  }
+
+  int
+  send_config ()
+  {
+    char blackhole[] = "route add 10.0.9.0/24 blackhole";
+    char start[] = "capture start eth0 snaplen 1514";
+
+    tsend (0, blackhole, sizeof (blackhole));
+    tsend (0, start, sizeof (start));
+    return 0;
+  };
+
+  int
+  send_frames ()
+  {
+    for (unsigned int i = 0; i < num_frames; i++)
+    {
+      build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.9.9", i,
+                       sizeof (tcp_frame) - 54);
+      tqueue (1,
+              tcp_frame,
+              sizeof (tcp_frame));
+    }
+    tflush (SIZE_MAX);
+    return 0;
+  };
+
+  int
+  send_stop ()
+  {
+    char stop[128];
+
+    snprintf (stop,
+              sizeof (stop),
+              "capture stop %s",
+              filename);
+    tsend (0, stop, strlen (stop) + 1);
+    return 0;
+  };
+
+  int
+  read_pipe ()
+  {
+    struct pollfd pfd = {
+      .fd = fd,
+      .events = POLLIN
+    };
+
+    /* until the router stopped writing for a while */
+    while (0 < poll (&pfd,
+                     1,
+                     1000))
+    {
+      ssize_t ret;
+
+      ret = read (fd,
+                  &data[data_len],
+                  sizeof (data) - data_len);
+      if (ret <= 0)
+        return 1;
+      data_len += ret;
+    }
+    return 0;
+  };
+
+  int
+  expect_written ()
+  {
+    char msg[128];
+
+    snprintf (msg,
+              sizeof (msg),
+              "Capture written to `%s', %u frames\n",
+              filename,
+              num_frames);
+    return trecv (0,
+                  &expect_frame2,
+                  NULL,
+                  msg,
+                  - (ssize_t) strlen (msg),
+                  0);
+  };
+
+  int
+  check_data ()
+  {
+    unsigned int frames = 0;
+    uint32_t v;
+
+    memcpy (&v, data, sizeof (v));
+    if ( (data_len < 28) ||
+         (0x0A0D0D0A != v) )
+      return 1;
+    for (size_t off = 0; off < data_len; off += v)
+    {
+      uint32_t type;
+      uint32_t caplen;
+
+      if (off + 12 > data_len)
+        return 1;
+      memcpy (&type, &data[off], sizeof (type));
+      memcpy (&v, &data[off + 4], sizeof (v));
+      if ( (v < 12) ||
+           (off + v > data_len) )
+        return 1;
+      if (6 != type)
+        continue;
+      build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.9.9", frames,
+                       sizeof (tcp_frame) - 54);
+      memcpy (&caplen, &data[off + 20], sizeof (caplen));
+      if ( (caplen != sizeof (tcp_frame)) ||
+           (0 != memcmp (&data[off + 28],
+                         tcp_frame,
+                         sizeof (tcp_frame))) )
+        return 1;
+      frames++;
+    }
+    return (frames == num_frames) ? 0 : 1;
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "start capture", &send_config },
+    { "send frames", &send_frames },
+    { "wait for the frames", &expect_silence },
+    { "stop capture", &send_stop },
+    { "read the pipe", &read_pipe },
+    { "wait for the end of the file", &expect_written },
+    { "check captured frames", &check_data },
+    { "end", &expect_silence },
+    { NULL }
+  };
+  int ret;
+
+  ret = meta (cmd,
+              (sizeof (argv) / sizeof (char *)) - 1,
+              argv);
+  close (fd);
+  unlink (filename);
+  return ret;
+}
+
+
 // Test fragmentation
 static int test_fragmentation(const char *prog) {
 
-/*
-    uint8_t fragment1[] = {
-        0x45, 0x00, 0x00, 0x34, 0x00, 0x01, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01, // IP header
-        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, // Payload
-    };
-    uint8_t fragment2[] = {
-        0x45, 0x00, 0x00, 0x34, 0x00, 0x02, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01, // IP header
-        0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, // Payload
-    };
-    uint8_t fragment3[] = {
-        0x45, 0x00, 0x00, 0x34, 0x00, 0x03, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01, // IP header
-        0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, // Payload
-    };
+/*
+    uint8_t fragment1[] = {
+        0x45, 0x00, 0x00, 0x34, 0x00, 0x01, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01, // IP header
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, // Payload
+    };
+    uint8_t fragment2[] = {
+        0x45, 0x00, 0x00, 0x34, 0x00, 0x02, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01, // IP header
+        0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, // Payload
+    };
+    uint8_t fragment3[] = {
+        0x45, 0x00, 0x00, 0x34, 0x00, 0x03, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01, // IP header
+        0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, // Payload
+    };
+
+    // verify ...
+
+    uint8_t expectedReassembledPacket[] = {
+        0x45, 0x00, 0x00, 0x64, 0x00, 0x02, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01, // IP header
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, // Payload
+        0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, // Payload
+        0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, // Payload
+    };
+*/
+    //int isEqual = memcmp(reassembledPacket, expectedReassembledPacket, sizeof(expectedReassembledPacket));
+    // equal good else bad
+
+    char *argv[] = {
+      (char *) prog,
+        "eth0[IPV4:10.0.0.2/24]",
+        "eth1[IPV4:10.0.0.3/24]",
+        "eth2[IPV4:10.0.0.4/24]",
+        NULL
+    };
+
+    struct Command cmd[] = {
+        //{ "send frame", &send_frame },
+        //{ "check broadcast", &expect_broadcast },
+        { "expect nothing", &expect_silence },
+        { NULL }
+    };
+
+    return meta(cmd, (sizeof(argv) / sizeof(char *)) - 1, argv);
+}
+/////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////
+// MAIN:
+
+/**
+ * Test the per-route counters: traffic over two routes must be
+ * counted against the matching route, and "route stats top" must
+ * list the route that carried more bytes first.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_route_stats (const char *prog)
+{
+  char tcp_frame[54 + 100];
+  uint32_t next_seq = 1;
+
+  int
+  send_config ()
+  {
+    char arp_frame[42];
+    char r1[] = "route add 10.0.4.0/24 via 10.0.1.7 dev eth1";
+    char r2[] = "route add 10.0.5.0/24 via 10.0.1.7 dev eth1";
+
+    tsend (0, r1, sizeof (r1));
+    tsend (0, r2, sizeof (r2));
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    return 0;
+  };
+
+  int
+  send_traffic ()
+  {
+    /* one frame over 10.0.4.0/24, two over 10.0.5.0/24 */
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.4.7", 1, 100);
+    tsend (1, tcp_frame, sizeof (tcp_frame));
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.5.7", 101, 100);
+    tsend (1, tcp_frame, sizeof (tcp_frame));
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.5.7", 201, 100);
+    tsend (1, tcp_frame, sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  expect_seg ()
+  {
+    return trecv (0,
+                  &expect_segment,
+                  &next_seq,
+                  NULL,
+                  1514,
+                  2);
+  };
+
+  int
+  send_top ()
+  {
+    char cmd[] = "route stats top 2";
+
+    tsend (0, cmd, sizeof (cmd));
+    return 0;
+  };
+
+  int
+  expect_text (const char *text)
+  {
+    return trecv (0,
+                  &expect_frame2,
+                  NULL,
+                  text,
+                  - (ssize_t) strlen (text),
+                  0);
+  };
+
+  int
+  expect_types ()
+  {
+    return expect_text ("0 blackhole, 0 unreachable, 0 prohibit, 0 local, "
+                        "0 icmp sent, 0 icmp rate limited\n");
+  };
+
+  int
+  expect_first ()
+  {
+    return expect_text ("10.0.5.0/255.255.255.0: 2 pkts 280 bytes\n");
+  };
+
+  int
+  expect_second ()
+  {
+    return expect_text ("10.0.4.0/255.255.255.0: 1 pkts 140 bytes\n");
+  };
+
+  int
+  send_one ()
+  {
+    char cmd[] = "route stats 10.0.4.0/24";
+
+    tsend (0, cmd, sizeof (cmd));
+    return 0;
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "add routes", &send_config },
+    { "send traffic", &send_traffic },
+    { "expect frame 1", &expect_seg },
+    { "expect frame 2", &expect_seg },
+    { "expect frame 3", &expect_seg },
+    { "list top routes", &send_top },
+    { "check type counters", &expect_types },
+    { "check busiest route", &expect_first },
+    { "check second route", &expect_second },
+    { "show one route", &send_one },
+    { "check one route", &expect_second },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * Header of the router's shared-memory export.  Mirrors `struct
+ * ShmHeader` in router.c: readers outside the router depend on this
+ * layout, so the test must notice if it changes.
+ */
+struct ShmHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t header_size;
+  uint64_t seq;
+  uint64_t updated;
+  uint32_t route_offset;
+  uint32_t route_count;
+  uint32_t route_size;
+  uint32_t route_max;
+  uint32_t arp_offset;
+  uint32_t arp_count;
+  uint32_t arp_size;
+  uint32_t arp_max;
+  uint32_t metric_offset;
+  uint32_t metric_count;
+  uint32_t metric_size;
+  uint32_t metric_max;
+};
+
+
+/**
+ * A route in the shared-memory export, see `struct ShmRoute`.
+ */
+struct ShmRoute
+{
+  struct in_addr network;
+  struct in_addr netmask;
+  struct in_addr next_hop;
+  uint16_t ifc_num;
+  uint8_t type;
+  uint8_t reserved;
+  uint64_t packets;
+  uint64_t bytes;
+};
+
+
+/**
+ * An ARP cache entry in the shared-memory export, see `struct ShmArp`.
+ */
+struct ShmArp
+{
+  struct in_addr ip;
+  uint16_t ifc_num;
+  struct MacAddress mac;
+};
+
+
+/**
+ * A metric in the shared-memory export, see `struct ShmMetric`.
+ */
+struct ShmMetric
+{
+  char name[48];
+  uint64_t value;
+};
+
+
+/**
+ * What the test reads from the shared-memory export.
+ */
+struct ShmSnapshot
+{
+  /**
+   * Sequence number the snapshot is consistent with.
+   */
+  uint64_t seq;
+
+  /**
+   * Packets and bytes of the route 10.0.4.0/24 via eth1.
+   */
+  uint64_t route_packets;
+  uint64_t route_bytes;
+
+  /**
+   * Value of the "eth0.rx_packets" metric.
+   */
+  uint64_t rx_packets;
+
+  /**
+   * Did we find the ARP entry of 10.0.1.7 on eth1?
+   */
+  int have_arp;
+};
+
+
+/**
+ * Map the segment @a name read-only and take a consistent snapshot,
+ * following the seqlock protocol of the router: retry while the
+ * sequence number is odd or changed during the copy.
+ *
+ * @param name path of the segment
+ * @param[out] snap where to store what we found
+ * @return 0 on success, 1 on failure
+ */
+static int
+shm_snapshot (const char *name,
+              struct ShmSnapshot *snap)
+{
+  const struct MacAddress mac = { { 0x02, 0, 0, 0, 0, 7 } };
+  const struct ShmHeader *h;
+  struct in_addr network;
+  struct stat st;
+  uint8_t *copy;
+  int ret = 1;
+  int fd;
+
+  fd = open (name,
+             O_RDONLY);
+  if (-1 == fd)
+    return 1;
+  if ( (0 != fstat (fd,
+                    &st)) ||
+       (st.st_size < (off_t) sizeof (struct ShmHeader)) )
+  {
+    close (fd);
+    return 1;
+  }
+  h = mmap (NULL,
+            st.st_size,
+            PROT_READ,
+            MAP_SHARED,
+            fd,
+            0);
+  close (fd);
+  if (MAP_FAILED == h)
+    return 1;
+  copy = malloc (st.st_size);
+  for (unsigned int i = 0; i < 1000; i++)
+  {
+    uint64_t seq = __atomic_load_n (&h->seq,
+                                    __ATOMIC_ACQUIRE);
+
+    if (0 != (seq & 1))
+      continue;
+    memcpy (copy,
+            h,
+            st.st_size);
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    if (seq != __atomic_load_n (&h->seq,
+                                __ATOMIC_RELAXED))
+      continue;
+    snap->seq = seq;
+    ret = 0;
+    break;
+  }
+  munmap ((void *) h,
+          st.st_size);
+  if (0 != ret)
+  {
+    free (copy);
+    return 1;
+  }
+  h = (const struct ShmHeader *) copy;
+  if ( (0x474c5254 != h->magic) ||
+       (1 != h->version) ||
+       (sizeof (struct ShmHeader) != h->header_size) ||
+       (sizeof (struct ShmRoute) != h->route_size) ||
+       (sizeof (struct ShmArp) != h->arp_size) ||
+       (sizeof (struct ShmMetric) != h->metric_size) ||
+       (h->route_count > h->route_max) ||
+       (h->arp_count > h->arp_max) ||
+       (h->metric_count > h->metric_max) ||
+       (h->route_offset + (size_t) h->route_max * h->route_size > (size_t) st.st_size) ||
+       (h->arp_offset + (size_t) h->arp_max * h->arp_size > (size_t) st.st_size) ||
+       (h->metric_offset + (size_t) h->metric_max * h->metric_size > (size_t) st.st_size) )
+  {
+    free (copy);
+    return 1;
+  }
+  inet_pton (AF_INET, "10.0.4.0", &network);
+  snap->route_packets = UINT64_MAX;
+  snap->rx_packets = UINT64_MAX;
+  snap->have_arp = 0;
+  for (uint32_t i = 0; i < h->route_count; i++)
+  {
+    const struct ShmRoute *r = (const struct ShmRoute *)
+                               &copy[h->route_offset + i * h->route_size];
+
+    if ( (r->network.s_addr == network.s_addr) &&
+         (r->netmask.s_addr == htonl (0xFFFFFF00)) &&
+         (2 == r->ifc_num) )
+    {
+      snap->route_packets = r->packets;
+      snap->route_bytes = r->bytes;
+    }
+  }
+  inet_pton (AF_INET, "10.0.1.7", &network);
+  for (uint32_t i = 0; i < h->arp_count; i++)
+  {
+    const struct ShmArp *a = (const struct ShmArp *)
+                             &copy[h->arp_offset + i * h->arp_size];
+
+    if ( (a->ip.s_addr == network.s_addr) &&
+         (2 == a->ifc_num) &&
+         (0 == memcmp (&a->mac, &mac, sizeof (mac))) )
+      snap->have_arp = 1;
+  }
+  for (uint32_t i = 0; i < h->metric_count; i++)
+  {
+    const struct ShmMetric *m = (const struct ShmMetric *)
+                                &copy[h->metric_offset + i * h->metric_size];
+
+    if (0 == strncmp (m->name,
+                      "eth0.rx_packets",
+                      sizeof (m->name)))
+      snap->rx_packets = m->value;
+  }
+  free (copy);
+  return 0;
+}
+
+
+/**
+ * Test the shared-memory export from the reader's side: map the
+ * segment, follow the sequence protocol and check the route, ARP and
+ * metric entries after traffic, then again after more traffic.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_shm (const char *prog)
+{
+  char tcp_frame[54 + 100];
+  char name[64];
+  char path[80];
+  uint32_t next_seq = 1;
+  struct ShmSnapshot first;
+  struct ShmSnapshot second;
 
-    // verify ...
+  snprintf (name,
+            sizeof (name),
+            "test-router-shm-%d",
+            (int) getpid ());
+  snprintf (path,
+            sizeof (path),
+            "/dev/shm/%s",
+            name);
 
-    uint8_t expectedReassembledPacket[] = {
-        0x45, 0x00, 0x00, 0x64, 0x00, 0x02, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01, // IP header
-        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, // Payload
-        0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, // Payload
-        0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, // Payload
-    };
-*/
-    //int isEqual = memcmp(reassembledPacket, expectedReassembledPacket, sizeof(expectedReassembledPacket));
-    // equal good else bad
+  int
+  send_config ()
+  {
+    char arp_frame[42];
+    char route[] = "route add 10.0.4.0/24 via 10.0.1.7 dev eth1";
+    char export[128];
 
-    char *argv[] = {
-      (char *) prog,
-        "eth0[IPV4:10.0.0.2/24]",
-        "eth1[IPV4:10.0.0.3/24]",
-        "eth2[IPV4:10.0.0.4/24]",
-        NULL
-    };
+    snprintf (export,
+              sizeof (export),
+              "shm export %s interval 10ms",
+              name);
+    tsend (0, route, sizeof (route));
+    tsend (0, export, strlen (export) + 1);
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    return 0;
+  };
 
-    struct Command cmd[] = {
-        //{ "send frame", &send_frame },
-        //{ "check broadcast", &expect_broadcast },
-        { "expect nothing", &expect_silence },
-        { NULL }
-    };
+  int
+  send_frame ()
+  {
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.4.7", next_seq, 100);
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
 
-    return meta(cmd, (sizeof(argv) / sizeof(char *)) - 1, argv);
+  int
+  expect_seg ()
+  {
+    int ret;
+
+    ret = trecv (0,
+                 &expect_segment,
+                 &next_seq,
+                 NULL,
+                 1514,
+                 2);
+    /* give the router time to publish */
+    usleep (100000);
+    return ret;
+  };
+
+  int
+  check_first ()
+  {
+    if ( (0 != shm_snapshot (path,
+                             &first)) ||
+         (0 == first.seq) ||
+         (1 != first.route_packets) ||
+         (140 != first.route_bytes) ||
+         (1 != first.rx_packets) ||
+         (! first.have_arp) )
+      return 1;
+    return 0;
+  };
+
+  int
+  check_second ()
+  {
+    if ( (0 != shm_snapshot (path,
+                             &second)) ||
+         (second.seq <= first.seq) ||
+         (2 != second.route_packets) ||
+         (280 != second.route_bytes) ||
+         (2 != second.rx_packets) )
+      return 1;
+    return 0;
+  };
+
+  int
+  send_stop ()
+  {
+    char off[] = "shm export off";
+
+    tsend (0, off, sizeof (off));
+    return 0;
+  };
+
+  int
+  check_removed ()
+  {
+    /* the router removes the name when the export stops */
+    if (0 == access (path,
+                     F_OK))
+    {
+      unlink (path);
+      return 1;
+    }
+    return 0;
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "configure export", &send_config },
+    { "send first frame", &send_frame },
+    { "expect first frame", &expect_seg },
+    { "read segment", &check_first },
+    { "send second frame", &send_frame },
+    { "expect second frame", &expect_seg },
+    { "read segment again", &check_second },
+    { "stop export", &send_stop },
+    { "wait for the router", &expect_silence },
+    { "check segment removed", &check_removed },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
 }
-/////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////
-// MAIN:
+
+
+/**
+ * Test that control messages are handled before the frames of the
+ * same batch: a frame to an unrouted prefix followed by "route add"
+ * for that prefix in one write() must be forwarded, not answered
+ * with ICMP network unreachable.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_control_first (const char *prog)
+{
+  char tcp_frame[54 + 100];
+  uint32_t next_seq = 1;
+
+  int
+  send_arp ()
+  {
+    char arp_frame[42];
+
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    return 0;
+  };
+
+  int
+  send_batch ()
+  {
+    char cmd[] = "route add 10.0.5.0/24 via 10.0.1.7 dev eth1";
+
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.5.7", 1, 100);
+    tqueue (1,
+            tcp_frame,
+            sizeof (tcp_frame));
+    tqueue (0,
+            cmd,
+            sizeof (cmd));
+    tflush (SIZE_MAX);
+    return 0;
+  };
+
+  int
+  expect_forwarded ()
+  {
+    return trecv (0,
+                  &expect_segment,
+                  &next_seq,
+                  NULL,
+                  1514,
+                  2);
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "send ARP reply", &send_arp },
+    { "send frame and route in one batch", &send_batch },
+    { "expect forwarded frame", &expect_forwarded },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * We expect the router's ARP answer from its address @a cls1 to the
+ * host 10.0.0.8.  handle_arp() answers with opcode 1, so we do not
+ * check the opcode.
+ *
+ * @param cls ignored
+ * @param ifc interface we got a frame from
+ * @param msg frame we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 IPv4 address of the router interface (as a string)
+ * @param cls2 ignored
+ * @param cls3 interface we expect to receive from
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_arp_reply (void *cls,
+                  uint16_t ifc,
+                  const void *msg,
+                  size_t msg_len,
+                  const void *cls1,
+                  ssize_t cls2,
+                  uint16_t cls3)
+{
+  const uint8_t *b = msg;
+  struct in_addr ip;
+  struct in_addr host;
+
+  (void) cls;
+  (void) cls2;
+  inet_pton (AF_INET, cls1, &ip);
+  inet_pton (AF_INET, "10.0.0.8", &host);
+  if ( (cls3 != ifc) ||
+       (msg_len < 42) ||
+       (0x08 != b[12]) ||
+       (0x06 != b[13]) ||
+       (0 != memcmp (&b[28],
+                     &ip,
+                     sizeof (ip))) ||
+       (0 != memcmp (&b[38],
+                     &host,
+                     sizeof (host))) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * We expect a line of text starting with @a cls1.
+ *
+ * @param cls ignored
+ * @param type message type, must be 0 (text)
+ * @param msg text we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 prefix we expect
+ * @param cls2 ignored
+ * @param cls3 ignored
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_prefix (void *cls,
+               uint16_t type,
+               const void *msg,
+               size_t msg_len,
+               const void *cls1,
+               ssize_t cls2,
+               uint16_t cls3)
+{
+  const char *prefix = cls1;
+
+  (void) cls;
+  (void) cls2;
+  (void) cls3;
+  if ( (0 != type) ||
+       (msg_len < strlen (prefix)) ||
+       (0 != memcmp (msg,
+                     prefix,
+                     strlen (prefix))) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * We expect the line of "overload" for the normal class to report
+ * the frames that were not forwarded as shed.
+ *
+ * @param cls pointer to the number of frames forwarded out of 180
+ * @param type message type, must be 0 (text)
+ * @param msg text we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 ignored
+ * @param cls2 ignored
+ * @param cls3 ignored
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_shed (void *cls,
+             uint16_t type,
+             const void *msg,
+             size_t msg_len,
+             const void *cls1,
+             ssize_t cls2,
+             uint16_t cls3)
+{
+  char line[256];
+  unsigned long long packets;
+  unsigned long long bytes;
+  const unsigned int *frames = cls;
+
+  (void) cls1;
+  (void) cls2;
+  (void) cls3;
+  if ( (0 != type) ||
+       (msg_len >= sizeof (line)) )
+    return 1;
+  memcpy (line,
+          msg,
+          msg_len);
+  line[msg_len] = '\0';
+  if (2 != sscanf (line,
+                   "  normal: %llu pkts %llu bytes shed",
+                   &packets,
+                   &bytes))
+    return 1;
+  return ( (0 == packets) ||
+           (packets + *frames != 180) ||
+           (packets * 1400 != bytes) ) ? 1 : 0;
+}
+
+
+/**
+ * Test load shedding: with a low "overload" backlog threshold, a batch
+ * that leaves more input waiting in the pipe gets its transit frames
+ * shed, while an ARP request and a control command in the same batch
+ * are still answered.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_overload (const char *prog)
+{
+  char tcp_frame[1400];
+  unsigned int frames = 0;
+
+  int
+  send_config ()
+  {
+    char cmd[] = "overload backlog 1k lag off";
+    char arp_frame[42];
+
+    tsend (0, cmd, sizeof (cmd));
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    return 0;
+  };
+
+  int
+  send_batch ()
+  {
+    char cmd[] = "overload";
+    char arp_frame[42];
+
+    /* turn a reply into a request for the router's address */
+    build_arp_reply (arp_frame, 1, 8, "10.0.0.8", "10.0.0.1");
+    arp_frame[21] = 1;
+    memset (&arp_frame[32], 0, MAC_ADDR_SIZE);
+    tqueue (1,
+            arp_frame,
+            sizeof (arp_frame));
+    tqueue (0,
+            cmd,
+            sizeof (cmd));
+    /* more than the router reads at once, so input stays backlogged */
+    for (uint32_t i = 0; i < 180; i++)
+    {
+      build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.1.7",
+                       1 + 1346 * i, sizeof (tcp_frame) - 54);
+      tqueue (1,
+              tcp_frame,
+              sizeof (tcp_frame));
+    }
+    tflush (SIZE_MAX);
+    return 0;
+  };
+
+  int
+  expect_arp ()
+  {
+    /* skip the shed counters that follow the level */
+    return trecv (4,
+                  &expect_arp_reply,
+                  NULL,
+                  "10.0.0.1",
+                  0,
+                  1);
+  };
+
+  int
+  expect_level ()
+  {
+    return trecv (0,
+                  &expect_prefix,
+                  NULL,
+                  "level 3 (max 3),",
+                  0,
+                  0);
+  };
+
+  int
+  read_forwarded ()
+  {
+    /* frames of the second read arrive, the shed ones do not */
+    while (0 == trecv (0,
+                       &expect_ipv4,
+                       &frames,
+                       NULL,
+                       0,
+                       2))
+      ;
+    return (frames > 0) && (frames < 180) ? 0 : 1;
+  };
+
+  int
+  send_query ()
+  {
+    char cmd[] = "overload";
+
+    tsend (0, cmd, sizeof (cmd));
+    return 0;
+  };
+
+  int
+  expect_counters ()
+  {
+    return trecv (6,
+                  &expect_shed,
+                  &frames,
+                  NULL,
+                  0,
+                  0);
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "configure overload and send ARP reply", &send_config },
+    { "send backlogged batch", &send_batch },
+    { "expect overload level", &expect_level },
+    { "expect ARP reply", &expect_arp },
+    { "read forwarded frames", &read_forwarded },
+    { "query overload counters", &send_query },
+    { "expect shed frames", &expect_counters },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
+/**
+ * We expect the line of the "perf" summary for the stage @a cls1 to
+ * report at least one sample.
+ *
+ * @param cls ignored
+ * @param type message type, must be 0 (text)
+ * @param msg text we received
+ * @param msg_len number of bytes in @a msg
+ * @param cls1 name of the stage
+ * @param cls2 ignored
+ * @param cls3 ignored
+ * @return 0 on success, 1 on missmatch
+ */
+static int
+expect_perf_stage (void *cls,
+                   uint16_t type,
+                   const void *msg,
+                   size_t msg_len,
+                   const void *cls1,
+                   ssize_t cls2,
+                   uint16_t cls3)
+{
+  char line[256];
+  char stage[16];
+  unsigned long long samples;
+
+  (void) cls;
+  (void) cls2;
+  (void) cls3;
+  if ( (0 != type) ||
+       (msg_len >= sizeof (line)) )
+    return 1;
+  memcpy (line,
+          msg,
+          msg_len);
+  line[msg_len] = '\0';
+  if (2 != sscanf (line,
+                   " %15[^:]: %llu samples",
+                   stage,
+                   &samples))
+    return 1;
+  return ( (0 != strcmp (stage,
+                         cls1)) ||
+           (0 == samples) ) ? 1 : 0;
+}
+
+
+/**
+ * Test that "perf" times every stage a forwarded frame goes through.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_perf (const char *prog)
+{
+  char tcp_frame[54 + 100];
+  uint32_t next_seq = 1;
+  const char *stages[] = {
+    "parse",
+    "lookup",
+    "arp",
+    "rewrite",
+    "write"
+  };
+
+  int
+  send_traffic ()
+  {
+    char cmd[] = "perf on";
+    char arp_frame[42];
+
+    tsend (0, cmd, sizeof (cmd));
+    build_arp_reply (arp_frame, 2, 7, "10.0.1.7", "10.0.1.1");
+    tsend (2,
+           arp_frame,
+           sizeof (arp_frame));
+    build_tcp_frame (tcp_frame, 1, "10.0.0.7", "10.0.1.7", 1, 100);
+    tsend (1,
+           tcp_frame,
+           sizeof (tcp_frame));
+    return 0;
+  };
+
+  int
+  expect_forwarded ()
+  {
+    return trecv (0,
+                  &expect_segment,
+                  &next_seq,
+                  NULL,
+                  1514,
+                  2);
+  };
+
+  int
+  send_query ()
+  {
+    char cmd[] = "perf";
+
+    tsend (0, cmd, sizeof (cmd));
+    return 0;
+  };
+
+  int
+  expect_summary ()
+  {
+    if (0 != trecv (0,
+                    &expect_prefix,
+                    NULL,
+                    "perf on, times in ",
+                    0,
+                    0))
+      return 1;
+    /* stages without samples (fragment) are not listed */
+    for (unsigned int i = 0; i < sizeof (stages) / sizeof (stages[0]); i++)
+      if (0 != trecv (0,
+                      &expect_perf_stage,
+                      NULL,
+                      stages[i],
+                      0,
+                      0))
+        return 1;
+    return 0;
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "enable perf and send a frame", &send_traffic },
+    { "expect forwarded frame", &expect_forwarded },
+    { "query perf summary", &send_query },
+    { "expect all stages timed", &expect_summary },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
 
 /**
  * Call with path to the arp program to test.
  */
+/**
+ * Test that "route list" sorts, filters and pages through the routes,
+ * and that a listing longer than a chunk is printed in several
+ * messages from a snapshot of the table.
+ *
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_route_list (const char *prog)
+{
+  int
+  send_config ()
+  {
+    char r1[] = "route add 10.0.5.0/24 via 10.0.1.7 dev eth1";
+    char r2[] = "route add 10.0.4.0/25 via 10.0.1.8 dev eth1";
+    char r3[] = "route add 10.0.4.0/24 via 10.0.1.7 dev eth1";
+    char r4[] = "route add 10.0.6.0/24 via 10.0.1.7 dev eth1";
+
+    tsend (0, r1, sizeof (r1));
+    tsend (0, r2, sizeof (r2));
+    tsend (0, r3, sizeof (r3));
+    tsend (0, r4, sizeof (r4));
+    return 0;
+  };
+
+  int
+  send_first_page ()
+  {
+    char list[] = "route list 10.0.4.0/23 limit 2";
+
+    tsend (0, list, sizeof (list));
+    return 0;
+  };
+
+  int
+  expect_first_page ()
+  {
+    const char page[] =
+      "Route List\n"
+      "10.0.4.0/255.255.255.0 -> 10.0.1.7 (eth1), 0 pkts 0 bytes\n"
+      "10.0.4.0/255.255.255.128 -> 10.0.1.8 (eth1), 0 pkts 0 bytes\n"
+      "More routes follow, continue with `from 10.0.4.0/25'\n";
+
+    return trecv (0,
+                  &expect_frame2,
+                  NULL,
+                  page,
+                  - (ssize_t) strlen (page),
+                  0);
+  };
+
+  int
+  send_next_page ()
+  {
+    char list[] = "route list 10.0.4.0/23 limit 2 from 10.0.4.0/25";
+
+    tsend (0, list, sizeof (list));
+    return 0;
+  };
+
+  int
+  expect_next_page ()
+  {
+    const char page[] =
+      "Route List\n"
+      "10.0.5.0/255.255.255.0 -> 10.0.1.7 (eth1), 0 pkts 0 bytes\n";
+
+    return trecv (0,
+                  &expect_frame2,
+                  NULL,
+                  page,
+                  - (ssize_t) strlen (page),
+                  0);
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0[IPV4:10.0.0.1/24]",
+    "eth1[IPV4:10.0.1.1/24]",
+    NULL
+  };
+
+  int
+  send_full ()
+  {
+    char list[] = "route list";
+    char add[] = "route add 10.0.7.0/24 via 10.0.1.7 dev eth1";
+
+    /* the route added while the listing is printed is not in it */
+    tqueue (0, list, sizeof (list));
+    tqueue (0, add, sizeof (add));
+    tflush (SIZE_MAX);
+    return 0;
+  };
+
+  int
+  expect_chunk (const char *chunk)
+  {
+    return trecv (0,
+                  &expect_frame2,
+                  NULL,
+                  chunk,
+                  - (ssize_t) strlen (chunk),
+                  0);
+  };
+
+  int
+  expect_full_first ()
+  {
+    return expect_chunk ("Route List\n"
+                         "10.0.0.0/255.255.255.0 -> 0.0.0.0 (eth0), 0 pkts 0 bytes\n"
+                         "10.0.1.0/255.255.255.0 -> 0.0.0.0 (eth1), 0 pkts 0 bytes\n"
+                         "10.0.4.0/255.255.255.0 -> 10.0.1.7 (eth1), 0 pkts 0 bytes\n"
+                         "10.0.4.0/255.255.255.128 -> 10.0.1.8 (eth1), 0 pkts 0 bytes\n");
+  };
+
+  int
+  expect_full_second ()
+  {
+    return expect_chunk ("10.0.5.0/255.255.255.0 -> 10.0.1.7 (eth1), 0 pkts 0 bytes\n"
+                         "10.0.6.0/255.255.255.0 -> 10.0.1.7 (eth1), 0 pkts 0 bytes\n");
+  };
+
+  int
+  send_limited ()
+  {
+    char list[] = "route list limit 5";
+
+    tsend (0, list, sizeof (list));
+    return 0;
+  };
+
+  int
+  expect_limited_second ()
+  {
+    return expect_chunk ("10.0.5.0/255.255.255.0 -> 10.0.1.7 (eth1), 0 pkts 0 bytes\n"
+                         "More routes follow, continue with `from 10.0.5.0/24'\n");
+  };
+
+  int
+  send_rest ()
+  {
+    char list[] = "route list from 10.0.5.0/24";
+
+    tsend (0, list, sizeof (list));
+    return 0;
+  };
+
+  int
+  expect_rest ()
+  {
+    return expect_chunk ("Route List\n"
+                         "10.0.6.0/255.255.255.0 -> 10.0.1.7 (eth1), 0 pkts 0 bytes\n"
+                         "10.0.7.0/255.255.255.0 -> 10.0.1.7 (eth1), 0 pkts 0 bytes\n");
+  };
+
+  struct Command cmd[] = {
+    { "add routes", &send_config },
+    { "list first page", &send_first_page },
+    { "check first page", &expect_first_page },
+    { "list next page", &send_next_page },
+    { "check next page", &expect_next_page },
+    { "list all routes while adding one", &send_full },
+    { "check first chunk", &expect_full_first },
+    { "check second chunk", &expect_full_second },
+    { "list limited", &send_limited },
+    { "check first limited chunk", &expect_full_first },
+    { "check second limited chunk", &expect_limited_second },
+    { "list the rest", &send_rest },
+    { "check the rest", &expect_rest },
+    { "end", &expect_silence },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
 int
 main (int argc, char **argv){
   unsigned int grade = 0;
@@ -78,6 +4388,30 @@ main (int argc, char **argv){
     int (*fun)(const char *arg);
   } tests[] = {
     //{ "test fragmentation", &test_fragmentation},
+    { "test gso", &test_gso },
+    { "test gso odd", &test_gso_odd },
+    { "test acl", &test_acl },
+    { "test nat", &test_nat },
+    { "test nat icmp", &test_nat_icmp },
+    { "test nat expiry", &test_nat_expiry },
+    { "test qos rate", &test_qos_rate },
+    { "test qos weight", &test_qos_weight },
+    { "test qos codel", &test_qos_codel },
+    { "test qos backlog", &test_qos_backlog },
+    { "test ipv6", &test_ipv6 },
+    { "test mpls", &test_mpls },
+    { "test tunnel", &test_tunnel },
+    { "test multicast", &test_multicast },
+    { "test route types", &test_route_types },
+    { "test flow export", &test_flow },
+    { "test capture", &test_capture },
+    { "test capture pipe", &test_capture_pipe },
+    { "test route list", &test_route_list },
+    { "test route stats", &test_route_stats },
+    { "test shm", &test_shm },
+    { "test control first", &test_control_first },
+    { "test overload", &test_overload },
+    { "test perf", &test_perf },
     //{ "test 1", &test_arp0 }, // test arp
     //{ "test 2", &test_arp1 }, // test arp list
     { NULL, NULL }
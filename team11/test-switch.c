@@ -255,6 +255,131 @@ test_uc0 (const char *prog)
 }
 
 
+/**
+ * Run test with @a prog.  Check the "stats" counters after one
+ * flooded and one unicast frame.
+ * @param prog command to test
+ * @return 0 on success, non-zero on failure
+ */
+static int
+test_stats (const char *prog)
+{
+  char my_frame[1400];
+  char my_frame2[1400];
+
+  for (unsigned int i = 0; i<sizeof (my_frame); i++){
+      my_frame[i] = random ();
+      my_frame2[i] = random();
+  }
+
+  int
+  send_frame ()
+  {
+    set_source_mac(my_frame,1);
+    tsend (1,
+           my_frame,
+           sizeof (my_frame));
+    return 0;
+  };
+  int
+  expect_broadcast ()
+  {
+    uint64_t ifcs = (1 << 1) | (1 << 2); // eth1 and eth2
+    return trecv (1, // expect *two* replies
+                  &expect_multicast,
+                  &ifcs,
+                  my_frame,
+                  sizeof (my_frame),
+                  UINT16_MAX ); // ignored
+  };
+  int
+  send_frame2()
+  {
+    set_source_mac(my_frame2, 2); // from 2
+    set_dest_mac(my_frame2, 1); // to 1
+    tsend ( 2,
+           my_frame2,
+           sizeof (my_frame2));
+    return 0;
+  };
+  int
+  expect_unicast()
+  {
+    return trecv (0,
+                  &expect_frame,
+                  NULL,
+                  my_frame2,
+                  sizeof (my_frame2),
+                  1);
+  };
+  int
+  send_stats ()
+  {
+    char cmd[] = "stats ifc1.";
+
+    tsend (0,
+           cmd,
+           sizeof (cmd));
+    return 0;
+  };
+  int
+  expect_line (const char *line)
+  {
+    return trecv (0,
+                  &expect_frame2,
+                  NULL,
+                  line,
+                  - (ssize_t) strlen (line),
+                  0);
+  };
+  int
+  expect_rx_packets ()
+  {
+    return expect_line ("ifc1.rx_packets 1\n");
+  };
+  int
+  expect_rx_bytes ()
+  {
+    return expect_line ("ifc1.rx_bytes 1400\n");
+  };
+  int
+  expect_tx_packets ()
+  {
+    return expect_line ("ifc1.tx_packets 1\n");
+  };
+  int
+  expect_tx_bytes ()
+  {
+    return expect_line ("ifc1.tx_bytes 1400\n");
+  };
+
+  char *argv[] = {
+    (char *) prog,
+    "eth0",
+    "eth1",
+    "eth2",
+    NULL
+  };
+
+  struct Command cmd[] = {
+    { "send frame", &send_frame },
+    { "check broadcast", &expect_broadcast },
+    { "send frame2 back", &send_frame2},
+    { "check unicast", &expect_unicast},
+    { "query ifc1 counters", &send_stats },
+    { "check received packets", &expect_rx_packets },
+    { "check received bytes", &expect_rx_bytes },
+    { "check sent packets", &expect_tx_packets },
+    { "check sent bytes", &expect_tx_bytes },
+    { NULL }
+  };
+
+  return meta (cmd,
+               (sizeof (argv) / sizeof (char *)) - 1,
+               argv);
+}
+
+
 /////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////
 // HUB COPY CODE (BROADCAST):
@@ -493,6 +618,7 @@ main (int argc,
       //{ "source is destination", &test_mc00},  // reference switch sends something back
       { "illegal mac", &test_mc0},  // bug1 bug2 bug3
       { "check unicast", &test_uc0},  // bug1 bug3
+      { "stats", &test_stats},
 
     { NULL, NULL }
   };